@@ -0,0 +1,102 @@
+/* apt-application-set.cpp - Installed packages that are applications
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "apt-application-set.h"
+
+#include <apt-pkg/configuration.h>
+
+#include <appstream.h>
+
+#include <mutex>
+
+#include "apt-file-index.h"
+#include "apt-utils.h"
+
+static std::mutex applicationSetMutex;
+static std::shared_ptr<const ApplicationSet> applicationSet;
+
+ApplicationSet::ApplicationSet() :
+    m_statusMtime(0),
+    m_listsMtime(0)
+{
+}
+
+std::shared_ptr<const ApplicationSet> ApplicationSet::get()
+{
+    // jobs running at the same time wait for one of them to build it
+    std::lock_guard<std::mutex> lock(applicationSetMutex);
+
+    const gint64 statusMtime = file_mtime(_config->FindFile("Dir::State::status"));
+    const gint64 listsMtime = file_mtime(_config->FindDir("Dir::State::Lists"));
+    if (applicationSet &&
+            applicationSet->m_statusMtime == statusMtime &&
+            applicationSet->m_listsMtime == listsMtime) {
+        return applicationSet;
+    }
+
+    std::shared_ptr<ApplicationSet> set(new ApplicationSet);
+    set->m_statusMtime = statusMtime;
+    set->m_listsMtime = listsMtime;
+    set->build();
+    applicationSet = set;
+    return applicationSet;
+}
+
+void ApplicationSet::build()
+{
+    g_autoptr(AsPool) pool = NULL;
+    g_autoptr(GPtrArray) cpts = NULL;
+    g_autoptr(GError) error = NULL;
+    vector<string> packages;
+    FileIndex index;
+
+    if (index.open()) {
+        index.lookupSuffix(".desktop", packages);
+    }
+    m_packages.insert(packages.begin(), packages.end());
+
+    // the AppStream package names have no architecture
+    pool = as_pool_new();
+    as_pool_load(pool, NULL, &error);
+    if (error != NULL) {
+        /* we do not fail here because even with error we might still find metadata */
+        g_debug("Issue while loading the AppStream metadata pool: %s", error->message);
+    }
+    cpts = as_pool_get_components(pool);
+    for (guint i = 0; i < cpts->len; i++) {
+        AsComponent *cpt = AS_COMPONENT(g_ptr_array_index(cpts, i));
+        if (as_component_get_kind(cpt) == AS_COMPONENT_KIND_DESKTOP_APP &&
+                as_component_get_pkgname(cpt) != NULL) {
+            m_packages.insert(as_component_get_pkgname(cpt));
+        }
+    }
+
+    g_debug("%zu packages are applications", m_packages.size());
+}
+
+bool ApplicationSet::contains(const pkgCache::VerIterator &ver) const
+{
+    // dpkg names the .list files of Multi-Arch: same packages name:arch
+    const pkgCache::PkgIterator &pkg = ver.ParentPkg();
+    if (m_packages.count(pkg.Name()) > 0) {
+        return true;
+    }
+    return m_packages.count(string(pkg.Name()) + ":" + ver.Arch()) > 0;
+}
@@ -0,0 +1,57 @@
+/* apt-application-set.h - Installed packages that are applications
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef APT_APPLICATION_SET_H
+#define APT_APPLICATION_SET_H
+
+#include <apt-pkg/pkgcache.h>
+#include <glib.h>
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+/**
+ * The packages that ship a .desktop file or are the package of an
+ * AppStream desktop application, for the application filters.
+ *
+ * It is shared by all jobs and only computed again when dpkg or the
+ * package lists changed.
+ */
+class ApplicationSet
+{
+public:
+    /**
+     * Returns the set for the packages installed now
+     */
+    static std::shared_ptr<const ApplicationSet> get();
+
+    bool contains(const pkgCache::VerIterator &ver) const;
+
+private:
+    ApplicationSet();
+    void build();
+
+    std::unordered_set<std::string> m_packages;
+    gint64 m_statusMtime;
+    gint64 m_listsMtime;
+};
+
+#endif // APT_APPLICATION_SET_H
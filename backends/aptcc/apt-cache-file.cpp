@@ -23,7 +23,13 @@
 
 #include <sstream>
 #include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <algorithm>
+#include <dirent.h>
 #include <apt-pkg/algorithms.h>
+#include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/configuration.h>
 #include <apt-pkg/progress.h>
 #include <apt-pkg/upgrade.h>
 
@@ -32,10 +38,36 @@
 
 using namespace APT;
 
+// The cache the last read-only job left behind, see takeShared()
+static std::mutex sharedCacheMutex;
+static AptCacheFile *sharedCache = 0;
+
 AptCacheFile::AptCacheFile(PkBackendJob *job) :
     m_packageRecords(0),
-    m_job(job)
+    m_job(job),
+    m_locked(false),
+    m_statusMtime(0),
+    m_listsMtime(0),
+    m_modified(false),
+    m_reusable(false)
+{
+    setJob(job);
+}
+
+/**
+  * Read-only jobs leave the locale of the process alone, so the
+  * description languages come from the locale the client asked for
+  */
+void AptCacheFile::setJob(PkBackendJob *job)
 {
+    const char *locale = pk_backend_job_get_locale(job);
+
+    m_job = job;
+    if (locale == NULL) {
+        m_languages = APT::Configuration::getLanguages();
+    } else {
+        m_languages = APT::Configuration::getLanguages(false, false, &locale);
+    }
 }
 
 AptCacheFile::~AptCacheFile()
@@ -46,9 +78,119 @@ AptCacheFile::~AptCacheFile()
 bool AptCacheFile::Open(bool withLock)
 {
     OpPackageKitProgress progress(m_job);
+
+    // taken before opening, so a change while we read the files makes
+    // the cache out of date instead of keeping old data around
+    m_statusMtime = file_mtime(_config->FindFile("Dir::State::status"));
+    m_listsMtime = file_mtime(_config->FindDir("Dir::State::Lists"));
+    m_state = currentState(m_statusMtime, m_listsMtime);
+    m_locked = withLock;
     return pkgCacheFile::Open(&progress, withLock);
 }
 
+string AptCacheFile::currentState()
+{
+    return currentState(file_mtime(_config->FindFile("Dir::State::status")),
+                        file_mtime(_config->FindDir("Dir::State::Lists")));
+}
+
+/**
+  * The newest of the preferences file, the preferences.d directory and
+  * the files in it, so adding, changing or removing a pin is noticed
+  */
+static gint64 preferencesMtime()
+{
+    gint64 mtime = file_mtime(_config->FindFile("Dir::Etc::preferences"));
+    string dir = _config->FindDir("Dir::Etc::preferencesparts");
+
+    mtime = std::max(mtime, file_mtime(dir));
+    DIR *dp = opendir(dir.c_str());
+    if (dp == NULL) {
+        return mtime;
+    }
+    struct dirent *dirp;
+    while ((dirp = readdir(dp)) != NULL) {
+        if (dirp->d_name[0] != '.') {
+            mtime = std::max(mtime, file_mtime(dir + dirp->d_name));
+        }
+    }
+    closedir(dp);
+    return mtime;
+}
+
+string AptCacheFile::currentState(gint64 statusMtime, gint64 listsMtime)
+{
+    // apt-get update changes the lists and dpkg the status file, a new
+    // sources.list is only used once the pkgcache.bin is rebuilt, but
+    // pins are read into the policy by every Open()
+    std::stringstream state;
+    state << statusMtime << ':'
+          << listsMtime << ':'
+          << file_mtime(_config->FindFile("Dir::Cache::pkgcache")) << ':'
+          << preferencesMtime();
+    return state.str();
+}
+
+AptCacheFile *AptCacheFile::takeShared(PkBackendJob *job)
+{
+    AptCacheFile *cache;
+
+    std::lock_guard<std::mutex> lock(sharedCacheMutex);
+    cache = sharedCache;
+    sharedCache = 0;
+    if (cache == 0) {
+        return 0;
+    }
+
+    if (cache->m_state != currentState()) {
+        g_debug("package cache changed, not reusing it");
+        delete cache;
+        return 0;
+    }
+    cache->setJob(job);
+    cache->m_reusable = false;
+    return cache;
+}
+
+void AptCacheFile::releaseShared(AptCacheFile *cache)
+{
+    if (cache == 0) {
+        return;
+    }
+
+    if (!cache->m_reusable) {
+        delete cache;
+        return;
+    }
+    cache->m_job = 0;
+
+    std::lock_guard<std::mutex> lock(sharedCacheMutex);
+    // two jobs ran at the same time, keep the newest
+    delete sharedCache;
+    sharedCache = cache;
+}
+
+void AptCacheFile::checkReusable()
+{
+    // only a cache in the state Open() left it can be used again, the
+    // depcache does not count a candidate set by tryToInstall()
+    m_reusable = !m_locked &&
+            !m_modified &&
+            DCache != 0 &&
+            DCache->DelCount() == 0 &&
+            DCache->InstCount() == 0 &&
+            DCache->BrokenCount() == 0 &&
+            _error->PendingError() == false &&
+            m_state == currentState();
+}
+
+void AptCacheFile::dropShared()
+{
+    std::lock_guard<std::mutex> lock(sharedCacheMutex);
+    delete sharedCache;
+    sharedCache = 0;
+}
+
 void AptCacheFile::Close()
 {
     delete m_packageRecords;
@@ -118,6 +260,7 @@ bool AptCacheFile::CheckDeps(bool AllowBroken)
 bool AptCacheFile::DistUpgrade()
 {
     OpPackageKitProgress progress(m_job);
+    m_modified = true;
     return Upgrade::Upgrade(*this, Upgrade::ALLOW_EVERYTHING, &progress);
 }
 
@@ -416,13 +559,36 @@ pkgCache::VerIterator AptCacheFile::findCandidateVer(const pkgCache::PkgIterator
     return (*this)[pkg].CandidateVerIter(*this);
 }
 
+/**
+  * Like VerIterator::TranslatedDescription(), but with the languages of
+  * the job instead of the ones apt cached for the process
+  */
+pkgCache::DescIterator AptCacheFile::translatedDescription(const pkgCache::VerIterator &ver) const
+{
+    for (const string &language : m_languages) {
+        for (pkgCache::DescIterator d = ver.DescriptionList(); !d.end(); ++d) {
+            // the untranslated description is the english one
+            if (language == d.LanguageCode() ||
+                    (language == "en" && strcmp(d.LanguageCode(), "") == 0)) {
+                return d;
+            }
+        }
+    }
+    for (pkgCache::DescIterator d = ver.DescriptionList(); !d.end(); ++d) {
+        if (strcmp(d.LanguageCode(), "") == 0) {
+            return d;
+        }
+    }
+    return ver.DescriptionList();
+}
+
 std::string AptCacheFile::getShortDescription(const pkgCache::VerIterator &ver)
 {
     if (ver.end() || ver.FileList().end() || GetPkgRecords() == 0) {
         return string();
     }
 
-    pkgCache::DescIterator d = ver.TranslatedDescription();
+    pkgCache::DescIterator d = translatedDescription(ver);
     if (d.end()) {
         return string();
     }
@@ -437,11 +603,19 @@ std::string AptCacheFile::getShortDescription(const pkgCache::VerIterator &ver)
 
 std::string AptCacheFile::getLongDescription(const pkgCache::VerIterator &ver)
 {
-    if (ver.end() || ver.FileList().end() || GetPkgRecords() == 0) {
+    if (GetPkgRecords() == 0) {
+        return string();
+    }
+    return getLongDescription(ver, *m_packageRecords);
+}
+
+std::string AptCacheFile::getLongDescription(const pkgCache::VerIterator &ver, pkgRecords &records)
+{
+    if (ver.end() || ver.FileList().end()) {
         return string();
     }
 
-    pkgCache::DescIterator d = ver.TranslatedDescription();
+    pkgCache::DescIterator d = translatedDescription(ver);
     if (d.end()) {
         return string();
     }
@@ -450,7 +624,7 @@ std::string AptCacheFile::getLongDescription(const pkgCache::VerIterator &ver)
     if (df.end()) {
         return string();
     } else {
-        return m_packageRecords->Lookup(df).LongDesc();
+        return records.Lookup(df).LongDesc();
     }
 }
 
@@ -468,6 +642,7 @@ bool AptCacheFile::tryToInstall(pkgProblemResolver &Fix,
     pkgCache::PkgIterator Pkg = ver.ParentPkg();
 
     // Check if there is something at all to install
+    m_modified = true;
     GetDepCache()->SetCandidateVersion(ver);
     pkgDepCache::StateCache &State = (*this)[Pkg];
 
@@ -501,6 +676,7 @@ void AptCacheFile::tryToRemove(pkgProblemResolver &Fix,
 {
     pkgCache::PkgIterator Pkg = ver.ParentPkg();
 
+    m_modified = true;
     // The package is not installed
     if (Pkg->CurrentVer == 0) {
         Fix.Clear(Pkg);
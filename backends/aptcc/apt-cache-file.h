@@ -25,6 +25,9 @@
 #include <apt-pkg/cachefile.h>
 #include <pk-backend.h>
 
+#include <string>
+#include <vector>
+
 class pkgProblemResolver;
 class AptCacheFile : public pkgCacheFile
 {
@@ -42,6 +45,36 @@ public:
       */
     void Close();
 
+    /**
+      * Returns the cache a previous job opened without the lock, if the
+      * package lists and the dpkg status did not change since, or NULL
+      */
+    static AptCacheFile *takeShared(PkBackendJob *job);
+
+    /**
+      * Keeps the cache for the next job that can use it if
+      * checkReusable() found it could be, or deletes it
+      */
+    static void releaseShared(AptCacheFile *cache);
+
+    /**
+      * Checks whether the cache is still the way Open() left it, this
+      * has to be called by the job thread as _error is per thread
+      */
+    void checkReusable();
+
+    /**
+      * Deletes the cache kept for the next job
+      */
+    static void dropShared();
+
+    /**
+      * The mtimes of the dpkg status and the package lists when the
+      * cache was opened, so what is built from it can be dated
+      */
+    inline gint64 statusMtime() const { return m_statusMtime; }
+    inline gint64 listsMtime() const { return m_listsMtime; }
+
     /**
       * Build caches
       */
@@ -118,6 +151,11 @@ public:
      */
     pkgCache::VerIterator findVer(const pkgCache::PkgIterator &pkg);
 
+    /** \return the description languages of the job using the cache,
+     *  which for a read-only job can differ from the process locale.
+     */
+    const std::vector<std::string> &languages() const { return m_languages; }
+
     /** \return a short description string corresponding to the given
      *  version.
      */
@@ -128,6 +166,11 @@ public:
      */
     std::string getLongDescription(const pkgCache::VerIterator &ver);
 
+    /** Like getLongDescription() but looks the description up in
+     *  \p records, so each thread can use its own pkgRecords.
+     */
+    std::string getLongDescription(const pkgCache::VerIterator &ver, pkgRecords &records);
+
     /** \return a short description string corresponding to the given
      *  version.
      */
@@ -142,10 +185,21 @@ public:
 
 private:
     void buildPkgRecords();
+    void setJob(PkBackendJob *job);
+    pkgCache::DescIterator translatedDescription(const pkgCache::VerIterator &ver) const;
     static std::string debParser(std::string descr);
+    static std::string currentState();
+    static std::string currentState(gint64 statusMtime, gint64 listsMtime);
 
     pkgRecords *m_packageRecords;
     PkBackendJob *m_job;
+    std::vector<std::string> m_languages;
+    bool m_locked;
+    std::string m_state;
+    gint64 m_statusMtime;
+    gint64 m_listsMtime;
+    bool m_modified;
+    bool m_reusable;
 };
 
 /**
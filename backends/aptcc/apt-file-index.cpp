@@ -0,0 +1,452 @@
+/* apt-file-index.cpp - Index of the files installed by dpkg
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "apt-file-index.h"
+
+#include <apt-pkg/configuration.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <cstring>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "apt-utils.h"
+
+#define FILE_INDEX_MAGIC "PKFILE01"
+#define DPKG_INFO_DIR    "/var/lib/dpkg/info/"
+
+/*
+ * The file is laid out as:
+ *  FileIndexHeader
+ *  FileIndexList table, one for each .list file, sorted by name
+ *  FileIndexPath table, sorted by path
+ *  uint32_t indexes into the path table, sorted by file name
+ *  the package names and paths, each nul terminated
+ */
+struct FileIndexHeader
+{
+    char     magic[8];
+    int64_t  statusMtime;
+    uint32_t lists;
+    uint32_t paths;
+    uint64_t listsOffset;
+    uint64_t pathsOffset;
+    uint64_t basenamesOffset;
+    uint64_t stringsOffset;
+    uint64_t size;
+};
+
+struct FileIndexList
+{
+    uint32_t name;
+    uint32_t padding;
+    int64_t  mtime;
+};
+
+struct FileIndexPath
+{
+    uint32_t path;
+    uint32_t basename;
+    uint32_t list;
+};
+
+struct ListFile
+{
+    string          name;
+    int64_t         mtime;
+    vector<string>  paths;
+};
+
+static string indexPath()
+{
+    return _config->FindDir("Dir::Cache") + "packagekit-files.bin";
+}
+
+static inline int64_t mtimeOf(const struct stat &buf)
+{
+    return (int64_t) buf.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + buf.st_mtim.tv_nsec;
+}
+
+/**
+  * dpkg writes the status file every time it changes a .list file, so
+  * while that did not change there is no need to look at the .list files
+  */
+static int64_t statusMtime()
+{
+    return file_mtime(_config->FindFile("Dir::State::status"));
+}
+
+/**
+  * Every table has to be where update() puts it, and the strings have to
+  * end with a nul so none of them runs past the end of the file
+  */
+static bool validLayout(const char *data, size_t size)
+{
+    const FileIndexHeader *header = (const FileIndexHeader *) data;
+
+    if (header->listsOffset != sizeof(FileIndexHeader) ||
+            header->pathsOffset != header->listsOffset +
+                (uint64_t) header->lists * sizeof(FileIndexList) ||
+            header->basenamesOffset != header->pathsOffset +
+                (uint64_t) header->paths * sizeof(FileIndexPath) ||
+            header->stringsOffset != header->basenamesOffset +
+                (uint64_t) header->paths * sizeof(uint32_t) ||
+            header->stringsOffset > size) {
+        return false;
+    }
+    return header->stringsOffset == size || data[size - 1] == '\0';
+}
+
+static inline const char *basenameOf(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash == NULL ? path : slash + 1;
+}
+
+FileIndex::FileIndex() :
+    m_data(0),
+    m_size(0)
+{
+}
+
+FileIndex::~FileIndex()
+{
+    unmap();
+}
+
+bool FileIndex::map()
+{
+    struct stat buf;
+    const FileIndexHeader *header;
+    void *data;
+    int fd;
+
+    unmap();
+    fd = ::open(indexPath().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &buf) != 0 || (size_t) buf.st_size < sizeof(FileIndexHeader)) {
+        close(fd);
+        return false;
+    }
+    data = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    m_data = (const char *) data;
+    m_size = buf.st_size;
+
+    // a partial write or an older format
+    header = (const FileIndexHeader *) m_data;
+    if (memcmp(header->magic, FILE_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+            header->size != m_size ||
+            !validLayout(m_data, m_size)) {
+        g_debug("ignoring invalid file index");
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+void FileIndex::unmap()
+{
+    if (m_data != 0) {
+        munmap((void *) m_data, m_size);
+        m_data = 0;
+        m_size = 0;
+    }
+}
+
+const char *FileIndex::stringAt(uint32_t offset) const
+{
+    const FileIndexHeader *header = (const FileIndexHeader *) m_data;
+    if (offset >= m_size - header->stringsOffset) {
+        return "";
+    }
+    return m_data + header->stringsOffset + offset;
+}
+
+const char *FileIndex::packageName(const FileIndexPath *path) const
+{
+    const FileIndexHeader *header = (const FileIndexHeader *) m_data;
+    const FileIndexList *lists = (const FileIndexList *) (m_data + header->listsOffset);
+    if (path->list >= header->lists) {
+        return NULL;
+    }
+    return stringAt(lists[path->list].name);
+}
+
+const FileIndexPath *FileIndex::pathAt(uint32_t index) const
+{
+    const FileIndexHeader *header = (const FileIndexHeader *) m_data;
+    const FileIndexPath *paths = (const FileIndexPath *) (m_data + header->pathsOffset);
+    static const FileIndexPath invalid = { 0, 0, G_MAXUINT32 };
+    return index < header->paths ? &paths[index] : &invalid;
+}
+
+bool FileIndex::open()
+{
+    if (map() && ((const FileIndexHeader *) m_data)->statusMtime == statusMtime()) {
+        return true;
+    }
+    unmap();
+    return update() && map();
+}
+
+bool FileIndex::update()
+{
+    FileIndex old;
+    vector<ListFile> lists;
+    vector<vector<uint32_t> > oldPaths;
+    const FileIndexHeader *oldHeader = NULL;
+    const FileIndexList *oldLists = NULL;
+    const FileIndexPath *oldPathTable = NULL;
+    int64_t status;
+    guint reread = 0;
+
+    // the status is read first so a dpkg run while we are reading makes
+    // the index out of date instead of silently missing files
+    status = statusMtime();
+
+    // group the paths we already have by the .list they came from
+    if (old.map()) {
+        oldHeader = (const FileIndexHeader *) old.m_data;
+        oldLists = (const FileIndexList *) (old.m_data + oldHeader->listsOffset);
+        oldPathTable = (const FileIndexPath *) (old.m_data + oldHeader->pathsOffset);
+        oldPaths.resize(oldHeader->lists);
+        for (uint32_t i = 0; i < oldHeader->paths; ++i) {
+            if (oldPathTable[i].list < oldHeader->lists) {
+                oldPaths[oldPathTable[i].list].push_back(i);
+            }
+        }
+    }
+
+    DIR *dp = opendir(DPKG_INFO_DIR);
+    if (dp == NULL) {
+        g_debug("Error opening " DPKG_INFO_DIR);
+        return false;
+    }
+
+    struct dirent *dirp;
+    string line;
+    while ((dirp = readdir(dp)) != NULL) {
+        if (!ends_with(dirp->d_name, ".list")) {
+            continue;
+        }
+
+        struct stat buf;
+        if (fstatat(dirfd(dp), dirp->d_name, &buf, 0) != 0) {
+            continue;
+        }
+
+        ListFile list;
+        list.name.assign(dirp->d_name, strlen(dirp->d_name) - 5);
+        list.mtime = mtimeOf(buf);
+
+        // reuse what we have if the .list was not modified
+        if (oldHeader != NULL) {
+            const FileIndexList *it;
+            it = std::lower_bound(oldLists, oldLists + oldHeader->lists, list.name,
+                                  [&old](const FileIndexList &item, const std::string &name) {
+                                      return strcmp(old.stringAt(item.name), name.c_str()) < 0;
+                                  });
+            if (it != oldLists + oldHeader->lists &&
+                    list.name == old.stringAt(it->name) && it->mtime == list.mtime) {
+                for (uint32_t i : oldPaths[it - oldLists]) {
+                    list.paths.push_back(old.stringAt(oldPathTable[i].path));
+                }
+                lists.push_back(std::move(list));
+                continue;
+            }
+        }
+
+        ifstream in((DPKG_INFO_DIR + string(dirp->d_name)).c_str());
+        if (!in) {
+            continue;
+        }
+        while (getline(in, line)) {
+            if (!line.empty()) {
+                list.paths.push_back(line);
+            }
+        }
+        lists.push_back(std::move(list));
+        reread++;
+    }
+    closedir(dp);
+
+    std::sort(lists.begin(), lists.end(),
+              [](const ListFile &a, const ListFile &b) {
+                  return a.name < b.name;
+              });
+
+    // lay out the strings, the package names first
+    std::string strings;
+    vector<FileIndexList> listTable;
+    vector<FileIndexPath> pathTable;
+    listTable.reserve(lists.size());
+    for (uint32_t i = 0; i < lists.size(); ++i) {
+        FileIndexList item = { (uint32_t) strings.size(), 0, lists[i].mtime };
+        listTable.push_back(item);
+        strings.append(lists[i].name);
+        strings.push_back('\0');
+    }
+    for (uint32_t i = 0; i < lists.size(); ++i) {
+        for (const std::string &path : lists[i].paths) {
+            FileIndexPath item;
+            item.path = strings.size();
+            item.basename = item.path + (basenameOf(path.c_str()) - path.c_str());
+            item.list = i;
+            pathTable.push_back(item);
+            strings.append(path);
+            strings.push_back('\0');
+        }
+    }
+
+    const char *str = strings.data();
+    std::sort(pathTable.begin(), pathTable.end(),
+              [str](const FileIndexPath &a, const FileIndexPath &b) {
+                  return strcmp(str + a.path, str + b.path) < 0;
+              });
+    vector<uint32_t> basenames(pathTable.size());
+    for (uint32_t i = 0; i < basenames.size(); ++i) {
+        basenames[i] = i;
+    }
+    std::stable_sort(basenames.begin(), basenames.end(),
+                     [str, &pathTable](uint32_t a, uint32_t b) {
+                         return strcmp(str + pathTable[a].basename,
+                                       str + pathTable[b].basename) < 0;
+                     });
+
+    FileIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FILE_INDEX_MAGIC, sizeof(header.magic));
+    header.statusMtime = status;
+    header.lists = listTable.size();
+    header.paths = pathTable.size();
+    header.listsOffset = sizeof(FileIndexHeader);
+    header.pathsOffset = header.listsOffset + listTable.size() * sizeof(FileIndexList);
+    header.basenamesOffset = header.pathsOffset + pathTable.size() * sizeof(FileIndexPath);
+    header.stringsOffset = header.basenamesOffset + basenames.size() * sizeof(uint32_t);
+    header.size = header.stringsOffset + strings.size();
+
+    std::string out;
+    out.reserve(header.size);
+    out.append((const char *) &header, sizeof(header));
+    out.append((const char *) listTable.data(), listTable.size() * sizeof(FileIndexList));
+    out.append((const char *) pathTable.data(), pathTable.size() * sizeof(FileIndexPath));
+    out.append((const char *) basenames.data(), basenames.size() * sizeof(uint32_t));
+    out.append(strings);
+
+    // readers may still have the old one mapped
+    std::string path = indexPath();
+    std::string tmp = path + ".XXXXXX";
+    int fd = g_mkstemp(&tmp[0]);
+    if (fd < 0) {
+        g_warning("failed to create %s: %s", tmp.c_str(), g_strerror(errno));
+        return false;
+    }
+    fchmod(fd, 0644);
+    bool ret = write(fd, out.data(), out.size()) == (ssize_t) out.size();
+    close(fd);
+    if (!ret || rename(tmp.c_str(), path.c_str()) != 0) {
+        g_warning("failed to write %s", path.c_str());
+        g_unlink(tmp.c_str());
+        return false;
+    }
+
+    g_debug("indexed %u files of %u packages, %u .list files read",
+            header.paths, header.lists, reread);
+    return true;
+}
+
+void FileIndex::lookup(const std::string &value, vector<std::string> &packages) const
+{
+    const FileIndexHeader *header = (const FileIndexHeader *) m_data;
+
+    if (m_data == 0 || value.empty()) {
+        return;
+    }
+
+    const FileIndexPath *paths = (const FileIndexPath *) (m_data + header->pathsOffset);
+    if (value[0] == '/') {
+        const FileIndexPath *end = paths + header->paths;
+        const FileIndexPath *it;
+        it = std::lower_bound(paths, end, value.c_str(),
+                              [this](const FileIndexPath &item, const char *path) {
+                                  return strcmp(stringAt(item.path), path) < 0;
+                              });
+        for (; it != end && value == stringAt(it->path); ++it) {
+            if (packageName(it) != NULL) {
+                packages.push_back(packageName(it));
+            }
+        }
+        return;
+    }
+
+    // "bin/ls" is looked up as "ls" and then has to be the end of the path
+    const char *name = basenameOf(value.c_str());
+    const uint32_t *basenames = (const uint32_t *) (m_data + header->basenamesOffset);
+    const uint32_t *end = basenames + header->paths;
+    const uint32_t *it;
+    it = std::lower_bound(basenames, end, name,
+                          [this](uint32_t item, const char *basename) {
+                              return strcmp(stringAt(pathAt(item)->basename), basename) < 0;
+                          });
+    for (; it != end && strcmp(stringAt(pathAt(*it)->basename), name) == 0; ++it) {
+        const FileIndexPath *path = pathAt(*it);
+        if (packageName(path) == NULL) {
+            continue;
+        }
+        if (name == value.c_str() || ends_with(stringAt(path->path), value.c_str())) {
+            packages.push_back(packageName(path));
+        }
+    }
+}
+
+void FileIndex::lookupSuffix(const char *suffix, vector<std::string> &packages) const
+{
+    const FileIndexHeader *header = (const FileIndexHeader *) m_data;
+    const size_t length = strlen(suffix);
+
+    if (m_data == 0) {
+        return;
+    }
+
+    const FileIndexPath *paths = (const FileIndexPath *) (m_data + header->pathsOffset);
+    for (uint32_t i = 0; i < header->paths; ++i) {
+        const char *name = stringAt(paths[i].basename);
+        const size_t nameLength = strlen(name);
+        if (nameLength >= length && memcmp(name + nameLength - length, suffix, length) == 0 &&
+                packageName(&paths[i]) != NULL) {
+            packages.push_back(packageName(&paths[i]));
+        }
+    }
+}
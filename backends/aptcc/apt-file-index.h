@@ -0,0 +1,79 @@
+/* apt-file-index.h - Index of the files installed by dpkg
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef APT_FILE_INDEX_H
+#define APT_FILE_INDEX_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+struct FileIndexPath;
+
+/**
+ * An on-disk copy of every path in the dpkg .list files, sorted by path
+ * and by file name, so finding the package that owns a file does not
+ * have to read all of them.
+ *
+ * When dpkg changed something only the .list files that were modified
+ * since the index was written are read again.
+ */
+class FileIndex
+{
+public:
+    FileIndex();
+    ~FileIndex();
+
+    /**
+     * Maps the index from disk, bringing it up to date first if dpkg
+     * ran since it was written
+     */
+    bool open();
+
+    /**
+     * Reads the .list files that changed and replaces the index on disk
+     */
+    static bool update();
+
+    /**
+     * Adds the packages owning value to packages, which is either an
+     * absolute path, a file name or the end of a path like "bin/ls"
+     */
+    void lookup(const std::string &value, std::vector<std::string> &packages) const;
+
+    /**
+     * Adds the packages owning any file whose name ends with suffix to
+     * packages, this has to look at every path
+     */
+    void lookupSuffix(const char *suffix, std::vector<std::string> &packages) const;
+
+private:
+    bool map();
+    void unmap();
+    const char *stringAt(uint32_t offset) const;
+    const char *packageName(const FileIndexPath *path) const;
+    const FileIndexPath *pathAt(uint32_t index) const;
+
+    const char *m_data;
+    size_t m_size;
+};
+
+#endif // APT_FILE_INDEX_H
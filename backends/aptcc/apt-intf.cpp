@@ -41,9 +41,14 @@
 #include <iostream>
 #include <memory>
 #include <fstream>
-#include <dirent.h>
+#include <thread>
+#include <system_error>
+#include <algorithm>
 
+#include "apt-application-set.h"
 #include "apt-cache-file.h"
+#include "apt-file-index.h"
+#include "apt-search-index.h"
 #include "apt-utils.h"
 #include "gst-matcher.h"
 #include "apt-messages.h"
@@ -59,19 +64,36 @@ AptIntf::AptIntf(PkBackendJob *job) :
     m_cancel(false),
     m_terminalTimeout(120),
     m_lastSubProgress(0),
-    m_cache(0)
+    m_cache(0),
+    m_locale((locale_t) 0),
+    m_oldLocale((locale_t) 0)
 {
     m_cancel = false;
 }
 
-bool AptIntf::init(gchar **localDebs)
+PkBitfield AptIntf::sharedRoles()
+{
+    return pk_bitfield_from_enums(
+                PK_ROLE_ENUM_DEPENDS_ON,
+                PK_ROLE_ENUM_GET_DETAILS,
+                PK_ROLE_ENUM_GET_FILES,
+                PK_ROLE_ENUM_GET_PACKAGES,
+                PK_ROLE_ENUM_REQUIRED_BY,
+                PK_ROLE_ENUM_RESOLVE,
+                PK_ROLE_ENUM_SEARCH_DETAILS,
+                PK_ROLE_ENUM_SEARCH_FILE,
+                PK_ROLE_ENUM_SEARCH_GROUP,
+                PK_ROLE_ENUM_SEARCH_NAME,
+                PK_ROLE_ENUM_WHAT_PROVIDES,
+                -1);
+}
+
+void AptIntf::setupProcess()
 {
     const gchar *locale;
     const gchar *http_proxy;
     const gchar *ftp_proxy;
 
-    m_isMultiArch = APT::Configuration::getArchitectures(false).size() > 1;
-
     // set locale
     if (locale = pk_backend_job_get_locale(m_job)) {
         setlocale(LC_ALL, locale);
@@ -93,10 +115,54 @@ bool AptIntf::init(gchar **localDebs)
     if (ftp_proxy != NULL)
         setenv("ftp_proxy", ftp_proxy, 1);
 
+    // Set does not replace list items, so drop the ones of the last job
+    _config->Clear("Dpkg::Options", "--force-confdef");
+    _config->Clear("Dpkg::Options", "--force-confold");
+    if (!m_interactive) {
+        // Do not ask about config updates if we are not interactive
+        _config->Set("Dpkg::Options::", "--force-confdef");
+        _config->Set("Dpkg::Options::", "--force-confold");
+        // Ensure nothing interferes with questions
+        setenv("APT_LISTCHANGES_FRONTEND", "none", 1);
+        setenv("APT_LISTBUGS_FRONTEND", "none", 1);
+    }
+}
+
+void AptIntf::setupThread()
+{
+    const gchar *locale = pk_backend_job_get_locale(m_job);
+    if (locale == NULL) {
+        return;
+    }
+
+    // only changes the messages of this thread, the descriptions use
+    // the languages the cache got from the job
+    m_locale = newlocale(LC_ALL_MASK, locale, (locale_t) 0);
+    if (m_locale == (locale_t) 0) {
+        g_debug("failed to use locale %s", locale);
+        return;
+    }
+    m_oldLocale = uselocale(m_locale);
+}
+
+bool AptIntf::init(gchar **localDebs)
+{
+    m_isMultiArch = APT::Configuration::getArchitectures(false).size() > 1;
+
+    // Shared jobs run next to each other and next to the one exclusive
+    // job, so only the exclusive one may change the locale, the
+    // environment and the apt configuration of the whole process
+    m_interactive = pk_backend_job_get_interactive(m_job);
+    PkRoleEnum role = pk_backend_job_get_role(m_job);
+    if (!pk_bitfield_contain(sharedRoles(), role)) {
+        setupProcess();
+    } else if (m_locale == (locale_t) 0) {
+        setupThread();
+    }
+
     // Check if we should open the Cache with lock
-    bool withLock;
+    bool withLock = false;
     bool AllowBroken = false;
-    PkRoleEnum role = pk_backend_job_get_role(m_job);
     switch (role) {
     case PK_ROLE_ENUM_INSTALL_PACKAGES:
     case PK_ROLE_ENUM_INSTALL_FILES:
@@ -121,54 +187,66 @@ bool AptIntf::init(gchar **localDebs)
         withLock = !simulate;
     }
 
-    // Create the AptCacheFile class to search for packages
-    m_cache = new AptCacheFile(m_job);
-    if (localDebs) {
-        for (int i = 0; i < g_strv_length(localDebs); ++i) {
-            markFileForInstall(localDebs[i]);
-        }
+    // Jobs that only read can reuse the cache of an earlier one, which
+    // saves building the policy and the dependency cache again
+    if (!withLock && !AllowBroken && localDebs == nullptr) {
+        m_cache = AptCacheFile::takeShared(m_job);
     }
 
-    int timeout = 10;
-    // TODO test this
-    while (m_cache->Open(withLock) == false) {
-        if (withLock == false || (timeout <= 0)) {
-            show_errors(m_job, PK_ERROR_ENUM_CANNOT_GET_LOCK);
-            return false;
-        } else {
-            _error->Discard();
-            pk_backend_job_set_status(m_job, PK_STATUS_ENUM_WAITING_FOR_LOCK);
-            sleep(1);
-            timeout--;
+    if (m_cache == 0) {
+        // Create the AptCacheFile class to search for packages
+        m_cache = new AptCacheFile(m_job);
+        if (localDebs) {
+            for (int i = 0; i < g_strv_length(localDebs); ++i) {
+                markFileForInstall(localDebs[i]);
+            }
         }
 
-        // Close the cache if we are going to try again
-        m_cache->Close();
-    }
+        int timeout = 10;
+        // TODO test this
+        while (m_cache->Open(withLock) == false) {
+            if (withLock == false || (timeout <= 0)) {
+                show_errors(m_job, PK_ERROR_ENUM_CANNOT_GET_LOCK);
+                return false;
+            } else {
+                _error->Discard();
+                pk_backend_job_set_status(m_job, PK_STATUS_ENUM_WAITING_FOR_LOCK);
+                sleep(1);
+                timeout--;
+            }
 
-    m_interactive = pk_backend_job_get_interactive(m_job);
-    if (!m_interactive) {
-        // Do not ask about config updates if we are not interactive
-        _config->Set("Dpkg::Options::", "--force-confdef");
-        _config->Set("Dpkg::Options::", "--force-confold");
-        // Ensure nothing interferes with questions
-        setenv("APT_LISTCHANGES_FRONTEND", "none", 1);
-        setenv("APT_LISTBUGS_FRONTEND", "none", 1);
+            // Close the cache if we are going to try again
+            m_cache->Close();
+        }
     }
 
     // Check if there are half-installed packages and if we can fix them
     return m_cache->CheckDeps(AllowBroken);
 }
 
+void AptIntf::threadFinished()
+{
+    if (m_cache != 0) {
+        m_cache->checkReusable();
+    }
+
+    // the pool thread runs other jobs next
+    if (m_locale != (locale_t) 0) {
+        uselocale(m_oldLocale);
+        freelocale(m_locale);
+        m_locale = (locale_t) 0;
+    }
+}
+
 AptIntf::~AptIntf()
 {
-    delete m_cache;
+    // deletes it unless it can be used by the next job
+    AptCacheFile::releaseShared(m_cache);
 }
 
 void AptIntf::cancel()
 {
-    if (!m_cancel) {
-        m_cancel = true;
+    if (!m_cancel.exchange(true)) {
         pk_backend_job_set_status(m_job, PK_STATUS_ENUM_CANCEL);
     }
 
@@ -1070,81 +1148,60 @@ PkgList AptIntf::getPackagesFromGroup(gchar **values)
     return output;
 }
 
-bool AptIntf::matchesQueries(const vector<string> &queries, string s) {
-    for (string query : queries) {
-        // Case insensitive "string.contains"
-        auto it = std::search(
-            s.begin(), s.end(),
-            query.begin(), query.end(),
-            [](unsigned char ch1, unsigned char ch2) {
-                return std::tolower(ch1) == std::tolower(ch2);
-            }
-        );
-
-        if (it != s.end()) {
+/**
+  * Returns true if any of the already folded queries is in str, buffer is
+  * only used to avoid an allocation for each string
+  */
+static bool matchesQueries(const vector<string> &queries, const char *str, size_t len, string &buffer)
+{
+    buffer.assign(str, len);
+    fold_case(buffer);
+    for (const string &query : queries) {
+        if (memmem(buffer.data(), buffer.size(), query.data(), query.size()) != NULL) {
             return true;
         }
     }
     return false;
 }
 
-PkgList AptIntf::searchPackageName(const vector<string> &queries)
+static bool matchesQueries(const vector<string> &queries, const string &str, string &buffer)
 {
-    PkgList output;
-
-    for (pkgCache::PkgIterator pkg = m_cache->GetPkgCache()->PkgBegin(); !pkg.end(); ++pkg) {
-        if (m_cancel) {
-            break;
-        }
-        // Ignore packages that exist only due to dependencies.
-        if (pkg.VersionList().end() && pkg.ProvidesList().end()) {
-            continue;
-        }
-
-        if (matchesQueries(queries, pkg.Name())) {
-            // Don't insert virtual packages instead add what it provides
-            const pkgCache::VerIterator &ver = m_cache->findVer(pkg);
-            if (ver.end() == false) {
-                output.push_back(ver);
-            } else {
-                // iterate over the provides list
-                for (pkgCache::PrvIterator Prv = pkg.ProvidesList(); Prv.end() == false; ++Prv) {
-                    const pkgCache::VerIterator &ownerVer = m_cache->findVer(Prv.OwnerPkg());
-
-                    // check to see if the provided package isn't virtual too
-                    if (ownerVer.end() == false) {
-                        // we add the package now because we will need to
-                        // remove duplicates later anyway
-                        output.push_back(ownerVer);
-                    }
-                }
-            }
-        }
-    }
-    return output;
+    return matchesQueries(queries, str.data(), str.size(), buffer);
 }
 
-PkgList AptIntf::searchPackageDetails(const vector<string> &queries)
+void AptIntf::searchPackageRange(const vector<string> &queries,
+                                 bool details,
+                                 const vector<pkgCache::PkgIterator> &pkgs,
+                                 size_t begin,
+                                 size_t end,
+                                 PkgList &output)
 {
-    PkgList output;
+    // pkgRecords keeps the parser state, so every thread needs its own
+    std::unique_ptr<pkgRecords> records;
+    if (details) {
+        records.reset(new pkgRecords(*m_cache));
+    }
 
-    for (pkgCache::PkgIterator pkg = m_cache->GetPkgCache()->PkgBegin(); !pkg.end(); ++pkg) {
+    string buffer;
+    for (size_t i = begin; i < end; ++i) {
         if (m_cancel) {
             break;
         }
-        // Ignore packages that exist only due to dependencies.
-        if (pkg.VersionList().end() && pkg.ProvidesList().end()) {
-            continue;
-        }
+
+        const pkgCache::PkgIterator &pkg = pkgs[i];
+        const char *name = pkg.Name();
+        bool nameMatched = matchesQueries(queries, name, strlen(name), buffer);
 
         const pkgCache::VerIterator &ver = m_cache->findVer(pkg);
         if (ver.end() == false) {
-            if (matchesQueries(queries, pkg.Name()) ||
-                    matchesQueries(queries, (*m_cache).getLongDescription(ver))) {
+            if (nameMatched ||
+                    (details && matchesQueries(queries,
+                                               m_cache->getLongDescription(ver, *records),
+                                               buffer))) {
                 // The package matched
                 output.push_back(ver);
             }
-        } else if (matchesQueries(queries, pkg.Name())) {
+        } else if (nameMatched) {
             // The package is virtual and MATCHED the name
             // Don't insert virtual packages instead add what it provides
 
@@ -1161,75 +1218,114 @@ PkgList AptIntf::searchPackageDetails(const vector<string> &queries)
             }
         }
     }
-    return output;
 }
 
-// used to return files it reads, using the info from the files in /var/lib/dpkg/info/
-PkgList AptIntf::searchPackageFiles(gchar **values)
+bool AptIntf::searchIndexLookup(const vector<string> &queries, vector<pkgCache::PkgIterator> &pkgs)
 {
-    PkgList output;
-    vector<string> packages;
-    string search;
-    regex_t re;
+    SearchIndex index;
 
-    for (uint i = 0; i < g_strv_length(values); ++i) {
-        gchar *value = values[i];
-        if (strlen(value) < 1) {
-            continue;
+    // build it now if the packages changed since it was last built
+    if (!index.open(*m_cache)) {
+        if (!SearchIndex::build(*m_cache) || !index.open(*m_cache)) {
+            return false;
         }
+    }
+    return index.lookup(*m_cache, queries, pkgs);
+}
 
-        if (!search.empty()) {
-            search.append("|");
-        }
+PkgList AptIntf::searchPackages(const vector<string> &queries, bool details)
+{
+    PkgList output;
+    vector<string> folded(queries);
+    vector<pkgCache::PkgIterator> pkgs;
 
-        if (value[0] == '/') {
-            search.append("^");
-            search.append(value);
-            search.append("$");
-        } else {
-            search.append(value);
-            search.append("$");
-        }
+    for (string &query : folded) {
+        fold_case(query);
     }
 
-    if(regcomp(&re, search.c_str(), REG_NOSUB) != 0) {
-        g_debug("Regex compilation error");
-        return output;
+    // Reading every description is slow, so only check the packages
+    // the index says can match
+    if (!details || !searchIndexLookup(folded, pkgs)) {
+        pkgs.reserve(m_cache->GetPkgCache()->Head().PackageCount);
+        for (pkgCache::PkgIterator pkg = m_cache->GetPkgCache()->PkgBegin(); !pkg.end(); ++pkg) {
+            // Ignore packages that exist only due to dependencies.
+            if (pkg.VersionList().end() && pkg.ProvidesList().end()) {
+                continue;
+            }
+            pkgs.push_back(pkg);
+        }
+    }
+
+    // The cache is only read from here, so it can be split between
+    // threads; each one gets a contiguous range so the merged output
+    // is in the same order as a single threaded search
+    size_t nThreads = std::max(1u, std::min(std::thread::hardware_concurrency(), 8u));
+    if (pkgs.size() < nThreads * 1000) {
+        nThreads = 1;
+    }
+    size_t chunk = (pkgs.size() + nThreads - 1) / nThreads;
+    vector<PkgList> results(nThreads);
+    vector<std::thread> threads;
+    size_t i;
+    for (i = 1; i < nThreads; ++i) {
+        try {
+            threads.emplace_back(&AptIntf::searchPackageRange, this,
+                                 std::cref(folded), details, std::cref(pkgs),
+                                 std::min(i * chunk, pkgs.size()),
+                                 std::min((i + 1) * chunk, pkgs.size()),
+                                 std::ref(results[i]));
+        } catch (const std::system_error &e) {
+            // the ranges that did not get a thread are searched below
+            g_debug("Failed to start a search thread: %s", e.what());
+            break;
+        }
+    }
+    searchPackageRange(folded, details, pkgs, 0, std::min(chunk, pkgs.size()), results[0]);
+    for (; i < nThreads; ++i) {
+        searchPackageRange(folded, details, pkgs,
+                           std::min(i * chunk, pkgs.size()),
+                           std::min((i + 1) * chunk, pkgs.size()),
+                           results[i]);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
     }
 
-    DIR *dp;
-    struct dirent *dirp;
-    if (!(dp = opendir("/var/lib/dpkg/info/"))) {
-        g_debug ("Error opening /var/lib/dpkg/info/\n");
-        regfree(&re);
-        return output;
+    for (const PkgList &result : results) {
+        output.insert(output.end(), result.begin(), result.end());
     }
+    return output;
+}
 
-    string line;
-    while ((dirp = readdir(dp)) != NULL) {
-        if (m_cancel) {
-            break;
-        }
+PkgList AptIntf::searchPackageName(const vector<string> &queries)
+{
+    return searchPackages(queries, false);
+}
 
-        if (ends_with(dirp->d_name, ".list")) {
-            string file(dirp->d_name);
-            string f = "/var/lib/dpkg/info/" + file;
-            ifstream in(f.c_str());
-            if (!in != 0) {
-                continue;
-            }
+PkgList AptIntf::searchPackageDetails(const vector<string> &queries)
+{
+    return searchPackages(queries, true);
+}
 
-            while (!in.eof()) {
-                getline(in, line);
-                if (regexec(&re, line.c_str(), (size_t)0, NULL, 0) == 0) {
-                    packages.push_back(file.erase(file.size() - 5, file.size()));
-                    break;
-                }
-            }
-        }
+// used to return files it reads, using the info from the files in /var/lib/dpkg/info/
+PkgList AptIntf::searchPackageFiles(gchar **values)
+{
+    PkgList output;
+    vector<string> packages;
+    FileIndex index;
+
+    if (!index.open()) {
+        g_debug("Error reading the installed files");
+        return output;
+    }
+
+    for (uint i = 0; i < g_strv_length(values); ++i) {
+        index.lookup(values[i], packages);
     }
-    closedir(dp);
-    regfree(&re);
+
+    // A package may own more than one of the files
+    std::sort(packages.begin(), packages.end());
+    packages.erase(std::unique(packages.begin(), packages.end()), packages.end());
 
     // Resolve the package names now
     for (const string &name : packages) {
@@ -1366,43 +1462,11 @@ void AptIntf::providesMimeType(PkgList &output, gchar **values)
 
 bool AptIntf::isApplication(const pkgCache::VerIterator &ver)
 {
-    bool ret = false;
-    gchar *fileName;
-    string line;
-
-    if (m_isMultiArch) {
-        fileName = g_strdup_printf("/var/lib/dpkg/info/%s:%s.list",
-                                   ver.ParentPkg().Name(),
-                                   ver.Arch());
-        if (!FileExists(fileName)) {
-            g_free(fileName);
-            // if the file was not found try without the arch field
-            fileName = g_strdup_printf("/var/lib/dpkg/info/%s.list",
-                                       ver.ParentPkg().Name());
-        }
-    } else {
-        fileName = g_strdup_printf("/var/lib/dpkg/info/%s.list",
-                                   ver.ParentPkg().Name());
+    // the same set is used for every package this job filters
+    if (!m_applications) {
+        m_applications = ApplicationSet::get();
     }
-
-    if (FileExists(fileName)) {
-        ifstream in(fileName);
-        if (!in != 0) {
-            g_free(fileName);
-            return false;
-        }
-
-        while (in.eof() == false) {
-            getline(in, line);
-            if (ends_with(line, ".desktop")) {
-                ret = true;
-                break;
-            }
-        }
-    }
-
-    g_free(fileName);
-    return ret;
+    return m_applications->contains(ver);
 }
 
 // used to emit files it reads the info directly from the files
@@ -2221,10 +2285,22 @@ bool AptIntf::runTransaction(const PkgList &install, const PkgList &remove, cons
         g_stat(REBOOT_REQUIRED, &restartStatStart);
     }
 
+    // To see if dpkg was run
+    struct stat statusStatStart = {};
+    const string statusFile = _config->FindFile("Dir::State::status");
+    g_stat(statusFile.c_str(), &statusStatStart);
+
     // If we are simulating the install packages
     // will just calculate the trusted packages
     const auto ret = installPackages(flags);
 
+    struct stat statusStat;
+    if (ret && _error->PendingError() == false &&
+            g_stat(statusFile.c_str(), &statusStat) == 0 &&
+            statusStat.st_mtime != statusStatStart.st_mtime) {
+        FileIndex::update();
+    }
+
     if (g_file_test(REBOOT_REQUIRED, G_FILE_TEST_EXISTS)) {
         struct stat restartStat;
         g_stat(REBOOT_REQUIRED, &restartStat);
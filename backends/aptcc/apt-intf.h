@@ -32,6 +32,10 @@
 
 #include <pk-backend.h>
 
+#include <atomic>
+#include <memory>
+#include <locale.h>
+
 #include "pkg-list.h"
 #include "apt-sourceslist.h"
 
@@ -41,6 +45,7 @@
 class pkgProblemResolver;
 class Matcher;
 class AptCacheFile;
+class ApplicationSet;
 class AptIntf
 {
 public:
@@ -48,6 +53,18 @@ public:
     ~AptIntf();
 
     bool init(gchar **localDebs = nullptr);
+
+    /**
+     * Called by the job thread once the job is done, to decide whether
+     * the cache can be kept for the next job
+     */
+    void threadFinished();
+
+    /**
+     * The read-only roles, which run next to other jobs
+     */
+    static PkBitfield sharedRoles();
+
     void cancel();
     bool cancelled() const;
 
@@ -243,10 +260,19 @@ public:
     AptCacheFile* aptCacheFile() const;
 
 private:
+    void setupProcess();
+    void setupThread();
     bool checkTrusted(pkgAcquire &fetcher, PkBitfield flags);
     bool packageIsSupported(const pkgCache::VerIterator &verIter, string component);
     bool isApplication(const pkgCache::VerIterator &verIter);
-    bool matchesQueries(const vector<string> &queries, string s);
+    PkgList searchPackages(const vector<string> &queries, bool details);
+    bool searchIndexLookup(const vector<string> &queries, vector<pkgCache::PkgIterator> &pkgs);
+    void searchPackageRange(const vector<string> &queries,
+                            bool details,
+                            const vector<pkgCache::PkgIterator> &pkgs,
+                            size_t begin,
+                            size_t end,
+                            PkgList &output);
 
     /**
      *  interprets dpkg status fd
@@ -257,10 +283,15 @@ private:
 
     AptCacheFile *m_cache;
     PkBackendJob  *m_job;
-    bool       m_cancel;
+    // the locale of a read-only job, only used by its own thread
+    locale_t m_locale;
+    locale_t m_oldLocale;
+    // set from the main thread while the job thread reads it
+    std::atomic<bool> m_cancel;
     struct stat m_restartStat;
 
     bool m_isMultiArch;
+    std::shared_ptr<const ApplicationSet> m_applications;
     PkgList m_pkgs;
     PkgList m_restartPackages;
 
@@ -0,0 +1,446 @@
+/* apt-search-index.cpp - Trigram index of package descriptions
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "apt-search-index.h"
+
+#include <apt-pkg/configuration.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <cstring>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+
+#include "apt-cache-file.h"
+#include "apt-utils.h"
+
+#define SEARCH_INDEX_MAGIC "PKSRCH01"
+
+/*
+ * The file is laid out as:
+ *  SearchIndexHeader
+ *  uint32_t name offsets, one for each package
+ *  the package names and architectures, each nul terminated
+ *  SearchIndexTrigram table, sorted by trigram
+ *  the package numbers for each trigram, as varint encoded deltas
+ */
+struct SearchIndexHeader
+{
+    char     magic[8];
+    int64_t  statusMtime;
+    int64_t  listsMtime;
+    char     languages[64];
+    uint32_t entries;
+    uint32_t trigrams;
+    uint64_t namesOffset;
+    uint64_t tableOffset;
+    uint64_t postingsOffset;
+    uint64_t size;
+};
+
+struct SearchIndexTrigram
+{
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t offset;
+};
+
+struct Posting
+{
+    uint32_t last;
+    uint32_t count;
+    string   data;
+};
+
+static string indexPath()
+{
+    return _config->FindDir("Dir::Cache") + "packagekit-search.bin";
+}
+
+/**
+  * What the index was built from: a new dpkg status, an apt update or
+  * another language all change the descriptions that can be found
+  */
+static void currentKey(SearchIndexHeader *header,
+                       gint64 statusMtime,
+                       gint64 listsMtime,
+                       const vector<string> &descriptionLanguages)
+{
+    string languages;
+
+    header->statusMtime = statusMtime;
+    header->listsMtime = listsMtime;
+    for (const string &language : descriptionLanguages) {
+        if (!languages.empty()) {
+            languages.append(",");
+        }
+        languages.append(language);
+    }
+    memset(header->languages, 0, sizeof(header->languages));
+    strncpy(header->languages, languages.c_str(), sizeof(header->languages) - 1);
+}
+
+/**
+  * Every table has to be inside the file and where build() puts it, and
+  * the names have to end with a nul so none of them runs past the end
+  */
+static bool validLayout(const char *data, size_t size)
+{
+    const SearchIndexHeader *header = (const SearchIndexHeader *) data;
+    uint64_t namesEnd;
+
+    if (header->namesOffset != sizeof(SearchIndexHeader)) {
+        return false;
+    }
+    namesEnd = header->namesOffset + (uint64_t) header->entries * sizeof(uint32_t);
+    if (namesEnd > header->tableOffset ||
+            header->tableOffset > size ||
+            header->tableOffset % 8 != 0 ||
+            header->postingsOffset != header->tableOffset +
+                (uint64_t) header->trigrams * sizeof(SearchIndexTrigram) ||
+            header->postingsOffset > size) {
+        return false;
+    }
+    return header->entries == 0 || data[header->tableOffset - 1] == '\0';
+}
+
+static inline uint32_t trigramAt(const string &str, size_t i)
+{
+    return ((uint32_t) (unsigned char) str[i] << 16) |
+           ((uint32_t) (unsigned char) str[i + 1] << 8) |
+           (uint32_t) (unsigned char) str[i + 2];
+}
+
+static void appendVarint(string &data, uint32_t value)
+{
+    while (value >= 0x80) {
+        data.push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+    data.push_back((char) value);
+}
+
+// Packages that only exist due to dependencies are never searched
+static inline bool isSearchable(const pkgCache::PkgIterator &pkg)
+{
+    return !(pkg.VersionList().end() && pkg.ProvidesList().end());
+}
+
+SearchIndex::SearchIndex() :
+    m_data(0),
+    m_size(0)
+{
+}
+
+SearchIndex::~SearchIndex()
+{
+    if (m_data != 0) {
+        munmap((void *) m_data, m_size);
+    }
+}
+
+bool SearchIndex::open(const AptCacheFile &cache)
+{
+    struct stat buf;
+    SearchIndexHeader key;
+    const SearchIndexHeader *header;
+    void *data;
+    int fd;
+
+    fd = ::open(indexPath().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &buf) != 0 || (size_t) buf.st_size < sizeof(SearchIndexHeader)) {
+        close(fd);
+        return false;
+    }
+    data = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    m_data = (const char *) data;
+    m_size = buf.st_size;
+
+    // a partial write or an older format
+    header = (const SearchIndexHeader *) m_data;
+    if (memcmp(header->magic, SEARCH_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+            header->size != m_size ||
+            !validLayout(m_data, m_size)) {
+        g_debug("ignoring invalid search index");
+        goto out;
+    }
+
+    currentKey(&key,
+               file_mtime(_config->FindFile("Dir::State::status")),
+               file_mtime(_config->FindDir("Dir::State::Lists")),
+               cache.languages());
+    if (header->statusMtime != key.statusMtime ||
+            header->listsMtime != key.listsMtime ||
+            strncmp(header->languages, key.languages, sizeof(key.languages)) != 0) {
+        g_debug("search index is out of date");
+        goto out;
+    }
+    return true;
+out:
+    munmap(data, m_size);
+    m_data = 0;
+    m_size = 0;
+    return false;
+}
+
+bool SearchIndex::build(AptCacheFile &cache)
+{
+    std::unordered_map<uint32_t, Posting> postings;
+    vector<uint32_t> nameOffsets;
+    vector<uint32_t> trigrams;
+    string names;
+    string text;
+    string out;
+    SearchIndexHeader header;
+    uint32_t id = 0;
+
+    for (pkgCache::PkgIterator pkg = cache.GetPkgCache()->PkgBegin(); !pkg.end(); ++pkg) {
+        if (!isSearchable(pkg)) {
+            continue;
+        }
+
+        nameOffsets.push_back(names.size());
+        names.append(pkg.Name());
+        names.push_back('\0');
+        names.append(pkg.Arch());
+        names.push_back('\0');
+
+        // the same text searchPackageDetails() looks at
+        text = pkg.Name();
+        const pkgCache::VerIterator &ver = cache.findVer(pkg);
+        if (ver.end() == false) {
+            text.push_back('\n');
+            text.append(cache.getLongDescription(ver));
+        }
+        fold_case(text);
+
+        for (size_t i = 0; i + 3 <= text.size(); ++i) {
+            Posting &posting = postings[trigramAt(text, i)];
+            if (posting.count > 0 && posting.last == id) {
+                continue;
+            }
+            appendVarint(posting.data, posting.count == 0 ? id : id - posting.last);
+            posting.last = id;
+            posting.count++;
+        }
+        id++;
+    }
+
+    trigrams.reserve(postings.size());
+    for (const auto &posting : postings) {
+        trigrams.push_back(posting.first);
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEARCH_INDEX_MAGIC, sizeof(header.magic));
+    // what the cache was opened from, not what is on disk now
+    currentKey(&header, cache.statusMtime(), cache.listsMtime(), cache.languages());
+    header.entries = nameOffsets.size();
+    header.trigrams = trigrams.size();
+    header.namesOffset = sizeof(SearchIndexHeader);
+    header.tableOffset = header.namesOffset + nameOffsets.size() * sizeof(uint32_t) + names.size();
+    header.tableOffset = (header.tableOffset + 7) & ~((uint64_t) 7);
+    header.postingsOffset = header.tableOffset + trigrams.size() * sizeof(SearchIndexTrigram);
+
+    out.append((const char *) &header, sizeof(header));
+    out.append((const char *) nameOffsets.data(), nameOffsets.size() * sizeof(uint32_t));
+    out.append(names);
+    out.resize(header.tableOffset, '\0');
+    uint64_t offset = 0;
+    for (uint32_t trigram : trigrams) {
+        const Posting &posting = postings[trigram];
+        SearchIndexTrigram item = { trigram, posting.count, offset };
+        out.append((const char *) &item, sizeof(item));
+        offset += posting.data.size();
+    }
+    for (uint32_t trigram : trigrams) {
+        out.append(postings[trigram].data);
+    }
+    ((SearchIndexHeader *) &out[0])->size = out.size();
+
+    // readers may still have the old one mapped
+    string path = indexPath();
+    string tmp = path + ".XXXXXX";
+    int fd = g_mkstemp(&tmp[0]);
+    if (fd < 0) {
+        g_warning("failed to create %s: %s", tmp.c_str(), g_strerror(errno));
+        return false;
+    }
+    fchmod(fd, 0644);
+    bool ret = write(fd, out.data(), out.size()) == (ssize_t) out.size();
+    close(fd);
+    if (!ret || rename(tmp.c_str(), path.c_str()) != 0) {
+        g_warning("failed to write %s", path.c_str());
+        g_unlink(tmp.c_str());
+        return false;
+    }
+
+    g_debug("indexed %u packages with %u trigrams in %zu bytes",
+            header.entries, header.trigrams, out.size());
+    return true;
+}
+
+const SearchIndexTrigram *SearchIndex::findTrigram(uint32_t trigram) const
+{
+    const SearchIndexHeader *header = (const SearchIndexHeader *) m_data;
+    const SearchIndexTrigram *begin = (const SearchIndexTrigram *) (m_data + header->tableOffset);
+    const SearchIndexTrigram *end = begin + header->trigrams;
+    const SearchIndexTrigram *it;
+
+    it = std::lower_bound(begin, end, trigram,
+                          [](const SearchIndexTrigram &item, uint32_t value) {
+                              return item.trigram < value;
+                          });
+    if (it == end || it->trigram != trigram) {
+        return NULL;
+    }
+    return it;
+}
+
+bool SearchIndex::decodePostings(const SearchIndexTrigram *trigram, vector<uint32_t> &ids) const
+{
+    const SearchIndexHeader *header = (const SearchIndexHeader *) m_data;
+    const uint64_t available = m_size - header->postingsOffset;
+    const unsigned char *p;
+    const unsigned char *end = (const unsigned char *) m_data + m_size;
+    uint32_t id = 0;
+
+    // each package number takes at least a byte
+    ids.clear();
+    if (trigram->offset > available || trigram->count > available - trigram->offset) {
+        return false;
+    }
+    p = (const unsigned char *) m_data + header->postingsOffset + trigram->offset;
+    ids.reserve(trigram->count);
+    for (uint32_t i = 0; i < trigram->count; ++i) {
+        uint32_t value = 0;
+        guint shift = 0;
+        while (p < end && (*p & 0x80) && shift < 28) {
+            value |= (uint32_t) (*p++ & 0x7f) << shift;
+            shift += 7;
+        }
+        if (p == end || (*p & 0x80)) {
+            return false;
+        }
+        value |= (uint32_t) *p++ << shift;
+        id = i == 0 ? value : id + value;
+        ids.push_back(id);
+    }
+    return true;
+}
+
+bool SearchIndex::lookup(AptCacheFile &cache,
+                         const vector<string> &queries,
+                         vector<pkgCache::PkgIterator> &pkgs) const
+{
+    const SearchIndexHeader *header = (const SearchIndexHeader *) m_data;
+    vector<uint32_t> ids;
+    vector<uint32_t> matched;
+    vector<uint32_t> posting;
+    vector<uint32_t> intersection;
+    vector<const SearchIndexTrigram *> items;
+
+    if (m_data == 0) {
+        return false;
+    }
+
+    for (const string &query : queries) {
+        if (query.size() < 3) {
+            return false;
+        }
+    }
+
+    for (const string &query : queries) {
+        // every trigram of the query has to be in the text
+        items.clear();
+        bool missing = false;
+        for (size_t i = 0; i + 3 <= query.size(); ++i) {
+            const SearchIndexTrigram *item = findTrigram(trigramAt(query, i));
+            if (item == NULL) {
+                missing = true;
+                break;
+            }
+            items.push_back(item);
+        }
+        if (missing) {
+            continue;
+        }
+
+        // start with the rarest so the intersections stay small
+        std::sort(items.begin(), items.end(),
+                  [](const SearchIndexTrigram *a, const SearchIndexTrigram *b) {
+                      return a->count < b->count;
+                  });
+        if (!decodePostings(items[0], matched)) {
+            g_debug("ignoring corrupt search index");
+            return false;
+        }
+        for (size_t i = 1; i < items.size() && !matched.empty(); ++i) {
+            if (!decodePostings(items[i], posting)) {
+                g_debug("ignoring corrupt search index");
+                return false;
+            }
+            intersection.clear();
+            std::set_intersection(matched.begin(), matched.end(),
+                                  posting.begin(), posting.end(),
+                                  std::back_inserter(intersection));
+            matched.swap(intersection);
+        }
+        ids.insert(ids.end(), matched.begin(), matched.end());
+    }
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    const uint32_t *nameOffsets = (const uint32_t *) (m_data + header->namesOffset);
+    const char *names = m_data + header->namesOffset + header->entries * sizeof(uint32_t);
+    const char *namesEnd = m_data + header->tableOffset;
+    for (uint32_t id : ids) {
+        if (id >= header->entries || nameOffsets[id] >= (size_t) (namesEnd - names)) {
+            continue;
+        }
+        const char *name = names + nameOffsets[id];
+        const char *arch = name + strlen(name) + 1;
+        if (arch >= namesEnd) {
+            continue;
+        }
+        pkgCache::PkgIterator pkg = cache.GetPkgCache()->FindPkg(name, arch);
+        if (pkg.end() == false && isSearchable(pkg)) {
+            pkgs.push_back(pkg);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+/* apt-search-index.h - Trigram index of package descriptions
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef APT_SEARCH_INDEX_H
+#define APT_SEARCH_INDEX_H
+
+#include <apt-pkg/pkgcache.h>
+
+#include <string>
+#include <vector>
+
+class AptCacheFile;
+struct SearchIndexTrigram;
+
+/**
+ * An on-disk index of the trigrams in the name and long description of
+ * every package, so searching the details only has to read the records
+ * of the packages that can match.
+ *
+ * The index is only a filter: the candidates still have to be checked
+ * against the real description.
+ */
+class SearchIndex
+{
+public:
+    SearchIndex();
+    ~SearchIndex();
+
+    /**
+     * Maps the index from disk
+     * @returns false if it is missing or was built from other package
+     * lists, dpkg status or languages than the ones \p cache uses now
+     */
+    bool open(const AptCacheFile &cache);
+
+    /**
+     * Indexes every package in the cache, replacing the index on disk
+     */
+    static bool build(AptCacheFile &cache);
+
+    /**
+     * Adds the packages that may contain any of the case folded queries
+     * to pkgs, in the same order as the cache
+     * @returns false if the index is not open or a query is too short to
+     * be looked up
+     */
+    bool lookup(AptCacheFile &cache,
+                const std::vector<std::string> &queries,
+                std::vector<pkgCache::PkgIterator> &pkgs) const;
+
+private:
+    const SearchIndexTrigram *findTrigram(uint32_t trigram) const;
+    bool decodePostings(const SearchIndexTrigram *trigram, std::vector<uint32_t> &ids) const;
+
+    const char *m_data;
+    size_t m_size;
+};
+
+#endif // APT_SEARCH_INDEX_H
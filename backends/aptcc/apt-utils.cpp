@@ -24,6 +24,7 @@
 #include <apt-pkg/version.h>
 #include <apt-pkg/acquire-item.h>
 #include <glib/gstdio.h>
+#include <sys/stat.h>
 
 #include <fstream>
 #include <regex>
@@ -352,6 +353,25 @@ bool starts_with(const string &str, const char *start)
     return str.size() >= startSize && (strncmp(str.data(), start, startSize) == 0);
 }
 
+void fold_case(string &str)
+{
+    // unlike std::tolower() this can be vectorized
+    for (char &c : str) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+    }
+}
+
+gint64 file_mtime(const string &path)
+{
+    struct stat buf;
+    if (stat(path.c_str(), &buf) != 0) {
+        return 0;
+    }
+    return (gint64) buf.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + buf.st_mtim.tv_nsec;
+}
+
 bool utilRestartRequired(const string &packageName)
 {
     if (starts_with(packageName, "linux-image-") ||
@@ -66,6 +66,17 @@ bool ends_with(const string &str, const char *end);
   */
 bool starts_with(const string &str, const char *end);
 
+/**
+  * Lower cases the ASCII letters in the given string
+  */
+void fold_case(string &str);
+
+/**
+  * Return the modification time of the given file in nanoseconds,
+  * or 0 if it does not exist
+  */
+gint64 file_mtime(const string &path);
+
 /**
   * Return true if the given package name is on the list of packages that require a restart
   */
@@ -65,6 +65,19 @@ pk_backend_supports_parallelization (PkBackend *backend)
     return FALSE;
 }
 
+/**
+ * pk_backend_get_shared_roles:
+ *
+ * Queries open their own read-only pkgCacheFile and do not change the
+ * locale, the environment or the apt configuration, which is left to
+ * the one exclusive job. So they can run next to each other and next
+ * to the job holding the apt lock.
+ */
+PkBitfield pk_backend_get_shared_roles(PkBackend *backend)
+{
+    return AptIntf::sharedRoles();
+}
+
 /**
  * pk_backend_initialize:
  */
@@ -102,6 +115,8 @@ void pk_backend_initialize(GKeyFile *conf, PkBackend *backend)
 void pk_backend_destroy(PkBackend *backend)
 {
     g_debug("APTcc being destroyed");
+
+    AptCacheFile::dropShared();
 }
 
 /**
@@ -193,6 +208,25 @@ void pk_backend_stop_job(PkBackend *backend, PkBackendJob *job)
     pk_backend_job_set_user_data (job, NULL);
 }
 
+/**
+ * backend_job_thread:
+ *
+ * Runs func in the job thread, then checks there whether the cache can be
+ * kept, as pk_backend_stop_job() runs on the main thread and _error is per
+ * thread. Each func gets its own instance, so the backend still only
+ * serializes jobs running the same func.
+ */
+template<PkBackendJobThreadFunc func>
+static void backend_job_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
+{
+    func(job, params, user_data);
+
+    AptIntf *apt = static_cast<AptIntf*>(pk_backend_job_get_user_data(job));
+    if (apt) {
+        apt->threadFinished();
+    }
+}
+
 /**
  * pk_backend_cancel:
  */
@@ -269,7 +303,7 @@ static void backend_depends_on_or_requires_thread(PkBackendJob *job, GVariant *p
 void pk_backend_depends_on(PkBackend *backend, PkBackendJob *job, PkBitfield filters,
                            gchar **package_ids, gboolean recursive)
 {
-    pk_backend_job_thread_create(job, backend_depends_on_or_requires_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_depends_on_or_requires_thread>, NULL, NULL);
 }
 
 /**
@@ -281,7 +315,7 @@ void pk_backend_required_by(PkBackend *backend,
                             gchar **package_ids,
                             gboolean recursive)
 {
-    pk_backend_job_thread_create(job, backend_depends_on_or_requires_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_depends_on_or_requires_thread>, NULL, NULL);
 }
 
 /**
@@ -342,7 +376,7 @@ static void backend_get_files_thread(PkBackendJob *job, GVariant *params, gpoint
  */
 void pk_backend_get_files(PkBackend *backend, PkBackendJob *job, gchar **package_ids)
 {
-    pk_backend_job_thread_create(job, backend_get_files_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_get_files_thread>, NULL, NULL);
 }
 
 static void backend_get_details_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -386,7 +420,7 @@ static void backend_get_details_thread(PkBackendJob *job, GVariant *params, gpoi
  */
 void pk_backend_get_update_detail(PkBackend *backend, PkBackendJob *job, gchar **package_ids)
 {
-    pk_backend_job_thread_create(job, backend_get_details_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_get_details_thread>, NULL, NULL);
 }
 
 /**
@@ -394,12 +428,12 @@ void pk_backend_get_update_detail(PkBackend *backend, PkBackendJob *job, gchar *
  */
 void pk_backend_get_details(PkBackend *backend, PkBackendJob *job, gchar **package_ids)
 {
-    pk_backend_job_thread_create(job, backend_get_details_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_get_details_thread>, NULL, NULL);
 }
 
 void pk_backend_get_details_local(PkBackend *backend, PkBackendJob *job, gchar **files)
 {
-    pk_backend_job_thread_create(job, backend_get_details_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_get_details_thread>, NULL, NULL);
 }
 
 static void backend_get_files_local_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -417,7 +451,7 @@ static void backend_get_files_local_thread(PkBackendJob *job, GVariant *params,
 
 void pk_backend_get_files_local(PkBackend *backend, PkBackendJob *job, gchar **files)
 {
-    pk_backend_job_thread_create(job, backend_get_files_local_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_get_files_local_thread>, NULL, NULL);
 }
 
 static void backend_get_updates_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -450,7 +484,7 @@ static void backend_get_updates_thread(PkBackendJob *job, GVariant *params, gpoi
  */
 void pk_backend_get_updates(PkBackend *backend, PkBackendJob *job, PkBitfield filters)
 {
-    pk_backend_job_thread_create(job, backend_get_updates_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_get_updates_thread>, NULL, NULL);
 }
 
 static void backend_what_provides_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -493,7 +527,7 @@ void pk_backend_what_provides(PkBackend *backend,
                               PkBitfield filters,
                               gchar **values)
 {
-    pk_backend_job_thread_create(job, backend_what_provides_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_what_provides_thread>, NULL, NULL);
 }
 
 /**
@@ -612,7 +646,7 @@ void pk_backend_download_packages(PkBackend *backend,
                                   gchar **package_ids,
                                   const gchar *directory)
 {
-    pk_backend_job_thread_create(job, pk_backend_download_packages_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<pk_backend_download_packages_thread>, NULL, NULL);
 }
 
 /**
@@ -647,7 +681,7 @@ static void pk_backend_refresh_cache_thread(PkBackendJob *job, GVariant *params,
  */
 void pk_backend_refresh_cache(PkBackend *backend, PkBackendJob *job, gboolean force)
 {
-    pk_backend_job_thread_create(job, pk_backend_refresh_cache_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<pk_backend_refresh_cache_thread>, NULL, NULL);
 }
 
 static void pk_backend_resolve_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -677,7 +711,7 @@ static void pk_backend_resolve_thread(PkBackendJob *job, GVariant *params, gpoin
  */
 void pk_backend_resolve(PkBackend *backend, PkBackendJob *job, PkBitfield filters, gchar **packages)
 {
-    pk_backend_job_thread_create(job, pk_backend_resolve_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<pk_backend_resolve_thread>, NULL, NULL);
 }
 
 static void pk_backend_search_files_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -713,7 +747,7 @@ static void pk_backend_search_files_thread(PkBackendJob *job, GVariant *params,
  */
 void pk_backend_search_files(PkBackend *backend, PkBackendJob *job, PkBitfield filters, gchar **values)
 {
-    pk_backend_job_thread_create(job, pk_backend_search_files_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<pk_backend_search_files_thread>, NULL, NULL);
 }
 
 static void backend_search_groups_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -744,7 +778,7 @@ static void backend_search_groups_thread(PkBackendJob *job, GVariant *params, gp
  */
 void pk_backend_search_groups(PkBackend *backend, PkBackendJob *job, PkBitfield filters, gchar **values)
 {
-    pk_backend_job_thread_create(job, backend_search_groups_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_search_groups_thread>, NULL, NULL);
 }
 
 static void backend_search_package_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -797,7 +831,7 @@ static void backend_search_package_thread(PkBackendJob *job, GVariant *params, g
  */
 void pk_backend_search_names(PkBackend *backend, PkBackendJob *job, PkBitfield filters, gchar **values)
 {
-    pk_backend_job_thread_create(job, backend_search_package_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_search_package_thread>, NULL, NULL);
 }
 
 /**
@@ -805,7 +839,7 @@ void pk_backend_search_names(PkBackend *backend, PkBackendJob *job, PkBitfield f
  */
 void pk_backend_search_details(PkBackend *backend, PkBackendJob *job, PkBitfield filters, gchar **values)
 {
-    pk_backend_job_thread_create(job, backend_search_package_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_search_package_thread>, NULL, NULL);
 }
 
 static void backend_manage_packages_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -914,7 +948,7 @@ void pk_backend_install_packages(PkBackend *backend,
                                  PkBitfield transaction_flags,
                                  gchar **package_ids)
 {
-    pk_backend_job_thread_create(job, backend_manage_packages_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_manage_packages_thread>, NULL, NULL);
 }
 
 /**
@@ -925,7 +959,7 @@ void pk_backend_update_packages(PkBackend *backend,
                                 PkBitfield transaction_flags,
                                 gchar **package_ids)
 {
-    pk_backend_job_thread_create(job, backend_manage_packages_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_manage_packages_thread>, NULL, NULL);
 }
 
 /**
@@ -936,7 +970,7 @@ void pk_backend_install_files(PkBackend *backend,
                               PkBitfield transaction_flags,
                               gchar **full_paths)
 {
-    pk_backend_job_thread_create(job, backend_manage_packages_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_manage_packages_thread>, NULL, NULL);
 }
 
 /**
@@ -949,7 +983,7 @@ void pk_backend_remove_packages(PkBackend *backend,
                                 gboolean allow_deps,
                                 gboolean autoremove)
 {
-    pk_backend_job_thread_create(job, backend_manage_packages_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_manage_packages_thread>, NULL, NULL);
 }
 
 /**
@@ -957,7 +991,7 @@ void pk_backend_remove_packages(PkBackend *backend,
  */
 void pk_backend_repair_system(PkBackend *backend, PkBackendJob *job, PkBitfield transaction_flags)
 {
-    pk_backend_job_thread_create(job, backend_manage_packages_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_manage_packages_thread>, NULL, NULL);
 }
 
 static void backend_repo_manager_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -1098,7 +1132,7 @@ static void backend_repo_manager_thread(PkBackendJob *job, GVariant *params, gpo
  */
 void pk_backend_get_repo_list(PkBackend *backend, PkBackendJob *job, PkBitfield filters)
 {
-    pk_backend_job_thread_create(job, backend_repo_manager_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_repo_manager_thread>, NULL, NULL);
 }
 
 /**
@@ -1106,7 +1140,7 @@ void pk_backend_get_repo_list(PkBackend *backend, PkBackendJob *job, PkBitfield
  */
 void pk_backend_repo_enable(PkBackend *backend, PkBackendJob *job, const gchar *repo_id, gboolean enabled)
 {
-    pk_backend_job_thread_create(job, backend_repo_manager_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_repo_manager_thread>, NULL, NULL);
 }
 
 /**
@@ -1119,7 +1153,7 @@ pk_backend_repo_remove (PkBackend *backend,
                         const gchar *repo_id,
                         gboolean autoremove)
 {
-    pk_backend_job_thread_create(job, backend_repo_manager_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_repo_manager_thread>, NULL, NULL);
 }
 
 static void backend_get_packages_thread(PkBackendJob *job, GVariant *params, gpointer user_data)
@@ -1147,7 +1181,7 @@ static void backend_get_packages_thread(PkBackendJob *job, GVariant *params, gpo
  */
 void pk_backend_get_packages(PkBackend *backend, PkBackendJob *job, PkBitfield filters)
 {
-    pk_backend_job_thread_create(job, backend_get_packages_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<backend_get_packages_thread>, NULL, NULL);
 }
 
 
@@ -1158,7 +1192,7 @@ void pk_backend_get_packages(PkBackend *backend, PkBackendJob *job, PkBitfield f
 void
 pk_backend_get_categories (PkBackend *backend, PkBackendJob *job)
 {
-    pk_backend_job_thread_create (job, pk_backend_get_categories_thread, NULL, NULL);
+    pk_backend_job_thread_create(job, backend_job_thread<pk_backend_get_categories_thread>, NULL, NULL);
 }
 */
 
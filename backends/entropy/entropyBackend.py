@@ -883,6 +883,12 @@ class PkUrlFetcher(UrlFetcher):
 
 class PackageKitEntropyBackend(PackageKitBaseBackend, PackageKitEntropyMixin):
 
+    # write package lists in batches
+    buffered = True
+
+    # all the records are written using the base class
+    supports_framing = True
+
     _log_fname = os.path.join(etpConst['syslogdir'], "packagekit.log")
 
     # Entropy <-> PackageKit groups map
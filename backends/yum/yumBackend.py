@@ -228,6 +228,9 @@ def _get_cmdline_for_pid(pid):
 
 class PackageKitYumBackend(PackageKitBaseBackend, PackagekitPackage):
 
+    # write package lists in batches
+    buffered = True
+
     def __init__(self, args, lock=True):
         signal.signal(signal.SIGQUIT, sigquit)
         PackageKitBaseBackend.__init__(self, args)
@@ -1542,6 +1542,7 @@ pk_console_get_summary (PkConsoleCtx *ctx)
 	g_string_append_printf (string, "  %s\n", "offline-trigger");
 	g_string_append_printf (string, "  %s\n", "offline-cancel");
 	g_string_append_printf (string, "  %s\n", "offline-status");
+	g_string_append_printf (string, "  %s\n", "stats");
 	g_string_append_printf (string, "  %s\n", "quit");
 	return g_string_free (string, FALSE);
 }
@@ -1597,6 +1598,64 @@ pk_console_offline_get_prepared (GError **error)
 	return TRUE;
 }
 
+/**
+ * pk_console_print_statistics:
+ **/
+static void
+pk_console_print_statistics (GVariant *dict, guint indent)
+{
+	GVariantIter iter;
+	GVariant *value;
+	const gchar *key;
+
+	g_variant_iter_init (&iter, dict);
+	while (g_variant_iter_loop (&iter, "{&sv}", &key, &value)) {
+		g_autofree gchar *tmp = NULL;
+		if (g_variant_is_of_type (value, G_VARIANT_TYPE_VARDICT)) {
+			g_print ("%*s%s:\n", indent, "", key);
+			pk_console_print_statistics (value, indent + 2);
+			continue;
+		}
+		tmp = g_variant_print (value, FALSE);
+		g_print ("%*s%s:\t%s\n", indent, "", key, tmp);
+	}
+}
+
+/**
+ * pk_console_stats:
+ **/
+static gboolean
+pk_console_stats (GError **error)
+{
+	g_autoptr(GDBusConnection) connection = NULL;
+	g_autoptr(GVariant) res = NULL;
+	g_autoptr(GVariant) dict = NULL;
+
+	connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, error);
+	if (connection == NULL) {
+		(*error)->code = PK_EXIT_CODE_CANNOT_SETUP;
+		return FALSE;
+	}
+	res = g_dbus_connection_call_sync (connection,
+					   PK_DBUS_SERVICE,
+					   PK_DBUS_PATH,
+					   PK_DBUS_INTERFACE_STATISTICS,
+					   "GetStatistics",
+					   NULL,
+					   G_VARIANT_TYPE ("(a{sv})"),
+					   G_DBUS_CALL_FLAGS_NONE,
+					   -1,
+					   NULL,
+					   error);
+	if (res == NULL) {
+		(*error)->code = PK_EXIT_CODE_TRANSACTION_FAILED;
+		return FALSE;
+	}
+	dict = g_variant_get_child_value (res, 0);
+	pk_console_print_statistics (dict, 0);
+	return TRUE;
+}
+
 /**
  * pk_console_offline_status:
  **/
@@ -2388,6 +2447,13 @@ main (int argc, char *argv[])
 		if (!ret)
 			ctx->retval = error->code;
 
+	} else if (strcmp (mode, "stats") == 0) {
+
+		run_mainloop = FALSE;
+		ret = pk_console_stats (&error);
+		if (!ret)
+			ctx->retval = error->code;
+
 	} else if (strcmp (mode, "get-transactions") == 0) {
 		pk_client_get_old_transactions_async (PK_CLIENT (ctx->task),
 						      10,
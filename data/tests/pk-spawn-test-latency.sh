@@ -0,0 +1,17 @@
+#!/bin/sh
+# Licensed under the GNU General Public License Version 2
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+
+# each line carries the wall-clock time it was written in microseconds so
+# that the reader can work out how long it took to be processed
+
+time=0.03
+
+for i in `seq 1 20`
+do
+	printf "time\t%s\n" `date +%s%6N`
+	sleep ${time}
+done
@@ -8,6 +8,12 @@
 
 time=0.5
 
+# just dump lots of data as quickly as possible
+if [ -n "$1" ]; then
+	yes "`printf 'package\tavailable\tpolkit;0.0.1;i386;data\tPolicyKit daemon'`" | head -n "$1"
+	exit 0
+fi
+
 echo -e "percentage\t0"
 echo -e "percentage\t10"
 sleep ${time}
@@ -1078,6 +1078,20 @@ pk_client_signal_cb (GDBusProxy *proxy,
 					  tmp_str[2]);
 		return;
 	}
+	if (g_strcmp0 (signal_name, "Packages") == 0) {
+		g_autoptr(GVariantIter) iter = NULL;
+		g_variant_get (parameters, "(a(uss))", &iter);
+		while (g_variant_iter_next (iter, "(u&s&s)",
+					    &tmp_uint,
+					    &tmp_str[1],
+					    &tmp_str[2])) {
+			pk_client_signal_package (state,
+						  tmp_uint,
+						  tmp_str[1],
+						  tmp_str[2]);
+		}
+		return;
+	}
 	if (g_strcmp0 (signal_name, "Details") == 0) {
 		gchar *key;
 		GVariantIter *dictionary;
@@ -2038,6 +2052,9 @@ pk_client_get_proxy_cb (GObject *object,
 		g_ptr_array_add (array, hint);
 	}
 
+	/* we can unpack the batched Packages signal */
+	g_ptr_array_add (array, g_strdup ("supports-plural-signals=true"));
+
 	/* create socket for roles that need interaction */
 	if (state->role == PK_ROLE_ENUM_INSTALL_FILES ||
 	    state->role == PK_ROLE_ENUM_INSTALL_PACKAGES ||
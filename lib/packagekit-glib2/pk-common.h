@@ -67,6 +67,15 @@ G_BEGIN_DECLS
  */
 #define	PK_DBUS_INTERFACE_OFFLINE	"org.freedesktop.PackageKit.Offline"
 
+/**
+ * PK_DBUS_INTERFACE_STATISTICS:
+ *
+ * The DBUS interface for PackageKit daemon statistics
+ *
+ * Since: 1.1.12
+ */
+#define	PK_DBUS_INTERFACE_STATISTICS	"org.freedesktop.PackageKit.Statistics"
+
 /**
  * PK_PACKAGE_LIST_FILENAME:
  *
@@ -30,9 +30,11 @@
 
 #include "config.h"
 
+#include <string.h>
 #include <glib-object.h>
 
 #include <packagekit-glib2/pk-package.h>
+#include <packagekit-glib2/pk-package-private.h>
 #include <packagekit-glib2/pk-common.h>
 #include <packagekit-glib2/pk-enum.h>
 #include <packagekit-glib2/pk-enum-types.h>
@@ -47,13 +49,8 @@ static void     pk_package_finalize	(GObject     *object);
  *
  * Private #PkPackage data
  **/
-struct _PkPackagePrivate
+typedef struct
 {
-	PkInfoEnum		 info;
-	gchar			*package_id;
-	gchar			*package_id_data;
-	const gchar		*package_id_split[4];
-	gchar			*summary;
 	gchar			*license;
 	PkGroupEnum		 group;
 	gchar			*description;
@@ -70,6 +67,16 @@ struct _PkPackagePrivate
 	PkUpdateStateEnum	 update_state;
 	gchar			*update_issued;
 	gchar			*update_updated;
+} PkPackageExtra;
+
+struct _PkPackagePrivate
+{
+	PkInfoEnum		 info;
+	guint			 package_id_offset[3];	/* of version, arch and data */
+	const gchar		*package_id;		/* maybe interned */
+	const gchar		*package_id_data;	/* name, then the other sections */
+	gchar			*summary;
+	PkPackageExtra		*extra;			/* details and update details */
 };
 
 enum {
@@ -105,6 +112,115 @@ static guint signals [SIGNAL_LAST] = { 0 };
 
 G_DEFINE_TYPE (PkPackage, pk_package, PK_TYPE_SOURCE)
 
+/* The string is followed by a copy with the first three ';' changed into
+ * '\0' so each section can be returned without another allocation. When
+ * pk_package_set_intern_ids() was used, every package-id is stored once
+ * per process however many PkPackage objects refer to it -- packages are
+ * created in backend threads too, so this takes a lock */
+typedef struct {
+	guint			 refcount;
+	gboolean		 interned;
+	gchar			 str[];
+} PkPackageIdPoolItem;
+
+static gboolean pk_package_id_pool_enabled = FALSE;
+static GHashTable *pk_package_id_pool = NULL;	/* str:PkPackageIdPoolItem */
+G_LOCK_DEFINE_STATIC (pk_package_id_pool);
+
+/**
+ * pk_package_set_intern_ids:
+ * @intern_ids: %TRUE to share package-ids between packages
+ *
+ * Makes every #PkPackage created from now on share one copy of each
+ * package-id. This is only worth the lock for the daemon, which keeps
+ * many packages with the same ids in different results at once.
+ **/
+void
+pk_package_set_intern_ids (gboolean intern_ids)
+{
+	pk_package_id_pool_enabled = intern_ids;
+}
+
+/*
+ * pk_package_id_pool_item_new:
+ **/
+static PkPackageIdPoolItem *
+pk_package_id_pool_item_new (const gchar *package_id)
+{
+	PkPackageIdPoolItem *item;
+	gchar *data;
+	guint cnt = 0;
+	gsize len;
+	gsize i;
+
+	len = strlen (package_id) + 1;
+	item = g_malloc (sizeof (PkPackageIdPoolItem) + len * 2);
+	item->refcount = 1;
+	item->interned = FALSE;
+	memcpy (item->str, package_id, len);
+	data = item->str + len;
+	memcpy (data, package_id, len);
+	for (i = 0; data[i] != '\0' && cnt < 3; i++) {
+		if (data[i] == ';') {
+			data[i] = '\0';
+			cnt++;
+		}
+	}
+	return item;
+}
+
+/*
+ * pk_package_id_pool_ref:
+ *
+ * Return value: a copy of @package_id, shared if interning is enabled,
+ * free with pk_package_id_pool_unref()
+ **/
+static const gchar *
+pk_package_id_pool_ref (const gchar *package_id)
+{
+	PkPackageIdPoolItem *item;
+
+	if (!pk_package_id_pool_enabled)
+		return pk_package_id_pool_item_new (package_id)->str;
+
+	G_LOCK (pk_package_id_pool);
+	if (pk_package_id_pool == NULL)
+		pk_package_id_pool = g_hash_table_new (g_str_hash, g_str_equal);
+	item = g_hash_table_lookup (pk_package_id_pool, package_id);
+	if (item == NULL) {
+		item = pk_package_id_pool_item_new (package_id);
+		item->interned = TRUE;
+		g_hash_table_insert (pk_package_id_pool, item->str, item);
+	} else {
+		item->refcount++;
+	}
+	G_UNLOCK (pk_package_id_pool);
+	return item->str;
+}
+
+/*
+ * pk_package_id_pool_unref:
+ **/
+static void
+pk_package_id_pool_unref (const gchar *package_id)
+{
+	PkPackageIdPoolItem *item;
+
+	if (package_id == NULL)
+		return;
+	item = (PkPackageIdPoolItem *) (package_id - G_STRUCT_OFFSET (PkPackageIdPoolItem, str));
+	if (!item->interned) {
+		g_free (item);
+		return;
+	}
+	G_LOCK (pk_package_id_pool);
+	if (--item->refcount == 0) {
+		g_hash_table_remove (pk_package_id_pool, item->str);
+		g_free (item);
+	}
+	G_UNLOCK (pk_package_id_pool);
+}
+
 /**
  * pk_package_equal:
  * @package1: a valid #PkPackage instance
@@ -122,7 +238,7 @@ pk_package_equal (PkPackage *package1, PkPackage *package2)
 	g_return_val_if_fail (PK_IS_PACKAGE (package1), FALSE);
 	g_return_val_if_fail (PK_IS_PACKAGE (package2), FALSE);
 	return (g_strcmp0 (package1->priv->summary, package2->priv->summary) == 0 &&
-	        g_strcmp0 (package1->priv->package_id, package2->priv->package_id) == 0 &&
+	        pk_package_equal_id (package1, package2) &&
 	        package1->priv->info == package2->priv->info);
 }
 
@@ -142,7 +258,10 @@ pk_package_equal_id (PkPackage *package1, PkPackage *package2)
 {
 	g_return_val_if_fail (PK_IS_PACKAGE (package1), FALSE);
 	g_return_val_if_fail (PK_IS_PACKAGE (package2), FALSE);
-	return (g_strcmp0 (package1->priv->package_id, package2->priv->package_id) == 0);
+	/* the same pointer if interned */
+	if (package1->priv->package_id == package2->priv->package_id)
+		return TRUE;
+	return g_strcmp0 (package1->priv->package_id, package2->priv->package_id) == 0;
 }
 
 /**
@@ -169,20 +288,18 @@ pk_package_set_id (PkPackage *package, const gchar *package_id, GError **error)
 	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
 	/* free old data */
-	g_free (priv->package_id);
-	g_free (priv->package_id_data);
-
-	/* copy the package-id into package_id_data, change the ';' into '\0'
-	 * and reference the pointers in the const gchar * array */
-	priv->package_id = g_strdup (package_id);
-	priv->package_id_data = g_strdup (package_id);
-	priv->package_id_split[0] = priv->package_id_data;
-	for (i = 0; priv->package_id_data[i] != '\0'; i++) {
+	pk_package_id_pool_unref (priv->package_id);
+	memset (priv->package_id_offset, 0, sizeof (priv->package_id_offset));
+
+	/* the copy has already been split, so just remember where each
+	 * section starts */
+	priv->package_id = pk_package_id_pool_ref (package_id);
+	priv->package_id_data = priv->package_id + strlen (priv->package_id) + 1;
+	for (i = 0; package_id[i] != '\0'; i++) {
 		if (package_id[i] == ';') {
 			if (++cnt > 3)
 				continue;
-			priv->package_id_split[cnt] = &priv->package_id_data[i+1];
-			priv->package_id_data[i] = '\0';
+			priv->package_id_offset[cnt - 1] = i + 1;
 		}
 	}
 	if (cnt != 3) {
@@ -192,7 +309,7 @@ pk_package_set_id (PkPackage *package, const gchar *package_id, GError **error)
 	}
 
 	/* name has to be valid */
-	ret = (priv->package_id_split[0][0] != '\0');
+	ret = (priv->package_id_data[0] != '\0');
 	if (!ret) {
 		g_set_error_literal (error, 1, 0, "name invalid");
 		goto out;
@@ -321,6 +438,19 @@ pk_package_get_summary (PkPackage *package)
 	return package->priv->summary;
 }
 
+/*
+ * pk_package_get_section:
+ **/
+static const gchar *
+pk_package_get_section (PkPackage *package, guint section)
+{
+	PkPackagePrivate *priv = package->priv;
+	guint offset = priv->package_id_offset[section - 1];
+	if (offset == 0)
+		return NULL;
+	return priv->package_id_data + offset;
+}
+
 /**
  * pk_package_get_name:
  * @package: a valid #PkPackage instance
@@ -335,7 +465,7 @@ const gchar *
 pk_package_get_name (PkPackage *package)
 {
 	g_return_val_if_fail (PK_IS_PACKAGE (package), NULL);
-	return package->priv->package_id_split[PK_PACKAGE_ID_NAME];
+	return package->priv->package_id_data;
 }
 
 /**
@@ -352,7 +482,7 @@ const gchar *
 pk_package_get_version (PkPackage *package)
 {
 	g_return_val_if_fail (PK_IS_PACKAGE (package), NULL);
-	return package->priv->package_id_split[PK_PACKAGE_ID_VERSION];
+	return pk_package_get_section (package, PK_PACKAGE_ID_VERSION);
 }
 
 /**
@@ -369,7 +499,7 @@ const gchar *
 pk_package_get_arch (PkPackage *package)
 {
 	g_return_val_if_fail (PK_IS_PACKAGE (package), NULL);
-	return package->priv->package_id_split[PK_PACKAGE_ID_ARCH];
+	return pk_package_get_section (package, PK_PACKAGE_ID_ARCH);
 }
 
 /**
@@ -388,7 +518,7 @@ const gchar *
 pk_package_get_data (PkPackage *package)
 {
 	g_return_val_if_fail (PK_IS_PACKAGE (package), NULL);
-	return package->priv->package_id_split[PK_PACKAGE_ID_DATA];
+	return pk_package_get_section (package, PK_PACKAGE_ID_DATA);
 }
 
 /**
@@ -405,11 +535,11 @@ pk_package_print (PkPackage *package)
 	PkPackagePrivate *priv = package->priv;
 	g_return_if_fail (PK_IS_PACKAGE (package));
 	g_print ("%s-%s.%s\t%s\t%s\n",
-		 priv->package_id_split[PK_PACKAGE_ID_NAME],
-		 priv->package_id_split[PK_PACKAGE_ID_VERSION],
-		 priv->package_id_split[PK_PACKAGE_ID_ARCH],
-		 priv->package_id_split[PK_PACKAGE_ID_DATA],
-		 package->priv->summary);
+		 priv->package_id_data,
+		 pk_package_get_section (package, PK_PACKAGE_ID_VERSION),
+		 pk_package_get_section (package, PK_PACKAGE_ID_ARCH),
+		 pk_package_get_section (package, PK_PACKAGE_ID_DATA),
+		 priv->summary);
 }
 
 /*
@@ -420,6 +550,7 @@ pk_package_get_property (GObject *object, guint prop_id, GValue *value, GParamSp
 {
 	PkPackage *package = PK_PACKAGE (object);
 	PkPackagePrivate *priv = package->priv;
+	PkPackageExtra *extra = priv->extra;
 
 	switch (prop_id) {
 	case PROP_PACKAGE_ID:
@@ -432,52 +563,52 @@ pk_package_get_property (GObject *object, guint prop_id, GValue *value, GParamSp
 		g_value_set_enum (value, priv->info);
 		break;
 	case PROP_LICENSE:
-		g_value_set_string (value, priv->license);
+		g_value_set_string (value, extra != NULL ? extra->license : NULL);
 		break;
 	case PROP_GROUP:
-		g_value_set_enum (value, priv->group);
+		g_value_set_enum (value, extra != NULL ? extra->group : PK_GROUP_ENUM_UNKNOWN);
 		break;
 	case PROP_DESCRIPTION:
-		g_value_set_string (value, priv->description);
+		g_value_set_string (value, extra != NULL ? extra->description : NULL);
 		break;
 	case PROP_URL:
-		g_value_set_string (value, priv->url);
+		g_value_set_string (value, extra != NULL ? extra->url : NULL);
 		break;
 	case PROP_SIZE:
-		g_value_set_uint64 (value, priv->size);
+		g_value_set_uint64 (value, extra != NULL ? extra->size : 0);
 		break;
 	case PROP_UPDATE_UPDATES:
-		g_value_set_string (value, priv->update_updates);
+		g_value_set_string (value, extra != NULL ? extra->update_updates : NULL);
 		break;
 	case PROP_UPDATE_OBSOLETES:
-		g_value_set_string (value, priv->update_obsoletes);
+		g_value_set_string (value, extra != NULL ? extra->update_obsoletes : NULL);
 		break;
 	case PROP_UPDATE_VENDOR_URLS:
-		g_value_set_boxed (value, priv->update_vendor_urls);
+		g_value_set_boxed (value, extra != NULL ? extra->update_vendor_urls : NULL);
 		break;
 	case PROP_UPDATE_BUGZILLA_URLS:
-		g_value_set_boxed (value, priv->update_bugzilla_urls);
+		g_value_set_boxed (value, extra != NULL ? extra->update_bugzilla_urls : NULL);
 		break;
 	case PROP_UPDATE_CVE_URLS:
-		g_value_set_boxed (value, priv->update_cve_urls);
+		g_value_set_boxed (value, extra != NULL ? extra->update_cve_urls : NULL);
 		break;
 	case PROP_UPDATE_RESTART:
-		g_value_set_enum (value, priv->update_restart);
+		g_value_set_enum (value, extra != NULL ? extra->update_restart : PK_RESTART_ENUM_UNKNOWN);
 		break;
 	case PROP_UPDATE_UPDATE_TEXT:
-		g_value_set_string (value, priv->update_text);
+		g_value_set_string (value, extra != NULL ? extra->update_text : NULL);
 		break;
 	case PROP_UPDATE_CHANGELOG:
-		g_value_set_string (value, priv->update_changelog);
+		g_value_set_string (value, extra != NULL ? extra->update_changelog : NULL);
 		break;
 	case PROP_UPDATE_STATE:
-		g_value_set_enum (value, priv->update_state);
+		g_value_set_enum (value, extra != NULL ? extra->update_state : PK_UPDATE_STATE_ENUM_UNKNOWN);
 		break;
 	case PROP_UPDATE_ISSUED:
-		g_value_set_string (value, priv->update_issued);
+		g_value_set_string (value, extra != NULL ? extra->update_issued : NULL);
 		break;
 	case PROP_UPDATE_UPDATED:
-		g_value_set_string (value, priv->update_updated);
+		g_value_set_string (value, extra != NULL ? extra->update_updated : NULL);
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -492,7 +623,13 @@ static void
 pk_package_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
 {
 	PkPackage *package = PK_PACKAGE (object);
-	PkPackagePrivate *priv = package->priv;
+	PkPackageExtra *extra;
+
+	/* most packages never have any details */
+	if (prop_id != PROP_INFO && prop_id != PROP_SUMMARY &&
+	    package->priv->extra == NULL)
+		package->priv->extra = g_new0 (PkPackageExtra, 1);
+	extra = package->priv->extra;
 
 	switch (prop_id) {
 	case PROP_INFO:
@@ -502,64 +639,64 @@ pk_package_set_property (GObject *object, guint prop_id, const GValue *value, GP
 		pk_package_set_summary (package, g_value_get_string (value));
 		break;
 	case PROP_LICENSE:
-		g_free (priv->license);
-		priv->license = g_strdup (g_value_get_string (value));
+		g_free (extra->license);
+		extra->license = g_strdup (g_value_get_string (value));
 		break;
 	case PROP_GROUP:
-		priv->group = g_value_get_enum (value);
+		extra->group = g_value_get_enum (value);
 		break;
 	case PROP_DESCRIPTION:
-		g_free (priv->description);
-		priv->description = g_strdup (g_value_get_string (value));
+		g_free (extra->description);
+		extra->description = g_strdup (g_value_get_string (value));
 		break;
 	case PROP_URL:
-		g_free (priv->url);
-		priv->url = g_strdup (g_value_get_string (value));
+		g_free (extra->url);
+		extra->url = g_strdup (g_value_get_string (value));
 		break;
 	case PROP_SIZE:
-		priv->size = g_value_get_uint64 (value);
+		extra->size = g_value_get_uint64 (value);
 		break;
 	case PROP_UPDATE_UPDATES:
-		g_free (priv->update_updates);
-		priv->update_updates = g_strdup (g_value_get_string (value));
+		g_free (extra->update_updates);
+		extra->update_updates = g_strdup (g_value_get_string (value));
 		break;
 	case PROP_UPDATE_OBSOLETES:
-		g_free (priv->update_obsoletes);
-		priv->update_obsoletes = g_strdup (g_value_get_string (value));
+		g_free (extra->update_obsoletes);
+		extra->update_obsoletes = g_strdup (g_value_get_string (value));
 		break;
 	case PROP_UPDATE_VENDOR_URLS:
-		g_strfreev (priv->update_vendor_urls);
-		priv->update_vendor_urls = g_strdupv (g_value_get_boxed (value));
+		g_strfreev (extra->update_vendor_urls);
+		extra->update_vendor_urls = g_strdupv (g_value_get_boxed (value));
 		break;
 	case PROP_UPDATE_BUGZILLA_URLS:
-		g_strfreev (priv->update_bugzilla_urls);
-		priv->update_bugzilla_urls = g_strdupv (g_value_get_boxed (value));
+		g_strfreev (extra->update_bugzilla_urls);
+		extra->update_bugzilla_urls = g_strdupv (g_value_get_boxed (value));
 		break;
 	case PROP_UPDATE_CVE_URLS:
-		g_strfreev (priv->update_cve_urls);
-		priv->update_cve_urls = g_strdupv (g_value_get_boxed (value));
+		g_strfreev (extra->update_cve_urls);
+		extra->update_cve_urls = g_strdupv (g_value_get_boxed (value));
 		break;
 	case PROP_UPDATE_RESTART:
-		priv->update_restart = g_value_get_enum (value);
+		extra->update_restart = g_value_get_enum (value);
 		break;
 	case PROP_UPDATE_UPDATE_TEXT:
-		g_free (priv->update_text);
-		priv->update_text = g_strdup (g_value_get_string (value));
+		g_free (extra->update_text);
+		extra->update_text = g_strdup (g_value_get_string (value));
 		break;
 	case PROP_UPDATE_CHANGELOG:
-		g_free (priv->update_changelog);
-		priv->update_changelog = g_strdup (g_value_get_string (value));
+		g_free (extra->update_changelog);
+		extra->update_changelog = g_strdup (g_value_get_string (value));
 		break;
 	case PROP_UPDATE_STATE:
-		priv->update_state = g_value_get_enum (value);
+		extra->update_state = g_value_get_enum (value);
 		break;
 	case PROP_UPDATE_ISSUED:
-		g_free (priv->update_issued);
-		priv->update_issued = g_strdup (g_value_get_string (value));
+		g_free (extra->update_issued);
+		extra->update_issued = g_strdup (g_value_get_string (value));
 		break;
 	case PROP_UPDATE_UPDATED:
-		g_free (priv->update_updated);
-		priv->update_updated = g_strdup (g_value_get_string (value));
+		g_free (extra->update_updated);
+		extra->update_updated = g_strdup (g_value_get_string (value));
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -812,10 +949,6 @@ static void
 pk_package_init (PkPackage *package)
 {
 	package->priv = PK_PACKAGE_GET_PRIVATE (package);
-	package->priv->package_id_split[PK_PACKAGE_ID_NAME] = NULL;
-	package->priv->package_id_split[PK_PACKAGE_ID_VERSION] = NULL;
-	package->priv->package_id_split[PK_PACKAGE_ID_ARCH] = NULL;
-	package->priv->package_id_split[PK_PACKAGE_ID_DATA] = NULL;
 }
 
 /*
@@ -828,21 +961,23 @@ pk_package_finalize (GObject *object)
 	PkPackage *package = PK_PACKAGE (object);
 	PkPackagePrivate *priv = package->priv;
 
-	g_free (priv->package_id);
+	pk_package_id_pool_unref (priv->package_id);
 	g_free (priv->summary);
-	g_free (priv->license);
-	g_free (priv->description);
-	g_free (priv->url);
-	g_free (priv->update_updates);
-	g_free (priv->update_obsoletes);
-	g_strfreev (priv->update_vendor_urls);
-	g_strfreev (priv->update_bugzilla_urls);
-	g_strfreev (priv->update_cve_urls);
-	g_free (priv->update_text);
-	g_free (priv->update_changelog);
-	g_free (priv->update_issued);
-	g_free (priv->update_updated);
-	g_free (priv->package_id_data);
+	if (priv->extra != NULL) {
+		g_free (priv->extra->license);
+		g_free (priv->extra->description);
+		g_free (priv->extra->url);
+		g_free (priv->extra->update_updates);
+		g_free (priv->extra->update_obsoletes);
+		g_strfreev (priv->extra->update_vendor_urls);
+		g_strfreev (priv->extra->update_bugzilla_urls);
+		g_strfreev (priv->extra->update_cve_urls);
+		g_free (priv->extra->update_text);
+		g_free (priv->extra->update_changelog);
+		g_free (priv->extra->update_issued);
+		g_free (priv->extra->update_updated);
+		g_free (priv->extra);
+	}
 
 	G_OBJECT_CLASS (pk_package_parent_class)->finalize (object);
 }
@@ -29,6 +29,7 @@
 #include "pk-offline.h"
 #include "pk-offline-private.h"
 #include "pk-package.h"
+#include "pk-package-private.h"
 #include "pk-package-id.h"
 #include "pk-package-ids.h"
 #include "pk-progress-bar.h"
@@ -540,6 +541,7 @@ pk_test_package_func (void)
 {
 	gboolean ret;
 	PkPackage *package;
+	PkPackage *package2;
 	const gchar *id;
 	gchar *text;
 	GError *error = NULL;
@@ -595,7 +597,38 @@ pk_test_package_func (void)
 	g_assert_cmpstr (text, ==, "gnome-power-manager;0.1.2;i386;fedora");
 	g_free (text);
 
+	/* get the sections */
+	g_assert_cmpstr (pk_package_get_name (package), ==, "gnome-power-manager");
+	g_assert_cmpstr (pk_package_get_version (package), ==, "0.1.2");
+	g_assert_cmpstr (pk_package_get_arch (package), ==, "i386");
+	g_assert_cmpstr (pk_package_get_data (package), ==, "fedora");
+
+	/* details are unset until needed */
+	g_object_get (package, "description", &text, NULL);
+	g_assert_cmpstr (text, ==, NULL);
+	g_object_set (package, "description", "Power management", NULL);
+	g_object_get (package, "description", &text, NULL);
+	g_assert_cmpstr (text, ==, "Power management");
+	g_free (text);
+
+	/* the same id is shared between packages */
+	pk_package_set_intern_ids (TRUE);
+	ret = pk_package_set_id (package, "gnome-power-manager;0.1.2;i386;fedora", &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	id = pk_package_get_id (package);
+	package2 = pk_package_new ();
+	ret = pk_package_set_id (package2, "gnome-power-manager;0.1.2;i386;fedora", &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (pk_package_get_id (package2) == id);
+	g_assert (pk_package_equal_id (package, package2));
+
+	/* and still valid when the first one goes away */
 	g_object_unref (package);
+	g_assert_cmpstr (pk_package_get_id (package2), ==, "gnome-power-manager;0.1.2;i386;fedora");
+	g_object_unref (package2);
+	pk_package_set_intern_ids (FALSE);
 }
 
 static void
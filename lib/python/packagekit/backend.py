@@ -24,7 +24,10 @@
 # imports
 from __future__ import print_function
 
+import atexit
+import struct
 import sys
+import threading
 import traceback
 import os.path
 
@@ -46,6 +49,27 @@ def _to_utf8(txt, errors='replace'):
         return txt.encode('utf-8', errors=errors)
     return str(txt)
 
+# the start of every frame, so the daemon can skip anything else that was
+# written to stdout; keep in sync with PK_SPAWN_FRAME_MAGIC
+_FRAME_MAGIC = b'PKF1'
+
+# records that are written straight away, even in buffered mode
+_URGENT_COMMANDS = frozenset([
+    'status',
+    'error',
+    'finished',
+    'allow-cancel',
+    'media-change-required',
+    'repo-signature-required',
+    'eula-required',
+])
+
+def _to_text(value):
+    text = '%s' % (value,)
+    if not isinstance(text, type(u'')):
+        text = text.decode('utf-8', 'replace')
+    return text
+
 class PkError(Exception):
     def __init__(self, code, details):
         self.code = code
@@ -55,6 +79,18 @@ class PkError(Exception):
 
 class PackageKitBaseBackend:
 
+    # backends that only write to stdout using the methods below can set
+    # this to send records to the daemon without any text escaping
+    supports_framing = False
+
+    # backends that return lots of results can set this to write the data
+    # records in batches rather than one line at a time; records that change
+    # the state of the transaction are still written straight away, and a
+    # batch is never held back for longer than buffer_interval seconds
+    buffered = False
+    buffer_size = 64 * 1024
+    buffer_interval = 0.1
+
     def __init__(self, cmds):
         # Setup a custom exception handler
         installExceptionHandler(self)
@@ -107,6 +143,27 @@ class PackageKitBaseBackend:
         except KeyError as e:
             pass
 
+        # records waiting to be written in buffered mode
+        self._pending = []
+        self._pending_size = 0
+        self._pending_out = None
+        self._pending_lock = threading.RLock()
+        self._pending_timer = None
+        if self.buffered:
+            atexit.register(self._flush)
+
+        # use the binary framing if the daemon offered it
+        self._glib = None
+        if self.supports_framing and os.environ.get('FRAMING') == 'gvariant':
+            try:
+                from gi.repository import GLib
+            except ImportError as e:
+                pass
+            else:
+                sys.stdout.write("framing\tgvariant\n")
+                sys.stdout.flush()
+                self._glib = GLib
+
     def doLock(self):
         ''' Generic locking, overide and extend in child class'''
         self._locked = True
@@ -118,25 +175,74 @@ class PackageKitBaseBackend:
     def isLocked(self):
         return self._locked
 
+    def _flush(self):
+        '''
+        Write any buffered records to the daemon
+        '''
+        with self._pending_lock:
+            if self._pending_timer:
+                self._pending_timer.cancel()
+                self._pending_timer = None
+            if not self._pending:
+                return
+            if self._glib:
+                data = b''.join(self._pending)
+            else:
+                data = ''.join(self._pending)
+            self._pending = []
+            self._pending_size = 0
+            self._pending_out.write(data)
+            self._pending_out.flush()
+
+    def _emit(self, command, *args):
+        '''
+        Write a record to the daemon
+        @param command: The name of the record, e.g. 'package'
+        @param args: The fields of the record
+        '''
+        if self._glib:
+            frame = self._glib.Variant('(sas)', (command, [_to_text(arg) for arg in args]))
+            data = frame.get_data_as_bytes().get_data()
+            data = _FRAME_MAGIC + struct.pack('<I', len(data)) + data
+            out = getattr(sys.stdout, 'buffer', sys.stdout)
+        else:
+            data = _to_utf8(command + ''.join(['\t%s' % (arg,) for arg in args]) + '\n')
+            out = sys.stdout
+
+        with self._pending_lock:
+            # the backend may have replaced stdout since the last record
+            if out is not self._pending_out:
+                self._flush()
+                self._pending_out = out
+
+            self._pending.append(data)
+            self._pending_size += len(data)
+            if not self.buffered or command in _URGENT_COMMANDS or \
+               self._pending_size >= self.buffer_size:
+                self._flush()
+            elif not self._pending_timer:
+                # write the batch even if the backend goes quiet
+                self._pending_timer = threading.Timer(self.buffer_interval, self._flush)
+                self._pending_timer.daemon = True
+                self._pending_timer.start()
+
     def percentage(self, percent=None):
         '''
         Write progress percentage
         @param percent: Progress percentage (int preferred)
         '''
         if percent == None:
-            sys.stdout.write(_to_utf8("no-percentage-updates\n"))
+            self._emit('no-percentage-updates')
         elif percent == 0 or percent > self.percentage_old:
-            sys.stdout.write(_to_utf8("percentage\t%i\n" % percent))
+            self._emit('percentage', '%i' % percent)
             self.percentage_old = percent
-        sys.stdout.flush()
 
     def speed(self, bps=0):
         '''
         Write progress speed
         @param bps: Progress speed (int, bytes per second)
         '''
-        sys.stdout.write(_to_utf8("speed\t%i\n" % bps))
-        sys.stdout.flush()
+        self._emit('speed', '%i' % bps)
 
     def item_progress(self, package_id, status, percent=None):
         '''
@@ -144,8 +250,7 @@ class PackageKitBaseBackend:
         @param package_id: The package ID name, e.g. openoffice-clipart;2.6.22;ppc64;fedora
         @param percent: percentage of the current item (int preferred)
         '''
-        sys.stdout.write(_to_utf8("item-progress\t%s\t%s\t%i\n" % (package_id, status, percent)))
-        sys.stdout.flush()
+        self._emit('item-progress', package_id, status, '%i' % percent)
 
     def error(self, err, description, exit=True):
         '''
@@ -159,8 +264,7 @@ class PackageKitBaseBackend:
             self.unLock()
 
         # this should be fast now
-        sys.stdout.write(_to_utf8("error\t%s\t%s\n" % (err, description)))
-        sys.stdout.flush()
+        self._emit('error', err, description)
         if exit:
             # Paradoxically, we don't want to print "finished" to stdout here.
             # Python takes an _enormous_ amount of time to exit, and leaves a
@@ -174,8 +278,7 @@ class PackageKitBaseBackend:
         send 'message' signal
         @param typ: MESSAGE_BROKEN_MIRROR
         '''
-        sys.stdout.write(_to_utf8("message\t%s\t%s\n" % (typ, msg)))
-        sys.stdout.flush()
+        self._emit('message', typ, msg)
 
     def package(self, package_id, status, summary):
         '''
@@ -184,8 +287,7 @@ class PackageKitBaseBackend:
         @param package_id: The package ID name, e.g. openoffice-clipart;2.6.22;ppc64;fedora
         @param summary: The package Summary
         '''
-        sys.stdout.write(_to_utf8("package\t%s\t%s\t%s\n" % (status, package_id, summary)))
-        sys.stdout.flush()
+        self._emit('package', status, package_id, summary)
 
     def media_change_required(self, mtype, id, text):
         '''
@@ -194,8 +296,7 @@ class PackageKitBaseBackend:
         @param id: the localised label of the media
         @param text: the localised text describing the media
         '''
-        sys.stdout.write(_to_utf8("media-change-required\t%s\t%s\t%s\n" % (mtype, id, text)))
-        sys.stdout.flush()
+        self._emit('media-change-required', mtype, id, text)
 
     def distro_upgrade(self, dtype, name, summary):
         '''
@@ -204,16 +305,14 @@ class PackageKitBaseBackend:
         @param name: The distro name, e.g. "fedora-9"
         @param summary: The localised distribution name and description
         '''
-        sys.stdout.write(_to_utf8("distro-upgrade\t%s\t%s\t%s\n" % (dtype, name, summary)))
-        sys.stdout.flush()
+        self._emit('distro-upgrade', dtype, name, summary)
 
     def status(self, state):
         '''
         send 'status' signal
         @param state: STATUS_DOWNLOAD, STATUS_INSTALL, STATUS_UPDATE, STATUS_REMOVE, STATUS_WAIT
         '''
-        sys.stdout.write(_to_utf8("status\t%s\n" % state))
-        sys.stdout.flush()
+        self._emit('status', state)
 
     def repo_detail(self, repoid, name, state):
         '''
@@ -221,16 +320,14 @@ class PackageKitBaseBackend:
         @param repoid: The repo id tag
         @param state: false is repo is disabled else true.
         '''
-        sys.stdout.write(_to_utf8("repo-detail\t%s\t%s\t%s\n" % (repoid, name, _bool_to_string(state))))
-        sys.stdout.flush()
+        self._emit('repo-detail', repoid, name, _bool_to_string(state))
 
     def data(self, data):
         '''
         send 'data' signal:
         @param data:  The current worked on package
         '''
-        sys.stdout.write(_to_utf8("data\t%s\n" % data))
-        sys.stdout.flush()
+        self._emit('data', data)
 
     def details(self, package_id, summary, package_license, group, desc, url, bytes):
         '''
@@ -243,16 +340,14 @@ class PackageKitBaseBackend:
         @param url: The upstream project homepage
         @param bytes: The size of the package, in bytes
         '''
-        sys.stdout.write(_to_utf8("details\t%s\t%s\t%s\t%s\t%s\t%s\t%ld\n" % (package_id, summary, package_license, group, desc, url, bytes)))
-        sys.stdout.flush()
+        self._emit('details', package_id, summary, package_license, group, desc, url, '%ld' % bytes)
 
     def files(self, package_id, file_list):
         '''
         Send 'files' signal
         @param file_list: List of the files in the package, separated by ';'
         '''
-        sys.stdout.write(_to_utf8("files\t%s\t%s\n" % (package_id, file_list)))
-        sys.stdout.flush()
+        self._emit('files', package_id, file_list)
 
     def category(self, parent_id, cat_id, name, summary, icon):
         '''
@@ -263,15 +358,13 @@ class PackageKitBaseBackend:
         summery   : a summary of the category in current locale.
         icon      : an icon name to represent the category
         '''
-        sys.stdout.write(_to_utf8("category\t%s\t%s\t%s\t%s\t%s\n" % (parent_id, cat_id, name, summary, icon)))
-        sys.stdout.flush()
+        self._emit('category', parent_id, cat_id, name, summary, icon)
 
     def finished(self):
         '''
         Send 'finished' signal
         '''
-        sys.stdout.write(_to_utf8("finished\n"))
-        sys.stdout.flush()
+        self._emit('finished')
 
     def update_detail(self, package_id, updates, obsoletes, vendor_url, bugzilla_url, cve_url, restart, update_text, changelog, state, issued, updated):
         '''
@@ -289,8 +382,7 @@ class PackageKitBaseBackend:
         @param issued:
         @param updated:
         '''
-        sys.stdout.write(_to_utf8("updatedetail\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" % (package_id, updates, obsoletes, vendor_url, bugzilla_url, cve_url, restart, update_text, changelog, state, issued, updated)))
-        sys.stdout.flush()
+        self._emit('updatedetail', package_id, updates, obsoletes, vendor_url, bugzilla_url, cve_url, restart, update_text, changelog, state, issued, updated)
 
     def require_restart(self, restart_type, details):
         '''
@@ -298,8 +390,7 @@ class PackageKitBaseBackend:
         @param restart_type: RESTART_SYSTEM, RESTART_APPLICATION, RESTART_SESSION
         @param details: Optional details about the restart
         '''
-        sys.stdout.write(_to_utf8("requirerestart\t%s\t%s\n" % (restart_type, details)))
-        sys.stdout.flush()
+        self._emit('requirerestart', restart_type, details)
 
     def allow_cancel(self, allow):
         '''
@@ -310,8 +401,7 @@ class PackageKitBaseBackend:
             data = 'true'
         else:
             data = 'false'
-        sys.stdout.write(_to_utf8("allow-cancel\t%s\n" % data))
-        sys.stdout.flush()
+        self._emit('allow-cancel', data)
 
     def repo_signature_required(self, package_id, repo_name, key_url, key_userid, key_id, key_fingerprint, key_timestamp, sig_type):
         '''
@@ -325,10 +415,7 @@ class PackageKitBaseBackend:
         @param key_timestamp:   Key timestamp
         @param sig_type:        Key type (GPG)
         '''
-        sys.stdout.write(_to_utf8("repo-signature-required\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" % (
-            package_id, repo_name, key_url, key_userid, key_id, key_fingerprint, key_timestamp, sig_type
-            )))
-        sys.stdout.flush()
+        self._emit('repo-signature-required', package_id, repo_name, key_url, key_userid, key_id, key_fingerprint, key_timestamp, sig_type)
 
     def eula_required(self, eula_id, package_id, vendor_name, license_agreement):
         '''
@@ -338,10 +425,7 @@ class PackageKitBaseBackend:
         @param vendor_name:     Name of the vendor that wrote the EULA
         @param license_agreement: The license text
         '''
-        sys.stdout.write(_to_utf8("eula-required\t%s\t%s\t%s\t%s\n" % (
-            eula_id, package_id, vendor_name, license_agreement
-            )))
-        sys.stdout.flush()
+        self._emit('eula-required', eula_id, package_id, vendor_name, license_agreement)
 
 #
 # Backend Action Methods
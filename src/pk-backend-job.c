@@ -62,6 +62,15 @@
  */
 #define PK_BACKEND_CANCEL_ACTION_TIMEOUT	2000 /* ms */
 
+/**
+ * PK_BACKEND_JOB_DISPATCH_BATCH:
+ *
+ * The maximum number of queued events delivered to the main thread in one
+ * main loop iteration. Any remaining events are delivered in the next
+ * iteration so that D-Bus traffic is not starved by a busy backend.
+ */
+#define PK_BACKEND_JOB_DISPATCH_BATCH		500
+
 typedef struct {
 	gboolean		 enabled;
 	PkBackendJobVFunc	 vfunc;
@@ -109,6 +118,12 @@ struct PkBackendJobPrivate
 	PkStatusEnum		 status;
 	GTimer			*timer;
 	gboolean		 started;
+	GMutex			 dispatch_mutex;
+	GQueue			*dispatch_queue;
+	gpointer		 dispatch_finished;
+	gboolean		 dispatch_pending;
+	guint			 dispatch_depth_max;
+	gint64			 dispatch_latency_max;
 };
 
 G_DEFINE_TYPE (PkBackendJob, pk_backend_job, G_TYPE_OBJECT)
@@ -586,10 +601,10 @@ pk_backend_job_get_is_error_set (PkBackendJob *job)
 
 /* used to call vfuncs in the main daemon thread */
 typedef struct {
-	PkBackendJob		*job;
 	PkBackendJobSignal	 signal_kind;
 	GObject			*object;
 	GDestroyNotify		 destroy_func;
+	gint64			 queued;
 } PkBackendJobVFuncHelper;
 
 /**
@@ -649,28 +664,69 @@ pk_backend_job_vfunc_event_free (PkBackendJobVFuncHelper *helper)
 {
 	if (helper->destroy_func != NULL)
 		helper->destroy_func (helper->object);
-	g_object_unref (helper->job);
 	g_free (helper);
 }
 
 /**
- * pk_backend_job_call_vfunc_idle_cb:
+ * pk_backend_job_vfunc_event_dispatch:
  **/
-static gboolean
-pk_backend_job_call_vfunc_idle_cb (gpointer user_data)
+static void
+pk_backend_job_vfunc_event_dispatch (PkBackendJob *job,
+				     PkBackendJobVFuncHelper *helper)
 {
-	PkBackendJobVFuncHelper *helper = (PkBackendJobVFuncHelper *) user_data;
 	PkBackendJobVFuncItem *item;
+	gint64 latency;
+
+	/* keep track of how far behind the main thread is */
+	latency = g_get_monotonic_time () - helper->queued;
+	g_mutex_lock (&job->priv->dispatch_mutex);
+	if (latency > job->priv->dispatch_latency_max)
+		job->priv->dispatch_latency_max = latency;
+	g_mutex_unlock (&job->priv->dispatch_mutex);
 
 	/* call transaction vfunc on main thread */
-	item = &helper->job->priv->vfunc_items[helper->signal_kind];
+	item = &job->priv->vfunc_items[helper->signal_kind];
 	if (item != NULL && item->vfunc != NULL) {
-		item->vfunc (helper->job, helper->object, item->user_data);
+		item->vfunc (job, helper->object, item->user_data);
 	} else {
 		g_warning ("tried to do signal %s when no longer connected",
 			   pk_backend_job_signal_to_string (helper->signal_kind));
 	}
-	return FALSE;
+}
+
+/**
+ * pk_backend_job_dispatch_idle_cb:
+ *
+ * Delivers queued events in the order they were added, with Finished()
+ * always delivered once everything else has been sent.
+ **/
+static gboolean
+pk_backend_job_dispatch_idle_cb (gpointer user_data)
+{
+	PkBackendJob *job = PK_BACKEND_JOB (user_data);
+	PkBackendJobVFuncHelper *helper;
+	guint i;
+
+	for (i = 0; i < PK_BACKEND_JOB_DISPATCH_BATCH; i++) {
+		g_mutex_lock (&job->priv->dispatch_mutex);
+		helper = g_queue_pop_head (job->priv->dispatch_queue);
+		if (helper == NULL) {
+			helper = job->priv->dispatch_finished;
+			job->priv->dispatch_finished = NULL;
+		}
+		if (helper == NULL) {
+			job->priv->dispatch_pending = FALSE;
+			g_mutex_unlock (&job->priv->dispatch_mutex);
+			return G_SOURCE_REMOVE;
+		}
+		g_mutex_unlock (&job->priv->dispatch_mutex);
+
+		pk_backend_job_vfunc_event_dispatch (job, helper);
+		pk_backend_job_vfunc_event_free (helper);
+	}
+
+	/* let the main loop do something else before the next batch */
+	return G_SOURCE_CONTINUE;
 }
 
 /**
@@ -687,32 +743,99 @@ pk_backend_job_call_vfunc (PkBackendJob *job,
 {
 	PkBackendJobVFuncHelper *helper;
 	PkBackendJobVFuncItem *item;
-	guint priority = G_PRIORITY_DEFAULT_IDLE;
-	g_autoptr(GSource) source = NULL;
+	guint depth;
 
 	/* call transaction vfunc if not disabled and set */
 	item = &job->priv->vfunc_items[signal_kind];
 	if (!item->enabled || item->vfunc == NULL)
 		return;
 
-	/* order this last if others are still pending */
-	if (signal_kind == PK_BACKEND_SIGNAL_FINISHED)
-		priority = G_PRIORITY_LOW;
-
-	/* emit idle */
 	helper = g_new0 (PkBackendJobVFuncHelper, 1);
-	helper->job = g_object_ref (job);
 	helper->signal_kind = signal_kind;
 	helper->object = object;
 	helper->destroy_func = destroy_func;
-	source = g_idle_source_new ();
-	g_source_set_priority (source, priority);
-	g_source_set_callback (source,
-			       pk_backend_job_call_vfunc_idle_cb,
-			       helper,
-			       (GDestroyNotify) pk_backend_job_vfunc_event_free);
-	g_source_set_name (source, "[PkBackendJob] idle_event_cb");
-	g_source_attach (source, NULL);
+	helper->queued = g_get_monotonic_time ();
+
+	g_mutex_lock (&job->priv->dispatch_mutex);
+
+	/* order this last if others are still pending */
+	if (signal_kind == PK_BACKEND_SIGNAL_FINISHED) {
+		if (job->priv->dispatch_finished != NULL) {
+			g_warning ("already queued finished");
+			pk_backend_job_vfunc_event_free (job->priv->dispatch_finished);
+		}
+		job->priv->dispatch_finished = helper;
+	} else {
+		g_queue_push_tail (job->priv->dispatch_queue, helper);
+		depth = g_queue_get_length (job->priv->dispatch_queue);
+		if (depth > job->priv->dispatch_depth_max)
+			job->priv->dispatch_depth_max = depth;
+	}
+
+	/* one idle source drains the queue for the whole job */
+	if (!job->priv->dispatch_pending) {
+		g_autoptr(GSource) source = g_idle_source_new ();
+		job->priv->dispatch_pending = TRUE;
+		g_source_set_priority (source, G_PRIORITY_DEFAULT_IDLE);
+		g_source_set_callback (source,
+				       pk_backend_job_dispatch_idle_cb,
+				       g_object_ref (job),
+				       (GDestroyNotify) g_object_unref);
+		g_source_set_name (source, "[PkBackendJob] dispatch_idle_cb");
+		g_source_attach (source, NULL);
+	}
+
+	g_mutex_unlock (&job->priv->dispatch_mutex);
+}
+
+/**
+ * pk_backend_job_get_dispatch_queue_depth:
+ *
+ * Return value: the number of events waiting to be delivered to the main thread
+ **/
+guint
+pk_backend_job_get_dispatch_queue_depth (PkBackendJob *job)
+{
+	guint depth;
+	g_return_val_if_fail (PK_IS_BACKEND_JOB (job), 0);
+	g_mutex_lock (&job->priv->dispatch_mutex);
+	depth = g_queue_get_length (job->priv->dispatch_queue);
+	if (job->priv->dispatch_finished != NULL)
+		depth++;
+	g_mutex_unlock (&job->priv->dispatch_mutex);
+	return depth;
+}
+
+/**
+ * pk_backend_job_get_dispatch_queue_depth_max:
+ *
+ * Return value: the largest number of events that were waiting at any one time
+ **/
+guint
+pk_backend_job_get_dispatch_queue_depth_max (PkBackendJob *job)
+{
+	guint depth;
+	g_return_val_if_fail (PK_IS_BACKEND_JOB (job), 0);
+	g_mutex_lock (&job->priv->dispatch_mutex);
+	depth = job->priv->dispatch_depth_max;
+	g_mutex_unlock (&job->priv->dispatch_mutex);
+	return depth;
+}
+
+/**
+ * pk_backend_job_get_dispatch_latency_max:
+ *
+ * Return value: the longest time an event waited before being delivered, in ms
+ **/
+guint
+pk_backend_job_get_dispatch_latency_max (PkBackendJob *job)
+{
+	gint64 latency;
+	g_return_val_if_fail (PK_IS_BACKEND_JOB (job), 0);
+	g_mutex_lock (&job->priv->dispatch_mutex);
+	latency = job->priv->dispatch_latency_max;
+	g_mutex_unlock (&job->priv->dispatch_mutex);
+	return latency / 1000;
 }
 
 /**
@@ -802,11 +925,13 @@ typedef struct {
 
 /**
  * pk_backend_job_thread_setup:
+ *
+ * Runs in a worker thread from the backend thread pool.
  **/
-static gpointer
-pk_backend_job_thread_setup (gpointer thread_data)
+static void
+pk_backend_job_thread_setup (gpointer data, gpointer user_data)
 {
-	PkBackendJobThreadHelper *helper = (PkBackendJobThreadHelper *) thread_data;
+	PkBackendJobThreadHelper *helper = (PkBackendJobThreadHelper *) user_data;
 
 	/* run original function with automatic locking */
 	pk_backend_thread_start (helper->backend, helper->job, helper->func);
@@ -814,22 +939,11 @@ pk_backend_job_thread_setup (gpointer thread_data)
 	pk_backend_job_finished (helper->job);
 	pk_backend_thread_stop (helper->backend, helper->job, helper->func);
 
-	/* set idle IO priority */
-#ifdef PK_BUILD_DAEMON
-	if (helper->job->priv->background == TRUE) {
-		g_debug ("setting ioprio class to idle");
-		pk_ioprio_set_idle (0);
-	}
-#endif
-
 	/* destroy helper */
 	g_object_unref (helper->job);
 	if (helper->destroy_func != NULL)
 		helper->destroy_func (helper->user_data);
 	g_free (helper);
-
-	/* no return value */
-	return NULL;
 }
 
 /**
@@ -843,6 +957,7 @@ pk_backend_job_thread_create (PkBackendJob *job,
 			      GDestroyNotify destroy_func)
 {
 	PkBackendJobThreadHelper *helper = NULL;
+	g_autoptr(GError) error = NULL;
 
 	g_return_val_if_fail (PK_IS_BACKEND_JOB (job), FALSE);
 	g_return_val_if_fail (func != NULL, FALSE);
@@ -854,12 +969,20 @@ pk_backend_job_thread_create (PkBackendJob *job,
 	helper->backend = job->priv->backend;
 	helper->func = func;
 	helper->user_data = user_data;
+	helper->destroy_func = destroy_func;
 
-	/* create a thread and unref it immediately as we do not need to join()
+	/* run in a pooled worker thread, as we do not need to join()
 	 * this at any stage */
-	g_thread_unref (g_thread_new ("PK-Backend",
-	                              pk_backend_job_thread_setup,
-	                              helper));
+	if (!pk_backend_thread_pool_push (job->priv->backend,
+					  job,
+					  pk_backend_job_thread_setup,
+					  helper,
+					  &error)) {
+		g_warning ("failed to queue job: %s", error->message);
+		g_object_unref (helper->job);
+		g_free (helper);
+		return FALSE;
+	}
 	return TRUE;
 }
 
@@ -1092,10 +1215,11 @@ pk_backend_job_package (PkBackendJob *job,
 	if (emitted_item != NULL && pk_package_equal (emitted_item, item))
 		return;
 
-	/* update the emitted package table */
-	g_hash_table_insert (job->priv->emitted,
-	                     g_strdup (pk_package_get_id (item)),
-	                     g_object_ref (item));
+	/* update the emitted package table; the key is owned by the value,
+	 * so replace rather than insert to keep the two together */
+	g_hash_table_replace (job->priv->emitted,
+			      (gpointer) pk_package_get_id (item),
+			      g_object_ref (item));
 
 	/* have we already set an error? */
 	if (job->priv->set_error) {
@@ -1828,6 +1952,11 @@ pk_backend_job_finalize (GObject *object)
 	g_free (job->priv->locale);
 	g_free (job->priv->frontend_socket);
 	g_hash_table_unref (job->priv->emitted);
+	g_queue_free_full (job->priv->dispatch_queue,
+			   (GDestroyNotify) pk_backend_job_vfunc_event_free);
+	if (job->priv->dispatch_finished != NULL)
+		pk_backend_job_vfunc_event_free (job->priv->dispatch_finished);
+	g_mutex_clear (&job->priv->dispatch_mutex);
 	if (job->priv->params != NULL)
 		g_variant_unref (job->priv->params);
 	g_timer_destroy (job->priv->timer);
@@ -1865,7 +1994,9 @@ pk_backend_job_init (PkBackendJob *job)
 	job->priv->role = PK_ROLE_ENUM_UNKNOWN;
 	job->priv->status = PK_STATUS_ENUM_UNKNOWN;
 	job->priv->emitted = g_hash_table_new_full (g_str_hash, g_str_equal,
-	                                            g_free, (GDestroyNotify) g_object_unref);
+	                                            NULL, (GDestroyNotify) g_object_unref);
+	g_mutex_init (&job->priv->dispatch_mutex);
+	job->priv->dispatch_queue = g_queue_new ();
 }
 
 /**
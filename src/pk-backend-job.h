@@ -113,6 +113,9 @@ void		 pk_backend_job_set_exit_code		(PkBackendJob	*job,
 							 PkExitEnum	 exit);
 gboolean	 pk_backend_job_has_set_error_code	(PkBackendJob	*job);
 guint		 pk_backend_job_get_runtime		(PkBackendJob	*job);
+guint		 pk_backend_job_get_dispatch_queue_depth (PkBackendJob	*job);
+guint		 pk_backend_job_get_dispatch_queue_depth_max (PkBackendJob *job);
+guint		 pk_backend_job_get_dispatch_latency_max (PkBackendJob	*job);
 gboolean	 pk_backend_job_get_is_finished		(PkBackendJob	*job);
 gboolean	 pk_backend_job_get_is_error_set	(PkBackendJob	*job);
 gboolean	 pk_backend_job_get_allow_cancel	(PkBackendJob	*job);
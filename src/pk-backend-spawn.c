@@ -53,6 +53,10 @@
 #define PK_BACKEND_SPAWN_PERCENTAGE_INVALID	101
 
 #define	PK_UNSAFE_DELIMITERS	"\\\f\r\t"
+#define PK_BACKEND_SPAWN_SECTIONS_MAX		13
+
+/* how much of a line that could not be parsed is logged */
+#define PK_BACKEND_SPAWN_LINE_LOGGED		1024
 
 struct PkBackendSpawnPrivate
 {
@@ -67,6 +71,8 @@ struct PkBackendSpawnPrivate
 	gboolean		 is_busy;
 	PkBackendSpawnFilterFunc stdout_func;
 	PkBackendSpawnFilterFunc stderr_func;
+	GString			*line_buf;
+	GPtrArray		*strv_buf[5];
 };
 
 G_DEFINE_TYPE (PkBackendSpawn, pk_backend_spawn, G_TYPE_OBJECT)
@@ -138,20 +144,224 @@ pk_backend_spawn_start_kill_timer (PkBackendSpawn *backend_spawn)
 	g_source_set_name_by_id (priv->kill_id, "[PkBackendSpawn] exit");
 }
 
+/* the commands understood on stdout, in the same order as the table below */
+typedef enum {
+	PK_BACKEND_SPAWN_COMMAND_PACKAGE,
+	PK_BACKEND_SPAWN_COMMAND_DETAILS,
+	PK_BACKEND_SPAWN_COMMAND_FINISHED,
+	PK_BACKEND_SPAWN_COMMAND_FILES,
+	PK_BACKEND_SPAWN_COMMAND_REPO_DETAIL,
+	PK_BACKEND_SPAWN_COMMAND_UPDATEDETAIL,
+	PK_BACKEND_SPAWN_COMMAND_PERCENTAGE,
+	PK_BACKEND_SPAWN_COMMAND_ITEM_PROGRESS,
+	PK_BACKEND_SPAWN_COMMAND_ERROR,
+	PK_BACKEND_SPAWN_COMMAND_REQUIRERESTART,
+	PK_BACKEND_SPAWN_COMMAND_STATUS,
+	PK_BACKEND_SPAWN_COMMAND_SPEED,
+	PK_BACKEND_SPAWN_COMMAND_DOWNLOAD_SIZE_REMAINING,
+	PK_BACKEND_SPAWN_COMMAND_ALLOW_CANCEL,
+	PK_BACKEND_SPAWN_COMMAND_NO_PERCENTAGE_UPDATES,
+	PK_BACKEND_SPAWN_COMMAND_REPO_SIGNATURE_REQUIRED,
+	PK_BACKEND_SPAWN_COMMAND_EULA_REQUIRED,
+	PK_BACKEND_SPAWN_COMMAND_MEDIA_CHANGE_REQUIRED,
+	PK_BACKEND_SPAWN_COMMAND_DISTRO_UPGRADE,
+	PK_BACKEND_SPAWN_COMMAND_CATEGORY,
+	PK_BACKEND_SPAWN_COMMAND_FRAMING,
+	PK_BACKEND_SPAWN_COMMAND_UNKNOWN
+} PkBackendSpawnCommand;
+
+/* the name and number of tab-separated sections, including the name */
+static const struct {
+	const gchar	*name;
+	guint		 size;
+} pk_backend_spawn_commands[] = {
+	{ "package",			4 },
+	{ "details",			8 },
+	{ "finished",			1 },
+	{ "files",			3 },
+	{ "repo-detail",		4 },
+	{ "updatedetail",		13 },
+	{ "percentage",			2 },
+	{ "item-progress",		4 },
+	{ "error",			3 },
+	{ "requirerestart",		3 },
+	{ "status",			2 },
+	{ "speed",			2 },
+	{ "download-size-remaining",	2 },
+	{ "allow-cancel",		2 },
+	{ "no-percentage-updates",	1 },
+	{ "repo-signature-required",	9 },
+	{ "eula-required",		5 },
+	{ "media-change-required",	4 },
+	{ "distro-upgrade",		4 },
+	{ "category",			6 },
+	{ "framing",			2 },
+};
+
 /**
- * pk_backend_spawn_parse_stdout:
+ * pk_backend_spawn_command_from_string:
+ *
+ * The length and the first character are enough to tell every command
+ * apart, so this only has to compare the string once.
+ **/
+static PkBackendSpawnCommand
+pk_backend_spawn_command_from_string (const gchar *command, gsize len)
+{
+	PkBackendSpawnCommand cmd = PK_BACKEND_SPAWN_COMMAND_UNKNOWN;
+
+	switch (len) {
+	case 5:
+		if (command[0] == 'f')
+			cmd = PK_BACKEND_SPAWN_COMMAND_FILES;
+		else if (command[0] == 'e')
+			cmd = PK_BACKEND_SPAWN_COMMAND_ERROR;
+		else if (command[0] == 's')
+			cmd = PK_BACKEND_SPAWN_COMMAND_SPEED;
+		break;
+	case 6:
+		cmd = PK_BACKEND_SPAWN_COMMAND_STATUS;
+		break;
+	case 7:
+		if (command[0] == 'p')
+			cmd = PK_BACKEND_SPAWN_COMMAND_PACKAGE;
+		else if (command[0] == 'd')
+			cmd = PK_BACKEND_SPAWN_COMMAND_DETAILS;
+		else if (command[0] == 'f')
+			cmd = PK_BACKEND_SPAWN_COMMAND_FRAMING;
+		break;
+	case 8:
+		if (command[0] == 'f')
+			cmd = PK_BACKEND_SPAWN_COMMAND_FINISHED;
+		else if (command[0] == 'c')
+			cmd = PK_BACKEND_SPAWN_COMMAND_CATEGORY;
+		break;
+	case 10:
+		cmd = PK_BACKEND_SPAWN_COMMAND_PERCENTAGE;
+		break;
+	case 11:
+		cmd = PK_BACKEND_SPAWN_COMMAND_REPO_DETAIL;
+		break;
+	case 12:
+		if (command[0] == 'u')
+			cmd = PK_BACKEND_SPAWN_COMMAND_UPDATEDETAIL;
+		else if (command[0] == 'a')
+			cmd = PK_BACKEND_SPAWN_COMMAND_ALLOW_CANCEL;
+		break;
+	case 13:
+		if (command[0] == 'i')
+			cmd = PK_BACKEND_SPAWN_COMMAND_ITEM_PROGRESS;
+		else if (command[0] == 'e')
+			cmd = PK_BACKEND_SPAWN_COMMAND_EULA_REQUIRED;
+		break;
+	case 14:
+		if (command[0] == 'r')
+			cmd = PK_BACKEND_SPAWN_COMMAND_REQUIRERESTART;
+		else if (command[0] == 'd')
+			cmd = PK_BACKEND_SPAWN_COMMAND_DISTRO_UPGRADE;
+		break;
+	case 21:
+		if (command[0] == 'n')
+			cmd = PK_BACKEND_SPAWN_COMMAND_NO_PERCENTAGE_UPDATES;
+		else if (command[0] == 'm')
+			cmd = PK_BACKEND_SPAWN_COMMAND_MEDIA_CHANGE_REQUIRED;
+		break;
+	case 23:
+		if (command[0] == 'd')
+			cmd = PK_BACKEND_SPAWN_COMMAND_DOWNLOAD_SIZE_REMAINING;
+		else if (command[0] == 'r')
+			cmd = PK_BACKEND_SPAWN_COMMAND_REPO_SIGNATURE_REQUIRED;
+		break;
+	default:
+		break;
+	}
+
+	/* check it really is the command */
+	if (cmd == PK_BACKEND_SPAWN_COMMAND_UNKNOWN)
+		return cmd;
+	if (memcmp (command, pk_backend_spawn_commands[cmd].name, len) != 0)
+		return PK_BACKEND_SPAWN_COMMAND_UNKNOWN;
+	return cmd;
+}
+
+/**
+ * pk_backend_spawn_split_in_place:
+ * @str: the string to split, which is modified
+ * @sections: an array of at least @max_sections + 1 entries
+ *
+ * Splits the string at each tab without allocating any memory.
+ *
+ * Return value: the number of sections, which may be more than @max_sections
+ **/
+static guint
+pk_backend_spawn_split_in_place (gchar *str, gchar **sections, guint max_sections)
+{
+	gchar *tmp;
+	guint size = 0;
+
+	for (;;) {
+		if (size < max_sections)
+			sections[size] = str;
+		size++;
+		tmp = strchr (str, '\t');
+		if (tmp == NULL)
+			break;
+		*tmp = '\0';
+		str = tmp + 1;
+	}
+	sections[MIN (size, max_sections)] = NULL;
+	return size;
+}
+
+/**
+ * pk_backend_spawn_strv_in_place:
+ * @str: the string to split, which is modified
+ * @array: a #GPtrArray that is reused for each call
+ *
+ * Splits the string at each delimiter like g_strsplit(), but without
+ * copying each section.
+ *
+ * Return value: (transfer none): a %NULL terminated array owned by @array
+ **/
+static gchar **
+pk_backend_spawn_strv_in_place (gchar *str, gchar delimiter, GPtrArray *array)
+{
+	gchar *tmp;
+
+	g_ptr_array_set_size (array, 0);
+
+	/* like g_strsplit(), an empty string has no sections */
+	if (str[0] != '\0') {
+		for (;;) {
+			g_ptr_array_add (array, str);
+			tmp = strchr (str, delimiter);
+			if (tmp == NULL)
+				break;
+			*tmp = '\0';
+			str = tmp + 1;
+		}
+	}
+	g_ptr_array_add (array, NULL);
+	return (gchar **) array->pdata;
+}
+
+/**
+ * pk_backend_spawn_parse_sections:
+ * @sections: the command and its arguments, which may be modified
+ * @size: the number of sections
+ * @validate: if the text needs checking for valid UTF-8
  **/
 static gboolean
-pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
-			       PkBackendJob *job,
-			       const gchar *line,
-			       GError **error)
+pk_backend_spawn_parse_sections (PkBackendSpawn *backend_spawn,
+				 PkBackendJob *job,
+				 gchar **sections,
+				 guint size,
+				 gboolean validate,
+				 GError **error)
 {
-	guint size;
-	gchar *command;
-	gchar *text;
+	gchar *command = sections[0];
 	guint64 speed;
 	guint64 download_size_remaining;
+	PkBackendSpawnCommand cmd;
 	PkInfoEnum info;
 	PkRestartEnum restart;
 	PkGroupEnum group;
@@ -165,26 +375,20 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 	PkMediaTypeEnum media_type_enum;
 	PkDistroUpgradeEnum distro_upgrade_enum;
 	PkBackendSpawnPrivate *priv = backend_spawn->priv;
-	g_auto(GStrv) sections = NULL;
-
-	g_return_val_if_fail (PK_IS_BACKEND_SPAWN (backend_spawn), FALSE);
 
-	/* check if output line */
-	if (line == NULL)
+	/* find the command */
+	cmd = pk_backend_spawn_command_from_string (command, strlen (command));
+	if (cmd == PK_BACKEND_SPAWN_COMMAND_UNKNOWN) {
+		g_set_error (error, 1, 0, "invalid command '%s'", command);
 		return FALSE;
+	}
+	if (size != pk_backend_spawn_commands[cmd].size) {
+		g_set_error (error, 1, 0, "invalid command '%s', size %i", command, size);
+		return FALSE;
+	}
 
-	/* split by tab */
-	sections = g_strsplit (line, "\t", 0);
-	command = sections[0];
-
-	/* get size */
-	size = g_strv_length (sections);
-
-	if (g_strcmp0 (command, "package") == 0) {
-		if (size != 4) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+	switch (cmd) {
+	case PK_BACKEND_SPAWN_COMMAND_PACKAGE:
 		if (pk_package_id_check (sections[2]) == FALSE) {
 			g_set_error_literal (error, 1, 0, "invalid package_id");
 			return FALSE;
@@ -195,20 +399,15 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			return FALSE;
 		}
 		g_strdelimit (sections[3], PK_UNSAFE_DELIMITERS, ' ');
-		if (!g_utf8_validate (sections[3], -1, NULL)) {
+		if (validate && !g_utf8_validate (sections[3], -1, NULL)) {
 			g_set_error (error, 1, 0,
 				     "text '%s' was not valid UTF8!",
 				     sections[3]);
 			return FALSE;
 		}
 		pk_backend_job_package (job, info, sections[2], sections[3]);
-	} else if (g_strcmp0 (command, "details") == 0) {
-		if (size != 8) {
-			g_set_error (error, 1, 0,
-				     "invalid command'%s', size %i",
-				     command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_DETAILS:
 		group = pk_group_enum_from_string (sections[4]);
 
 		/* ITS4: ignore, checked for overflow */
@@ -219,44 +418,32 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			return FALSE;
 		}
 		g_strdelimit (sections[5], PK_UNSAFE_DELIMITERS, ' ');
-		if (!g_utf8_validate (sections[4], -1, NULL)) {
+		if (validate && !g_utf8_validate (sections[5], -1, NULL)) {
 			g_set_error (error, 1, 0,
 				     "text '%s' was not valid UTF8!",
 				     sections[5]);
 			return FALSE;
 		}
-		text = g_strdup (sections[5]);
 		/* convert ; to \n as we can't emit them on stdout */
-		g_strdelimit (text, ";", '\n');
+		g_strdelimit (sections[5], ";", '\n');
 		pk_backend_job_details (job, sections[1], sections[2], sections[3],
-					group, text, sections[6], package_size);
-		g_free (text);
-	} else if (g_strcmp0 (command, "finished") == 0) {
-		if (size != 1) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+					group, sections[5], sections[6], package_size);
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_FINISHED:
 		pk_backend_job_finished (job);
 		priv->is_busy = FALSE;
 
 		/* from this point on, we can start the kill timer */
 		pk_backend_spawn_start_kill_timer (backend_spawn);
-
-	} else if (g_strcmp0 (command, "files") == 0) {
-		g_auto(GStrv) tmp = NULL;
-		if (size != 3) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
-		tmp = g_strsplit (sections[2], ";", -1);
-		pk_backend_job_files (job, sections[1], tmp);
-	} else if (g_strcmp0 (command, "repo-detail") == 0) {
-		if (size != 4) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_FILES:
+		pk_backend_job_files (job, sections[1],
+				      pk_backend_spawn_strv_in_place (sections[2], ';',
+								      priv->strv_buf[0]));
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_REPO_DETAIL:
 		g_strdelimit (sections[2], PK_UNSAFE_DELIMITERS, ' ');
-		if (!g_utf8_validate (sections[2], -1, NULL)) {
+		if (validate && !g_utf8_validate (sections[2], -1, NULL)) {
 			g_set_error (error, 1, 0,
 				     "text '%s' was not valid UTF8!",
 				     sections[2]);
@@ -270,23 +457,15 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			g_set_error (error, 1, 0, "invalid qualifier '%s'", sections[3]);
 			return FALSE;
 		}
-	} else if (g_strcmp0 (command, "updatedetail") == 0) {
-		g_auto(GStrv) updates = NULL;
-		g_auto(GStrv) obsoletes = NULL;
-		g_auto(GStrv) vendor_urls = NULL;
-		g_auto(GStrv) bugzilla_urls = NULL;
-		g_auto(GStrv) cve_urls = NULL;
-		if (size != 13) {
-			g_set_error (error, 1, 0, "invalid command '%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_UPDATEDETAIL:
 		restart = pk_restart_enum_from_string (sections[7]);
 		if (restart == PK_RESTART_ENUM_UNKNOWN) {
 			g_set_error (error, 1, 0, "Restart enum not recognised, and hence ignored: '%s'", sections[7]);
 			return FALSE;
 		}
 		g_strdelimit (sections[12], PK_UNSAFE_DELIMITERS, ' ');
-		if (!g_utf8_validate (sections[12], -1, NULL)) {
+		if (validate && !g_utf8_validate (sections[12], -1, NULL)) {
 			g_set_error (error, 1, 0,
 				     "text '%s' was not valid UTF8!",
 				     sections[12]);
@@ -296,29 +475,21 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 		/* convert ; to \n as we can't emit them on stdout */
 		g_strdelimit (sections[8], ";", '\n');
 		g_strdelimit (sections[9], ";", '\n');
-		updates = g_strsplit (sections[2], "&", -1);
-		obsoletes = g_strsplit (sections[3], "&", -1);
-		vendor_urls = g_strsplit (sections[4], ";", -1);
-		bugzilla_urls = g_strsplit (sections[5], ";", -1);
-		cve_urls = g_strsplit (sections[6], ";", -1);
 		pk_backend_job_update_detail (job,
 					  sections[1],
-					  updates,
-					  obsoletes,
-					  vendor_urls,
-					  bugzilla_urls,
-					  cve_urls,
+					  pk_backend_spawn_strv_in_place (sections[2], '&', priv->strv_buf[0]),
+					  pk_backend_spawn_strv_in_place (sections[3], '&', priv->strv_buf[1]),
+					  pk_backend_spawn_strv_in_place (sections[4], ';', priv->strv_buf[2]),
+					  pk_backend_spawn_strv_in_place (sections[5], ';', priv->strv_buf[3]),
+					  pk_backend_spawn_strv_in_place (sections[6], ';', priv->strv_buf[4]),
 					  restart,
 					  sections[8],
 					  sections[9],
 					  update_state_enum,
 					  sections[11],
 					  sections[12]);
-	} else if (g_strcmp0 (command, "percentage") == 0) {
-		if (size != 2) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_PERCENTAGE:
 		if (!pk_strtoint (sections[1], &percentage)) {
 			g_set_error (error, 1, 0, "invalid percentage value %s", sections[1]);
 			return FALSE;
@@ -328,11 +499,8 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 		} else {
 			pk_backend_job_set_percentage (job, percentage);
 		}
-	} else if (g_strcmp0 (command, "item-progress") == 0) {
-		if (size != 4) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_ITEM_PROGRESS:
 		if (!pk_package_id_check (sections[1])) {
 			g_set_error (error, 1, 0, "invalid package_id");
 			return FALSE;
@@ -354,32 +522,23 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 						  sections[1],
 						  status_enum,
 						  percentage);
-	} else if (g_strcmp0 (command, "error") == 0) {
-		if (size != 3) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_ERROR:
 		error_enum = pk_error_enum_from_string (sections[1]);
 		if (error_enum == PK_ERROR_ENUM_UNKNOWN) {
 			g_set_error (error, 1, 0, "Error enum not recognised, and hence ignored: '%s'", sections[1]);
 			return FALSE;
 		}
-		/* convert back all the ;'s to newlines */
-		text = g_strdup (sections[2]);
 
 		/* convert ; to \n as we can't emit them on stdout */
-		g_strdelimit (text, ";", '\n');
+		g_strdelimit (sections[2], ";", '\n');
 
 		/* convert % else we try to format them */
-		g_strdelimit (text, "%", '$');
+		g_strdelimit (sections[2], "%", '$');
 
-		pk_backend_job_error_code (job, error_enum, "%s", text);
-		g_free (text);
-	} else if (g_strcmp0 (command, "requirerestart") == 0) {
-		if (size != 3) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		pk_backend_job_error_code (job, error_enum, "%s", sections[2]);
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_REQUIRERESTART:
 		restart_enum = pk_restart_enum_from_string (sections[1]);
 		if (restart_enum == PK_RESTART_ENUM_UNKNOWN) {
 			g_set_error (error, 1, 0, "Restart enum not recognised, and hence ignored: '%s'", sections[1]);
@@ -390,22 +549,16 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			return FALSE;
 		}
 		pk_backend_job_require_restart (job, restart_enum, sections[2]);
-	} else if (g_strcmp0 (command, "status") == 0) {
-		if (size != 2) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_STATUS:
 		status_enum = pk_status_enum_from_string (sections[1]);
 		if (status_enum == PK_STATUS_ENUM_UNKNOWN) {
 			g_set_error (error, 1, 0, "Status enum not recognised, and hence ignored: '%s'", sections[1]);
 			return FALSE;
 		}
 		pk_backend_job_set_status (job, status_enum);
-	} else if (g_strcmp0 (command, "speed") == 0) {
-		if (size != 2) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_SPEED:
 		if (!pk_strtouint64 (sections[1], &speed)) {
 			g_set_error (error, 1, 0,
 				     "failed to parse speed: '%s'",
@@ -413,11 +566,8 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			return FALSE;
 		}
 		pk_backend_job_set_speed (job, speed);
-	} else if (g_strcmp0 (command, "download-size-remaining") == 0) {
-		if (size != 2) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_DOWNLOAD_SIZE_REMAINING:
 		if (!pk_strtouint64 (sections[1], &download_size_remaining)) {
 			g_set_error (error, 1, 0,
 				     "failed to parse download_size_remaining: '%s'",
@@ -425,11 +575,8 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			return FALSE;
 		}
 		pk_backend_job_set_download_size_remaining (job, download_size_remaining);
-	} else if (g_strcmp0 (command, "allow-cancel") == 0) {
-		if (size != 2) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_ALLOW_CANCEL:
 		if (g_strcmp0 (sections[1], "true") == 0) {
 			pk_backend_job_set_allow_cancel (job, TRUE);
 		} else if (g_strcmp0 (sections[1], "false") == 0) {
@@ -438,19 +585,11 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			g_set_error (error, 1, 0, "invalid section '%s'", sections[1]);
 			return FALSE;
 		}
-	} else if (g_strcmp0 (command, "no-percentage-updates") == 0) {
-		if (size != 1) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_NO_PERCENTAGE_UPDATES:
 		pk_backend_job_set_percentage (job, PK_BACKEND_PERCENTAGE_INVALID);
-	} else if (g_strcmp0 (command, "repo-signature-required") == 0) {
-
-		if (size != 9) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
-
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_REPO_SIGNATURE_REQUIRED:
 		sig_type = pk_sig_type_enum_from_string (sections[8]);
 		if (sig_type == PK_SIGTYPE_ENUM_UNKNOWN) {
 			g_set_error (error, 1, 0, "Sig enum not recognised, and hence ignored: '%s'", sections[8]);
@@ -469,13 +608,8 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 		pk_backend_job_repo_signature_required (job, sections[1],
 							  sections[2], sections[3], sections[4],
 							  sections[5], sections[6], sections[7], sig_type);
-	} else if (g_strcmp0 (command, "eula-required") == 0) {
-
-		if (size != 5) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
-
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_EULA_REQUIRED:
 		if (pk_strzero (sections[1])) {
 			g_set_error (error, 1, 0, "eula_id blank, and hence ignored: '%s'", sections[1]);
 			return FALSE;
@@ -492,13 +626,8 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 		}
 
 		pk_backend_job_eula_required (job, sections[1], sections[2], sections[3], sections[4]);
-	} else if (g_strcmp0 (command, "media-change-required") == 0) {
-
-		if (size != 4) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
-
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_MEDIA_CHANGE_REQUIRED:
 		media_type_enum = pk_media_type_enum_from_string (sections[1]);
 		if (media_type_enum == PK_MEDIA_TYPE_ENUM_UNKNOWN) {
 			g_set_error (error, 1, 0, "media type enum not recognised, and hence ignored: '%s'", sections[1]);
@@ -506,20 +635,15 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 		}
 
 		pk_backend_job_media_change_required (job, media_type_enum, sections[2], sections[3]);
-	} else if (g_strcmp0 (command, "distro-upgrade") == 0) {
-
-		if (size != 4) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
-			return FALSE;
-		}
-
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_DISTRO_UPGRADE:
 		distro_upgrade_enum = pk_distro_upgrade_enum_from_string (sections[1]);
 		if (distro_upgrade_enum == PK_DISTRO_UPGRADE_ENUM_UNKNOWN) {
 			g_set_error (error, 1, 0, "distro upgrade enum not recognised, and hence ignored: '%s'", sections[1]);
 			return FALSE;
 		}
 		g_strdelimit (sections[3], PK_UNSAFE_DELIMITERS, ' ');
-		if (!g_utf8_validate (sections[3], -1, NULL)) {
+		if (validate && !g_utf8_validate (sections[3], -1, NULL)) {
 			g_set_error (error, 1, 0,
 				     "text '%s' was not valid UTF8!",
 				     sections[3]);
@@ -527,12 +651,16 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 		}
 
 		pk_backend_job_distro_upgrade (job, distro_upgrade_enum, sections[2], sections[3]);
-	} else if (g_strcmp0 (command, "category") == 0) {
-
-		if (size != 6) {
-			g_set_error (error, 1, 0, "invalid command'%s', size %i", command, size);
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_FRAMING:
+		if (g_strcmp0 (sections[1], "gvariant") == 0) {
+			pk_spawn_set_framing (priv->spawn, PK_SPAWN_FRAMING_GVARIANT);
+		} else {
+			g_set_error (error, 1, 0, "invalid framing '%s'", sections[1]);
 			return FALSE;
 		}
+		break;
+	case PK_BACKEND_SPAWN_COMMAND_CATEGORY:
 		if (g_strcmp0 (sections[1], sections[2]) == 0) {
 			g_set_error_literal (error, 1, 0, "cat_id cannot be the same as parent_id");
 			return FALSE;
@@ -546,7 +674,7 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			return FALSE;
 		}
 		g_strdelimit (sections[4], PK_UNSAFE_DELIMITERS, ' ');
-		if (!g_utf8_validate (sections[4], -1, NULL)) {
+		if (validate && !g_utf8_validate (sections[4], -1, NULL)) {
 			g_set_error (error, 1, 0,
 				     "text '%s' was not valid UTF8!",
 				     sections[4]);
@@ -561,13 +689,80 @@ pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
 			return FALSE;
 		}
 		pk_backend_job_category (job, sections[1], sections[2], sections[3], sections[4], sections[5]);
-	} else {
-		g_set_error (error, 1, 0, "invalid command '%s'", command);
-		return FALSE;
+		break;
+	default:
+		g_assert_not_reached ();
 	}
 	return TRUE;
 }
 
+/**
+ * pk_backend_spawn_parse_stdout:
+ * @line: the line to parse, which is split in place
+ **/
+static gboolean
+pk_backend_spawn_parse_stdout (PkBackendSpawn *backend_spawn,
+			       PkBackendJob *job,
+			       gchar *line,
+			       GError **error)
+{
+	guint size;
+	gchar *sections[PK_BACKEND_SPAWN_SECTIONS_MAX + 1];
+
+	g_return_val_if_fail (PK_IS_BACKEND_SPAWN (backend_spawn), FALSE);
+
+	/* check if output line */
+	if (line == NULL)
+		return FALSE;
+
+	size = pk_backend_spawn_split_in_place (line,
+						sections,
+						PK_BACKEND_SPAWN_SECTIONS_MAX);
+	return pk_backend_spawn_parse_sections (backend_spawn, job,
+						sections, size, TRUE, error);
+}
+
+/**
+ * pk_backend_spawn_parse_frame:
+ *
+ * Parses a record sent with the binary framing, which needs no splitting
+ * on tabs and has already been checked for valid UTF-8 by GVariant.
+ **/
+static gboolean
+pk_backend_spawn_parse_frame (PkBackendSpawn *backend_spawn,
+			      PkBackendJob *job,
+			      GVariant *frame,
+			      GError **error)
+{
+	const gchar *command;
+	gsize offsets[PK_BACKEND_SPAWN_SECTIONS_MAX];
+	guint i;
+	guint size;
+	GString *buf = backend_spawn->priv->line_buf;
+	gchar *sections[PK_BACKEND_SPAWN_SECTIONS_MAX + 1];
+	g_autofree const gchar **args = NULL;
+
+	g_variant_get (frame, "(&s^a&s)", &command, &args);
+	size = g_strv_length ((gchar **) args) + 1;
+	if (size > PK_BACKEND_SPAWN_SECTIONS_MAX) {
+		g_set_error (error, 1, 0, "invalid command '%s', size %i", command, size);
+		return FALSE;
+	}
+
+	/* the sections may be modified, so copy them into our own buffer */
+	g_string_truncate (buf, 0);
+	for (i = 0; i < size; i++) {
+		offsets[i] = buf->len;
+		g_string_append (buf, i == 0 ? command : args[i - 1]);
+		g_string_append_c (buf, '\0');
+	}
+	for (i = 0; i < size; i++)
+		sections[i] = buf->str + offsets[i];
+	sections[size] = NULL;
+	return pk_backend_spawn_parse_sections (backend_spawn, job,
+						sections, size, FALSE, error);
+}
+
 /**
  * pk_backend_spawn_exit_cb:
  **/
@@ -624,7 +819,15 @@ pk_backend_spawn_inject_data (PkBackendSpawn *backend_spawn,
 			return TRUE;
 	}
 
-	return pk_backend_spawn_parse_stdout (backend_spawn, job, line, error);
+	/* check if output line */
+	if (line == NULL)
+		return FALSE;
+
+	/* the caller owns the line, so split our own copy */
+	g_string_assign (backend_spawn->priv->line_buf, line);
+	return pk_backend_spawn_parse_stdout (backend_spawn, job,
+					      backend_spawn->priv->line_buf->str,
+					      error);
 }
 
 /**
@@ -634,13 +837,40 @@ static void
 pk_backend_spawn_stdout_cb (PkBackendSpawn *spawn, const gchar *line, PkBackendSpawn *backend_spawn)
 {
 	gboolean ret;
+	gchar copy[PK_BACKEND_SPAWN_LINE_LOGGED];
 	g_autoptr(GError) error = NULL;
-	ret = pk_backend_spawn_inject_data (backend_spawn,
+
+	/* do we ignore with a filter func ? */
+	if (backend_spawn->priv->stdout_func != NULL) {
+		if (!backend_spawn->priv->stdout_func (backend_spawn->priv->job, line))
+			return;
+	}
+
+	/* the line is in the PkSpawn read buffer, which may be modified, and
+	 * is split in place, so keep the start of it for the warning */
+	g_strlcpy (copy, line, sizeof (copy));
+	ret = pk_backend_spawn_parse_stdout (backend_spawn,
+					     backend_spawn->priv->job,
+					     (gchar *) line,
+					     &error);
+	if (!ret)
+		g_warning ("failed to parse %s: %s", copy, error->message);
+}
+
+/**
+ * pk_backend_spawn_stdout_frame_cb:
+ **/
+static void
+pk_backend_spawn_stdout_frame_cb (PkSpawn *spawn, GVariant *frame, PkBackendSpawn *backend_spawn)
+{
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+	ret = pk_backend_spawn_parse_frame (backend_spawn,
 					    backend_spawn->priv->job,
-					    line,
+					    frame,
 					    &error);
 	if (!ret)
-		g_warning ("failed to parse: %s: %s", line, error->message);
+		g_warning ("failed to parse frame: %s", error->message);
 }
 
 /**
@@ -787,6 +1017,10 @@ pk_backend_spawn_get_envp (PkBackendSpawn *backend_spawn)
 			      g_strdup ("UID"),
 			      g_strdup_printf ("%u", pk_backend_job_get_uid (priv->job)));
 
+	/* offer binary framing, unless the output has to be filtered as text */
+	if (priv->stdout_func == NULL)
+		g_hash_table_replace (env_table, g_strdup ("FRAMING"), g_strdup ("gvariant"));
+
 	/* CACHE_AGE */
 	cache_age = pk_backend_job_get_cache_age (priv->job);
 	if (cache_age == G_MAXUINT) {
@@ -1070,6 +1304,7 @@ pk_backend_spawn_set_allow_sigkill (PkBackendSpawn *backend_spawn, gboolean allo
 static void
 pk_backend_spawn_finalize (GObject *object)
 {
+	guint i;
 	PkBackendSpawn *backend_spawn;
 
 	g_return_if_fail (PK_IS_BACKEND_SPAWN (object));
@@ -1080,6 +1315,9 @@ pk_backend_spawn_finalize (GObject *object)
 		g_source_remove (backend_spawn->priv->kill_id);
 
 	g_free (backend_spawn->priv->name);
+	g_string_free (backend_spawn->priv->line_buf, TRUE);
+	for (i = 0; i < G_N_ELEMENTS (backend_spawn->priv->strv_buf); i++)
+		g_ptr_array_unref (backend_spawn->priv->strv_buf[i]);
 	g_key_file_unref (backend_spawn->priv->conf);
 	g_object_unref (backend_spawn->priv->spawn);
 	if (backend_spawn->priv->backend != NULL)
@@ -1105,7 +1343,12 @@ pk_backend_spawn_class_init (PkBackendSpawnClass *klass)
 static void
 pk_backend_spawn_init (PkBackendSpawn *backend_spawn)
 {
+	guint i;
+
 	backend_spawn->priv = PK_BACKEND_SPAWN_GET_PRIVATE (backend_spawn);
+	backend_spawn->priv->line_buf = g_string_new (NULL);
+	for (i = 0; i < G_N_ELEMENTS (backend_spawn->priv->strv_buf); i++)
+		backend_spawn->priv->strv_buf[i] = g_ptr_array_new ();
 }
 
 /**
@@ -1122,6 +1365,8 @@ pk_backend_spawn_new (GKeyFile *conf)
 			  G_CALLBACK (pk_backend_spawn_exit_cb), backend_spawn);
 	g_signal_connect (backend_spawn->priv->spawn, "stdout",
 			  G_CALLBACK (pk_backend_spawn_stdout_cb), backend_spawn);
+	g_signal_connect (backend_spawn->priv->spawn, "stdout-frame",
+			  G_CALLBACK (pk_backend_spawn_stdout_frame_cb), backend_spawn);
 	g_signal_connect (backend_spawn->priv->spawn, "stderr",
 			  G_CALLBACK (pk_backend_spawn_stderr_cb), backend_spawn);
 	return PK_BACKEND_SPAWN (backend_spawn);
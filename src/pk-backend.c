@@ -26,6 +26,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include <glib/gi18n.h>
 #include <glib.h>
@@ -37,6 +40,7 @@
 
 #include "pk-backend.h"
 #include "pk-shared.h"
+#include "pk-statistics.h"
 
 #define PK_BACKEND_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), PK_TYPE_BACKEND, PkBackendPrivate))
 
@@ -48,6 +52,15 @@
  */
 #define PK_BACKEND_PERCENTAGE_DEFAULT		102
 
+/**
+ * PK_BACKEND_THREADS_DEFAULT:
+ *
+ * The default number of idle worker threads kept for backend jobs, and
+ * the number of threads for background backend jobs respectively.
+ */
+#define PK_BACKEND_THREADS_DEFAULT		4
+#define PK_BACKEND_BACKGROUND_THREADS_DEFAULT	1
+
 /**
  * PkBackendDesc:
  */
@@ -63,6 +76,7 @@ typedef struct {
 	PkBitfield	(*get_provides)			(PkBackend	*backend);
 	gchar		**(*get_mime_types)		(PkBackend	*backend);
 	gboolean	(*supports_parallelization)	(PkBackend	*backend);
+	PkBitfield	(*get_shared_roles)		(PkBackend	*backend);
 	void		(*job_start)			(PkBackend	*backend,
 							 PkBackendJob	*job);
 	void		(*job_stop)			(PkBackend	*backend,
@@ -202,6 +216,12 @@ struct PkBackendPrivate
 	gpointer		 user_data;
 	GHashTable		*thread_hash;
 	GMutex			 thread_hash_mutex;
+	PkStatistics		*statistics;
+	GThreadPool		*thread_pool;
+	GThreadPool		*thread_pool_background;
+	GMutex			 thread_pool_mutex;
+	guint			 thread_pool_queued[PK_ROLE_ENUM_LAST];
+	guint			 thread_pool_running[PK_ROLE_ENUM_LAST];
 	gboolean		 transaction_in_progress;
 	guint			 transaction_inhibit_end_idle_id;
 	guint			 repo_list_changed_id;
@@ -214,6 +234,7 @@ G_DEFINE_TYPE (PkBackend, pk_backend, G_TYPE_OBJECT)
 enum {
 	SIGNAL_REPO_LIST_CHANGED,
 	SIGNAL_UPDATES_CHANGED,
+	SIGNAL_INSTALLED_CHANGED,
 	SIGNAL_LAST
 };
 
@@ -267,6 +288,82 @@ pk_backend_supports_parallelization (PkBackend	*backend)
 	return backend->priv->desc->supports_parallelization (backend);
 }
 
+/**
+ * pk_backend_get_shared_roles:
+ **/
+PkBitfield
+pk_backend_get_shared_roles (PkBackend *backend)
+{
+	g_return_val_if_fail (PK_IS_BACKEND (backend), 0);
+
+	/* not compulsory */
+	if (backend->priv->desc->get_shared_roles == NULL)
+		return 0;
+	return backend->priv->desc->get_shared_roles (backend);
+}
+
+/**
+ * pk_backend_role_is_reader:
+ *
+ * Return value: %TRUE if @role only reads the package database.
+ **/
+static gboolean
+pk_backend_role_is_reader (PkRoleEnum role)
+{
+	switch (role) {
+	case PK_ROLE_ENUM_DEPENDS_ON:
+	case PK_ROLE_ENUM_GET_CATEGORIES:
+	case PK_ROLE_ENUM_GET_DETAILS:
+	case PK_ROLE_ENUM_GET_DETAILS_LOCAL:
+	case PK_ROLE_ENUM_GET_DISTRO_UPGRADES:
+	case PK_ROLE_ENUM_GET_FILES:
+	case PK_ROLE_ENUM_GET_FILES_LOCAL:
+	case PK_ROLE_ENUM_GET_PACKAGES:
+	case PK_ROLE_ENUM_GET_REPO_LIST:
+	case PK_ROLE_ENUM_GET_UPDATE_DETAIL:
+	case PK_ROLE_ENUM_GET_UPDATES:
+	case PK_ROLE_ENUM_REQUIRED_BY:
+	case PK_ROLE_ENUM_RESOLVE:
+	case PK_ROLE_ENUM_SEARCH_DETAILS:
+	case PK_ROLE_ENUM_SEARCH_FILE:
+	case PK_ROLE_ENUM_SEARCH_GROUP:
+	case PK_ROLE_ENUM_SEARCH_NAME:
+	case PK_ROLE_ENUM_WHAT_PROVIDES:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * pk_backend_supports_shared_role:
+ *
+ * Backends that cannot run arbitrary jobs in parallel can still list the
+ * read-only roles they are able to answer from an immutable snapshot of
+ * the package database in pk_backend_get_shared_roles(). Jobs with such
+ * roles do not take the exclusive lock, and so can run alongside each
+ * other and alongside the one exclusive job.
+ *
+ * Return value: %TRUE if a job with @role does not need to be exclusive.
+ **/
+gboolean
+pk_backend_supports_shared_role (PkBackend *backend, PkRoleEnum role)
+{
+	PkBitfield roles;
+
+	g_return_val_if_fail (PK_IS_BACKEND (backend), FALSE);
+
+	if (pk_backend_supports_parallelization (backend))
+		return TRUE;
+
+	/* writers are always exclusive */
+	if (!pk_backend_role_is_reader (role))
+		return FALSE;
+
+	roles = pk_backend_get_shared_roles (backend);
+	return pk_bitfield_contain (roles, role);
+}
+
 /**
  * pk_backend_thread_start:
  **/
@@ -287,9 +384,12 @@ pk_backend_thread_start (PkBackend *backend, PkBackendJob *job, gpointer func)
 
 	ret = g_mutex_trylock (mutex);
 	if (!ret) {
+		gint64 waiting = g_get_monotonic_time ();
 		pk_backend_job_set_status (job,
 					   PK_STATUS_ENUM_WAITING_FOR_LOCK);
 		g_mutex_lock (mutex);
+		pk_statistics_add_lock_wait (backend->priv->statistics,
+					     (g_get_monotonic_time () - waiting) / 1000);
 	}
 }
 
@@ -305,6 +405,188 @@ pk_backend_thread_stop (PkBackend *backend, PkBackendJob *job, gpointer func)
 	g_mutex_unlock (mutex);
 }
 
+/* a job waiting for a worker thread */
+typedef struct {
+	PkBackendJob		*job;
+	PkRoleEnum		 role;
+	GFunc			 func;
+	gpointer		 user_data;
+} PkBackendThreadPoolItem;
+
+/**
+ * pk_backend_thread_pool_run:
+ **/
+static void
+pk_backend_thread_pool_run (PkBackend *backend,
+			    PkBackendThreadPoolItem *item)
+{
+#ifdef __linux__
+	/* the pool names its threads after the program */
+	prctl (PR_SET_NAME, "PK-Backend", 0, 0, 0);
+#endif
+	g_mutex_lock (&backend->priv->thread_pool_mutex);
+	backend->priv->thread_pool_queued[item->role]--;
+	backend->priv->thread_pool_running[item->role]++;
+	g_mutex_unlock (&backend->priv->thread_pool_mutex);
+
+	item->func (item->job, item->user_data);
+
+	g_mutex_lock (&backend->priv->thread_pool_mutex);
+	backend->priv->thread_pool_running[item->role]--;
+	g_mutex_unlock (&backend->priv->thread_pool_mutex);
+	g_free (item);
+}
+
+/**
+ * pk_backend_thread_pool_cb:
+ **/
+static void
+pk_backend_thread_pool_cb (gpointer data, gpointer user_data)
+{
+	pk_backend_thread_pool_run (PK_BACKEND (user_data),
+				    (PkBackendThreadPoolItem *) data);
+}
+
+/**
+ * pk_backend_thread_pool_background_cb:
+ **/
+static void
+pk_backend_thread_pool_background_cb (gpointer data, gpointer user_data)
+{
+	/* this pool is exclusive, so this only affects background jobs */
+#ifdef PK_BUILD_DAEMON
+	pk_ioprio_set_idle (0);
+#endif
+	pk_backend_thread_pool_run (PK_BACKEND (user_data),
+				    (PkBackendThreadPoolItem *) data);
+}
+
+/**
+ * pk_backend_thread_pool_get_size:
+ **/
+static gint
+pk_backend_thread_pool_get_size (PkBackend *backend,
+				 const gchar *key,
+				 gint default_size)
+{
+	gint size;
+	size = g_key_file_get_integer (backend->priv->conf, "Daemon", key, NULL);
+	if (size <= 0)
+		return default_size;
+	return size;
+}
+
+/**
+ * pk_backend_thread_pool_push:
+ * @func: (scope async): the function to run with the job and @user_data
+ *
+ * Runs @func in one of the backend worker threads, re-using threads
+ * between jobs rather than creating a new thread each time.
+ * Background jobs are run in a separate lower priority set of threads
+ * so that they cannot delay jobs that the user is waiting for.
+ *
+ * The scheduler has already marked the job as running, so a foreground
+ * job always gets a thread straight away; it must never wait behind
+ * jobs that are themselves waiting for the lock of their function.
+ **/
+gboolean
+pk_backend_thread_pool_push (PkBackend *backend,
+			     PkBackendJob *job,
+			     GFunc func,
+			     gpointer user_data,
+			     GError **error)
+{
+	GThreadPool **pool;
+	PkBackendThreadPoolItem *item;
+	gboolean background;
+
+	g_return_val_if_fail (PK_IS_BACKEND (backend), FALSE);
+	g_return_val_if_fail (pk_is_thread_default (), FALSE);
+
+	/* create the lane on demand */
+	background = pk_backend_job_get_background (job);
+	pool = background ? &backend->priv->thread_pool_background :
+			    &backend->priv->thread_pool;
+	if (*pool == NULL) {
+		gint size;
+		if (background) {
+			size = pk_backend_thread_pool_get_size (backend,
+								"BackendBackgroundThreads",
+								PK_BACKEND_BACKGROUND_THREADS_DEFAULT);
+			*pool = g_thread_pool_new (pk_backend_thread_pool_background_cb,
+						   backend, size, TRUE, error);
+		} else {
+			size = pk_backend_thread_pool_get_size (backend,
+								"BackendThreads",
+								PK_BACKEND_THREADS_DEFAULT);
+			*pool = g_thread_pool_new (pk_backend_thread_pool_cb,
+						   backend, -1, FALSE, error);
+			g_thread_pool_set_max_unused_threads (size);
+		}
+		if (*pool == NULL)
+			return FALSE;
+		g_debug ("created %s thread pool, keeping %i threads",
+			 background ? "background" : "foreground", size);
+	}
+
+	item = g_new0 (PkBackendThreadPoolItem, 1);
+	item->job = job;
+	item->role = pk_backend_job_get_role (job);
+	item->func = func;
+	item->user_data = user_data;
+
+	g_mutex_lock (&backend->priv->thread_pool_mutex);
+	backend->priv->thread_pool_queued[item->role]++;
+	g_debug ("queued %s job, %u queued and %u running with this role",
+		 pk_role_enum_to_string (item->role),
+		 backend->priv->thread_pool_queued[item->role],
+		 backend->priv->thread_pool_running[item->role]);
+	g_mutex_unlock (&backend->priv->thread_pool_mutex);
+
+	if (!g_thread_pool_push (*pool, item, error)) {
+		g_mutex_lock (&backend->priv->thread_pool_mutex);
+		backend->priv->thread_pool_queued[item->role]--;
+		g_mutex_unlock (&backend->priv->thread_pool_mutex);
+		g_free (item);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * pk_backend_get_thread_pool_queued:
+ *
+ * Return value: the number of jobs with @role waiting for a worker thread
+ **/
+guint
+pk_backend_get_thread_pool_queued (PkBackend *backend, PkRoleEnum role)
+{
+	guint queued;
+	g_return_val_if_fail (PK_IS_BACKEND (backend), 0);
+	g_return_val_if_fail (role < PK_ROLE_ENUM_LAST, 0);
+	g_mutex_lock (&backend->priv->thread_pool_mutex);
+	queued = backend->priv->thread_pool_queued[role];
+	g_mutex_unlock (&backend->priv->thread_pool_mutex);
+	return queued;
+}
+
+/**
+ * pk_backend_get_thread_pool_running:
+ *
+ * Return value: the number of jobs with @role running in a worker thread
+ **/
+guint
+pk_backend_get_thread_pool_running (PkBackend *backend, PkRoleEnum role)
+{
+	guint running;
+	g_return_val_if_fail (PK_IS_BACKEND (backend), 0);
+	g_return_val_if_fail (role < PK_ROLE_ENUM_LAST, 0);
+	g_mutex_lock (&backend->priv->thread_pool_mutex);
+	running = backend->priv->thread_pool_running[role];
+	g_mutex_unlock (&backend->priv->thread_pool_mutex);
+	return running;
+}
+
 /**
  * pk_backend_get_filters:
  **/
@@ -544,6 +826,7 @@ pk_backend_load (PkBackend *backend, GError **error)
 		g_module_symbol (handle, "pk_backend_get_groups", (gpointer *)&desc->get_groups);
 		g_module_symbol (handle, "pk_backend_get_mime_types", (gpointer *)&desc->get_mime_types);
 		g_module_symbol (handle, "pk_backend_supports_parallelization", (gpointer *)&desc->supports_parallelization);
+		g_module_symbol (handle, "pk_backend_get_shared_roles", (gpointer *)&desc->get_shared_roles);
 		g_module_symbol (handle, "pk_backend_get_packages", (gpointer *)&desc->get_packages);
 		g_module_symbol (handle, "pk_backend_get_repo_list", (gpointer *)&desc->get_repo_list);
 		g_module_symbol (handle, "pk_backend_required_by", (gpointer *)&desc->required_by);
@@ -629,6 +912,17 @@ pk_backend_unload (PkBackend *backend)
 		g_warning ("not yet loaded backend, try pk_backend_load()");
 		return FALSE;
 	}
+
+	/* wait for any jobs still using the backend */
+	if (backend->priv->thread_pool != NULL) {
+		g_thread_pool_free (backend->priv->thread_pool, FALSE, TRUE);
+		backend->priv->thread_pool = NULL;
+	}
+	if (backend->priv->thread_pool_background != NULL) {
+		g_thread_pool_free (backend->priv->thread_pool_background, FALSE, TRUE);
+		backend->priv->thread_pool_background = NULL;
+	}
+
 	if (backend->priv->desc->destroy != NULL)
 		backend->priv->desc->destroy (backend);
 	backend->priv->loaded = FALSE;
@@ -734,6 +1028,7 @@ pk_backend_installed_db_changed_cb (gpointer user_data)
 			g_warning ("failed to invalidate: %s", error->message);
 	}
 	backend->priv->installed_db_changed_id = 0;
+	g_signal_emit (backend, signals [SIGNAL_INSTALLED_CHANGED], 0);
 	return FALSE;
 }
 
@@ -1171,6 +1466,12 @@ pk_backend_finalize (GObject *object)
 
 	g_mutex_clear (&backend->priv->thread_hash_mutex);
 	g_hash_table_unref (backend->priv->thread_hash);
+	if (backend->priv->thread_pool != NULL)
+		g_thread_pool_free (backend->priv->thread_pool, FALSE, TRUE);
+	if (backend->priv->thread_pool_background != NULL)
+		g_thread_pool_free (backend->priv->thread_pool_background, FALSE, TRUE);
+	g_mutex_clear (&backend->priv->thread_pool_mutex);
+	g_object_unref (backend->priv->statistics);
 	g_free (backend->priv->desc);
 
 	if (backend->priv->monitor != NULL)
@@ -1199,6 +1500,11 @@ pk_backend_class_init (PkBackendClass *klass)
 			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
 			      0, NULL, NULL, g_cclosure_marshal_VOID__VOID,
 			      G_TYPE_NONE, 0);
+	signals [SIGNAL_INSTALLED_CHANGED] =
+		g_signal_new ("installed-changed",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_VOID__VOID,
+			      G_TYPE_NONE, 0);
 	signals [SIGNAL_UPDATES_CHANGED] =
 		g_signal_new ("updates-changed",
 			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
@@ -1912,6 +2218,8 @@ pk_backend_init (PkBackend *backend)
 							    NULL,
 							    g_free);
 	g_mutex_init (&backend->priv->thread_hash_mutex);
+	backend->priv->statistics = pk_statistics_new ();
+	g_mutex_init (&backend->priv->thread_pool_mutex);
 }
 
 /**
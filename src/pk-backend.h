@@ -119,6 +119,9 @@ PkBitfield	 pk_backend_get_filters			(PkBackend	*backend);
 PkBitfield	 pk_backend_get_roles			(PkBackend	*backend);
 gchar		**pk_backend_get_mime_types		(PkBackend	*backend);
 gboolean	 pk_backend_supports_parallelization	(PkBackend	*backend);
+PkBitfield	 pk_backend_get_shared_roles		(PkBackend	*backend);
+gboolean	 pk_backend_supports_shared_role	(PkBackend	*backend,
+							 PkRoleEnum	 role);
 void		 pk_backend_initialize			(GKeyFile		*conf,
 							 PkBackend	*backend);
 void		 pk_backend_destroy			(PkBackend	*backend);
@@ -250,6 +253,15 @@ void		 pk_backend_thread_start		(PkBackend	*backend,
 void		 pk_backend_thread_stop			(PkBackend	*backend,
 							 PkBackendJob	*job,
 							 gpointer	 func);
+gboolean	 pk_backend_thread_pool_push		(PkBackend	*backend,
+							 PkBackendJob	*job,
+							 GFunc		 func,
+							 gpointer	 user_data,
+							 GError		**error);
+guint		 pk_backend_get_thread_pool_queued	(PkBackend	*backend,
+							 PkRoleEnum	 role);
+guint		 pk_backend_get_thread_pool_running	(PkBackend	*backend,
+							 PkRoleEnum	 role);
 
 /* global backend state */
 void		 pk_backend_accept_eula			(PkBackend	*backend,
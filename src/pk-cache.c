@@ -0,0 +1,294 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * The results of successful read-only transactions, so that a client
+ * polling GetUpdates or Resolve does not make the backend do the same
+ * work again when nothing has changed.
+ *
+ * Each entry is keyed on everything that can change the result, and the
+ * whole cache is dropped when the installed packages, the repo list or
+ * the update list changes. The generation number makes sure a transaction
+ * that was already running when this happened cannot add stale results.
+ * Entries also expire after a while, as the package manager can be used
+ * outside of PackageKit without the backend telling us.
+ **/
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "pk-cache.h"
+
+#define PK_CACHE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), PK_TYPE_CACHE, PkCachePrivate))
+
+struct PkCachePrivate
+{
+	GHashTable		*hash;		/* key:PkCacheItem */
+	GQueue			*lru;		/* of PkCacheItem, newest first */
+	guint			 max_size;
+	guint			 max_age;
+	guint			 generation;
+	PkCacheStats		 stats;
+};
+
+typedef struct {
+	gchar			*key;
+	PkResults		*results;
+	GList			*link;
+	gint64			 created;
+} PkCacheItem;
+
+static gpointer pk_cache_object = NULL;
+
+G_DEFINE_TYPE (PkCache, pk_cache, G_TYPE_OBJECT)
+
+/**
+ * pk_cache_item_free:
+ **/
+static void
+pk_cache_item_free (PkCacheItem *item)
+{
+	g_free (item->key);
+	g_object_unref (item->results);
+	g_free (item);
+}
+
+/**
+ * pk_cache_remove_item:
+ **/
+static void
+pk_cache_remove_item (PkCache *cache, PkCacheItem *item)
+{
+	g_queue_delete_link (cache->priv->lru, item->link);
+	g_hash_table_remove (cache->priv->hash, item->key);
+}
+
+/**
+ * pk_cache_set_max_size:
+ * @max_size: the number of results to keep, or 0 to disable the cache
+ **/
+void
+pk_cache_set_max_size (PkCache *cache, guint max_size)
+{
+	PkCacheItem *item;
+
+	g_return_if_fail (PK_IS_CACHE (cache));
+
+	cache->priv->max_size = max_size;
+	while (g_queue_get_length (cache->priv->lru) > max_size) {
+		item = g_queue_peek_tail (cache->priv->lru);
+		pk_cache_remove_item (cache, item);
+		cache->priv->stats.evictions++;
+	}
+}
+
+/**
+ * pk_cache_set_max_age:
+ * @max_age: the number of seconds results are reused for, or 0 for no limit
+ **/
+void
+pk_cache_set_max_age (PkCache *cache, guint max_age)
+{
+	g_return_if_fail (PK_IS_CACHE (cache));
+	cache->priv->max_age = max_age;
+}
+
+/**
+ * pk_cache_get_generation:
+ *
+ * Return value: a number that changes every time the cache is invalidated
+ **/
+guint
+pk_cache_get_generation (PkCache *cache)
+{
+	g_return_val_if_fail (PK_IS_CACHE (cache), 0);
+	return cache->priv->generation;
+}
+
+/**
+ * pk_cache_lookup:
+ *
+ * Return value: (transfer full): the results, or %NULL if not cached
+ **/
+PkResults *
+pk_cache_lookup (PkCache *cache, const gchar *key)
+{
+	PkCacheItem *item;
+
+	g_return_val_if_fail (PK_IS_CACHE (cache), NULL);
+	g_return_val_if_fail (key != NULL, NULL);
+
+	if (cache->priv->max_size == 0)
+		return NULL;
+
+	item = g_hash_table_lookup (cache->priv->hash, key);
+	if (item != NULL && cache->priv->max_age > 0 &&
+	    g_get_monotonic_time () - item->created > (gint64) cache->priv->max_age * G_USEC_PER_SEC) {
+		g_debug ("cached %s has expired", key);
+		pk_cache_remove_item (cache, item);
+		cache->priv->stats.evictions++;
+		item = NULL;
+	}
+	if (item == NULL) {
+		cache->priv->stats.misses++;
+		return NULL;
+	}
+	cache->priv->stats.hits++;
+
+	/* most recently used */
+	g_queue_unlink (cache->priv->lru, item->link);
+	g_queue_push_head_link (cache->priv->lru, item->link);
+	return g_object_ref (item->results);
+}
+
+/**
+ * pk_cache_insert:
+ * @generation: the value of pk_cache_get_generation() when the
+ * transaction was started
+ *
+ * Adds @results, dropping the least recently used entry if full.
+ **/
+void
+pk_cache_insert (PkCache *cache,
+		 const gchar *key,
+		 guint generation,
+		 PkResults *results)
+{
+	PkCacheItem *item;
+
+	g_return_if_fail (PK_IS_CACHE (cache));
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (PK_IS_RESULTS (results));
+
+	if (cache->priv->max_size == 0)
+		return;
+
+	/* something changed while the transaction was running */
+	if (generation != cache->priv->generation) {
+		g_debug ("not caching %s as invalidated", key);
+		return;
+	}
+
+	/* replace any old entry */
+	item = g_hash_table_lookup (cache->priv->hash, key);
+	if (item != NULL)
+		pk_cache_remove_item (cache, item);
+
+	item = g_new0 (PkCacheItem, 1);
+	item->key = g_strdup (key);
+	item->results = g_object_ref (results);
+	item->created = g_get_monotonic_time ();
+	g_queue_push_head (cache->priv->lru, item);
+	item->link = g_queue_peek_head_link (cache->priv->lru);
+	g_hash_table_insert (cache->priv->hash, item->key, item);
+
+	/* too big */
+	pk_cache_set_max_size (cache, cache->priv->max_size);
+}
+
+/**
+ * pk_cache_invalidate:
+ **/
+void
+pk_cache_invalidate (PkCache *cache, const gchar *reason)
+{
+	g_return_if_fail (PK_IS_CACHE (cache));
+
+	cache->priv->generation++;
+	if (g_hash_table_size (cache->priv->hash) == 0)
+		return;
+	g_debug ("invalidating %u cached results as %s",
+		 g_hash_table_size (cache->priv->hash), reason);
+	g_queue_clear (cache->priv->lru);
+	g_hash_table_remove_all (cache->priv->hash);
+	cache->priv->stats.invalidations++;
+}
+
+/**
+ * pk_cache_get_stats:
+ **/
+void
+pk_cache_get_stats (PkCache *cache, PkCacheStats *stats)
+{
+	g_return_if_fail (PK_IS_CACHE (cache));
+	g_return_if_fail (stats != NULL);
+
+	*stats = cache->priv->stats;
+	stats->size = g_hash_table_size (cache->priv->hash);
+	stats->max_size = cache->priv->max_size;
+}
+
+/**
+ * pk_cache_finalize:
+ **/
+static void
+pk_cache_finalize (GObject *object)
+{
+	PkCache *cache = PK_CACHE (object);
+
+	g_queue_free (cache->priv->lru);
+	g_hash_table_unref (cache->priv->hash);
+
+	G_OBJECT_CLASS (pk_cache_parent_class)->finalize (object);
+}
+
+/**
+ * pk_cache_class_init:
+ **/
+static void
+pk_cache_class_init (PkCacheClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = pk_cache_finalize;
+	g_type_class_add_private (klass, sizeof (PkCachePrivate));
+}
+
+/**
+ * pk_cache_init:
+ **/
+static void
+pk_cache_init (PkCache *cache)
+{
+	cache->priv = PK_CACHE_GET_PRIVATE (cache);
+	cache->priv->hash = g_hash_table_new_full (g_str_hash, g_str_equal,
+						   NULL, (GDestroyNotify) pk_cache_item_free);
+	cache->priv->lru = g_queue_new ();
+	cache->priv->max_size = PK_CACHE_SIZE_DEFAULT;
+	cache->priv->max_age = PK_CACHE_MAX_AGE_DEFAULT;
+}
+
+/**
+ * pk_cache_new:
+ *
+ * Return value: the shared cache instance
+ **/
+PkCache *
+pk_cache_new (void)
+{
+	if (pk_cache_object != NULL) {
+		g_object_ref (pk_cache_object);
+	} else {
+		pk_cache_object = g_object_new (PK_TYPE_CACHE, NULL);
+		g_object_add_weak_pointer (pk_cache_object, &pk_cache_object);
+	}
+	return PK_CACHE (pk_cache_object);
+}
@@ -0,0 +1,91 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __PK_CACHE_H
+#define __PK_CACHE_H
+
+#include <glib-object.h>
+#include <packagekit-glib2/pk-results.h>
+
+G_BEGIN_DECLS
+
+#define PK_TYPE_CACHE		(pk_cache_get_type ())
+#define PK_CACHE(o)		(G_TYPE_CHECK_INSTANCE_CAST ((o), PK_TYPE_CACHE, PkCache))
+#define PK_CACHE_CLASS(k)	(G_TYPE_CHECK_CLASS_CAST((k), PK_TYPE_CACHE, PkCacheClass))
+#define PK_IS_CACHE(o)		(G_TYPE_CHECK_INSTANCE_TYPE ((o), PK_TYPE_CACHE))
+#define PK_IS_CACHE_CLASS(k)	(G_TYPE_CHECK_CLASS_TYPE ((k), PK_TYPE_CACHE))
+#define PK_CACHE_GET_CLASS(o)	(G_TYPE_INSTANCE_GET_CLASS ((o), PK_TYPE_CACHE, PkCacheClass))
+
+/* off unless ResultsCacheSize is set, as the package database can be
+ * changed without the backend noticing */
+#define PK_CACHE_SIZE_DEFAULT	0
+
+/* how long results are reused when ResultsCacheMaxAge is not set */
+#define PK_CACHE_MAX_AGE_DEFAULT	60 /* s */
+
+typedef struct PkCachePrivate PkCachePrivate;
+
+typedef struct
+{
+	GObject			 parent;
+	PkCachePrivate		*priv;
+} PkCache;
+
+typedef struct
+{
+	GObjectClass		 parent_class;
+} PkCacheClass;
+
+typedef struct {
+	guint			 hits;
+	guint			 misses;
+	guint			 invalidations;
+	guint			 evictions;
+	guint			 size;
+	guint			 max_size;
+} PkCacheStats;
+
+#ifdef G_DEFINE_AUTOPTR_CLEANUP_FUNC
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PkCache, g_object_unref)
+#endif
+
+GType		 pk_cache_get_type		(void);
+PkCache		*pk_cache_new			(void);
+
+void		 pk_cache_set_max_size		(PkCache	*cache,
+						 guint		 max_size);
+void		 pk_cache_set_max_age		(PkCache	*cache,
+						 guint		 max_age);
+guint		 pk_cache_get_generation	(PkCache	*cache);
+PkResults	*pk_cache_lookup		(PkCache	*cache,
+						 const gchar	*key);
+void		 pk_cache_insert		(PkCache	*cache,
+						 const gchar	*key,
+						 guint		 generation,
+						 PkResults	*results);
+void		 pk_cache_invalidate		(PkCache	*cache,
+						 const gchar	*reason);
+void		 pk_cache_get_stats		(PkCache	*cache,
+						 PkCacheStats	*stats);
+
+G_END_DECLS
+
+#endif /* __PK_CACHE_H */
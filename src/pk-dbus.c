@@ -38,71 +38,98 @@
 struct PkDbusPrivate
 {
 	GDBusConnection		*connection;
-	GDBusProxy		*proxy_pid;
 	GDBusProxy		*proxy_uid;
 	GDBusProxy		*proxy_session;
+	GHashTable		*credentials;
 };
 
+/* what we know about a unique bus name, which never changes until the
+ * name goes away; the entry is added before asking the bus so that the
+ * NameOwnerChanged match is in place before the reply can arrive */
+typedef struct {
+	GDBusConnection		*connection;
+	guint			 name_owner_changed_id;
+	gboolean		 valid;
+	guint			 uid;
+	guint			 pid;
+	gchar			*session;
+	gchar			*cmdline;
+} PkDbusCredentials;
+
 static gpointer pk_dbus_object = NULL;
 
 G_DEFINE_TYPE (PkDbus, pk_dbus, G_TYPE_OBJECT)
 
 /**
- * pk_dbus_get_uid:
- * @dbus: the #PkDbus instance
- * @sender: the sender
- *
- * Gets the process UID.
+ * pk_dbus_credentials_free:
+ **/
+static void
+pk_dbus_credentials_free (PkDbusCredentials *credentials)
+{
+	if (credentials->name_owner_changed_id != 0) {
+		g_dbus_connection_signal_unsubscribe (credentials->connection,
+						      credentials->name_owner_changed_id);
+	}
+	g_free (credentials->session);
+	g_free (credentials->cmdline);
+	g_free (credentials);
+}
+
+/**
+ * pk_dbus_credentials_set_from_variant:
+ * @value: the result of GetConnectionCredentials
  *
- * Return value: the UID, or %G_MAXUINT if it could not be obtained
+ * Return value: %FALSE if the uid or pid is missing
  **/
-guint
-pk_dbus_get_uid (PkDbus *dbus, const gchar *sender)
+static gboolean
+pk_dbus_credentials_set_from_variant (PkDbusCredentials *credentials,
+				      GVariant *value)
 {
-	guint uid = G_MAXUINT;
-	g_autoptr(GError) error = NULL;
-	g_autoptr(GVariant) value = NULL;
+	g_autoptr(GVariant) dict = NULL;
+
+	dict = g_variant_get_child_value (value, 0);
+	if (!g_variant_lookup (dict, "UnixUserID", "u", &credentials->uid) ||
+	    !g_variant_lookup (dict, "ProcessID", "u", &credentials->pid))
+		return FALSE;
+	credentials->valid = TRUE;
+	return TRUE;
+}
 
-	g_return_val_if_fail (PK_IS_DBUS (dbus), G_MAXUINT);
-	g_return_val_if_fail (sender != NULL, G_MAXUINT);
+/**
+ * pk_dbus_get_credentials:
+ *
+ * Gets the credentials from the cache, which pk_dbus_lookup_async()
+ * has to have filled for this sender first. We never ask the bus here
+ * as this is called from the main loop.
+ *
+ * Return value: (transfer none): the credentials, or %NULL
+ **/
+static PkDbusCredentials *
+pk_dbus_get_credentials (PkDbus *dbus, const gchar *sender)
+{
+	PkDbusCredentials *credentials;
 
-	/* set in the test suite */
-	if (g_strcmp0 (sender, ":org.freedesktop.PackageKit") == 0) {
-		g_debug ("using self-check shortcut");
-		return 500;
-	}
-	value = g_dbus_proxy_call_sync (dbus->priv->proxy_uid,
-					"GetConnectionUnixUser",
-					g_variant_new ("(s)",
-						       sender),
-					G_DBUS_CALL_FLAGS_NONE,
-					2000,
-					NULL,
-					&error);
-	if (value == NULL) {
-		g_warning ("Failed to get uid for %s: %s",
-			   sender, error->message);
-		return G_MAXUINT;
+	credentials = g_hash_table_lookup (dbus->priv->credentials, sender);
+	if (credentials == NULL || !credentials->valid) {
+		g_warning ("no credentials for %s, not looked up", sender);
+		return NULL;
 	}
-	g_variant_get (value, "(u)", &uid);
-	return uid;
+	return credentials;
 }
 
 /**
- * pk_dbus_get_pid:
+ * pk_dbus_get_uid:
  * @dbus: the #PkDbus instance
- * @sender: the sender, usually got from dbus_g_method_get_dbus()
+ * @sender: the sender
  *
- * Gets the process ID.
+ * Gets the process UID.
  *
- * Return value: the PID, or %G_MAXUINT if it could not be obtained
+ * Return value: the UID, or %G_MAXUINT if it could not be obtained
  **/
-static guint
-pk_dbus_get_pid (PkDbus *dbus, const gchar *sender)
+guint
+pk_dbus_get_uid (PkDbus *dbus, const gchar *sender)
 {
-	guint pid = G_MAXUINT;
-	g_autoptr(GError) error = NULL;
-	g_autoptr(GVariant) value = NULL;
+	PkDbusCredentials *credentials;
 
 	g_return_val_if_fail (PK_IS_DBUS (dbus), G_MAXUINT);
 	g_return_val_if_fail (sender != NULL, G_MAXUINT);
@@ -110,29 +137,12 @@ pk_dbus_get_pid (PkDbus *dbus, const gchar *sender)
 	/* set in the test suite */
 	if (g_strcmp0 (sender, ":org.freedesktop.PackageKit") == 0) {
 		g_debug ("using self-check shortcut");
-		return G_MAXUINT - 1;
+		return 500;
 	}
-
-	/* no connection to DBus */
-	if (dbus->priv->proxy_pid == NULL)
+	credentials = pk_dbus_get_credentials (dbus, sender);
+	if (credentials == NULL)
 		return G_MAXUINT;
-
-	/* get pid from DBus */
-	value = g_dbus_proxy_call_sync (dbus->priv->proxy_pid,
-					"GetConnectionUnixProcessID",
-					g_variant_new ("(s)",
-						       sender),
-					G_DBUS_CALL_FLAGS_NONE,
-					2000,
-					NULL,
-					&error);
-	if (value == NULL) {
-		g_warning ("Failed to get pid for %s: %s",
-			   sender, error->message);
-		return G_MAXUINT;
-	}
-	g_variant_get (value, "(u)", &pid);
-	return pid;
+	return credentials->uid;
 }
 
 /**
@@ -149,7 +159,7 @@ pk_dbus_get_cmdline (PkDbus *dbus, const gchar *sender)
 {
 	gboolean ret;
 	gchar *cmdline = NULL;
-	guint pid;
+	PkDbusCredentials *credentials;
 	g_autoptr(GError) error = NULL;
 	g_autofree gchar *filename = NULL;
 
@@ -163,17 +173,22 @@ pk_dbus_get_cmdline (PkDbus *dbus, const gchar *sender)
 	}
 
 	/* get pid */
-	pid = pk_dbus_get_pid (dbus, sender);
-	if (pid == G_MAXUINT) {
+	credentials = pk_dbus_get_credentials (dbus, sender);
+	if (credentials == NULL) {
 		g_warning ("failed to get PID");
 		return NULL;
 	}
+	if (credentials->cmdline != NULL)
+		return g_strdup (credentials->cmdline);
 
 	/* get command line from proc */
-	filename = g_strdup_printf ("/proc/%i/cmdline", pid);
+	filename = g_strdup_printf ("/proc/%i/cmdline", credentials->pid);
 	ret = g_file_get_contents (filename, &cmdline, NULL, &error);
-	if (!ret)
+	if (!ret) {
 		g_warning ("failed to get cmdline: %s", error->message);
+		return NULL;
+	}
+	credentials->cmdline = g_strdup (cmdline);
 	return cmdline;
 }
 
@@ -221,11 +236,7 @@ gchar *
 pk_dbus_get_session (PkDbus *dbus, const gchar *sender)
 {
 	gchar *session = NULL;
-#ifndef HAVE_SYSTEMD
-	g_autoptr(GError) error = NULL;
-#endif
-	guint pid;
-	g_autoptr(GVariant) value = NULL;
+	PkDbusCredentials *credentials;
 
 	g_return_val_if_fail (PK_IS_DBUS (dbus), NULL);
 	g_return_val_if_fail (sender != NULL, NULL);
@@ -244,38 +255,240 @@ pk_dbus_get_session (PkDbus *dbus, const gchar *sender)
 	}
 
 	/* get pid */
-	pid = pk_dbus_get_pid (dbus, sender);
-	if (pid == G_MAXUINT) {
+	credentials = pk_dbus_get_credentials (dbus, sender);
+	if (credentials == NULL) {
 		g_warning ("failed to get PID");
 		goto out;
 	}
+	if (credentials->session != NULL) {
+		session = g_strdup (credentials->session);
+		goto out;
+	}
 
-	/* get session from systemd or ConsoleKit */
+	/* logind is asked directly, ConsoleKit only by pk_dbus_lookup_async() */
 #ifdef HAVE_SYSTEMD
-	session = pk_dbus_get_session_systemd (pid);
+	session = pk_dbus_get_session_systemd (credentials->pid);
 	if (session == NULL)
-		g_warning ("failed to get session for pid %u", pid);
+		g_warning ("failed to get session for pid %u", credentials->pid);
+	else
+		credentials->session = g_strdup (session);
 #else
-	/* get session from ConsoleKit */
-	value = g_dbus_proxy_call_sync (dbus->priv->proxy_session,
-					"GetSessionForUnixProcess",
-					g_variant_new ("(u)",
-						       pid),
-					G_DBUS_CALL_FLAGS_NONE,
-					2000,
-					NULL,
-					&error);
-	if (value == NULL) {
-		g_warning ("Failed to get session for %s: %s",
-			   sender, error->message);
-		goto out;
-	}
-	g_variant_get (value, "(o)", &session);
+	g_warning ("failed to get session for %s", sender);
 #endif
 out:
 	return session;
 }
 
+/**
+ * pk_dbus_lookup_session_cb:
+ **/
+#ifndef HAVE_SYSTEMD
+static void
+pk_dbus_lookup_session_cb (GObject *source_object,
+			   GAsyncResult *res,
+			   gpointer user_data)
+{
+	PkDbus *dbus;
+	PkDbusCredentials *credentials;
+	const gchar *sender;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GTask) task = G_TASK (user_data);
+	g_autoptr(GVariant) value = NULL;
+
+	value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+	if (value == NULL) {
+		/* not fatal, just nothing that needs the session will work */
+		g_warning ("Failed to get session: %s", error->message);
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	/* the name may have gone away whilst we were waiting */
+	dbus = PK_DBUS (g_task_get_source_object (task));
+	sender = g_task_get_task_data (task);
+	credentials = g_hash_table_lookup (dbus->priv->credentials, sender);
+	if (credentials != NULL && credentials->session == NULL)
+		g_variant_get (value, "(o)", &credentials->session);
+	g_task_return_boolean (task, TRUE);
+}
+#endif
+
+/**
+ * pk_dbus_lookup_cb:
+ **/
+static void
+pk_dbus_lookup_cb (GObject *source_object,
+		   GAsyncResult *res,
+		   gpointer user_data)
+{
+	PkDbus *dbus;
+	PkDbusCredentials *credentials;
+	const gchar *sender;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GTask) task = G_TASK (user_data);
+	g_autoptr(GVariant) value = NULL;
+
+	dbus = PK_DBUS (g_task_get_source_object (task));
+	sender = g_task_get_task_data (task);
+	value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+	if (value == NULL) {
+		g_hash_table_remove (dbus->priv->credentials, sender);
+		g_task_return_error (task, g_steal_pointer (&error));
+		return;
+	}
+
+	/* the name went away whilst we were waiting, and as unique names
+	 * are never reused there is nothing worth keeping */
+	credentials = g_hash_table_lookup (dbus->priv->credentials, sender);
+	if (credentials == NULL) {
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+					 "%s disconnected", sender);
+		return;
+	}
+	if (!credentials->valid &&
+	    !pk_dbus_credentials_set_from_variant (credentials, value)) {
+		g_hash_table_remove (dbus->priv->credentials, sender);
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+					 "No uid or pid in credentials");
+		return;
+	}
+
+	/* get the session too, so that it is ready when required */
+#ifdef HAVE_SYSTEMD
+	if (credentials->session == NULL)
+		credentials->session = pk_dbus_get_session_systemd (credentials->pid);
+#else
+	if (dbus->priv->proxy_session != NULL && credentials->session == NULL) {
+		g_dbus_proxy_call (dbus->priv->proxy_session,
+				   "GetSessionForUnixProcess",
+				   g_variant_new ("(u)", credentials->pid),
+				   G_DBUS_CALL_FLAGS_NONE,
+				   2000,
+				   g_task_get_cancellable (task),
+				   pk_dbus_lookup_session_cb,
+				   g_steal_pointer (&task));
+		return;
+	}
+#endif
+	g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * pk_dbus_name_owner_changed_cb:
+ **/
+static void
+pk_dbus_name_owner_changed_cb (GDBusConnection *connection,
+			       const gchar *sender_name,
+			       const gchar *object_path,
+			       const gchar *interface_name,
+			       const gchar *signal_name,
+			       GVariant *parameters,
+			       gpointer user_data)
+{
+	PkDbus *dbus = PK_DBUS (user_data);
+	const gchar *name;
+	const gchar *old_owner;
+	const gchar *new_owner;
+
+	/* forget everything about clients that have gone away */
+	g_variant_get (parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+	if (new_owner[0] != '\0')
+		return;
+	if (g_hash_table_remove (dbus->priv->credentials, name))
+		g_debug ("removed cached credentials for %s", name);
+}
+
+/**
+ * pk_dbus_lookup_async:
+ * @dbus: the #PkDbus instance
+ * @sender: the sender, usually got from g_dbus_method_invocation_get_sender()
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Looks up the uid, pid and session of the sender without blocking, so
+ * that later calls to pk_dbus_get_uid(), pk_dbus_get_cmdline() and
+ * pk_dbus_get_session() for the same sender do not have to ask the bus.
+ *
+ * The results are kept until the sender disconnects from the bus.
+ **/
+void
+pk_dbus_lookup_async (PkDbus *dbus,
+		      const gchar *sender,
+		      GCancellable *cancellable,
+		      GAsyncReadyCallback callback,
+		      gpointer user_data)
+{
+	PkDbusCredentials *credentials;
+	g_autoptr(GTask) task = NULL;
+
+	g_return_if_fail (PK_IS_DBUS (dbus));
+	g_return_if_fail (sender != NULL);
+
+	task = g_task_new (dbus, cancellable, callback, user_data);
+
+	/* set in the test suite, or already known */
+	credentials = g_hash_table_lookup (dbus->priv->credentials, sender);
+	if (g_strcmp0 (sender, ":org.freedesktop.PackageKit") == 0 ||
+	    (credentials != NULL && credentials->valid)) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	/* no connection to DBus */
+	if (dbus->priv->proxy_uid == NULL) {
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+					 "no connection to the system bus");
+		return;
+	}
+
+	/* watch just this name, and before asking the bus about it, so we
+	 * either get an error or see it disconnect after the reply */
+	if (credentials == NULL) {
+		credentials = g_new0 (PkDbusCredentials, 1);
+		credentials->connection = dbus->priv->connection;
+		credentials->name_owner_changed_id =
+			g_dbus_connection_signal_subscribe (dbus->priv->connection,
+							    "org.freedesktop.DBus",
+							    "org.freedesktop.DBus",
+							    "NameOwnerChanged",
+							    "/org/freedesktop/DBus",
+							    sender,
+							    G_DBUS_SIGNAL_FLAGS_NONE,
+							    pk_dbus_name_owner_changed_cb,
+							    dbus,
+							    NULL);
+		g_hash_table_insert (dbus->priv->credentials,
+				     g_strdup (sender),
+				     credentials);
+	}
+
+	g_task_set_task_data (task, g_strdup (sender), g_free);
+	g_dbus_proxy_call (dbus->priv->proxy_uid,
+			   "GetConnectionCredentials",
+			   g_variant_new ("(s)", sender),
+			   G_DBUS_CALL_FLAGS_NONE,
+			   2000,
+			   cancellable,
+			   pk_dbus_lookup_cb,
+			   g_steal_pointer (&task));
+}
+
+/**
+ * pk_dbus_lookup_finish:
+ * @dbus: the #PkDbus instance
+ * @res: the #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Return value: %TRUE if the credentials of the sender are now known
+ **/
+gboolean
+pk_dbus_lookup_finish (PkDbus *dbus, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (res, dbus), FALSE);
+	return g_task_propagate_boolean (G_TASK (res), error);
+}
+
 /**
  * pk_dbus_finalize:
  **/
@@ -288,10 +501,11 @@ pk_dbus_finalize (GObject *object)
 	g_return_if_fail (PK_IS_DBUS (object));
 	dbus = PK_DBUS (object);
 
-	g_object_unref (dbus->priv->proxy_pid);
+	g_hash_table_unref (dbus->priv->credentials);
 	g_object_unref (dbus->priv->proxy_uid);
 	if (dbus->priv->proxy_session != NULL)
 		g_object_unref (dbus->priv->proxy_session);
+	g_clear_object (&dbus->priv->connection);
 
 	G_OBJECT_CLASS (pk_dbus_parent_class)->finalize (object);
 }
@@ -320,6 +534,9 @@ pk_dbus_init (PkDbus *dbus)
 {
 	g_autoptr(GError) error = NULL;
 	dbus->priv = PK_DBUS_GET_PRIVATE (dbus);
+	dbus->priv->credentials = g_hash_table_new_full (g_str_hash, g_str_equal,
+							 g_free,
+							 (GDestroyNotify) pk_dbus_credentials_free);
 
 	/* use the bus to get the uid */
 	dbus->priv->connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM,
@@ -329,23 +546,7 @@ pk_dbus_init (PkDbus *dbus)
 		return;
 	}
 
-	/* connect to DBus so we can get the pid */
-	dbus->priv->proxy_pid =
-		g_dbus_proxy_new_sync (dbus->priv->connection,
-				       G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
-				       G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
-				       NULL,
-				       "org.freedesktop.DBus",
-				       "/org/freedesktop/DBus/Bus",
-				       "org.freedesktop.DBus",
-				       NULL,
-				       &error);
-	if (dbus->priv->proxy_pid == NULL) {
-		g_warning ("cannot connect to DBus: %s", error->message);
-		return;
-	}
-
-	/* connect to DBus so we can get the uid */
+	/* connect to DBus so we can get the uid and pid */
 	dbus->priv->proxy_uid =
 		g_dbus_proxy_new_sync (dbus->priv->connection,
 				       G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
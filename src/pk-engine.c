@@ -44,6 +44,8 @@
 #include <polkit/polkit.h>
 
 #include "pk-backend.h"
+#include "pk-cache.h"
+#include "pk-statistics.h"
 #include "pk-dbus.h"
 #include "pk-engine.h"
 #include "pk-shared.h"
@@ -67,6 +69,9 @@ static void	pk_engine_set_locked (PkEngine *engine, gboolean is_locked);
 /* how long to wait after the computer has been resumed or any system event */
 #define PK_ENGINE_STATE_CHANGED_TIMEOUT_NORMAL		600 /* s */
 
+/* how long the daemon has to be idle before old transactions are pruned */
+#define PK_ENGINE_COMPACT_TIMEOUT			30 /* s */
+
 struct PkEnginePrivate
 {
 	GTimer			*timer;
@@ -74,6 +79,8 @@ struct PkEnginePrivate
 	gboolean		 shutdown_as_soon_as_possible;
 	PkScheduler		*scheduler;
 	PkTransactionDb		*transaction_db;
+	PkCache			*cache;
+	PkStatistics		*statistics;
 	PkBackend		*backend;
 	GNetworkMonitor		*network_monitor;
 	GKeyFile		*conf;
@@ -92,6 +99,7 @@ struct PkEnginePrivate
 	gchar			*distro_id;
 	guint			 timeout_priority_id;
 	guint			 timeout_normal_id;
+	guint			 compact_id;
 	PolkitAuthority		*authority;
 	gboolean		 locked;
 	PkNetworkEnum		 network_state;
@@ -174,6 +182,42 @@ pk_engine_set_inhibited (PkEngine *engine, gboolean inhibited)
 		pk_engine_uninhibit (engine);
 }
 
+/**
+ * pk_engine_compact_cb:
+ *
+ * Prunes the transaction database once the daemon has gone idle.
+ **/
+static gboolean
+pk_engine_compact_cb (gpointer user_data)
+{
+	PkEngine *engine = PK_ENGINE (user_data);
+
+	if (pk_scheduler_get_size (engine->priv->scheduler) > 0)
+		return G_SOURCE_CONTINUE;
+	if (g_timer_elapsed (engine->priv->timer, NULL) < PK_ENGINE_COMPACT_TIMEOUT)
+		return G_SOURCE_CONTINUE;
+	pk_transaction_db_compact_async (engine->priv->transaction_db, NULL, NULL, NULL);
+	engine->priv->compact_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * pk_engine_schedule_compact:
+ *
+ * Compacts the database once the daemon is next idle, so an idle daemon
+ * is not woken up again until something has been written.
+ **/
+static void
+pk_engine_schedule_compact (PkEngine *engine)
+{
+	if (engine->priv->compact_id != 0)
+		return;
+	engine->priv->compact_id =
+		g_timeout_add_seconds (PK_ENGINE_COMPACT_TIMEOUT,
+				       pk_engine_compact_cb, engine);
+	g_source_set_name_by_id (engine->priv->compact_id, "[PkEngine] compact");
+}
+
 /**
  * pk_engine_scheduler_changed_cb:
  **/
@@ -184,6 +228,9 @@ pk_engine_scheduler_changed_cb (PkScheduler *scheduler, PkEngine *engine)
 
 	g_return_if_fail (PK_IS_ENGINE (engine));
 
+	/* the database may have grown */
+	pk_engine_schedule_compact (engine);
+
 	/* automatically locked if the transaction cannot be cancelled */
 	pk_engine_set_locked (engine, pk_scheduler_get_locked (scheduler));
 	pk_engine_set_inhibited (engine, pk_scheduler_get_inhibited (scheduler));
@@ -367,6 +414,8 @@ pk_engine_backend_repo_list_changed_cb (PkBackend *backend, PkEngine *engine)
 {
 	g_return_if_fail (PK_IS_ENGINE (engine));
 
+	pk_cache_invalidate (engine->priv->cache, "repo list changed");
+
 	g_debug ("emitting RepoListChanged");
 	g_dbus_connection_emit_signal (engine->priv->connection,
 				       NULL,
@@ -385,6 +434,8 @@ pk_engine_backend_updates_changed_cb (PkBackend *backend, PkEngine *engine)
 {
 	g_return_if_fail (PK_IS_ENGINE (engine));
 
+	pk_cache_invalidate (engine->priv->cache, "updates changed");
+
 	g_debug ("emitting UpdatesChanged");
 	g_dbus_connection_emit_signal (engine->priv->connection,
 				       NULL,
@@ -395,6 +446,16 @@ pk_engine_backend_updates_changed_cb (PkBackend *backend, PkEngine *engine)
 				       NULL);
 }
 
+/**
+ * pk_engine_backend_installed_changed_cb:
+ **/
+static void
+pk_engine_backend_installed_changed_cb (PkBackend *backend, PkEngine *engine)
+{
+	g_return_if_fail (PK_IS_ENGINE (engine));
+	pk_cache_invalidate (engine->priv->cache, "installed packages changed");
+}
+
 /**
  * pk_engine_state_changed_cb:
  *
@@ -550,8 +611,28 @@ typedef struct {
 	gchar			*value4;
 	gchar			*value5;
 	gchar			*value6;
+	GVariant		*parameters;
 } PkEngineDbusState;
 
+/**
+ * pk_engine_dbus_state_free:
+ **/
+static void
+pk_engine_dbus_state_free (PkEngineDbusState *state)
+{
+	g_object_unref (state->engine);
+	g_free (state->sender);
+	g_free (state->value1);
+	g_free (state->value2);
+	g_free (state->value3);
+	g_free (state->value4);
+	g_free (state->value5);
+	g_free (state->value6);
+	if (state->parameters != NULL)
+		g_variant_unref (state->parameters);
+	g_free (state);
+}
+
 /**
  * pk_engine_action_obtain_authorization:
  **/
@@ -618,15 +699,7 @@ pk_engine_action_obtain_proxy_authorization_finished_cb (PolkitAuthority *author
 	g_dbus_method_invocation_return_value (state->context, NULL);
 out:
 	/* unref state, we're done */
-	g_object_unref (state->engine);
-	g_free (state->sender);
-	g_free (state->value1);
-	g_free (state->value2);
-	g_free (state->value3);
-	g_free (state->value4);
-	g_free (state->value5);
-	g_free (state->value6);
-	g_free (state);
+	pk_engine_dbus_state_free (state);
 }
 
 /**
@@ -689,6 +762,59 @@ pk_engine_is_proxy_unchanged (PkEngine *engine, const gchar *sender,
 	return TRUE;
 }
 
+/**
+ * pk_engine_set_proxy_lookup_cb:
+ **/
+static void
+pk_engine_set_proxy_lookup_cb (GObject *source_object,
+			       GAsyncResult *res,
+			       gpointer user_data)
+{
+	gboolean ret;
+	PkEngineDbusState *state = (PkEngineDbusState *) user_data;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(PolkitSubject) subject = NULL;
+
+	/* failed */
+	ret = pk_dbus_lookup_finish (PK_DBUS (source_object), res, &error);
+	if (!ret) {
+		g_dbus_method_invocation_return_error (state->context,
+						       PK_ENGINE_ERROR,
+						       PK_ENGINE_ERROR_CANNOT_SET_PROXY,
+						       "failed to get the caller details: %s",
+						       error->message);
+		pk_engine_dbus_state_free (state);
+		return;
+	}
+
+	/* is exactly the same proxy? */
+	ret = pk_engine_is_proxy_unchanged (state->engine, state->sender,
+					    state->value1,
+					    state->value2,
+					    state->value3,
+					    state->value4,
+					    state->value5,
+					    state->value6);
+	if (ret) {
+		g_debug ("not changing proxy as the same as before");
+		g_dbus_method_invocation_return_value (state->context, NULL);
+		pk_engine_dbus_state_free (state);
+		return;
+	}
+
+	/* check subject */
+	subject = polkit_system_bus_name_new (state->sender);
+
+	/* do authorization async */
+	polkit_authority_check_authorization (state->engine->priv->authority, subject,
+					      "org.freedesktop.packagekit.system-network-proxy-configure",
+					      NULL,
+					      POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
+					      NULL,
+					      (GAsyncReadyCallback) pk_engine_action_obtain_proxy_authorization_finished_cb,
+					      state);
+}
+
 /**
  * pk_engine_set_proxy:
  **/
@@ -704,10 +830,7 @@ pk_engine_set_proxy (PkEngine *engine,
 {
 	guint len;
 	GError *error = NULL;
-	gboolean ret;
-	const gchar *sender;
 	PkEngineDbusState *state;
-	g_autoptr(PolkitSubject) subject = NULL;
 
 	g_return_if_fail (PK_IS_ENGINE (engine));
 
@@ -739,31 +862,11 @@ pk_engine_set_proxy (PkEngine *engine,
 		goto out;
 	}
 
-	/* save sender */
-	sender = g_dbus_method_invocation_get_sender (context);
-
-	/* is exactly the same proxy? */
-	ret = pk_engine_is_proxy_unchanged (engine, sender,
-					    proxy_http,
-					    proxy_https,
-					    proxy_ftp,
-					    proxy_socks,
-					    no_proxy,
-					    pac);
-	if (ret) {
-		g_debug ("not changing proxy as the same as before");
-		g_dbus_method_invocation_return_value (context, NULL);
-		goto out;
-	}
-
-	/* check subject */
-	subject = polkit_system_bus_name_new (sender);
-
 	/* cache state */
 	state = g_new0 (PkEngineDbusState, 1);
 	state->context = context;
 	state->engine = g_object_ref (engine);
-	state->sender = g_strdup (sender);
+	state->sender = g_strdup (g_dbus_method_invocation_get_sender (context));
 	state->value1 = g_strdup (proxy_http);
 	state->value2 = g_strdup (proxy_https);
 	state->value3 = g_strdup (proxy_ftp);
@@ -771,14 +874,12 @@ pk_engine_set_proxy (PkEngine *engine,
 	state->value5 = g_strdup (no_proxy);
 	state->value6 = g_strdup (pac);
 
-	/* do authorization async */
-	polkit_authority_check_authorization (engine->priv->authority, subject,
-					      "org.freedesktop.packagekit.system-network-proxy-configure",
-					      NULL,
-					      POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
-					      NULL,
-					      (GAsyncReadyCallback) pk_engine_action_obtain_proxy_authorization_finished_cb,
-					      state);
+	/* get the uid and session without blocking the daemon */
+	pk_dbus_lookup_async (engine->priv->dbus,
+			      state->sender,
+			      NULL,
+			      pk_engine_set_proxy_lookup_cb,
+			      state);
 
 	/* reset the timer */
 	pk_engine_reset_timer (engine);
@@ -1038,6 +1139,32 @@ pk_engine_setup_file_monitors (PkEngine *engine)
 			  G_CALLBACK (pk_engine_offline_upgrade_file_changed_cb), engine);
 }
 
+/**
+ * pk_engine_load_retention:
+ **/
+static void
+pk_engine_load_retention (PkEngine *engine)
+{
+	gboolean vacuum;
+	guint max_age;
+	guint max_size;
+	guint max_transactions;
+
+	max_transactions = g_key_file_get_integer (engine->priv->conf, "Daemon",
+						   "HistoryMaxTransactions", NULL);
+	max_age = g_key_file_get_integer (engine->priv->conf, "Daemon",
+					  "HistoryMaxAge", NULL);
+	max_size = g_key_file_get_integer (engine->priv->conf, "Daemon",
+					   "HistoryMaxSize", NULL);
+	vacuum = g_key_file_get_boolean (engine->priv->conf, "Daemon",
+					 "HistoryIncrementalVacuum", NULL);
+	pk_transaction_db_set_retention (engine->priv->transaction_db,
+					 max_transactions,
+					 max_age * 24 * 60 * 60,
+					 (guint64) max_size * 1024 * 1024,
+					 vacuum);
+}
+
 /**
  * pk_engine_load_backend:
  **/
@@ -1055,6 +1182,10 @@ pk_engine_load_backend (PkEngine *engine, GError **error)
 	if (!pk_transaction_db_load (engine->priv->transaction_db, error))
 		return FALSE;
 
+	/* keep the transaction database from growing forever */
+	pk_engine_load_retention (engine);
+	pk_engine_schedule_compact (engine);
+
 	/* create a new backend so we can get the static stuff */
 	engine->priv->roles = pk_backend_get_roles (engine->priv->backend);
 	engine->priv->groups = pk_backend_get_groups (engine->priv->backend);
@@ -1189,64 +1320,29 @@ pk_engine_daemon_get_property (GDBusConnection *connection_, const gchar *sender
 	return NULL;
 }
 
-/**
- * pk_engine_package_name_in_strv:
- **/
-static gboolean
-pk_engine_package_name_in_strv (gchar **strv, PkPackage *pkg)
-{
-	guint i;
-	for (i = 0; strv[i] != NULL; i++) {
-		if (g_strcmp0 (strv[i], pk_package_get_name (pkg)) == 0)
-			return TRUE;
-	}
-	return FALSE;
-}
-
 /**
  * pk_engine_get_package_history_pkg:
  *
- * Create a 'a{sv}' GVariant instance from all the PkTransactionPast data
+ * Create a 'a{sv}' GVariant instance from the package history item
  **/
 static GVariant *
-pk_engine_get_package_history_pkg (PkTransactionPast *item, PkPackage *pkg)
+pk_engine_get_package_history_pkg (PkTransactionDbHistoryItem *item)
 {
 	GVariantBuilder builder;
 	g_variant_builder_init (&builder, G_VARIANT_TYPE_ARRAY);
 	g_variant_builder_add (&builder, "{sv}", "info",
-			       g_variant_new_uint32 (pk_package_get_info (pkg)));
+			       g_variant_new_uint32 (item->info));
 	g_variant_builder_add (&builder, "{sv}", "source",
-			       g_variant_new_string (pk_package_get_data (pkg)));
+			       g_variant_new_string (item->data != NULL ? item->data : ""));
 	g_variant_builder_add (&builder, "{sv}", "version",
-			       g_variant_new_string (pk_package_get_version (pkg)));
+			       g_variant_new_string (item->version != NULL ? item->version : ""));
 	g_variant_builder_add (&builder, "{sv}", "timestamp",
-			       g_variant_new_uint64 (pk_transaction_past_get_timestamp (item)));
+			       g_variant_new_uint64 (item->timestamp));
 	g_variant_builder_add (&builder, "{sv}", "user-id",
-			       g_variant_new_uint32 (pk_transaction_past_get_uid (item)));
+			       g_variant_new_uint32 (item->uid));
 	return g_variant_builder_end (&builder);
 }
 
-/**
- * pk_engine_is_package_history_interesing:
- **/
-static gboolean
-pk_engine_is_package_history_interesing (PkPackage *package)
-{
-	gboolean ret;
-
-	switch (pk_package_get_info (package)) {
-	case PK_INFO_ENUM_INSTALLING:
-	case PK_INFO_ENUM_REMOVING:
-	case PK_INFO_ENUM_UPDATING:
-		ret = TRUE;
-		break;
-	default:
-		ret = FALSE;
-		break;
-	}
-	return ret;
-}
-
 /**
  * pk_engine_get_package_history:
  **/
@@ -1256,120 +1352,196 @@ pk_engine_get_package_history (PkEngine *engine,
 			       guint max_size,
 			       GError **error)
 {
-	const gchar *data;
-	const gchar *pkgname;
-	gboolean ret;
-	gchar *key;
-	gint64 timestamp;
-	GList *l;
-	GList *list;
-	GPtrArray *array = NULL;
 	guint i;
+	guint j;
 	GVariantBuilder builder;
-	GVariant *value = NULL;
-	PkTransactionPast *item;
-	g_autoptr(GHashTable) deduplicate_hash = NULL;
+	GVariantBuilder builder_pkg;
+	PkTransactionDbHistoryItem *item;
 	g_autoptr(GHashTable) pkgname_hash = NULL;
-	g_autoptr(GList) keys = NULL;
-	g_autoptr(PkPackage) package_tmp = NULL;
 
-	list = pk_transaction_db_get_list (engine->priv->transaction_db, max_size);
+	/* each package name is an indexed lookup */
+	pkgname_hash = g_hash_table_new (g_str_hash, g_str_equal);
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{saa{sv}}"));
+	for (i = 0; package_names[i] != NULL; i++) {
+		g_autoptr(GPtrArray) array = NULL;
 
-	/* simplify the loop */
-	if (max_size == 0)
-		max_size = G_MAXUINT;
-
-	pkgname_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
-	deduplicate_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-	package_tmp = pk_package_new ();
-	for (l = list; l != NULL; l = l->next) {
-		g_auto(GStrv) package_lines = NULL;
-		item = PK_TRANSACTION_PAST (l->data);
-
-		/* ignore anything that failed */
-		if (!pk_transaction_past_get_succeeded (item))
+		/* the same name twice */
+		if (g_hash_table_contains (pkgname_hash, package_names[i]))
 			continue;
+		g_hash_table_add (pkgname_hash, package_names[i]);
 
-		/* split up data */
-		data = pk_transaction_past_get_data (item);
-		if (data == NULL)
+		array = pk_transaction_db_get_package_history (engine->priv->transaction_db,
+							       package_names[i],
+							       max_size);
+		if (array->len == 0)
 			continue;
-		package_lines = g_strsplit (data, "\n", -1);
-		for (i = 0; package_lines[i] != NULL; i++) {
-			g_autoptr(GError) error_local = NULL;
-			ret = pk_package_parse (package_tmp,
-						package_lines[i],
-						&error_local);
-			if (!ret) {
-				g_warning ("Failed to parse package: '%s': %s",
-					   package_lines[i], error_local->message);
-				continue;
-			}
-
-			/* not the package we care about */
-			if (!pk_engine_package_name_in_strv (package_names, package_tmp))
-				continue;
-
-			/* not a state we care about */
-			if (!pk_engine_is_package_history_interesing (package_tmp))
-				continue;
-
-			/* transactions without a timestamp are not interesting */
-			timestamp = pk_transaction_past_get_timestamp (item);
-			if (timestamp == 0)
-				continue;
-
-			/* de-duplicate the entry, in the case of multiarch */
-			key = g_strdup_printf ("%s-%" G_GINT64_FORMAT,
-					       pk_package_get_name (package_tmp),
-					       timestamp);
-			if (g_hash_table_lookup (deduplicate_hash, key) != NULL) {
-				g_free (key);
-				continue;
-			}
-			g_hash_table_insert (deduplicate_hash, key, package_lines[i]);
-
-			/* get the blob for this data item */
-			value = pk_engine_get_package_history_pkg (item, package_tmp);
-			if (value == NULL)
-				continue;
-
-			/* find the array */
-			pkgname = pk_package_get_name (package_tmp);
-			array = g_hash_table_lookup (pkgname_hash, pkgname);
-			if (array == NULL) {
-				array = g_ptr_array_new ();
-				g_hash_table_insert (pkgname_hash,
-						     g_strdup (pkgname),
-						     array);
-			}
-			g_ptr_array_add (array, value);
+
+		/* create aa{sv} */
+		g_variant_builder_init (&builder_pkg, G_VARIANT_TYPE ("aa{sv}"));
+		for (j = 0; j < array->len; j++) {
+			item = g_ptr_array_index (array, j);
+			g_variant_builder_add_value (&builder_pkg,
+						     pk_engine_get_package_history_pkg (item));
 		}
+		g_variant_builder_add (&builder, "{saa{sv}}",
+				       package_names[i], &builder_pkg);
 	}
 
 	/* no history returns an empty array */
-	if (g_hash_table_size (pkgname_hash) == 0) {
-		value = g_variant_new_array (G_VARIANT_TYPE ("{saa{sv}}"), NULL, 0);
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * pk_engine_create_transaction_lookup_cb:
+ **/
+static void
+pk_engine_create_transaction_lookup_cb (GObject *source_object,
+					GAsyncResult *res,
+					gpointer user_data)
+{
+	gboolean ret;
+	PkEngineDbusState *state = (PkEngineDbusState *) user_data;
+	PkEngine *engine = state->engine;
+	g_autoptr(GError) error = NULL;
+	g_autofree gchar *tid = NULL;
+
+	/* this is not fatal, the transaction just has no uid */
+	if (!pk_dbus_lookup_finish (PK_DBUS (source_object), res, &error))
+		g_warning ("failed to get caller details: %s", error->message);
+
+	tid = pk_transaction_db_generate_id (engine->priv->transaction_db);
+	g_assert (tid != NULL);
+	g_clear_error (&error);
+	ret = pk_scheduler_create (engine->priv->scheduler,
+				   tid, state->sender, &error);
+	if (!ret) {
+		g_dbus_method_invocation_return_error (state->context,
+						       PK_ENGINE_ERROR,
+						       PK_ENGINE_ERROR_CANNOT_CHECK_AUTH,
+						       "could not create transaction %s: %s",
+						       tid,
+						       error->message);
 		goto out;
 	}
 
-	/* we have a hash of pkgname:GPtrArray where the GPtrArray is an array
-	 * of GVariants of type a{sv} */
-	g_variant_builder_init (&builder, G_VARIANT_TYPE_ARRAY);
-	keys = g_hash_table_get_keys (pkgname_hash);
-	for (l = keys; l != NULL; l = l->next) {
-		pkgname = l->data;
-		array = g_hash_table_lookup (pkgname_hash, pkgname);
-		/* create aa{sv} */
-		value = g_variant_new_array (NULL,
-					     (GVariant * const *) array->pdata,
-					     MIN (array->len, max_size));
-		g_variant_builder_add (&builder, "{s@aa{sv}}", pkgname, value);
-	}
-	value = g_variant_builder_end (&builder);
+	g_debug ("sending object path: '%s'", tid);
+	g_dbus_method_invocation_return_value (state->context,
+					       g_variant_new ("(o)", tid));
 out:
-	g_list_free_full (list, (GDestroyNotify) g_object_unref);
-	return value;
+	pk_engine_dbus_state_free (state);
+}
+
+/**
+ * pk_engine_get_database_statistics:
+ **/
+static GVariant *
+pk_engine_get_database_statistics (PkEngine *engine)
+{
+	GVariantBuilder builder;
+	PkTransactionDbStats stats;
+
+	pk_transaction_db_get_stats (engine->priv->transaction_db, &stats);
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "transactions",
+			       g_variant_new_uint64 (stats.transactions));
+	g_variant_builder_add (&builder, "{sv}", "package-history",
+			       g_variant_new_uint64 (stats.package_history));
+	g_variant_builder_add (&builder, "{sv}", "size",
+			       g_variant_new_uint64 (stats.size));
+	g_variant_builder_add (&builder, "{sv}", "free",
+			       g_variant_new_uint64 (stats.free));
+	g_variant_builder_add (&builder, "{sv}", "pruned",
+			       g_variant_new_uint64 (stats.pruned));
+	g_variant_builder_add (&builder, "{sv}", "compacted",
+			       g_variant_new_int64 (stats.compacted));
+	g_variant_builder_add (&builder, "{sv}", "max-transactions",
+			       g_variant_new_uint32 (stats.max_transactions));
+	g_variant_builder_add (&builder, "{sv}", "max-age",
+			       g_variant_new_uint32 (stats.max_age));
+	g_variant_builder_add (&builder, "{sv}", "max-size",
+			       g_variant_new_uint64 (stats.max_size));
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * pk_engine_get_cache_statistics:
+ **/
+static GVariant *
+pk_engine_get_cache_statistics (PkEngine *engine)
+{
+	GVariantBuilder builder;
+	PkCacheStats stats;
+
+	pk_cache_get_stats (engine->priv->cache, &stats);
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "hits",
+			       g_variant_new_uint32 (stats.hits));
+	g_variant_builder_add (&builder, "{sv}", "misses",
+			       g_variant_new_uint32 (stats.misses));
+	g_variant_builder_add (&builder, "{sv}", "invalidations",
+			       g_variant_new_uint32 (stats.invalidations));
+	g_variant_builder_add (&builder, "{sv}", "evictions",
+			       g_variant_new_uint32 (stats.evictions));
+	g_variant_builder_add (&builder, "{sv}", "size",
+			       g_variant_new_uint32 (stats.size));
+	g_variant_builder_add (&builder, "{sv}", "max-size",
+			       g_variant_new_uint32 (stats.max_size));
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * pk_engine_get_database_statistics_cb:
+ **/
+static void
+pk_engine_get_database_statistics_cb (GObject *source_object,
+				      GAsyncResult *res,
+				      gpointer user_data)
+{
+	GVariant *value;
+	PkEngineDbusState *state = (PkEngineDbusState *) user_data;
+	g_autoptr(GError) error = NULL;
+
+	/* the statistics are still useful without the pending changes */
+	if (!pk_transaction_db_flush_finish (PK_TRANSACTION_DB (source_object), res, &error))
+		g_warning ("failed to write pending changes: %s", error->message);
+	value = g_variant_new ("(@a{sv})",
+			       pk_engine_get_database_statistics (state->engine));
+	g_dbus_method_invocation_return_value (state->context, value);
+	pk_engine_dbus_state_free (state);
+}
+
+/**
+ * pk_engine_get_package_history_cb:
+ **/
+static void
+pk_engine_get_package_history_cb (GObject *source_object,
+				  GAsyncResult *res,
+				  gpointer user_data)
+{
+	guint size;
+	GVariant *value;
+	PkEngineDbusState *state = (PkEngineDbusState *) user_data;
+	g_autoptr(GError) error = NULL;
+	g_autofree gchar **package_names = NULL;
+
+	if (!pk_transaction_db_flush_finish (PK_TRANSACTION_DB (source_object), res, &error))
+		g_warning ("failed to write pending changes: %s", error->message);
+	g_clear_error (&error);
+
+	g_variant_get (state->parameters, "(^a&su)", &package_names, &size);
+	value = pk_engine_get_package_history (state->engine, package_names, size, &error);
+	if (value == NULL) {
+		g_dbus_method_invocation_return_error (state->context,
+						       PK_ENGINE_ERROR,
+						       PK_ENGINE_ERROR_NOT_SUPPORTED,
+						       "history for package name %s failed: %s",
+						       package_names[0],
+						       error->message);
+	} else {
+		g_dbus_method_invocation_return_value (state->context,
+						       g_variant_new_tuple (&value, 1));
+	}
+	pk_engine_dbus_state_free (state);
 }
 
 /**
@@ -1382,10 +1554,8 @@ pk_engine_daemon_method_call (GDBusConnection *connection_, const gchar *sender,
 			      GDBusMethodInvocation *invocation, gpointer user_data)
 {
 	const gchar *tmp = NULL;
-	gboolean ret;
 	guint time_since;
 	GVariant *value = NULL;
-	GVariant *tuple = NULL;
 	PkAuthorizeEnum result_enum;
 	PkEngine *engine = PK_ENGINE (user_data);
 	PkRoleEnum role;
@@ -1417,7 +1587,22 @@ pk_engine_daemon_method_call (GDBusConnection *connection_, const gchar *sender,
 		return;
 	}
 
+	if (g_strcmp0 (method_name, "GetDatabaseStatistics") == 0) {
+		PkEngineDbusState *state;
+
+		/* include anything not written yet, without blocking */
+		state = g_new0 (PkEngineDbusState, 1);
+		state->context = invocation;
+		state->engine = g_object_ref (engine);
+		pk_transaction_db_flush_async (engine->priv->transaction_db,
+					       NULL,
+					       pk_engine_get_database_statistics_cb,
+					       state);
+		return;
+	}
+
 	if (g_strcmp0 (method_name, "GetPackageHistory") == 0) {
+		PkEngineDbusState *state;
 		g_autofree gchar **package_names = NULL;
 
 		g_variant_get (parameters, "(^a&su)", &package_names, &size);
@@ -1428,41 +1613,35 @@ pk_engine_daemon_method_call (GDBusConnection *connection_, const gchar *sender,
 							       "history for package name invalid");
 			return;
 		}
-		value = pk_engine_get_package_history (engine, package_names, size, &error);
-		if (value == NULL) {
-			g_dbus_method_invocation_return_error (invocation,
-							       PK_ENGINE_ERROR,
-							       PK_ENGINE_ERROR_NOT_SUPPORTED,
-							       "history for package name %s failed: %s",
-							       package_names[0],
-							       error->message);
-			return;
-		}
-		tuple = g_variant_new_tuple (&value, 1);
-		g_dbus_method_invocation_return_value (invocation, tuple);
+
+		/* include anything not written yet, without blocking */
+		state = g_new0 (PkEngineDbusState, 1);
+		state->context = invocation;
+		state->engine = g_object_ref (engine);
+		state->parameters = g_variant_ref (parameters);
+		pk_transaction_db_flush_async (engine->priv->transaction_db,
+					       NULL,
+					       pk_engine_get_package_history_cb,
+					       state);
 		return;
 	}
 
 	if (g_strcmp0 (method_name, "CreateTransaction") == 0) {
 
+		PkEngineDbusState *state;
+
 		g_debug ("CreateTransaction method called");
-		data = pk_transaction_db_generate_id (engine->priv->transaction_db);
-		g_assert (data != NULL);
-		ret = pk_scheduler_create (engine->priv->scheduler,
-					   data, sender, &error);
-		if (!ret) {
-			g_dbus_method_invocation_return_error (invocation,
-							       PK_ENGINE_ERROR,
-							       PK_ENGINE_ERROR_CANNOT_CHECK_AUTH,
-							       "could not create transaction %s: %s",
-							       data,
-							       error->message);
-			return;
-		}
 
-		g_debug ("sending object path: '%s'", data);
-		value = g_variant_new ("(o)", data);
-		g_dbus_method_invocation_return_value (invocation, value);
+		/* the scheduler needs the uid, so get it without blocking */
+		state = g_new0 (PkEngineDbusState, 1);
+		state->context = invocation;
+		state->engine = g_object_ref (engine);
+		state->sender = g_strdup (sender);
+		pk_dbus_lookup_async (engine->priv->dbus,
+				      sender,
+				      NULL,
+				      pk_engine_create_transaction_lookup_cb,
+				      state);
 		return;
 	}
 
@@ -1847,6 +2026,46 @@ pk_engine_proxy_logind_cb (GObject *source_object,
 }
 #endif
 
+/**
+ * pk_engine_statistics_method_call:
+ **/
+static void
+pk_engine_statistics_method_call (GDBusConnection *connection_, const gchar *sender,
+				  const gchar *object_path, const gchar *interface_name,
+				  const gchar *method_name, GVariant *parameters,
+				  GDBusMethodInvocation *invocation, gpointer user_data)
+{
+	PkEngine *engine = PK_ENGINE (user_data);
+
+	g_return_if_fail (PK_IS_ENGINE (engine));
+
+	if (g_strcmp0 (method_name, "GetStatistics") == 0) {
+		GVariantBuilder builder;
+		guint queued;
+		guint running;
+
+		queued = pk_scheduler_get_queue_depth (engine->priv->scheduler, &running);
+		g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_add (&builder, "{sv}", "queue-depth",
+				       g_variant_new_uint32 (queued));
+		g_variant_builder_add (&builder, "{sv}", "running",
+				       g_variant_new_uint32 (running));
+		pk_statistics_to_builder (engine->priv->statistics, &builder);
+		g_variant_builder_add (&builder, "{sv}", "cache",
+				       pk_engine_get_cache_statistics (engine));
+		g_variant_builder_add (&builder, "{sv}", "database",
+				       pk_engine_get_database_statistics (engine));
+		g_dbus_method_invocation_return_value (invocation,
+						       g_variant_new ("(a{sv})", &builder));
+		return;
+	}
+
+	g_dbus_method_invocation_return_error (invocation,
+					       G_DBUS_ERROR,
+					       G_DBUS_ERROR_UNKNOWN_METHOD,
+					       "method %s not known", method_name);
+}
+
 /**
  * pk_engine_on_bus_acquired_cb:
  **/
@@ -1867,6 +2086,11 @@ pk_engine_on_bus_acquired_cb (GDBusConnection *connection,
 		pk_engine_offline_get_property,
 		NULL
 	};
+	static const GDBusInterfaceVTable iface_statistics_vtable = {
+		pk_engine_statistics_method_call,
+		NULL,
+		NULL
+	};
 
 	/* save copy for emitting signals */
 	engine->priv->connection = g_object_ref (connection);
@@ -1901,6 +2125,16 @@ pk_engine_on_bus_acquired_cb (GDBusConnection *connection,
 							     NULL,  /* user_data_free_func */
 							     NULL); /* GError** */
 	g_assert (registration_id > 0);
+
+	/* register org.freedesktop.PackageKit.Statistics */
+	registration_id = g_dbus_connection_register_object (connection,
+							     PK_DBUS_PATH,
+							     engine->priv->introspection->interfaces[2],
+							     &iface_statistics_vtable,
+							     engine,  /* user_data */
+							     NULL,  /* user_data_free_func */
+							     NULL); /* GError** */
+	g_assert (registration_id > 0);
 }
 
 
@@ -1979,6 +2213,10 @@ pk_engine_init (PkEngine *engine)
 	/* we use a trasaction db to store old transactions */
 	engine->priv->transaction_db = pk_transaction_db_new ();
 
+	/* shared with all the transactions */
+	engine->priv->cache = pk_cache_new ();
+	engine->priv->statistics = pk_statistics_new ();
+
 	/* own the object */
 	engine->priv->owner_id =
 		g_bus_own_name (G_BUS_TYPE_SYSTEM,
@@ -2016,6 +2254,8 @@ pk_engine_finalize (GObject *object)
 		g_source_remove (engine->priv->timeout_normal_id);
 		engine->priv->timeout_normal_id = 0;
 	}
+	if (engine->priv->compact_id != 0)
+		g_source_remove (engine->priv->compact_id);
 
 	/* unlock if we locked this */
 	if (!pk_backend_unload (engine->priv->backend))
@@ -2046,6 +2286,8 @@ pk_engine_finalize (GObject *object)
 	g_object_unref (engine->priv->monitor_offline_upgrade);
 	g_object_unref (engine->priv->scheduler);
 	g_object_unref (engine->priv->transaction_db);
+	g_object_unref (engine->priv->cache);
+	g_object_unref (engine->priv->statistics);
 	if (engine->priv->authority != NULL)
 		g_object_unref (engine->priv->authority);
 	g_object_unref (engine->priv->backend);
@@ -2073,6 +2315,16 @@ pk_engine_new (GKeyFile *conf)
 			  G_CALLBACK (pk_engine_backend_repo_list_changed_cb), engine);
 	g_signal_connect (engine->priv->backend, "updates-changed",
 			  G_CALLBACK (pk_engine_backend_updates_changed_cb), engine);
+	g_signal_connect (engine->priv->backend, "installed-changed",
+			  G_CALLBACK (pk_engine_backend_installed_changed_cb), engine);
+	if (g_key_file_has_key (conf, "Daemon", "ResultsCacheSize", NULL)) {
+		gint size = g_key_file_get_integer (conf, "Daemon", "ResultsCacheSize", NULL);
+		pk_cache_set_max_size (engine->priv->cache, MAX (size, 0));
+	}
+	if (g_key_file_has_key (conf, "Daemon", "ResultsCacheMaxAge", NULL)) {
+		gint age = g_key_file_get_integer (conf, "Daemon", "ResultsCacheMaxAge", NULL);
+		pk_cache_set_max_age (engine->priv->cache, MAX (age, 0));
+	}
 	engine->priv->scheduler = pk_scheduler_new (engine->priv->conf);
 	pk_scheduler_set_backend (engine->priv->scheduler,
 				  engine->priv->backend);
@@ -32,6 +32,7 @@
 #include <glib-unix.h>
 #include <glib/gi18n.h>
 #include <packagekit-glib2/pk-debug.h>
+#include <packagekit-glib2/pk-package-private.h>
 
 #include "pk-engine.h"
 #include "pk-shared.h"
@@ -214,6 +215,9 @@ main (int argc, char *argv[])
 
 	loop = g_main_loop_new (NULL, FALSE);
 
+	/* the same packages end up in many results and caches */
+	pk_package_set_intern_ids (TRUE);
+
 	/* create a new engine object */
 	engine = pk_engine_new (conf);
 	g_signal_connect (engine, "quit",
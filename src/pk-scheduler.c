@@ -66,6 +66,9 @@
 #include "pk-transaction.h"
 #include "pk-transaction-private.h"
 #include "pk-scheduler.h"
+#include "pk-scheduler-private.h"
+#include "pk-statistics.h"
+#include "pk-trace.h"
 
 static void     pk_scheduler_finalize	(GObject	*object);
 
@@ -89,9 +92,22 @@ static void     pk_scheduler_finalize	(GObject	*object);
 struct PkSchedulerPrivate
 {
 	GPtrArray		*array;
+	GHashTable		*items;		/* tid:PkSchedulerItem */
+	GHashTable		*users;		/* uid:PkSchedulerUser */
+	GHashTable		*shared;	/* cache-key:PkSchedulerItem */
+	GSequence		*queue;		/* of PkSchedulerItem, READY only */
+	GSequence		*waiting_exclusive; /* READY, waiting for the lock */
+	guint64			 queue_seq;
+	guint64			 queue_round;
+	guint			 queued;
+	guint			 running_exclusive;
+	guint			 running_background;
+	guint			 max_transactions_for_uid;
+	guint			 max_running_for_uid;
 	guint			 unwedge_id;
 	GKeyFile		*conf;
 	PkBackend		*backend;
+	PkStatistics		*statistics;
 	GDBusNodeInfo		*introspection;
 };
 
@@ -107,8 +123,26 @@ typedef struct {
 	gulong			 allow_cancel_changed_id;
 	guint			 uid;
 	guint			 tries;
+	GSequenceIter		*queue_iter;
+	guint64			 queue_seq;
+	guint64			 queue_round;
+	gboolean		 interactive;
+	gboolean		 background;
+	gboolean		 exclusive;
+	gboolean		 running;
+	gchar			*cache_key;
+	gint64			 queued_at;
 } PkSchedulerItem;
 
+typedef struct {
+	guint			 uid;
+	guint			 items;
+	guint			 queued;
+	guint			 running;
+	guint64			 queue_round;
+	GSequence		*waiting;	/* READY, over the running limit */
+} PkSchedulerUser;
+
 enum {
 	PK_SCHEDULER_CHANGED,
 	PK_SCHEDULER_LAST_SIGNAL
@@ -124,23 +158,192 @@ G_DEFINE_TYPE (PkScheduler, pk_scheduler, G_TYPE_OBJECT)
 static PkSchedulerItem *
 pk_scheduler_get_from_tid (PkScheduler *scheduler, const gchar *tid)
 {
-	guint i;
-	GPtrArray *array;
-	PkSchedulerItem *item;
-	const gchar *tmptid;
-
 	g_return_val_if_fail (scheduler != NULL, NULL);
 	g_return_val_if_fail (PK_IS_SCHEDULER (scheduler), NULL);
 
-	/* find the runner with the transaction ID */
-	array = scheduler->priv->array;
-	for (i = 0; i < array->len; i++) {
-		item = (PkSchedulerItem *) g_ptr_array_index (array, i);
-		tmptid = pk_transaction_get_tid (item->transaction);
-		if (g_strcmp0 (tmptid, tid) == 0)
-			return item;
+	if (tid == NULL)
+		return NULL;
+	return g_hash_table_lookup (scheduler->priv->items, tid);
+}
+
+/**
+ * pk_scheduler_get_user:
+ **/
+static PkSchedulerUser *
+pk_scheduler_get_user (PkScheduler *scheduler, guint uid, gboolean create)
+{
+	PkSchedulerUser *user;
+
+	user = g_hash_table_lookup (scheduler->priv->users, GUINT_TO_POINTER (uid));
+	if (user != NULL || !create)
+		return user;
+	user = g_new0 (PkSchedulerUser, 1);
+	user->uid = uid;
+	user->waiting = g_sequence_new (NULL);
+	g_hash_table_insert (scheduler->priv->users, GUINT_TO_POINTER (uid), user);
+	return user;
+}
+
+/**
+ * pk_scheduler_user_free:
+ **/
+static void
+pk_scheduler_user_free (PkSchedulerUser *user)
+{
+	g_sequence_free (user->waiting);
+	g_free (user);
+}
+
+/**
+ * pk_scheduler_item_compare:
+ *
+ * Orders the queue so that interactive transactions come first, then
+ * foreground before background, then users in round-robin order and
+ * finally the order the transactions were committed in.
+ **/
+static gint
+pk_scheduler_item_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const PkSchedulerItem *item1 = a;
+	const PkSchedulerItem *item2 = b;
+
+	if (item1->interactive != item2->interactive)
+		return item1->interactive ? -1 : 1;
+	if (item1->background != item2->background)
+		return item1->background ? 1 : -1;
+	if (item1->queue_round != item2->queue_round)
+		return item1->queue_round < item2->queue_round ? -1 : 1;
+	if (item1->queue_seq != item2->queue_seq)
+		return item1->queue_seq < item2->queue_seq ? -1 : 1;
+	return 0;
+}
+
+/**
+ * pk_scheduler_enqueue:
+ *
+ * Each user gets the next free round after the one last dispatched, so a
+ * user queueing hundreds of transactions cannot starve the others.
+ **/
+static void
+pk_scheduler_enqueue (PkScheduler *scheduler, PkSchedulerItem *item)
+{
+	PkSchedulerPrivate *priv = scheduler->priv;
+	PkSchedulerUser *user;
+	PkBackendJob *job;
+
+	if (item->queue_iter != NULL)
+		return;
+
+	user = pk_scheduler_get_user (scheduler, item->uid, TRUE);
+	if (user->queued == 0 || user->queue_round < priv->queue_round)
+		user->queue_round = priv->queue_round;
+	user->queue_round++;
+	user->queued++;
+	priv->queued++;
+
+	job = pk_transaction_get_backend_job (item->transaction);
+	item->interactive = job != NULL && pk_backend_job_get_interactive (job);
+	item->background = pk_transaction_get_background (item->transaction);
+	item->queue_round = user->queue_round;
+	item->queue_seq = priv->queue_seq++;
+	item->queued_at = g_get_monotonic_time ();
+	item->queue_iter = g_sequence_insert_sorted (priv->queue, item,
+						     pk_scheduler_item_compare,
+						     NULL);
+}
+
+/**
+ * pk_scheduler_dequeue:
+ **/
+static void
+pk_scheduler_dequeue (PkScheduler *scheduler, PkSchedulerItem *item)
+{
+	PkSchedulerUser *user;
+
+	if (item->queue_iter == NULL)
+		return;
+	g_sequence_remove (item->queue_iter);
+	item->queue_iter = NULL;
+	scheduler->priv->queued--;
+	user = pk_scheduler_get_user (scheduler, item->uid, FALSE);
+	if (user != NULL && user->queued > 0)
+		user->queued--;
+}
+
+/**
+ * pk_scheduler_park:
+ *
+ * Moves a queued item that cannot run yet out of the way, so finding the
+ * next transaction to run does not have to look at it again until
+ * whatever it waits for is released.
+ **/
+static void
+pk_scheduler_park (PkSchedulerItem *item, GSequence *waiting)
+{
+	g_sequence_remove (item->queue_iter);
+	item->queue_iter = g_sequence_insert_sorted (waiting, item,
+						     pk_scheduler_item_compare,
+						     NULL);
+}
+
+/**
+ * pk_scheduler_unpark:
+ **/
+static void
+pk_scheduler_unpark (PkScheduler *scheduler, GSequence *waiting)
+{
+	PkSchedulerItem *item;
+	GSequenceIter *iter;
+
+	for (;;) {
+		iter = g_sequence_get_begin_iter (waiting);
+		if (g_sequence_iter_is_end (iter))
+			break;
+		item = g_sequence_get (iter);
+		g_sequence_remove (iter);
+		item->queue_iter = g_sequence_insert_sorted (scheduler->priv->queue, item,
+							     pk_scheduler_item_compare,
+							     NULL);
 	}
-	return NULL;
+}
+
+/**
+ * pk_scheduler_item_set_running:
+ **/
+static void
+pk_scheduler_item_set_running (PkScheduler *scheduler,
+			       PkSchedulerItem *item,
+			       gboolean running)
+{
+	PkSchedulerPrivate *priv = scheduler->priv;
+	PkSchedulerUser *user;
+
+	if (item->running == running)
+		return;
+	item->running = running;
+
+	user = pk_scheduler_get_user (scheduler, item->uid, TRUE);
+	if (running) {
+		item->exclusive = pk_transaction_is_exclusive (item->transaction);
+		item->background = pk_transaction_get_background (item->transaction);
+		user->running++;
+		if (item->exclusive)
+			priv->running_exclusive++;
+		if (item->background)
+			priv->running_background++;
+		return;
+	}
+	user->running--;
+	if (item->exclusive)
+		priv->running_exclusive--;
+	if (item->background)
+		priv->running_background--;
+
+	/* what was waiting for this can be run again */
+	if (item->exclusive && priv->running_exclusive == 0)
+		pk_scheduler_unpark (scheduler, priv->waiting_exclusive);
+	if (user->running < priv->max_running_for_uid)
+		pk_scheduler_unpark (scheduler, user->waiting);
 }
 
 /**
@@ -215,9 +418,24 @@ pk_scheduler_item_free (PkSchedulerItem *item)
 		g_source_remove (item->remove_id);
 	g_object_unref (item->scheduler);
 	g_free (item->tid);
+	g_free (item->cache_key);
 	g_free (item);
 }
 
+/**
+ * pk_scheduler_unshare:
+ *
+ * Stops new transactions from subscribing to @item.
+ **/
+static void
+pk_scheduler_unshare (PkScheduler *scheduler, PkSchedulerItem *item)
+{
+	if (item->cache_key == NULL)
+		return;
+	if (g_hash_table_lookup (scheduler->priv->shared, item->cache_key) == item)
+		g_hash_table_remove (scheduler->priv->shared, item->cache_key);
+}
+
 /**
  * pk_scheduler_remove_internal:
  **/
@@ -225,6 +443,7 @@ static gboolean
 pk_scheduler_remove_internal (PkScheduler *scheduler, PkSchedulerItem *item)
 {
 	gboolean ret;
+	PkSchedulerUser *user;
 
 	g_return_val_if_fail (PK_IS_SCHEDULER (scheduler), FALSE);
 	g_return_val_if_fail (item != NULL, FALSE);
@@ -235,6 +454,14 @@ pk_scheduler_remove_internal (PkScheduler *scheduler, PkSchedulerItem *item)
 		g_warning ("could not remove %p as not present in list", item);
 		return FALSE;
 	}
+	g_hash_table_remove (scheduler->priv->items, item->tid);
+	pk_scheduler_unshare (scheduler, item);
+	pk_transaction_requeue_subscribers (item->transaction);
+	pk_scheduler_dequeue (scheduler, item);
+	pk_scheduler_item_set_running (scheduler, item, FALSE);
+	user = pk_scheduler_get_user (scheduler, item->uid, FALSE);
+	if (user != NULL && --user->items == 0)
+		g_hash_table_remove (scheduler->priv->users, GUINT_TO_POINTER (item->uid));
 	pk_scheduler_item_free (item);
 
 	return TRUE;
@@ -320,8 +547,18 @@ pk_scheduler_run_idle_cb (PkSchedulerItem *item)
 static void
 pk_scheduler_run_item (PkScheduler *scheduler, PkSchedulerItem *item)
 {
+	/* later users get queued behind this round */
+	pk_scheduler_dequeue (scheduler, item);
+	if (item->queue_round > scheduler->priv->queue_round)
+		scheduler->priv->queue_round = item->queue_round;
+	pk_statistics_add_timing (scheduler->priv->statistics,
+				  pk_transaction_get_role (item->transaction),
+				  PK_STATISTICS_TIMING_QUEUE_WAIT,
+				  (g_get_monotonic_time () - item->queued_at) / 1000);
+
 	/* we set this here so that we don't try starting more than one */
 	pk_transaction_set_state (item->transaction, PK_TRANSACTION_STATE_RUNNING);
+	pk_scheduler_item_set_running (scheduler, item, TRUE);
 
 	/* add this idle, so that we don't have a deep out-of-order callchain */
 	item->idle_id = g_idle_add ((GSourceFunc) pk_scheduler_run_idle_cb, item);
@@ -398,79 +635,113 @@ pk_scheduler_get_exclusive_running (PkScheduler *scheduler)
 static gboolean
 pk_scheduler_get_background_running (PkScheduler *scheduler)
 {
-	PkSchedulerItem *item = NULL;
-	guint i;
-	g_autoptr(GPtrArray) array = NULL;
-
 	g_return_val_if_fail (PK_IS_SCHEDULER (scheduler), FALSE);
-
-	/* anything running? */
-	array = pk_scheduler_get_active_transactions (scheduler);
-	if (array->len == 0)
-		return FALSE;
-
-	/* check if we have any running background transaction */
-	for (i = 0; i < array->len; i++) {
-		item = (PkSchedulerItem *) g_ptr_array_index (array, i);
-		if (pk_transaction_get_background (item->transaction))
-			return TRUE;
-	}
-	return FALSE;
+	return scheduler->priv->running_background > 0;
 }
 
 /**
  * pk_scheduler_get_next_item:
+ *
+ * Returns the first queued transaction that can be run now. The ones
+ * waiting for the exclusive lock or for the user to drop below the
+ * MaximumRunningTransactionsPerUser limit are parked until that happens,
+ * so each is only looked at once however long it has to wait.
  **/
 static PkSchedulerItem *
 pk_scheduler_get_next_item (PkScheduler *scheduler)
 {
-	PkSchedulerItem *item = NULL;
-	GPtrArray *array;
-	guint i;
-	PkTransactionState state;
-	gboolean exclusive_running;
-
-	array = scheduler->priv->array;
-
-	/* check for running exclusive transaction */
-	exclusive_running = pk_scheduler_get_exclusive_running (scheduler) > 0;
+	PkSchedulerPrivate *priv = scheduler->priv;
+	PkSchedulerItem *item;
+	PkSchedulerUser *user;
+	GSequenceIter *iter;
+
+	for (;;) {
+		iter = g_sequence_get_begin_iter (priv->queue);
+		if (g_sequence_iter_is_end (iter))
+			break;
+		item = g_sequence_get (iter);
+
+		/* committing it again queues it again */
+		if (pk_transaction_get_state (item->transaction) != PK_TRANSACTION_STATE_READY) {
+			pk_scheduler_dequeue (scheduler, item);
+			continue;
+		}
 
-	/* first try the waiting non-background transactions */
-	for (i = 0; i < array->len; i++) {
-		item = (PkSchedulerItem *) g_ptr_array_index (array, i);
-		state = pk_transaction_get_state (item->transaction);
+		/* check if we can run the transaction now or if we need to wait for lock release */
+		if (priv->running_exclusive > 0 &&
+		    pk_transaction_is_exclusive (item->transaction)) {
+			pk_scheduler_park (item, priv->waiting_exclusive);
+			continue;
+		}
 
-		if ((state == PK_TRANSACTION_STATE_READY) && (!pk_transaction_get_background (item->transaction))) {
-			/* check if we can run the transaction now or if we need to wait for lock release */
-			if (pk_transaction_is_exclusive (item->transaction)) {
-				if (!exclusive_running)
-					goto out;
-			} else {
-				goto out;
+		/* this user already has as many running as allowed */
+		if (priv->max_running_for_uid > 0) {
+			user = pk_scheduler_get_user (scheduler, item->uid, FALSE);
+			if (user != NULL && user->running >= priv->max_running_for_uid) {
+				pk_scheduler_park (item, user->waiting);
+				continue;
 			}
 		}
+		return item;
 	}
 
-	/* then try the other waiting transactions (background tasks) */
-	for (i = 0; i < array->len; i++) {
-		item = (PkSchedulerItem *) g_ptr_array_index (array, i);
-		state = pk_transaction_get_state (item->transaction);
+	/* nothing to run */
+	return NULL;
+}
 
-		if (state == PK_TRANSACTION_STATE_READY) {
-			/* check if we can run the transaction now or if we need to wait for lock release */
-			if (pk_transaction_is_exclusive (item->transaction)) {
-				if (!exclusive_running)
-					goto out;
-			} else {
-				goto out;
-			}
-		}
+/**
+ * pk_scheduler_run_queued:
+ **/
+static void
+pk_scheduler_run_queued (PkScheduler *scheduler)
+{
+	PkSchedulerItem *item;
+
+	while ((item = pk_scheduler_get_next_item (scheduler)) != NULL) {
+		g_debug ("running %s", item->tid);
+		pk_scheduler_run_item (scheduler, item);
 	}
+}
 
-	/* nothing to run */
-	item = NULL;
-out:
-	return item;
+/**
+ * pk_scheduler_subscribe:
+ *
+ * Attaches @item to an identical read-only transaction that is already
+ * queued or running, so the backend only does the work once.
+ *
+ * Return value: %TRUE if @item does not need to be run itself
+ **/
+static gboolean
+pk_scheduler_subscribe (PkScheduler *scheduler, PkSchedulerItem *item)
+{
+	PkSchedulerItem *leader;
+
+	pk_scheduler_unshare (scheduler, item);
+	g_free (item->cache_key);
+	item->cache_key = pk_transaction_get_cache_key (item->transaction);
+	if (item->cache_key == NULL)
+		return FALSE;
+
+	/* the one we were sharing was cancelled, so take its place */
+	leader = g_hash_table_lookup (scheduler->priv->shared, item->cache_key);
+	if (leader != NULL && !pk_transaction_is_shareable (leader->transaction)) {
+		pk_scheduler_unshare (scheduler, leader);
+		leader = NULL;
+	}
+	if (leader == NULL) {
+		g_hash_table_insert (scheduler->priv->shared, item->cache_key, item);
+		return FALSE;
+	}
+
+	/* a background transaction could be cancelled under us */
+	if (pk_transaction_get_background (leader->transaction) &&
+	    !pk_transaction_get_background (item->transaction))
+		return FALSE;
+
+	g_debug ("%s is identical to %s", item->tid, leader->tid);
+	pk_transaction_subscribe (leader->transaction, item->transaction);
+	pk_transaction_set_state (item->transaction, PK_TRANSACTION_STATE_RUNNING);
+	return TRUE;
 }
 
 /**
@@ -489,9 +760,12 @@ pk_scheduler_commit (PkScheduler *scheduler, const gchar *tid)
 		g_warning ("could not get transaction: %s", tid);
 		return;
 	}
+	PK_TRACE2 (scheduler__commit, tid, pk_transaction_get_role (item->transaction));
 
-	/* treat all transactions as exclusive if backend does not support parallelization */
-	if (!pk_backend_supports_parallelization (scheduler->priv->backend))
+	/* treat all transactions as exclusive if backend does not support
+	 * running this role in parallel */
+	if (!pk_backend_supports_shared_role (scheduler->priv->backend,
+					      pk_transaction_get_role (item->transaction)))
 		pk_transaction_make_exclusive (item->transaction);
 
 	/* we've been 'used' */
@@ -503,6 +777,10 @@ pk_scheduler_commit (PkScheduler *scheduler, const gchar *tid)
 	/* we will changed what is running */
 	g_signal_emit (scheduler, signals [PK_SCHEDULER_CHANGED], 0);
 
+	/* the same query is already in progress */
+	if (pk_scheduler_subscribe (scheduler, item))
+		return;
+
 	/* is one of the current running transactions background, and this new
 	 * transaction foreground? */
 	if (!pk_transaction_get_background (item->transaction) &&
@@ -513,9 +791,8 @@ pk_scheduler_commit (PkScheduler *scheduler, const gchar *tid)
 	}
 
 	/* do the transaction now, if possible */
-	if (pk_transaction_is_exclusive (item->transaction) == FALSE ||
-	    pk_scheduler_get_exclusive_running (scheduler) == 0)
-		pk_scheduler_run_item (scheduler, item);
+	pk_scheduler_enqueue (scheduler, item);
+	pk_scheduler_run_queued (scheduler);
 }
 
 /**
@@ -575,6 +852,10 @@ pk_scheduler_transaction_finished_cb (PkTransaction *transaction,
 		return;
 	}
 
+	/* no longer counts against the user or the exclusive lock */
+	pk_scheduler_dequeue (scheduler, item);
+	pk_scheduler_item_set_running (scheduler, item, FALSE);
+
 	if (pk_transaction_is_finished_with_lock_required (item->transaction)) {
 		pk_transaction_reset_after_lock_error (item->transaction);
 
@@ -601,6 +882,7 @@ pk_scheduler_transaction_finished_cb (PkTransaction *transaction,
 			g_source_remove (item->commit_id);
 			item->commit_id = 0;
 		}
+		pk_scheduler_unshare (scheduler, item);
 		pk_transaction_set_state (item->transaction, PK_TRANSACTION_STATE_FINISHED);
 
 		/* give the client a few seconds to still query the runner */
@@ -610,12 +892,8 @@ pk_scheduler_transaction_finished_cb (PkTransaction *transaction,
 		g_source_set_name_by_id (item->remove_id, "[PkScheduler] remove");
 	}
 
-	/* try to run the next transaction, if possible */
-	item = pk_scheduler_get_next_item (scheduler);
-	if (item != NULL) {
-		g_debug ("running %s as previous one finished", item->tid);
-		pk_scheduler_run_item (scheduler, item);
-	}
+	/* try to run the next transactions, if possible */
+	pk_scheduler_run_queued (scheduler);
 
 	/* we have changed what is running */
 	g_signal_emit (scheduler, signals [PK_SCHEDULER_CHANGED], 0);
@@ -643,19 +921,11 @@ pk_scheduler_no_commit_cb (gpointer user_data)
 static guint
 pk_scheduler_get_number_transactions_for_uid (PkScheduler *scheduler, guint uid)
 {
-	guint i;
-	GPtrArray *array;
-	PkSchedulerItem *item;
-	guint count = 0;
-
-	/* find all the transactions in progress */
-	array = scheduler->priv->array;
-	for (i = 0; i < array->len; i++) {
-		item = (PkSchedulerItem *) g_ptr_array_index (array, i);
-		if (item->uid == uid)
-			count++;
-	}
-	return count;
+	PkSchedulerUser *user;
+	user = pk_scheduler_get_user (scheduler, uid, FALSE);
+	if (user == NULL)
+		return 0;
+	return user->items;
 }
 
 /**
@@ -733,7 +1003,7 @@ pk_scheduler_create (PkScheduler *scheduler,
 	count = pk_scheduler_get_number_transactions_for_uid (scheduler, item->uid);
 
 	/* would this take us over the maximum number of requests allowed */
-	if (count > PK_SCHEDULER_SIMULTANEOUS_TRANSACTIONS_FOR_UID) {
+	if (count > scheduler->priv->max_transactions_for_uid) {
 		g_set_error (error, 1, 0,
 			     "failed to allocate %s as uid %i already has "
 			     "%i transactions in progress",
@@ -751,6 +1021,8 @@ pk_scheduler_create (PkScheduler *scheduler,
 
 	g_debug ("adding transaction %p", item->transaction);
 	g_ptr_array_add (scheduler->priv->array, item);
+	g_hash_table_insert (scheduler->priv->items, item->tid, item);
+	pk_scheduler_get_user (scheduler, item->uid, TRUE)->items++;
 	return TRUE;
 }
 
@@ -913,6 +1185,88 @@ pk_scheduler_get_size (PkScheduler *scheduler)
 	return scheduler->priv->array->len;
 }
 
+/**
+ * pk_scheduler_get_queue_depth:
+ * @running: (out) (allow-none): the number of transactions running
+ *
+ * Return value: the number of committed transactions waiting to run
+ **/
+guint
+pk_scheduler_get_queue_depth (PkScheduler *scheduler, guint *running)
+{
+	PkSchedulerItem *item;
+	guint i;
+
+	g_return_val_if_fail (PK_IS_SCHEDULER (scheduler), 0);
+
+	if (running != NULL) {
+		*running = 0;
+		for (i = 0; i < scheduler->priv->array->len; i++) {
+			item = g_ptr_array_index (scheduler->priv->array, i);
+			if (item->running)
+				(*running)++;
+		}
+	}
+	return scheduler->priv->queued;
+}
+
+/**
+ * pk_scheduler_get_queue:
+ *
+ * Return value: the IDs of the committed transactions waiting to run, in
+ * the order they will be run in
+ **/
+gchar **
+pk_scheduler_get_queue (PkScheduler *scheduler)
+{
+	GSequenceIter *iter;
+	GPtrArray *array;
+	PkSchedulerItem *item;
+	guint i;
+	g_autoptr(GSequence) queue = NULL;
+
+	g_return_val_if_fail (PK_IS_SCHEDULER (scheduler), NULL);
+
+	queue = g_sequence_new (NULL);
+	for (i = 0; i < scheduler->priv->array->len; i++) {
+		item = g_ptr_array_index (scheduler->priv->array, i);
+		if (item->queue_iter != NULL)
+			g_sequence_insert_sorted (queue, item, pk_scheduler_item_compare, NULL);
+	}
+	array = g_ptr_array_new ();
+	iter = g_sequence_get_begin_iter (queue);
+	for (; !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
+		item = g_sequence_get (iter);
+		g_ptr_array_add (array, g_strdup (item->tid));
+	}
+	g_ptr_array_add (array, NULL);
+	return (gchar **) g_ptr_array_free (array, FALSE);
+}
+
+/**
+ * pk_scheduler_set_uid:
+ *
+ * Makes a transaction that has not been committed yet count as @uid's.
+ **/
+void
+pk_scheduler_set_uid (PkScheduler *scheduler, const gchar *tid, guint uid)
+{
+	PkSchedulerItem *item;
+	PkSchedulerUser *user;
+
+	g_return_if_fail (PK_IS_SCHEDULER (scheduler));
+
+	item = pk_scheduler_get_from_tid (scheduler, tid);
+	g_return_if_fail (item != NULL);
+	g_return_if_fail (item->queue_iter == NULL && !item->running);
+
+	user = pk_scheduler_get_user (scheduler, item->uid, FALSE);
+	if (user != NULL && --user->items == 0)
+		g_hash_table_remove (scheduler->priv->users, GUINT_TO_POINTER (item->uid));
+	item->uid = uid;
+	pk_scheduler_get_user (scheduler, item->uid, TRUE)->items++;
+}
+
 /**
  * pk_scheduler_get_state:
  **/
@@ -1108,6 +1462,13 @@ pk_scheduler_init (PkScheduler *scheduler)
 {
 	scheduler->priv = PK_SCHEDULER_GET_PRIVATE (scheduler);
 	scheduler->priv->array = g_ptr_array_new ();
+	scheduler->priv->items = g_hash_table_new (g_str_hash, g_str_equal);
+	scheduler->priv->users = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+							NULL, (GDestroyNotify) pk_scheduler_user_free);
+	scheduler->priv->shared = g_hash_table_new (g_str_hash, g_str_equal);
+	scheduler->priv->queue = g_sequence_new (NULL);
+	scheduler->priv->waiting_exclusive = g_sequence_new (NULL);
+	scheduler->priv->statistics = pk_statistics_new ();
 	scheduler->priv->introspection = pk_load_introspection (PK_DBUS_INTERFACE_TRANSACTION ".xml",
 							    NULL);
 	scheduler->priv->unwedge_id = g_timeout_add_seconds (PK_TRANSACTION_WEDGE_CHECK,
@@ -1133,10 +1494,16 @@ pk_scheduler_finalize (GObject *object)
 	if (scheduler->priv->unwedge_id != 0)
 		g_source_remove (scheduler->priv->unwedge_id);
 
+	g_sequence_free (scheduler->priv->queue);
+	g_sequence_free (scheduler->priv->waiting_exclusive);
+	g_hash_table_unref (scheduler->priv->items);
+	g_hash_table_unref (scheduler->priv->users);
+	g_hash_table_unref (scheduler->priv->shared);
 	g_ptr_array_foreach (scheduler->priv->array, (GFunc) pk_scheduler_item_free, NULL);
 	g_ptr_array_free (scheduler->priv->array, TRUE);
 	g_dbus_node_info_unref (scheduler->priv->introspection);
 	g_key_file_unref (scheduler->priv->conf);
+	g_object_unref (scheduler->priv->statistics);
 	if (scheduler->priv->backend != NULL)
 		g_object_unref (scheduler->priv->backend);
 
@@ -1151,8 +1518,16 @@ pk_scheduler_finalize (GObject *object)
 PkScheduler *
 pk_scheduler_new (GKeyFile *conf)
 {
+	gint max;
 	PkScheduler *scheduler = PK_SCHEDULER (g_object_new (PK_TYPE_SCHEDULER, NULL));
 	scheduler->priv->conf = g_key_file_ref (conf);
+
+	/* per-user limits, 0 means the default */
+	max = g_key_file_get_integer (conf, "Daemon", "MaximumTransactionsPerUser", NULL);
+	scheduler->priv->max_transactions_for_uid = max > 0 ? (guint) max :
+		PK_SCHEDULER_SIMULTANEOUS_TRANSACTIONS_FOR_UID;
+	max = g_key_file_get_integer (conf, "Daemon", "MaximumRunningTransactionsPerUser", NULL);
+	scheduler->priv->max_running_for_uid = MAX (max, 0);
 	return scheduler;
 }
 
@@ -71,6 +71,8 @@ gchar		**pk_scheduler_get_array	(PkScheduler	*scheduler)
 gchar		*pk_scheduler_get_state		(PkScheduler	*scheduler)
 						 G_GNUC_WARN_UNUSED_RESULT;
 guint		 pk_scheduler_get_size		(PkScheduler	*scheduler);
+guint		 pk_scheduler_get_queue_depth	(PkScheduler	*scheduler,
+						 guint		*running);
 gboolean	 pk_scheduler_get_locked	(PkScheduler	*scheduler);
 gboolean	 pk_scheduler_get_inhibited	(PkScheduler	*scheduler);
 PkTransaction	*pk_scheduler_get_transaction	(PkScheduler	*scheduler,
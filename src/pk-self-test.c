@@ -27,15 +27,19 @@
 
 #include "pk-backend.h"
 #include "pk-backend-spawn.h"
+#include "pk-cache.h"
 #include "pk-dbus.h"
 #include "pk-engine.h"
 #include "pk-spawn.h"
+#include "pk-statistics.h"
 #include "pk-transaction-db.h"
 #include "pk-transaction.h"
 #include "pk-transaction-private.h"
 #include "pk-scheduler.h"
+#include "pk-scheduler-private.h"
 
 
+#define PK_TRANSACTION_ERROR_NOT_SUPPORTED	4
 #define PK_TRANSACTION_ERROR_INPUT_INVALID	14
 
 /** ver:1.0 ***********************************************************/
@@ -484,13 +488,207 @@ pk_test_backend_spawn_func (void)
 	g_object_unref (backend_spawn);
 }
 
+static void
+pk_test_backend_spawn_parse_func (void)
+{
+	gboolean ret;
+	gdouble elapsed;
+	guint count = 0;
+	guint i;
+	guint j;
+	guint repeats;
+	g_autofree gchar *data = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GKeyFile) conf = NULL;
+	g_autoptr(PkBackend) backend = NULL;
+	g_autoptr(PkBackendJob) job = NULL;
+	PkBackendSpawn *backend_spawn;
+	g_auto(GStrv) lines = NULL;
+
+	/* captured output from a helper */
+	ret = g_file_get_contents (TESTDATADIR "/pk-backend-spawn-replay.txt",
+				   &data, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	lines = g_strsplit (data, "\n", -1);
+
+	conf = g_key_file_new ();
+	g_key_file_set_string (conf, "Daemon", "DefaultBackend", "test_spawn");
+	backend_spawn = pk_backend_spawn_new (conf);
+	ret = pk_backend_spawn_set_name (backend_spawn, "test_spawn");
+	g_assert (ret);
+	backend = pk_backend_new (conf);
+	job = pk_backend_job_new (conf);
+	pk_backend_job_set_backend (job, backend);
+	ret = pk_backend_load (backend, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* replay it lots of times when benchmarking */
+	repeats = g_test_perf () ? 10000 : 1;
+	g_test_timer_start ();
+	for (j = 0; j < repeats; j++) {
+		for (i = 0; lines[i] != NULL; i++) {
+			if (lines[i][0] == '\0')
+				continue;
+			ret = pk_backend_spawn_inject_data (backend_spawn, job, lines[i], &error);
+			g_assert_no_error (error);
+			g_assert (ret);
+			count++;
+		}
+	}
+	elapsed = g_test_timer_elapsed ();
+	g_test_minimized_result (elapsed * 1000000000 / count,
+				 "parsed %u lines in %.3fs", count, elapsed);
+
+	/* manually unlock as we have no engine */
+	ret = pk_backend_unload (backend);
+	g_assert (ret);
+	g_object_unref (backend_spawn);
+}
+
+/**
+ * pk_test_dbus_lookup_cb:
+ **/
+static void
+pk_test_dbus_lookup_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+
+	ret = pk_dbus_lookup_finish (PK_DBUS (source_object), res, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	_g_test_loop_quit ();
+}
+
+static void
+pk_test_statistics_func (void)
+{
+	GVariantBuilder builder;
+	guint64 count;
+	g_autoptr(GVariant) dict = NULL;
+	g_autoptr(GVariant) roles = NULL;
+	g_autoptr(GVariant) resolve = NULL;
+	g_autoptr(GVariant) runtime = NULL;
+	g_autoptr(GVariant) buckets = NULL;
+	g_autoptr(PkStatistics) statistics = NULL;
+	g_autoptr(PkStatistics) statistics2 = NULL;
+	const guint64 *values;
+	gsize len;
+
+	/* shared instance */
+	statistics = pk_statistics_new ();
+	statistics2 = pk_statistics_new ();
+	g_assert (statistics == statistics2);
+
+	pk_statistics_add_finished (statistics, PK_ROLE_ENUM_RESOLVE, PK_EXIT_ENUM_SUCCESS);
+	pk_statistics_add_finished (statistics, PK_ROLE_ENUM_RESOLVE, PK_EXIT_ENUM_CANCELLED);
+	pk_statistics_add_timing (statistics, PK_ROLE_ENUM_RESOLVE,
+				  PK_STATISTICS_TIMING_RUNTIME, 3);
+	pk_statistics_add_timing (statistics, PK_ROLE_ENUM_RESOLVE,
+				  PK_STATISTICS_TIMING_RUNTIME, 120000);
+	pk_statistics_add_packages (statistics, 42);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	pk_statistics_to_builder (statistics, &builder);
+	dict = g_variant_ref_sink (g_variant_builder_end (&builder));
+	g_assert (g_variant_lookup (dict, "packages-emitted", "t", &count));
+	g_assert_cmpint (count, ==, 42);
+
+	/* only roles that were used */
+	roles = g_variant_lookup_value (dict, "roles", G_VARIANT_TYPE_VARDICT);
+	g_assert (roles != NULL);
+	g_assert (!g_variant_lookup (roles, "remove-packages", "@a{sv}", NULL));
+	resolve = g_variant_lookup_value (roles, "resolve", G_VARIANT_TYPE_VARDICT);
+	g_assert (resolve != NULL);
+	g_assert (g_variant_lookup (resolve, "transactions", "t", &count));
+	g_assert_cmpint (count, ==, 2);
+	g_assert (g_variant_lookup (resolve, "cancelled", "t", &count));
+	g_assert_cmpint (count, ==, 1);
+
+	/* one in the 5ms bucket, one slower than the last bound */
+	runtime = g_variant_lookup_value (resolve, "runtime", G_VARIANT_TYPE_VARDICT);
+	g_assert (runtime != NULL);
+	buckets = g_variant_lookup_value (runtime, "buckets", G_VARIANT_TYPE ("at"));
+	values = g_variant_get_fixed_array (buckets, &len, sizeof (guint64));
+	g_assert_cmpint (len, ==, 11);
+	g_assert_cmpint (values[1], ==, 1);
+	g_assert_cmpint (values[10], ==, 1);
+}
+
+static void
+pk_test_cache_func (void)
+{
+	guint generation;
+	PkCacheStats stats;
+	g_autoptr(PkCache) cache = NULL;
+	g_autoptr(PkResults) results = NULL;
+	g_autoptr(PkResults) tmp = NULL;
+
+	cache = pk_cache_new ();
+	results = pk_results_new ();
+	pk_cache_set_max_size (cache, 2);
+
+	/* miss, then hit */
+	generation = pk_cache_get_generation (cache);
+	tmp = pk_cache_lookup (cache, "get-updates");
+	g_assert (tmp == NULL);
+	pk_cache_insert (cache, "get-updates", generation, results);
+	tmp = pk_cache_lookup (cache, "get-updates");
+	g_assert (tmp == results);
+	g_clear_object (&tmp);
+
+	/* least recently used is dropped */
+	pk_cache_insert (cache, "resolve", generation, results);
+	pk_cache_insert (cache, "search-name", generation, results);
+	tmp = pk_cache_lookup (cache, "get-updates");
+	g_assert (tmp == NULL);
+	pk_cache_get_stats (cache, &stats);
+	g_assert_cmpint (stats.hits, ==, 1);
+	g_assert_cmpint (stats.misses, ==, 2);
+	g_assert_cmpint (stats.evictions, ==, 1);
+	g_assert_cmpint (stats.size, ==, 2);
+
+	/* results from before an invalidation are not added */
+	pk_cache_invalidate (cache, "test");
+	pk_cache_insert (cache, "resolve", generation, results);
+	pk_cache_get_stats (cache, &stats);
+	g_assert_cmpint (stats.size, ==, 0);
+	g_assert_cmpint (stats.invalidations, ==, 1);
+
+	/* old results are not reused */
+	pk_cache_set_max_age (cache, 1);
+	generation = pk_cache_get_generation (cache);
+	pk_cache_insert (cache, "resolve", generation, results);
+	g_usleep (G_USEC_PER_SEC + G_USEC_PER_SEC / 10);
+	tmp = pk_cache_lookup (cache, "resolve");
+	g_assert (tmp == NULL);
+	pk_cache_get_stats (cache, &stats);
+	g_assert_cmpint (stats.size, ==, 0);
+}
+
 static void
 pk_test_dbus_func (void)
 {
+	g_autofree gchar *cmdline = NULL;
+	g_autofree gchar *session = NULL;
 	g_autoptr(PkDbus) dbus = NULL;
 
 	dbus = pk_dbus_new ();
 	g_assert (dbus != NULL);
+
+	/* look up the self-test sender without blocking */
+	pk_dbus_lookup_async (dbus, ":org.freedesktop.PackageKit", NULL,
+			      pk_test_dbus_lookup_cb, NULL);
+	_g_test_loop_run_with_timeout (5000);
+
+	/* these should now all be known */
+	g_assert_cmpint (pk_dbus_get_uid (dbus, ":org.freedesktop.PackageKit"), ==, 500);
+	cmdline = pk_dbus_get_cmdline (dbus, ":org.freedesktop.PackageKit");
+	g_assert_cmpstr (cmdline, ==, "/usr/sbin/packagekit");
+	session = pk_dbus_get_session (dbus, ":org.freedesktop.PackageKit");
+	g_assert_cmpstr (session, ==, "xxx");
 }
 
 PkSpawnExitType mexit = PK_SPAWN_EXIT_TYPE_UNKNOWN;
@@ -519,6 +717,63 @@ pk_test_stdout_cb (PkSpawn *spawn, const gchar *line, gpointer user_data)
 	stdout_count++;
 }
 
+guint latency_count = 0;
+gint64 latency_total = 0;
+gint64 latency_max = 0;
+
+/**
+ * pk_test_latency_cb:
+ **/
+static void
+pk_test_latency_cb (PkSpawn *spawn, const gchar *line, gpointer user_data)
+{
+	gint64 latency;
+
+	if (!g_str_has_prefix (line, "time\t"))
+		return;
+	latency = g_get_real_time () - g_ascii_strtoll (line + 5, NULL, 10);
+	latency_total += latency;
+	latency_max = MAX (latency_max, latency);
+	latency_count++;
+}
+
+/**
+ * pk_test_frame_append:
+ **/
+static void
+pk_test_frame_append (GString *string, const gchar *command, const gchar * const *args)
+{
+	GVariant *frame;
+	guint32 size;
+
+	frame = g_variant_ref_sink (g_variant_new ("(s^as)", command, args));
+	size = GUINT32_TO_LE (g_variant_get_size (frame));
+	g_string_append_len (string, PK_SPAWN_FRAME_MAGIC, PK_SPAWN_FRAME_MAGIC_LEN);
+	g_string_append_len (string, (const gchar *) &size, sizeof (size));
+	g_string_append_len (string, g_variant_get_data (frame), g_variant_get_size (frame));
+	g_variant_unref (frame);
+}
+
+/**
+ * pk_test_frame_switch_cb:
+ **/
+static void
+pk_test_frame_switch_cb (PkSpawn *spawn, const gchar *line, gpointer user_data)
+{
+	if (g_strcmp0 (line, "framing\tgvariant") == 0)
+		pk_spawn_set_framing (spawn, PK_SPAWN_FRAMING_GVARIANT);
+}
+
+/**
+ * pk_test_frame_cb:
+ **/
+static void
+pk_test_frame_cb (PkSpawn *spawn, GVariant *frame, gpointer user_data)
+{
+	GPtrArray *frames = (GPtrArray *) user_data;
+	g_ptr_array_add (frames, g_variant_print (frame, FALSE));
+}
+
 static gboolean
 cancel_cb (gpointer data)
 {
@@ -558,6 +813,13 @@ pk_test_spawn_func (void)
 	g_autoptr(PkSpawn) spawn = NULL;
 	g_auto(GStrv) argv = NULL;
 	g_auto(GStrv) envp = NULL;
+	GString *frame_data;
+	GPtrArray *frames;
+	gchar *frame_file = NULL;
+	gint fd;
+	const gchar *frame_args_percentage[] = { "10", NULL };
+	const gchar *frame_args_package[] = { "installed", "foo;1.0;x86_64;fedora", "Foo", NULL };
+	const gchar *frame_args_finished[] = { NULL };
 
 	new_spawn_object (&spawn);
 
@@ -677,6 +939,90 @@ pk_test_spawn_func (void)
 	/* get new object */
 	new_spawn_object (&spawn);
 
+	/* lines should be processed as they are written, not when we poll */
+	mexit = PK_SPAWN_EXIT_TYPE_UNKNOWN;
+	g_signal_connect (spawn, "stdout",
+			  G_CALLBACK (pk_test_latency_cb), NULL);
+	argv = g_strsplit (TESTDATADIR "/pk-spawn-test-latency.sh", " ", 0);
+	ret = pk_spawn_argv (spawn, argv, NULL, PK_SPAWN_ARGV_FLAGS_NONE, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_strfreev (argv);
+
+	/* wait for finished */
+	_g_test_loop_run_with_timeout (10000);
+	g_assert_cmpint (mexit, ==, PK_SPAWN_EXIT_TYPE_SUCCESS);
+	g_assert_cmpint (latency_count, ==, 20);
+	g_test_message ("per-line latency: average %" G_GINT64_FORMAT "us, max %" G_GINT64_FORMAT "us",
+			latency_total / latency_count, latency_max);
+
+	/* get new object */
+	new_spawn_object (&spawn);
+
+	/* frames are decoded, and anything else on stdout is skipped */
+	frame_data = g_string_new ("framing\tgvariant\n");
+	pk_test_frame_append (frame_data, "percentage", frame_args_percentage);
+	g_string_append (frame_data, "stray text from a library\n");
+	pk_test_frame_append (frame_data, "package", frame_args_package);
+	g_string_append_len (frame_data, PK_SPAWN_FRAME_MAGIC "\xff\xff\xff\xff", 8);
+	pk_test_frame_append (frame_data, "finished", frame_args_finished);
+	fd = g_file_open_tmp ("pk-spawn-test-frames-XXXXXX", &frame_file, &error);
+	g_assert_no_error (error);
+	g_assert_cmpint (fd, >=, 0);
+	g_close (fd, NULL);
+	ret = g_file_set_contents (frame_file, frame_data->str, frame_data->len, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_string_free (frame_data, TRUE);
+
+	mexit = PK_SPAWN_EXIT_TYPE_UNKNOWN;
+	frames = g_ptr_array_new_with_free_func (g_free);
+	g_signal_connect (spawn, "stdout",
+			  G_CALLBACK (pk_test_frame_switch_cb), NULL);
+	g_signal_connect (spawn, "stdout-frame",
+			  G_CALLBACK (pk_test_frame_cb), frames);
+	argv = g_new0 (gchar *, 3);
+	argv[0] = g_strdup ("cat");
+	argv[1] = g_strdup (frame_file);
+	ret = pk_spawn_argv (spawn, argv, NULL, PK_SPAWN_ARGV_FLAGS_NONE, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_strfreev (argv);
+
+	/* wait for finished */
+	_g_test_loop_run_with_timeout (10000);
+	g_assert_cmpint (mexit, ==, PK_SPAWN_EXIT_TYPE_SUCCESS);
+	g_assert_cmpint (stdout_count, ==, 1);
+	g_assert_cmpint (frames->len, ==, 3);
+	g_assert_cmpstr (g_ptr_array_index (frames, 0), ==, "('percentage', ['10'])");
+	g_assert_cmpstr (g_ptr_array_index (frames, 1), ==,
+			 "('package', ['installed', 'foo;1.0;x86_64;fedora', 'Foo'])");
+	g_assert_cmpstr (g_ptr_array_index (frames, 2), ==, "('finished', [])");
+	g_ptr_array_unref (frames);
+	g_unlink (frame_file);
+	g_free (frame_file);
+
+	/* get new object */
+	new_spawn_object (&spawn);
+
+	/* make sure a large burst of output is processed quickly */
+	mexit = PK_SPAWN_EXIT_TYPE_UNKNOWN;
+	argv = g_strsplit (TESTDATADIR "/pk-spawn-test.sh 100000", " ", 0);
+	g_test_timer_start ();
+	ret = pk_spawn_argv (spawn, argv, NULL, PK_SPAWN_ARGV_FLAGS_NONE, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_strfreev (argv);
+
+	/* wait for finished */
+	_g_test_loop_run_with_timeout (10000);
+	g_assert_cmpint (mexit, ==, PK_SPAWN_EXIT_TYPE_SUCCESS);
+	g_assert_cmpint (stdout_count, ==, 100000);
+	g_assert_cmpfloat (g_test_timer_elapsed (), <, 2.0);
+
+	/* get new object */
+	new_spawn_object (&spawn);
+
 	/* run the dispatcher */
 	mexit = PK_SPAWN_EXIT_TYPE_UNKNOWN;
 	argv = g_strsplit (TESTDATADIR "/pk-spawn-dispatcher.py\tsearch-name\tnone\tpower manager", "\t", 0);
@@ -730,12 +1076,34 @@ pk_test_spawn_func (void)
 	g_assert (!ret);
 }
 
+/**
+ * pk_test_transaction_signal_cb:
+ **/
+static void
+pk_test_transaction_signal_cb (GDBusConnection *connection,
+			       const gchar *sender_name,
+			       const gchar *object_path,
+			       const gchar *interface_name,
+			       const gchar *signal_name,
+			       GVariant *parameters,
+			       gpointer user_data)
+{
+	GPtrArray *signals = (GPtrArray *) user_data;
+	g_ptr_array_add (signals, g_strdup (signal_name));
+	if (g_strcmp0 (signal_name, "PropertiesChanged") == 0)
+		_g_test_loop_quit ();
+}
+
 static void
 pk_test_transaction_func (void)
 {
 	gboolean ret;
+	guint i;
+	guint subscription;
 	GError *error = NULL;
 	GDBusNodeInfo *introspection;
+	g_autoptr(GDBusConnection) connection = NULL;
+	g_autoptr(GPtrArray) signals = NULL;
 	g_autoptr(PkTransaction) transaction = NULL;
 	g_autoptr(GKeyFile) conf = NULL;
 
@@ -759,18 +1127,97 @@ pk_test_transaction_func (void)
 	g_assert (ret);
 	g_clear_error (&error);
 
+	/* watch what the transaction sends */
+	ret = pk_transaction_set_tid (transaction, "/42_plural_data");
+	g_assert (ret);
+	connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+	g_assert (connection != NULL);
+	signals = g_ptr_array_new_with_free_func (g_free);
+	subscription = g_dbus_connection_signal_subscribe (connection,
+							   NULL, NULL, NULL,
+							   "/42_plural_data",
+							   NULL,
+							   G_DBUS_SIGNAL_FLAGS_NONE,
+							   pk_test_transaction_signal_cb,
+							   signals, NULL);
+
+	/* the hint only takes true or false */
+	ret = pk_transaction_set_hint (transaction, "supports-plural-signals", "yes", &error);
+	g_assert_error (error, PK_TRANSACTION_ERROR, PK_TRANSACTION_ERROR_NOT_SUPPORTED);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = pk_transaction_set_hint (transaction, "supports-plural-signals", "true", &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the packages are batched, and sent before the property change */
+	for (i = 0; i < 2; i++) {
+		g_autoptr(PkPackage) item = pk_package_new ();
+		g_autofree gchar *package_id = g_strdup_printf ("plural%u;0.1;noarch;data", i);
+		ret = pk_package_set_id (item, package_id, &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+		pk_package_set_info (item, PK_INFO_ENUM_AVAILABLE);
+		pk_transaction_package_cb (NULL, item, transaction);
+	}
+	pk_transaction_set_role (transaction, PK_ROLE_ENUM_SEARCH_NAME);
+	_g_test_loop_run_with_timeout (5000);
+	g_assert_cmpint (signals->len, ==, 2);
+	g_assert_cmpstr (g_ptr_array_index (signals, 0), ==, "Packages");
+	g_assert_cmpstr (g_ptr_array_index (signals, 1), ==, "PropertiesChanged");
+	g_dbus_connection_signal_unsubscribe (connection, subscription);
+
 	g_dbus_node_info_unref (introspection);
 }
 
+/**
+ * pk_test_transaction_db_flush_cb:
+ **/
+static void
+pk_test_transaction_db_flush_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	gboolean *flushed = (gboolean *) user_data;
+	g_autoptr(GError) error = NULL;
+
+	*flushed = pk_transaction_db_flush_finish (PK_TRANSACTION_DB (source_object), res, &error);
+	g_assert_no_error (error);
+	_g_test_loop_quit ();
+}
+
+/**
+ * pk_test_transaction_db_compact_cb:
+ **/
+static void
+pk_test_transaction_db_compact_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	gboolean *compacted = (gboolean *) user_data;
+	g_autoptr(GError) error = NULL;
+
+	*compacted = pk_transaction_db_compact_finish (PK_TRANSACTION_DB (source_object), res, &error);
+	g_assert_no_error (error);
+	_g_test_loop_quit ();
+}
+
 static void
 pk_test_transaction_db_func (void)
 {
+	guint i;
+	guint repeats;
 	guint value;
 	gchar *tid;
+	gchar *timeline;
 	gboolean ret;
+	gboolean compacted = FALSE;
+	gboolean flushed = FALSE;
 	gdouble ms;
 	GError *error = NULL;
+	GList *list;
+	GPtrArray *history;
+	PkTransactionDb *db_shared;
+	PkTransactionDbHistoryItem *item;
+	PkTransactionDbStats stats;
 	g_autoptr(PkTransactionDb) db = NULL;
+	g_autofree gchar *cmdline = NULL;
 	g_autofree gchar *proxy_http = NULL;
 	g_autofree gchar *proxy_ftp = NULL;
 
@@ -782,6 +1229,8 @@ pk_test_transaction_db_func (void)
 		value = g_unlink ("./transactions.db");
 		g_assert (value == 0);
 	}
+	g_unlink ("./transactions.db-wal");
+	g_unlink ("./transactions.db-shm");
 #endif
 	/* check we created quickly */
 	g_test_timer_start ();
@@ -888,6 +1337,101 @@ pk_test_transaction_db_func (void)
 	g_assert (ret);
 	g_assert_cmpstr (proxy_http, ==, "127.0.0.1:80");
 	g_assert_cmpstr (proxy_ftp, ==, "127.0.0.1:21");
+
+	/* write transactions one at a time, as the daemon would */
+	repeats = g_test_perf () ? 10000 : 100;
+	g_test_timer_start ();
+	for (i = 0; i < repeats; i++) {
+		tid = pk_transaction_db_generate_id (db);
+		pk_transaction_db_add (db, tid);
+		pk_transaction_db_set_role (db, tid, PK_ROLE_ENUM_INSTALL_PACKAGES);
+		pk_transaction_db_set_uid (db, tid, 500);
+		pk_transaction_db_set_cmdline (db, tid, "pkcon install \"it's\"");
+		pk_transaction_db_flush (db);
+		pk_transaction_db_set_data (db, tid, "installing\tpolkit;0.0.1;i386;fedora");
+		pk_transaction_db_set_finished (db, tid, TRUE, 1000);
+		pk_transaction_db_flush (db);
+		g_free (tid);
+	}
+	ms = g_test_timer_elapsed ();
+	g_test_maximized_result (repeats / ms, "wrote %u transactions in %.3fs", repeats, ms);
+
+	/* check they all got written, including the quoting */
+	list = pk_transaction_db_get_list (db, 0);
+	g_assert_cmpint (g_list_length (list), ==, repeats);
+	g_object_get (list->data, "cmdline", &cmdline, NULL);
+	g_assert_cmpstr (cmdline, ==, "pkcon install \"it's\"");
+	g_list_free_full (list, (GDestroyNotify) g_object_unref);
+
+	/* the statistics count the rows as they are written */
+	pk_transaction_db_get_stats (db, &stats);
+	g_assert_cmpint (stats.transactions, ==, repeats);
+	g_assert_cmpint (stats.package_history, ==, repeats);
+
+	/* get the package history, which merges entries from the same second */
+	history = pk_transaction_db_get_package_history (db, "polkit", 10);
+	g_assert_cmpint (history->len, >=, 1);
+	g_assert_cmpint (history->len, <=, 10);
+	item = g_ptr_array_index (history, 0);
+	g_assert_cmpint (item->info, ==, PK_INFO_ENUM_INSTALLING);
+	g_assert_cmpstr (item->version, ==, "0.0.1");
+	g_assert_cmpstr (item->data, ==, "fedora");
+	g_assert_cmpint (item->uid, ==, 500);
+	g_assert_cmpint (item->timestamp, >, 0);
+	for (i = 1; i < history->len; i++) {
+		PkTransactionDbHistoryItem *item_last = g_ptr_array_index (history, i - 1);
+		item = g_ptr_array_index (history, i);
+		g_assert_cmpint (item->timestamp, >, item_last->timestamp);
+	}
+	g_ptr_array_unref (history);
+
+	/* merged entries do not count towards the limit */
+	history = pk_transaction_db_get_package_history (db, "polkit", 1);
+	g_assert_cmpint (history->len, ==, 1);
+	g_ptr_array_unref (history);
+
+	/* no history */
+	history = pk_transaction_db_get_package_history (db, "hal", 10);
+	g_assert_cmpint (history->len, ==, 0);
+	g_ptr_array_unref (history);
+
+	/* prune down to the newest transactions */
+	pk_transaction_db_set_retention (db, 10, 0, 0, TRUE);
+	pk_transaction_db_compact_async (db, NULL, pk_test_transaction_db_compact_cb, &compacted);
+	_g_test_loop_run_with_timeout (10000);
+	g_assert (compacted);
+	pk_transaction_db_get_stats (db, &stats);
+	g_assert_cmpint (stats.transactions, ==, 10);
+	g_assert_cmpint (stats.package_history, ==, 10);
+	g_assert_cmpint (stats.pruned, ==, repeats - 10);
+	g_assert_cmpint (stats.compacted, >, 0);
+	g_assert_cmpint (stats.size, >, 0);
+	g_assert_cmpint (stats.max_transactions, ==, 10);
+	g_assert_cmpint (stats.free, ==, 0);
+
+	/* save a timeline for a role that is not otherwise logged */
+	tid = pk_transaction_db_generate_id (db);
+	pk_transaction_db_set_timeline (db, tid, "ready\t0\nstarted\t5\nfinished\t20\n");
+
+	/* the transactions share the engine's database and its pending changes */
+	db_shared = pk_transaction_db_new ();
+	g_assert (db_shared == db);
+	g_object_unref (db_shared);
+
+	/* reads do not wait for pending changes, so ask for them first */
+	pk_transaction_db_flush_async (db, NULL, pk_test_transaction_db_flush_cb, &flushed);
+	_g_test_loop_run_with_timeout (5000);
+	g_assert (flushed);
+	timeline = pk_transaction_db_get_timeline (db, tid);
+	g_assert_cmpstr (timeline, ==, "ready\t0\nstarted\t5\nfinished\t20\n");
+	g_free (timeline);
+	timeline = pk_transaction_db_get_timeline (db, "/0_aaaa");
+	g_assert_cmpstr (timeline, ==, NULL);
+
+	/* the timeline is not in the transaction log */
+	pk_transaction_db_get_stats (db, &stats);
+	g_assert_cmpint (stats.transactions, ==, 10);
+	g_free (tid);
 }
 
 static PkTransactionDb *db = NULL;
@@ -936,6 +1480,7 @@ pk_test_scheduler_func (void)
 	g_autofree gchar *tid_item3 = NULL;
 	g_autoptr(GKeyFile) conf = NULL;
 	g_autoptr(PkBackend) backend = NULL;
+	g_autoptr(PkCache) cache = NULL;
 	g_autoptr(PkScheduler) tlist = NULL;
 
 	/* remove the self check file */
@@ -947,6 +1492,8 @@ pk_test_scheduler_func (void)
 		size = g_unlink ("./transactions.db");
 		g_assert (size == 0);
 	}
+	g_unlink ("./transactions.db-wal");
+	g_unlink ("./transactions.db-shm");
 #endif
 
 	db = pk_transaction_db_new ();
@@ -964,6 +1511,10 @@ pk_test_scheduler_func (void)
 
 	/* get a transaction list object */
 	tlist = pk_scheduler_new (conf);
+
+	/* every search has to run in the backend */
+	cache = pk_cache_new ();
+	pk_cache_set_max_size (cache, 0);
 	g_assert (tlist != NULL);
 
 	/* make sure we get a valid tid */
@@ -1229,6 +1780,236 @@ pk_test_scheduler_func (void)
 	g_object_unref (db);
 }
 
+static void
+pk_test_scheduler_shared_func (void)
+{
+	gboolean ret;
+	gchar **array;
+	guint size;
+	PkTransaction *transaction;
+	GError *error = NULL;
+	g_autofree gchar *tid_item1 = NULL;
+	g_autofree gchar *tid_item2 = NULL;
+	g_autofree gchar *tid_item3 = NULL;
+	g_autofree gchar *tid_item4 = NULL;
+	g_autoptr(GKeyFile) conf = NULL;
+	g_autoptr(PkBackend) backend = NULL;
+	g_autoptr(PkCache) cache = NULL;
+	g_autoptr(PkScheduler) tlist = NULL;
+
+	db = pk_transaction_db_new ();
+	ret = pk_transaction_db_load (db, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* try to load a valid backend */
+	conf = g_key_file_new ();
+	g_key_file_set_string (conf, "Daemon", "MaximumPackagesToProcess", "1000");
+	g_key_file_set_string (conf, "Daemon", "DefaultBackend", "dummy");
+	backend = pk_backend_new (conf);
+	ret = pk_backend_load (backend, NULL);
+	g_assert (ret);
+
+	/* get a transaction list object */
+	tlist = pk_scheduler_new (conf);
+	g_assert (tlist != NULL);
+	pk_scheduler_set_backend (tlist, backend);
+
+	/* the results must not come from the cache */
+	cache = pk_cache_new ();
+	pk_cache_set_max_size (cache, 0);
+
+	tid_item1 = pk_test_scheduler_create_transaction (tlist);
+	tid_item2 = pk_test_scheduler_create_transaction (tlist);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item1);
+	g_signal_connect (transaction, "finished",
+			  G_CALLBACK (pk_test_scheduler_finished_cb), NULL);
+
+	/* run the same search twice */
+	array = g_strsplit ("power", " ", -1);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item1);
+	pk_transaction_make_exclusive (transaction);
+	pk_transaction_search_names (transaction,
+				     g_variant_new ("(t^as)",
+						    pk_bitfield_value (PK_FILTER_ENUM_NONE),
+						    array),
+				     NULL);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item2);
+	pk_transaction_make_exclusive (transaction);
+	pk_transaction_search_names (transaction,
+				     g_variant_new ("(t^as)",
+						    pk_bitfield_value (PK_FILTER_ENUM_NONE),
+						    array),
+				     NULL);
+	g_strfreev (array);
+
+	/* the second does not wait for the exclusive lock */
+	transaction = pk_scheduler_get_transaction (tlist, tid_item2);
+	g_assert_cmpint (pk_transaction_get_state (transaction), ==, PK_TRANSACTION_STATE_RUNNING);
+	array = pk_scheduler_get_array (tlist);
+	size = g_strv_length (array);
+	g_assert_cmpint (size, ==, 2);
+	g_strfreev (array);
+
+	/* both finish together */
+	_g_test_loop_run_with_timeout (10000);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item1);
+	g_assert_cmpint (pk_transaction_get_state (transaction), ==, PK_TRANSACTION_STATE_FINISHED);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item2);
+	g_assert_cmpint (pk_transaction_get_state (transaction), ==, PK_TRANSACTION_STATE_FINISHED);
+
+	/* run the same search twice again */
+	tid_item3 = pk_test_scheduler_create_transaction (tlist);
+	tid_item4 = pk_test_scheduler_create_transaction (tlist);
+	array = g_strsplit ("power", " ", -1);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item3);
+	g_signal_connect (transaction, "finished",
+			  G_CALLBACK (pk_test_scheduler_finished_cb), NULL);
+	pk_transaction_make_exclusive (transaction);
+	pk_transaction_search_names (transaction,
+				     g_variant_new ("(t^as)",
+						    pk_bitfield_value (PK_FILTER_ENUM_NONE),
+						    array),
+				     NULL);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item4);
+	g_signal_connect (transaction, "finished",
+			  G_CALLBACK (pk_test_scheduler_finished_cb), NULL);
+	pk_transaction_make_exclusive (transaction);
+	pk_transaction_search_names (transaction,
+				     g_variant_new ("(t^as)",
+						    pk_bitfield_value (PK_FILTER_ENUM_NONE),
+						    array),
+				     NULL);
+	g_strfreev (array);
+
+	/* cancelling the first does not cancel the second */
+	transaction = pk_scheduler_get_transaction (tlist, tid_item3);
+	pk_transaction_cancel_bg (transaction);
+	_g_test_loop_run_with_timeout (10000);
+	g_assert_cmpint (pk_transaction_get_state (transaction), ==, PK_TRANSACTION_STATE_FINISHED);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item4);
+	g_assert_cmpint (pk_transaction_get_state (transaction), !=, PK_TRANSACTION_STATE_FINISHED);
+
+	/* it runs the search itself instead */
+	_g_test_loop_run_with_timeout (10000);
+	transaction = pk_scheduler_get_transaction (tlist, tid_item4);
+	g_assert_cmpint (pk_transaction_get_state (transaction), ==, PK_TRANSACTION_STATE_FINISHED);
+
+	g_object_unref (db);
+}
+
+/**
+ * pk_test_scheduler_install:
+ **/
+static void
+pk_test_scheduler_install (PkScheduler *tlist, const gchar *tid, guint uid, gboolean interactive)
+{
+	PkTransaction *transaction;
+	gchar **array;
+
+	pk_scheduler_set_uid (tlist, tid, uid);
+	transaction = pk_scheduler_get_transaction (tlist, tid);
+	pk_backend_job_set_interactive (pk_transaction_get_backend_job (transaction),
+					interactive);
+	pk_transaction_skip_auth_checks (transaction, TRUE);
+	array = g_strsplit ("libawesome;42;i386;debian", " ", -1);
+	pk_transaction_install_packages (transaction,
+				       g_variant_new ("(t^as)",
+						      pk_bitfield_value (PK_FILTER_ENUM_NONE),
+						      array),
+				       NULL);
+	g_strfreev (array);
+}
+
+static void
+pk_test_scheduler_queue_func (void)
+{
+	gboolean ret;
+	guint i;
+	guint running;
+	guint size;
+	PkTransaction *transaction;
+	GError *error = NULL;
+	g_autofree gchar *tid_lock = NULL;
+	g_autofree gchar *tid_a1 = NULL;
+	g_autofree gchar *tid_a2 = NULL;
+	g_autofree gchar *tid_a3 = NULL;
+	g_autofree gchar *tid_b1 = NULL;
+	g_autofree gchar *tid_b2 = NULL;
+	g_autofree gchar *tid_c1 = NULL;
+	g_auto(GStrv) queue = NULL;
+	g_autoptr(GKeyFile) conf = NULL;
+	g_autoptr(PkBackend) backend = NULL;
+	g_autoptr(PkScheduler) tlist = NULL;
+
+	db = pk_transaction_db_new ();
+	ret = pk_transaction_db_load (db, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* try to load a valid backend */
+	conf = g_key_file_new ();
+	g_key_file_set_string (conf, "Daemon", "MaximumPackagesToProcess", "1000");
+	g_key_file_set_string (conf, "Daemon", "DefaultBackend", "dummy");
+	backend = pk_backend_new (conf);
+	ret = pk_backend_load (backend, NULL);
+	g_assert (ret);
+
+	/* get a transaction list object */
+	tlist = pk_scheduler_new (conf);
+	g_assert (tlist != NULL);
+	pk_scheduler_set_backend (tlist, backend);
+
+	tid_lock = pk_test_scheduler_create_transaction (tlist);
+	tid_a1 = pk_test_scheduler_create_transaction (tlist);
+	tid_a2 = pk_test_scheduler_create_transaction (tlist);
+	tid_a3 = pk_test_scheduler_create_transaction (tlist);
+	tid_b1 = pk_test_scheduler_create_transaction (tlist);
+	tid_b2 = pk_test_scheduler_create_transaction (tlist);
+	tid_c1 = pk_test_scheduler_create_transaction (tlist);
+	transaction = pk_scheduler_get_transaction (tlist, tid_lock);
+	g_signal_connect (transaction, "finished",
+			  G_CALLBACK (pk_test_scheduler_finished_cb), NULL);
+
+	/* everything else has to wait for the exclusive lock */
+	pk_test_scheduler_install (tlist, tid_lock, 999, FALSE);
+	pk_test_scheduler_install (tlist, tid_a1, 1000, FALSE);
+	pk_test_scheduler_install (tlist, tid_a2, 1000, FALSE);
+	pk_test_scheduler_install (tlist, tid_a3, 1000, FALSE);
+	pk_test_scheduler_install (tlist, tid_b1, 1001, FALSE);
+	pk_test_scheduler_install (tlist, tid_b2, 1001, FALSE);
+	pk_test_scheduler_install (tlist, tid_c1, 1002, TRUE);
+	size = pk_scheduler_get_queue_depth (tlist, &running);
+	g_assert_cmpint (size, ==, 6);
+	g_assert_cmpint (running, ==, 1);
+
+	/* interactive first, then the users take turns in commit order */
+	queue = pk_scheduler_get_queue (tlist);
+	g_assert_cmpint (g_strv_length (queue), ==, 6);
+	g_assert_cmpstr (queue[0], ==, tid_c1);
+	g_assert_cmpstr (queue[1], ==, tid_a1);
+	g_assert_cmpstr (queue[2], ==, tid_b1);
+	g_assert_cmpstr (queue[3], ==, tid_a2);
+	g_assert_cmpstr (queue[4], ==, tid_b2);
+	g_assert_cmpstr (queue[5], ==, tid_a3);
+
+	/* don't run the rest */
+	pk_scheduler_cancel_queued (tlist);
+	size = pk_scheduler_get_queue_depth (tlist, NULL);
+	g_assert_cmpint (size, ==, 0);
+
+	/* wait for the lock to be released */
+	transaction = pk_scheduler_get_transaction (tlist, tid_lock);
+	for (i = 0; i < 10; i++) {
+		if (pk_transaction_get_state (transaction) == PK_TRANSACTION_STATE_FINISHED)
+			break;
+		_g_test_loop_run_with_timeout (2000);
+	}
+	g_assert_cmpint (pk_transaction_get_state (transaction), ==, PK_TRANSACTION_STATE_FINISHED);
+
+	g_object_unref (db);
+}
+
 static void
 pk_test_scheduler_parallel_func (void)
 {
@@ -1247,6 +2028,7 @@ pk_test_scheduler_parallel_func (void)
 	g_autofree gchar *tid_item5 = NULL;
 	g_autoptr(GKeyFile) conf = NULL;
 	g_autoptr(PkBackend) backend = NULL;
+	g_autoptr(PkCache) cache = NULL;
 	g_autoptr(PkScheduler) tlist = NULL;
 
 	db = pk_transaction_db_new ();
@@ -1264,6 +2046,10 @@ pk_test_scheduler_parallel_func (void)
 
 	/* get a transaction list object */
 	tlist = pk_scheduler_new (conf);
+
+	/* every search has to run in the backend */
+	cache = pk_cache_new ();
+	pk_cache_set_max_size (cache, 0);
 	g_assert (tlist != NULL);
 
 	pk_scheduler_set_backend (tlist, backend);
@@ -1453,15 +2239,20 @@ main (int argc, char **argv)
 
 	/* components */
 	g_test_add_func ("/packagekit/transaction", pk_test_transaction_func);
+	g_test_add_func ("/packagekit/cache", pk_test_cache_func);
+	g_test_add_func ("/packagekit/statistics", pk_test_statistics_func);
 	g_test_add_func ("/packagekit/dbus", pk_test_dbus_func);
 	g_test_add_func ("/packagekit/spawn", pk_test_spawn_func);
 	g_test_add_func ("/packagekit/scheduler", pk_test_scheduler_func);
 	g_test_add_func ("/packagekit/scheduler-parallel", pk_test_scheduler_parallel_func);
+	g_test_add_func ("/packagekit/scheduler-shared", pk_test_scheduler_shared_func);
+	g_test_add_func ("/packagekit/scheduler-queue", pk_test_scheduler_queue_func);
 	g_test_add_func ("/packagekit/transaction-db", pk_test_transaction_db_func);
 
 	/* backend stuff */
 	g_test_add_func ("/packagekit/backend", pk_test_backend_func);
 	g_test_add_func ("/packagekit/backend_spawn", pk_test_backend_spawn_func);
+	g_test_add_func ("/packagekit/backend_spawn/parse", pk_test_backend_spawn_parse_func);
 
 	return g_test_run ();
 }
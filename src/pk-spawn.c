@@ -36,9 +36,11 @@
 #endif /* HAVE_UNISTD_H */
 
 #include <sys/wait.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 
 #include <glib/gi18n.h>
+#include <glib-unix.h>
 
 #include "pk-spawn.h"
 #include "pk-shared.h"
@@ -46,8 +48,9 @@
 static void     pk_spawn_finalize	(GObject       *object);
 
 #define PK_SPAWN_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), PK_TYPE_SPAWN, PkSpawnPrivate))
-#define PK_SPAWN_POLL_DELAY	50 /* ms */
 #define PK_SPAWN_SIGKILL_DELAY	2500 /* ms */
+#define PK_SPAWN_FRAME_SIZE_MAX	(16 * 1024 * 1024) /* bytes */
+#define PK_SPAWN_READ_SIZE_MAX	(64 * 1024) /* bytes per wakeup */
 
 struct PkSpawnPrivate
 {
@@ -55,7 +58,10 @@ struct PkSpawnPrivate
 	gint			 stdin_fd;
 	gint			 stdout_fd;
 	gint			 stderr_fd;
-	guint			 poll_id;
+	guint			 stdout_id;
+	guint			 stderr_id;
+	gint			 child_fd;
+	guint			 child_id;
 	guint			 kill_id;
 	gboolean		 finished;
 	gboolean		 background;
@@ -64,6 +70,9 @@ struct PkSpawnPrivate
 	gboolean		 allow_sigkill;
 	PkSpawnExitType		 exit;
 	GString			*stdout_buf;
+	gsize			 stdout_scanned;
+	gboolean		 is_emitting_stdout;
+	PkSpawnFraming		 framing;
 	GString			*stderr_buf;
 	gchar			*last_argv0;
 	gchar			**last_envp;
@@ -74,6 +83,7 @@ enum {
 	SIGNAL_EXIT,
 	SIGNAL_STDOUT,
 	SIGNAL_STDERR,
+	SIGNAL_STDOUT_FRAME,
 	SIGNAL_LAST
 };
 
@@ -90,56 +100,186 @@ G_DEFINE_TYPE (PkSpawn, pk_spawn, G_TYPE_OBJECT)
 
 /**
  * pk_spawn_read_fd_into_buffer:
+ * @max: the most bytes to read, so a chatty helper can't starve the loop
+ *
+ * Return value: %FALSE if the other end has been closed
  **/
 static gboolean
-pk_spawn_read_fd_into_buffer (gint fd, GString *string)
+pk_spawn_read_fd_into_buffer (gint fd, GString *string, gsize max)
 {
-	gint bytes_read;
-	gchar buffer[BUFSIZ];
+	gssize bytes_read;
+	gsize len;
+	gsize total = 0;
 
-	/* ITS4: ignore, we manually NULL terminate and GString cannot overflow */
-	while ((bytes_read = read (fd, buffer, BUFSIZ-1)) > 0) {
-		buffer[bytes_read] = '\0';
-		g_string_append (string, buffer);
-	}
+	/* read straight into the end of the buffer */
+	do {
+		len = string->len;
+		g_string_set_size (string, len + BUFSIZ);
+		bytes_read = read (fd, string->str + len, BUFSIZ);
+		g_string_set_size (string, len + MAX (bytes_read, 0));
+		total += MAX (bytes_read, 0);
+	} while (bytes_read > 0 && total < max);
+
+	/* the rest is read when the watch fires again */
+	if (bytes_read > 0)
+		return TRUE;
 
-	return TRUE;
+	/* nothing more to read right now */
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))
+		return TRUE;
+	return FALSE;
 }
 
 /**
- * pk_spawn_emit_whole_lines:
+ * pk_spawn_find_frame_magic:
+ *
+ * Like g_strstr_len() but does not stop at the nul bytes in frames.
  **/
-static gboolean
-pk_spawn_emit_whole_lines (PkSpawn *spawn, GString *string)
+static const gchar *
+pk_spawn_find_frame_magic (const gchar *data, gsize len)
 {
-	guint i;
-	guint size;
-	guint bytes_processed;
-	g_auto(GStrv) lines = NULL;
+	const gchar *end = data + len;
+	const gchar *tmp = data;
+
+	while ((tmp = memchr (tmp, PK_SPAWN_FRAME_MAGIC[0], end - tmp)) != NULL) {
+		if ((gsize) (end - tmp) < PK_SPAWN_FRAME_MAGIC_LEN)
+			return NULL;
+		if (memcmp (tmp, PK_SPAWN_FRAME_MAGIC, PK_SPAWN_FRAME_MAGIC_LEN) == 0)
+			return tmp;
+		tmp++;
+	}
+	return NULL;
+}
 
-	/* if nothing then don't emit */
-	if (pk_strzero (string->str))
-		return FALSE;
+/**
+ * pk_spawn_emit_frames:
+ *
+ * Emits each complete frame in the stdout buffer. A frame is the
+ * PK_SPAWN_FRAME_MAGIC bytes, a 32 bit little endian length and then that
+ * many bytes of serialized GVariant data of type (sas).
+ *
+ * Anything that is not a valid frame, for instance text printed by a
+ * library the helper uses, is skipped up to the next magic.
+ **/
+static void
+pk_spawn_emit_frames (PkSpawn *spawn)
+{
+	GString *string = spawn->priv->stdout_buf;
+	const gsize header = PK_SPAWN_FRAME_MAGIC_LEN + sizeof (guint32);
+	const gchar *magic;
+	GBytes *bytes;
+	GVariant *frame;
+	gsize start = 0;
+	guint32 size;
+
+	while (string->len - start >= PK_SPAWN_FRAME_MAGIC_LEN) {
+		if (memcmp (string->str + start, PK_SPAWN_FRAME_MAGIC,
+			    PK_SPAWN_FRAME_MAGIC_LEN) != 0) {
+			magic = pk_spawn_find_frame_magic (string->str + start + 1,
+							   string->len - start - 1);
+			if (magic == NULL) {
+				/* keep what could be the start of a magic */
+				magic = string->str + string->len - PK_SPAWN_FRAME_MAGIC_LEN + 1;
+			}
+			g_warning ("skipping %" G_GSIZE_FORMAT " bytes that are not a frame",
+				   (gsize) (magic - string->str) - start);
+			start = magic - string->str;
+			continue;
+		}
 
-	/* split into lines - the last line may be incomplete */
-	lines = g_strsplit (string->str, "\n", 0);
-	if (lines == NULL)
-		return FALSE;
+		/* incomplete header */
+		if (string->len - start < header)
+			break;
+		memcpy (&size, string->str + start + PK_SPAWN_FRAME_MAGIC_LEN, sizeof (size));
+		size = GUINT32_FROM_LE (size);
+		if (size > PK_SPAWN_FRAME_SIZE_MAX) {
+			g_warning ("frame of %u bytes is too large, skipping", size);
+			start++;
+			continue;
+		}
 
-	/* find size */
-	size = g_strv_length (lines);
+		/* incomplete */
+		if (string->len - start - header < size)
+			break;
+
+		/* the buffer is reused, so the frame gets its own copy */
+		bytes = g_bytes_new (string->str + start + header, size);
+		frame = g_variant_new_from_bytes (G_VARIANT_TYPE ("(sas)"), bytes, FALSE);
+		g_variant_ref_sink (frame);
+		g_bytes_unref (bytes);
+		if (!g_variant_is_normal_form (frame)) {
+			g_warning ("frame of %u bytes is not valid, skipping", size);
+			g_variant_unref (frame);
+			start++;
+			continue;
+		}
+		start += header + size;
+		g_signal_emit (spawn, signals [SIGNAL_STDOUT_FRAME], 0, frame);
+		g_variant_unref (frame);
+	}
+
+	/* remove the frames we've processed */
+	if (start > 0)
+		g_string_erase (string, 0, start);
+}
 
-	bytes_processed = 0;
-	/* we only emit n-1 strings */
-	for (i = 0; i < (size-1); i++) {
-		g_signal_emit (spawn, signals [SIGNAL_STDOUT], 0, lines[i]);
-		/* ITS4: ignore, g_strsplit always NULL terminates */
-		bytes_processed += strlen (lines[i]) + 1;
+/**
+ * pk_spawn_emit_whole_lines:
+ *
+ * Emits each complete line in the stdout buffer in place, leaving any
+ * trailing partial line in the buffer for next time. Only the bytes that
+ * were not already scanned for a newline are looked at, and the buffer is
+ * only shifted once per call, so this is linear in the amount of output.
+ **/
+static void
+pk_spawn_emit_whole_lines (PkSpawn *spawn)
+{
+	GString *string = spawn->priv->stdout_buf;
+	gchar *eol;
+	gsize start = 0;
+
+	/* a signal handler may cause more output to be read */
+	if (spawn->priv->is_emitting_stdout)
+		return;
+	spawn->priv->is_emitting_stdout = TRUE;
+
+	/* use offsets, as handlers can cause the buffer to be reallocated */
+	while (spawn->priv->framing == PK_SPAWN_FRAMING_TEXT &&
+	       (eol = memchr (string->str + spawn->priv->stdout_scanned, '\n',
+			      string->len - spawn->priv->stdout_scanned)) != NULL) {
+		*eol = '\0';
+		spawn->priv->stdout_scanned = eol - string->str + 1;
+		g_signal_emit (spawn, signals [SIGNAL_STDOUT], 0, string->str + start);
+		start = spawn->priv->stdout_scanned;
 	}
 
-	/* remove the text we've processed */
-	g_string_erase (string, 0, bytes_processed);
-	return TRUE;
+	/* remove the text we've processed, what is left has no newline */
+	if (start > 0)
+		g_string_erase (string, 0, start);
+	spawn->priv->stdout_scanned = string->len;
+
+	/* the helper may have switched to frames after the last line */
+	if (spawn->priv->framing == PK_SPAWN_FRAMING_GVARIANT)
+		pk_spawn_emit_frames (spawn);
+	spawn->priv->is_emitting_stdout = FALSE;
+}
+
+/**
+ * pk_spawn_set_framing:
+ * @spawn: a #PkSpawn
+ * @framing: a #PkSpawnFraming
+ *
+ * Sets how the rest of the output on stdout is split into records. This
+ * is usually called from a #PkSpawn::stdout handler when the helper says
+ * it is switching, and is reset to text when the helper exits.
+ **/
+void
+pk_spawn_set_framing (PkSpawn *spawn, PkSpawnFraming framing)
+{
+	g_return_if_fail (PK_IS_SPAWN (spawn));
+	g_debug ("setting framing to %s",
+		 framing == PK_SPAWN_FRAMING_GVARIANT ? "gvariant" : "text");
+	spawn->priv->framing = framing;
 }
 
 /**
@@ -164,25 +304,14 @@ pk_spawn_exit_type_enum_to_string (PkSpawnExitType type)
 }
 
 /**
- * pk_spawn_check_child:
+ * pk_spawn_read_output:
+ * @max: the most bytes to read from each pipe
  **/
-static gboolean
-pk_spawn_check_child (PkSpawn *spawn)
+static void
+pk_spawn_read_output (PkSpawn *spawn, gsize max)
 {
-	pid_t pid;
-	int status;
-	gint retval;
-	static guint limit_printing = 0;
-
-	/* this shouldn't happen */
-	if (spawn->priv->finished) {
-		g_warning ("finished twice!");
-		spawn->priv->poll_id = 0;
-		return FALSE;
-	}
-
-	pk_spawn_read_fd_into_buffer (spawn->priv->stdout_fd, spawn->priv->stdout_buf);
-	pk_spawn_read_fd_into_buffer (spawn->priv->stderr_fd, spawn->priv->stderr_buf);
+	pk_spawn_read_fd_into_buffer (spawn->priv->stdout_fd, spawn->priv->stdout_buf, max);
+	pk_spawn_read_fd_into_buffer (spawn->priv->stderr_fd, spawn->priv->stderr_buf, max);
 
 	/* emit all lines on standard out in one callback, as it's all probably
 	* related to the error that just happened */
@@ -192,32 +321,102 @@ pk_spawn_check_child (PkSpawn *spawn)
 	}
 
 	/* all usual output goes on standard out, only bad libraries bitch to stderr */
-	pk_spawn_emit_whole_lines (spawn, spawn->priv->stdout_buf);
+	pk_spawn_emit_whole_lines (spawn);
+}
+
+/**
+ * pk_spawn_stdout_cb:
+ **/
+static gboolean
+pk_spawn_stdout_cb (GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	gboolean ret;
+	PkSpawn *spawn = PK_SPAWN (user_data);
+
+	ret = pk_spawn_read_fd_into_buffer (spawn->priv->stdout_fd,
+					    spawn->priv->stdout_buf,
+					    PK_SPAWN_READ_SIZE_MAX);
+	pk_spawn_emit_whole_lines (spawn);
+
+	/* keep the watch until the child closes stdout */
+	if (ret)
+		return G_SOURCE_CONTINUE;
+	spawn->priv->stdout_id = 0;
+	return G_SOURCE_REMOVE;
+}
 
-	/* Only print one in twenty times to avoid filling the screen */
-	if (limit_printing++ % 20 == 0)
-		g_debug ("polling child_pid=%ld (1/20)", (long)spawn->priv->child_pid);
+/**
+ * pk_spawn_stderr_cb:
+ **/
+static gboolean
+pk_spawn_stderr_cb (GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	gboolean ret;
+	PkSpawn *spawn = PK_SPAWN (user_data);
 
-	/* check if the child exited */
-	pid = waitpid (spawn->priv->child_pid, &status, WNOHANG);
-	if (pid == -1) {
-		g_warning ("failed to get the child PID data for %ld", (long)spawn->priv->child_pid);
-		return TRUE;
+	ret = pk_spawn_read_fd_into_buffer (spawn->priv->stderr_fd,
+					    spawn->priv->stderr_buf,
+					    PK_SPAWN_READ_SIZE_MAX);
+	if (spawn->priv->stderr_buf->len != 0) {
+		g_signal_emit (spawn, signals [SIGNAL_STDERR], 0, spawn->priv->stderr_buf->str);
+		g_string_set_size (spawn->priv->stderr_buf, 0);
 	}
-	if (pid == 0) {
-		/* process still exist, but has not changed state */
-		return TRUE;
+	if (ret)
+		return G_SOURCE_CONTINUE;
+	spawn->priv->stderr_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * pk_spawn_remove_watches:
+ **/
+static void
+pk_spawn_remove_watches (PkSpawn *spawn)
+{
+	if (spawn->priv->stdout_id != 0) {
+		g_source_remove (spawn->priv->stdout_id);
+		spawn->priv->stdout_id = 0;
 	}
-	if (pid != spawn->priv->child_pid) {
-		g_warning ("some other process id was returned: got %ld and wanted %ld",
-			     (long)pid, (long)spawn->priv->child_pid);
-		return TRUE;
+	if (spawn->priv->stderr_id != 0) {
+		g_source_remove (spawn->priv->stderr_id);
+		spawn->priv->stderr_id = 0;
+	}
+	if (spawn->priv->child_id != 0) {
+		g_source_remove (spawn->priv->child_id);
+		spawn->priv->child_id = 0;
+	}
+	if (spawn->priv->child_fd != -1) {
+		close (spawn->priv->child_fd);
+		spawn->priv->child_fd = -1;
+	}
+}
+
+/**
+ * pk_spawn_child_exited:
+ * @status: the status returned by waitpid()
+ **/
+static void
+pk_spawn_child_exited (PkSpawn *spawn, gint status)
+{
+	gint retval;
+
+	/* this shouldn't happen */
+	if (spawn->priv->finished) {
+		g_warning ("finished twice!");
+		return;
 	}
 
-	/* disconnect the poll as there will be no more updates */
-	if (spawn->priv->poll_id > 0) {
-		g_source_remove (spawn->priv->poll_id);
-		spawn->priv->poll_id = 0;
+	/* disconnect the watches as there will be no more updates */
+	pk_spawn_remove_watches (spawn);
+
+	/* get anything written just before the child exited */
+	pk_spawn_read_output (spawn, G_MAXSIZE);
+
+	/* the next instance starts off talking text */
+	if (spawn->priv->framing != PK_SPAWN_FRAMING_TEXT) {
+		g_string_set_size (spawn->priv->stdout_buf, 0);
+		spawn->priv->stdout_scanned = 0;
+		spawn->priv->framing = PK_SPAWN_FRAMING_TEXT;
 	}
 
 	/* child exited, close resources */
@@ -243,12 +442,6 @@ pk_spawn_check_child (PkSpawn *spawn)
 			spawn->priv->exit = PK_SPAWN_EXIT_TYPE_SIGKILL;
 		}
 	} else {
-		/* check we are dead and buried */
-		if (!WIFEXITED (status)) {
-			g_warning ("the process did not exit, but waitpid() returned!");
-			return TRUE;
-		}
-
 		/* get the exit code */
 		retval = WEXITSTATUS (status);
 		if (retval == 0) {
@@ -283,9 +476,105 @@ pk_spawn_check_child (PkSpawn *spawn)
 	/* don't emit if we just closed an invalid dispatcher */
 	g_debug ("emitting exit %s", pk_spawn_exit_type_enum_to_string (spawn->priv->exit));
 	g_signal_emit (spawn, signals [SIGNAL_EXIT], 0, spawn->priv->exit);
+}
 
-	spawn->priv->poll_id = 0;
-	return FALSE;
+/**
+ * pk_spawn_child_watch_cb:
+ **/
+static void
+pk_spawn_child_watch_cb (GPid pid, gint status, gpointer user_data)
+{
+	PkSpawn *spawn = PK_SPAWN (user_data);
+
+	/* the source is destroyed when we return */
+	spawn->priv->child_id = 0;
+	if (pid != spawn->priv->child_pid) {
+		g_warning ("some other process id was returned: got %ld and wanted %ld",
+			   (long)pid, (long)spawn->priv->child_pid);
+		return;
+	}
+	pk_spawn_child_exited (spawn, status);
+}
+
+/**
+ * pk_spawn_child_fd_cb:
+ *
+ * The pidfd is readable once the child exited, and as we reap it ourselves
+ * the exit status can't be lost when pk_spawn_exit() removes this source.
+ **/
+static gboolean
+pk_spawn_child_fd_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+	PkSpawn *spawn = PK_SPAWN (user_data);
+	gint status = 0;
+	pid_t pid;
+
+	pid = waitpid (spawn->priv->child_pid, &status, WNOHANG);
+	if (pid == 0)
+		return G_SOURCE_CONTINUE;
+
+	/* the source is destroyed when we return */
+	spawn->priv->child_id = 0;
+	if (pid != spawn->priv->child_pid) {
+		g_warning ("failed to reap %ld: %s",
+			   (long)spawn->priv->child_pid, g_strerror (errno));
+		status = W_EXITCODE (255, 0);
+	}
+	pk_spawn_child_exited (spawn, status);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * pk_spawn_add_child_watch:
+ **/
+static void
+pk_spawn_add_child_watch (PkSpawn *spawn)
+{
+	/* GLib may reap the child from another thread as soon as it exits,
+	 * so only fall back to a child watch without pidfd support */
+	if (spawn->priv->child_fd != -1) {
+		spawn->priv->child_id = g_unix_fd_add (spawn->priv->child_fd,
+						       G_IO_IN,
+						       pk_spawn_child_fd_cb,
+						       spawn);
+	} else {
+		spawn->priv->child_id = g_child_watch_add (spawn->priv->child_pid,
+							   pk_spawn_child_watch_cb,
+							   spawn);
+	}
+	g_source_set_name_by_id (spawn->priv->child_id, "[PkSpawn] child");
+}
+
+/**
+ * pk_spawn_add_watches:
+ **/
+static void
+pk_spawn_add_watches (PkSpawn *spawn)
+{
+	GIOChannel *channel;
+
+	/* process output as soon as it arrives */
+	channel = g_io_channel_unix_new (spawn->priv->stdout_fd);
+	spawn->priv->stdout_id = g_io_add_watch (channel,
+						 G_IO_IN | G_IO_HUP | G_IO_ERR,
+						 pk_spawn_stdout_cb,
+						 spawn);
+	g_source_set_name_by_id (spawn->priv->stdout_id, "[PkSpawn] stdout");
+	g_io_channel_unref (channel);
+
+	channel = g_io_channel_unix_new (spawn->priv->stderr_fd);
+	spawn->priv->stderr_id = g_io_add_watch (channel,
+						 G_IO_IN | G_IO_HUP | G_IO_ERR,
+						 pk_spawn_stderr_cb,
+						 spawn);
+	g_source_set_name_by_id (spawn->priv->stderr_id, "[PkSpawn] stderr");
+	g_io_channel_unref (channel);
+
+	/* reap the child when it exits */
+#ifdef SYS_pidfd_open
+	spawn->priv->child_fd = syscall (SYS_pidfd_open, spawn->priv->child_pid, 0);
+#endif
+	pk_spawn_add_child_watch (spawn);
 }
 
 /**
@@ -435,7 +724,9 @@ gboolean
 pk_spawn_exit (PkSpawn *spawn)
 {
 	gboolean ret;
+	gint status = 0;
 	guint count = 0;
+	pid_t pid;
 
 	g_return_val_if_fail (PK_IS_SPAWN (spawn), FALSE);
 
@@ -453,6 +744,12 @@ pk_spawn_exit (PkSpawn *spawn)
 		goto out;
 	}
 
+	/* we reap the child ourselves from now on */
+	if (spawn->priv->child_id != 0) {
+		g_source_remove (spawn->priv->child_id);
+		spawn->priv->child_id = 0;
+	}
+
 	/* block until the previous script exited */
 	do {
 		g_debug ("waiting for exit");
@@ -461,14 +758,30 @@ pk_spawn_exit (PkSpawn *spawn)
 		 * and this includes sending data to a new instance,
 		 * which of course will fail as the 'old' script is exiting */
 		g_usleep (10*1000); /* 10 ms */
-		ret = pk_spawn_check_child (spawn);
-	} while (ret && count++ < 500);
+
+		/* keep draining the pipes so the child can't block on write */
+		pk_spawn_read_output (spawn, PK_SPAWN_READ_SIZE_MAX);
+		pid = waitpid (spawn->priv->child_pid, &status, WNOHANG);
+
+		/* reaped by the GLib child watch before it was removed, and
+		 * the exit status went with it */
+		if (pid == -1 && errno == ECHILD) {
+			g_warning ("exit status of %ld was lost",
+				   (long)spawn->priv->child_pid);
+			status = W_EXITCODE (255, 0);
+			pid = spawn->priv->child_pid;
+		}
+	} while (pid != spawn->priv->child_pid && count++ < 500);
 
 	/* the script exited okay */
-	if (count < 500)
+	if (count < 500) {
+		pk_spawn_child_exited (spawn, status);
 		ret = TRUE;
-	else
+	} else {
 		g_warning ("failed to exit script");
+		pk_spawn_add_child_watch (spawn);
+		ret = FALSE;
+	}
 out:
 	spawn->priv->is_sending_exit = FALSE;
 	return ret;
@@ -575,11 +888,8 @@ pk_spawn_argv (PkSpawn *spawn, gchar **argv, gchar **envp,
 		ret = pk_spawn_exit (spawn);
 		if (!ret) {
 			g_warning ("failed to exit previous instance");
-			/* remove poll, as we can't reply on pk_spawn_check_child() */
-			if (spawn->priv->poll_id != 0) {
-				g_source_remove (spawn->priv->poll_id);
-				spawn->priv->poll_id = 0;
-			}
+			/* remove watches, as we can't rely on pk_spawn_child_exited() */
+			pk_spawn_remove_watches (spawn);
 		}
 		spawn->priv->is_changing_dispatcher = FALSE;
 	}
@@ -626,7 +936,7 @@ pk_spawn_argv (PkSpawn *spawn, gchar **argv, gchar **envp,
 	g_strfreev (spawn->priv->last_envp);
 	spawn->priv->last_envp = g_strdupv (envp);
 
-	/* install an idle handler to check if the child returnd successfully. */
+	/* we read until EAGAIN or the per-wakeup limit when woken up */
 	rc = fcntl (spawn->priv->stdout_fd, F_SETFL, O_NONBLOCK);
 	if (rc < 0) {
 		ret = FALSE;
@@ -641,14 +951,13 @@ pk_spawn_argv (PkSpawn *spawn, gchar **argv, gchar **envp,
 	}
 
 	/* sanity check */
-	if (spawn->priv->poll_id != 0) {
-		g_warning ("trying to set timeout when already set");
-		g_source_remove (spawn->priv->poll_id);
+	if (spawn->priv->child_id != 0) {
+		g_warning ("trying to add watches when already set");
+		pk_spawn_remove_watches (spawn);
 	}
 
-	/* poll quickly */
-	spawn->priv->poll_id = g_timeout_add (PK_SPAWN_POLL_DELAY, (GSourceFunc) pk_spawn_check_child, spawn);
-	g_source_set_name_by_id (spawn->priv->poll_id, "[PkSpawn] main poll");
+	/* wake up only when there is output or the child exits */
+	pk_spawn_add_watches (spawn);
 out:
 	return ret;
 }
@@ -735,11 +1044,23 @@ pk_spawn_class_init (PkSpawnClass *klass)
 			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
 			      0, NULL, NULL, g_cclosure_marshal_VOID__INT,
 			      G_TYPE_NONE, 1, G_TYPE_INT);
+	/**
+	 * PkSpawn::stdout:
+	 *
+	 * Emitted for each line written by the helper. The line points into
+	 * the read buffer and is only valid for the duration of the emission;
+	 * handlers may modify it in place, so only the last handler should.
+	 **/
 	signals [SIGNAL_STDOUT] =
 		g_signal_new ("stdout",
 			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
 			      0, NULL, NULL, g_cclosure_marshal_VOID__STRING,
-			      G_TYPE_NONE, 1, G_TYPE_STRING);
+			      G_TYPE_NONE, 1, G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE);
+	signals [SIGNAL_STDOUT_FRAME] =
+		g_signal_new ("stdout-frame",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_VOID__VARIANT,
+			      G_TYPE_NONE, 1, G_TYPE_VARIANT | G_SIGNAL_TYPE_STATIC_SCOPE);
 	signals [SIGNAL_STDERR] =
 		g_signal_new ("stderr",
 			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
@@ -762,7 +1083,10 @@ pk_spawn_init (PkSpawn *spawn)
 	spawn->priv->stdout_fd = -1;
 	spawn->priv->stderr_fd = -1;
 	spawn->priv->stdin_fd = -1;
-	spawn->priv->poll_id = 0;
+	spawn->priv->stdout_id = 0;
+	spawn->priv->stderr_id = 0;
+	spawn->priv->child_fd = -1;
+	spawn->priv->child_id = 0;
 	spawn->priv->kill_id = 0;
 	spawn->priv->finished = FALSE;
 	spawn->priv->is_sending_exit = FALSE;
@@ -793,11 +1117,8 @@ pk_spawn_finalize (GObject *object)
 
 	g_return_if_fail (spawn->priv != NULL);
 
-	/* disconnect the poll in case we were cancelled before completion */
-	if (spawn->priv->poll_id != 0) {
-		g_source_remove (spawn->priv->poll_id);
-		spawn->priv->poll_id = 0;
-	}
+	/* disconnect the watches in case we were cancelled before completion */
+	pk_spawn_remove_watches (spawn);
 
 	/* disconnect the SIGKILL check */
 	if (spawn->priv->kill_id != 0) {
@@ -67,6 +67,22 @@ typedef enum {
 	PK_SPAWN_EXIT_TYPE_UNKNOWN
 } PkSpawnExitType;
 
+/**
+ * PkSpawnFraming:
+ *
+ * How the output on stdout is split into records
+ **/
+typedef enum {
+	PK_SPAWN_FRAMING_TEXT,			/* newline terminated text */
+	PK_SPAWN_FRAMING_GVARIANT,		/* length prefixed GVariant data */
+	PK_SPAWN_FRAMING_LAST
+} PkSpawnFraming;
+
+/* the start of every frame, so the reader can find the next frame if a
+ * helper wrote something else to stdout */
+#define PK_SPAWN_FRAME_MAGIC		"PKF1"
+#define PK_SPAWN_FRAME_MAGIC_LEN	4
+
 typedef enum {
 	PK_SPAWN_ARGV_FLAGS_NONE,
 	PK_SPAWN_ARGV_FLAGS_NEVER_REUSE,
@@ -85,6 +101,8 @@ gboolean	 pk_spawn_argv				(PkSpawn	*spawn,
 gboolean	 pk_spawn_is_running			(PkSpawn	*spawn);
 gboolean	 pk_spawn_kill				(PkSpawn	*spawn);
 gboolean	 pk_spawn_exit				(PkSpawn	*spawn);
+void		 pk_spawn_set_framing			(PkSpawn	*spawn,
+							 PkSpawnFraming	 framing);
 
 G_END_DECLS
 
@@ -0,0 +1,332 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Counters and latency histograms for what the daemon has been doing
+ * since it started, exported on org.freedesktop.PackageKit.Statistics.
+ *
+ * Some of these are recorded from backend and database threads, so
+ * everything is protected by one mutex; nothing here is on a path that
+ * happens more than once per transaction or lock.
+ **/
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "pk-statistics.h"
+
+#define PK_STATISTICS_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), PK_TYPE_STATISTICS, PkStatisticsPrivate))
+
+/* upper bounds of the histogram buckets in ms, the last bucket has
+ * everything that is slower */
+static const guint pk_statistics_bounds[] = {
+	1, 5, 10, 50, 100, 500, 1000, 5000, 10000, 60000 };
+#define PK_STATISTICS_BUCKETS	(G_N_ELEMENTS (pk_statistics_bounds) + 1)
+
+typedef struct {
+	guint64			 count;
+	guint64			 total;
+	guint			 max;
+	guint64			 buckets[PK_STATISTICS_BUCKETS];
+} PkStatisticsHistogram;
+
+typedef struct {
+	guint64			 transactions;
+	guint64			 succeeded;
+	guint64			 failed;
+	guint64			 cancelled;
+	PkStatisticsHistogram	 timings[PK_STATISTICS_TIMING_LAST];
+} PkStatisticsRole;
+
+struct PkStatisticsPrivate
+{
+	GMutex			 mutex;
+	gint64			 started;
+	guint64			 packages;
+	PkStatisticsHistogram	 lock_wait;
+	PkStatisticsHistogram	 database_write;
+	PkStatisticsRole	 roles[PK_ROLE_ENUM_LAST];
+};
+
+static gpointer pk_statistics_object = NULL;
+
+G_DEFINE_TYPE (PkStatistics, pk_statistics, G_TYPE_OBJECT)
+
+/**
+ * pk_statistics_timing_to_string:
+ **/
+static const gchar *
+pk_statistics_timing_to_string (PkStatisticsTiming timing)
+{
+	if (timing == PK_STATISTICS_TIMING_QUEUE_WAIT)
+		return "queue-wait";
+	if (timing == PK_STATISTICS_TIMING_AUTHORIZATION)
+		return "authorization";
+	if (timing == PK_STATISTICS_TIMING_RUNTIME)
+		return "runtime";
+	if (timing == PK_STATISTICS_TIMING_FIRST_PACKAGE)
+		return "first-package";
+	return NULL;
+}
+
+/**
+ * pk_statistics_histogram_add:
+ **/
+static void
+pk_statistics_histogram_add (PkStatisticsHistogram *histogram, guint time_ms)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (pk_statistics_bounds); i++) {
+		if (time_ms <= pk_statistics_bounds[i])
+			break;
+	}
+	histogram->buckets[i]++;
+	histogram->count++;
+	histogram->total += time_ms;
+	histogram->max = MAX (histogram->max, time_ms);
+}
+
+/**
+ * pk_statistics_histogram_to_variant:
+ **/
+static GVariant *
+pk_statistics_histogram_to_variant (PkStatisticsHistogram *histogram)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "count",
+			       g_variant_new_uint64 (histogram->count));
+	g_variant_builder_add (&builder, "{sv}", "total",
+			       g_variant_new_uint64 (histogram->total));
+	g_variant_builder_add (&builder, "{sv}", "max",
+			       g_variant_new_uint32 (histogram->max));
+	g_variant_builder_add (&builder, "{sv}", "buckets",
+			       g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+							  histogram->buckets,
+							  PK_STATISTICS_BUCKETS,
+							  sizeof (guint64)));
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * pk_statistics_add_timing:
+ **/
+void
+pk_statistics_add_timing (PkStatistics *statistics,
+			  PkRoleEnum role,
+			  PkStatisticsTiming timing,
+			  guint time_ms)
+{
+	g_return_if_fail (PK_IS_STATISTICS (statistics));
+	g_return_if_fail (role < PK_ROLE_ENUM_LAST);
+	g_return_if_fail (timing < PK_STATISTICS_TIMING_LAST);
+
+	g_mutex_lock (&statistics->priv->mutex);
+	pk_statistics_histogram_add (&statistics->priv->roles[role].timings[timing], time_ms);
+	g_mutex_unlock (&statistics->priv->mutex);
+}
+
+/**
+ * pk_statistics_add_finished:
+ **/
+void
+pk_statistics_add_finished (PkStatistics *statistics,
+			    PkRoleEnum role,
+			    PkExitEnum exit_enum)
+{
+	PkStatisticsRole *item;
+
+	g_return_if_fail (PK_IS_STATISTICS (statistics));
+	g_return_if_fail (role < PK_ROLE_ENUM_LAST);
+
+	g_mutex_lock (&statistics->priv->mutex);
+	item = &statistics->priv->roles[role];
+	item->transactions++;
+	if (exit_enum == PK_EXIT_ENUM_SUCCESS)
+		item->succeeded++;
+	else if (exit_enum == PK_EXIT_ENUM_CANCELLED ||
+		 exit_enum == PK_EXIT_ENUM_CANCELLED_PRIORITY)
+		item->cancelled++;
+	else
+		item->failed++;
+	g_mutex_unlock (&statistics->priv->mutex);
+}
+
+/**
+ * pk_statistics_add_packages:
+ **/
+void
+pk_statistics_add_packages (PkStatistics *statistics, guint packages)
+{
+	g_return_if_fail (PK_IS_STATISTICS (statistics));
+
+	g_mutex_lock (&statistics->priv->mutex);
+	statistics->priv->packages += packages;
+	g_mutex_unlock (&statistics->priv->mutex);
+}
+
+/**
+ * pk_statistics_add_lock_wait:
+ *
+ * Called when a backend thread had to wait for another thread to
+ * finish with the same backend method.
+ **/
+void
+pk_statistics_add_lock_wait (PkStatistics *statistics, guint time_ms)
+{
+	g_return_if_fail (PK_IS_STATISTICS (statistics));
+
+	g_mutex_lock (&statistics->priv->mutex);
+	pk_statistics_histogram_add (&statistics->priv->lock_wait, time_ms);
+	g_mutex_unlock (&statistics->priv->mutex);
+}
+
+/**
+ * pk_statistics_add_database_write:
+ **/
+void
+pk_statistics_add_database_write (PkStatistics *statistics, guint time_ms)
+{
+	g_return_if_fail (PK_IS_STATISTICS (statistics));
+
+	g_mutex_lock (&statistics->priv->mutex);
+	pk_statistics_histogram_add (&statistics->priv->database_write, time_ms);
+	g_mutex_unlock (&statistics->priv->mutex);
+}
+
+/**
+ * pk_statistics_to_builder:
+ * @builder: a #GVariantBuilder of type a{sv}
+ *
+ * Adds everything recorded so far to @builder.
+ **/
+void
+pk_statistics_to_builder (PkStatistics *statistics, GVariantBuilder *builder)
+{
+	PkStatisticsPrivate *priv = statistics->priv;
+	PkStatisticsRole *item;
+	GVariantBuilder roles;
+	GVariantBuilder role;
+	guint i;
+	guint j;
+
+	g_return_if_fail (PK_IS_STATISTICS (statistics));
+	g_return_if_fail (builder != NULL);
+
+	g_mutex_lock (&priv->mutex);
+	g_variant_builder_add (builder, "{sv}", "uptime",
+			       g_variant_new_uint64 ((g_get_monotonic_time () - priv->started) / G_USEC_PER_SEC));
+	g_variant_builder_add (builder, "{sv}", "bucket-bounds",
+			       g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+							  pk_statistics_bounds,
+							  G_N_ELEMENTS (pk_statistics_bounds),
+							  sizeof (guint)));
+	g_variant_builder_add (builder, "{sv}", "packages-emitted",
+			       g_variant_new_uint64 (priv->packages));
+	g_variant_builder_add (builder, "{sv}", "lock-wait",
+			       pk_statistics_histogram_to_variant (&priv->lock_wait));
+	g_variant_builder_add (builder, "{sv}", "database-write",
+			       pk_statistics_histogram_to_variant (&priv->database_write));
+
+	/* only the roles that have been used */
+	g_variant_builder_init (&roles, G_VARIANT_TYPE ("a{sv}"));
+	for (i = 0; i < PK_ROLE_ENUM_LAST; i++) {
+		item = &priv->roles[i];
+		if (item->transactions == 0 &&
+		    item->timings[PK_STATISTICS_TIMING_QUEUE_WAIT].count == 0)
+			continue;
+		g_variant_builder_init (&role, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_add (&role, "{sv}", "transactions",
+				       g_variant_new_uint64 (item->transactions));
+		g_variant_builder_add (&role, "{sv}", "succeeded",
+				       g_variant_new_uint64 (item->succeeded));
+		g_variant_builder_add (&role, "{sv}", "failed",
+				       g_variant_new_uint64 (item->failed));
+		g_variant_builder_add (&role, "{sv}", "cancelled",
+				       g_variant_new_uint64 (item->cancelled));
+		for (j = 0; j < PK_STATISTICS_TIMING_LAST; j++) {
+			g_variant_builder_add (&role, "{sv}",
+					       pk_statistics_timing_to_string (j),
+					       pk_statistics_histogram_to_variant (&item->timings[j]));
+		}
+		g_variant_builder_add (&roles, "{sv}",
+				       pk_role_enum_to_string (i),
+				       g_variant_builder_end (&role));
+	}
+	g_variant_builder_add (builder, "{sv}", "roles",
+			       g_variant_builder_end (&roles));
+	g_mutex_unlock (&priv->mutex);
+}
+
+/**
+ * pk_statistics_finalize:
+ **/
+static void
+pk_statistics_finalize (GObject *object)
+{
+	PkStatistics *statistics = PK_STATISTICS (object);
+
+	g_mutex_clear (&statistics->priv->mutex);
+
+	G_OBJECT_CLASS (pk_statistics_parent_class)->finalize (object);
+}
+
+/**
+ * pk_statistics_class_init:
+ **/
+static void
+pk_statistics_class_init (PkStatisticsClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = pk_statistics_finalize;
+	g_type_class_add_private (klass, sizeof (PkStatisticsPrivate));
+}
+
+/**
+ * pk_statistics_init:
+ **/
+static void
+pk_statistics_init (PkStatistics *statistics)
+{
+	statistics->priv = PK_STATISTICS_GET_PRIVATE (statistics);
+	g_mutex_init (&statistics->priv->mutex);
+	statistics->priv->started = g_get_monotonic_time ();
+}
+
+/**
+ * pk_statistics_new:
+ *
+ * Return value: the shared statistics instance
+ **/
+PkStatistics *
+pk_statistics_new (void)
+{
+	if (pk_statistics_object != NULL) {
+		g_object_ref (pk_statistics_object);
+	} else {
+		pk_statistics_object = g_object_new (PK_TYPE_STATISTICS, NULL);
+		g_object_add_weak_pointer (pk_statistics_object, &pk_statistics_object);
+	}
+	return PK_STATISTICS (pk_statistics_object);
+}
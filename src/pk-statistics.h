@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __PK_STATISTICS_H
+#define __PK_STATISTICS_H
+
+#include <glib-object.h>
+#include <packagekit-glib2/pk-enum.h>
+
+G_BEGIN_DECLS
+
+#define PK_TYPE_STATISTICS		(pk_statistics_get_type ())
+#define PK_STATISTICS(o)		(G_TYPE_CHECK_INSTANCE_CAST ((o), PK_TYPE_STATISTICS, PkStatistics))
+#define PK_STATISTICS_CLASS(k)		(G_TYPE_CHECK_CLASS_CAST((k), PK_TYPE_STATISTICS, PkStatisticsClass))
+#define PK_IS_STATISTICS(o)		(G_TYPE_CHECK_INSTANCE_TYPE ((o), PK_TYPE_STATISTICS))
+#define PK_IS_STATISTICS_CLASS(k)	(G_TYPE_CHECK_CLASS_TYPE ((k), PK_TYPE_STATISTICS))
+#define PK_STATISTICS_GET_CLASS(o)	(G_TYPE_INSTANCE_GET_CLASS ((o), PK_TYPE_STATISTICS, PkStatisticsClass))
+
+typedef struct PkStatisticsPrivate PkStatisticsPrivate;
+
+typedef struct
+{
+	GObject			 parent;
+	PkStatisticsPrivate	*priv;
+} PkStatistics;
+
+typedef struct
+{
+	GObjectClass		 parent_class;
+} PkStatisticsClass;
+
+typedef enum {
+	PK_STATISTICS_TIMING_QUEUE_WAIT,	/* committed until started */
+	PK_STATISTICS_TIMING_AUTHORIZATION,	/* waiting for polkit */
+	PK_STATISTICS_TIMING_RUNTIME,		/* backend started until finished */
+	PK_STATISTICS_TIMING_FIRST_PACKAGE,	/* backend started until first package */
+	PK_STATISTICS_TIMING_LAST
+} PkStatisticsTiming;
+
+#ifdef G_DEFINE_AUTOPTR_CLEANUP_FUNC
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PkStatistics, g_object_unref)
+#endif
+
+GType		 pk_statistics_get_type		(void);
+PkStatistics	*pk_statistics_new		(void);
+
+void		 pk_statistics_add_timing	(PkStatistics		*statistics,
+						 PkRoleEnum		 role,
+						 PkStatisticsTiming	 timing,
+						 guint			 time_ms);
+void		 pk_statistics_add_finished	(PkStatistics		*statistics,
+						 PkRoleEnum		 role,
+						 PkExitEnum		 exit_enum);
+void		 pk_statistics_add_packages	(PkStatistics		*statistics,
+						 guint			 packages);
+void		 pk_statistics_add_lock_wait	(PkStatistics		*statistics,
+						 guint			 time_ms);
+void		 pk_statistics_add_database_write (PkStatistics		*statistics,
+						 guint			 time_ms);
+void		 pk_statistics_to_builder	(PkStatistics		*statistics,
+						 GVariantBuilder	*builder);
+
+G_END_DECLS
+
+#endif /* __PK_STATISTICS_H */
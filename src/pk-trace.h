@@ -0,0 +1,55 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __PK_TRACE_H
+#define __PK_TRACE_H
+
+/*
+ * Static probes in the "packagekit" provider, which cost a single nop
+ * when nothing is attached. They can be listed with
+ * 'perf list sdt_packagekit:*' or 'bpftrace -l usdt:/usr/libexec/packagekitd'.
+ *
+ *  transaction__new	(tid)
+ *  auth__start		(tid, role)
+ *  auth__done		(tid, role, authorized)
+ *  scheduler__commit	(tid, role)
+ *  job__start		(tid, role)
+ *  first__package	(tid, role, ms since the job started)
+ *  finished		(tid, role, exit, runtime in ms)
+ *  db__commit		(rows, ms)
+ *
+ * Roles and exit codes are passed as the enum values.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PK_TRACE1(name, a)		DTRACE_PROBE1 (packagekit, name, a)
+#define PK_TRACE2(name, a, b)		DTRACE_PROBE2 (packagekit, name, a, b)
+#define PK_TRACE3(name, a, b, c)	DTRACE_PROBE3 (packagekit, name, a, b, c)
+#define PK_TRACE4(name, a, b, c, d)	DTRACE_PROBE4 (packagekit, name, a, b, c, d)
+#else
+#define PK_TRACE1(name, a)
+#define PK_TRACE2(name, a, b)
+#define PK_TRACE3(name, a, b, c)
+#define PK_TRACE4(name, a, b, c, d)
+#endif
+
+#endif /* __PK_TRACE_H */
@@ -39,24 +39,168 @@
 #include <packagekit-glib2/pk-enum.h>
 #include <packagekit-glib2/pk-results.h>
 #include <packagekit-glib2/pk-common.h>
+#include <packagekit-glib2/pk-package-id.h>
 
 #include "pk-shared.h"
+#include "pk-statistics.h"
+#include "pk-trace.h"
 
 #include "pk-transaction-db.h"
 
 static void     pk_transaction_db_finalize	(GObject        *object);
 
 #define PK_TRANSACTION_DB_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), PK_TYPE_TRANSACTION_DB, PkTransactionDbPrivate))
+#define PK_TRANSACTION_DB_FILE		PK_DB_DIR "/transactions.db"
+#define PK_TRANSACTION_DB_BUSY_TIMEOUT	5000 /* ms */
+#define PK_TRANSACTION_DB_PRUNE_CHUNK	500 /* rows per SQL transaction */
+#define PK_TRANSACTION_DB_VACUUM_CHUNK	256 /* pages per SQL transaction */
+#define PK_TRANSACTION_DB_WRITE_RETRIES	3
+
+typedef enum {
+	PK_TRANSACTION_DB_STATEMENT_ACTION_TIME_GET,
+	PK_TRANSACTION_DB_STATEMENT_ACTION_TIME_SET,
+	PK_TRANSACTION_DB_STATEMENT_GET_LIST,
+	PK_TRANSACTION_DB_STATEMENT_PROXY_GET,
+	PK_TRANSACTION_DB_STATEMENT_PROXY_UPDATE,
+	PK_TRANSACTION_DB_STATEMENT_PROXY_INSERT,
+	PK_TRANSACTION_DB_STATEMENT_BEGIN,
+	PK_TRANSACTION_DB_STATEMENT_COMMIT,
+	PK_TRANSACTION_DB_STATEMENT_ROLLBACK,
+	PK_TRANSACTION_DB_STATEMENT_ADD,
+	PK_TRANSACTION_DB_STATEMENT_UPDATE,
+	PK_TRANSACTION_DB_STATEMENT_JOB_COUNT,
+	PK_TRANSACTION_DB_STATEMENT_TIMESPEC_GET,
+	PK_TRANSACTION_DB_STATEMENT_HISTORY_ADD,
+	PK_TRANSACTION_DB_STATEMENT_HISTORY_REMOVE,
+	PK_TRANSACTION_DB_STATEMENT_HISTORY_GET,
+	PK_TRANSACTION_DB_STATEMENT_COUNT,
+	PK_TRANSACTION_DB_STATEMENT_HISTORY_COUNT,
+	PK_TRANSACTION_DB_STATEMENT_PRUNE_HISTORY,
+	PK_TRANSACTION_DB_STATEMENT_PRUNE,
+	PK_TRANSACTION_DB_STATEMENT_PAGE_COUNT,
+	PK_TRANSACTION_DB_STATEMENT_PAGE_SIZE,
+	PK_TRANSACTION_DB_STATEMENT_FREELIST_COUNT,
+	PK_TRANSACTION_DB_STATEMENT_AUTO_VACUUM,
+	PK_TRANSACTION_DB_STATEMENT_TIMELINE_GET,
+	PK_TRANSACTION_DB_STATEMENT_TIMELINE_SET,
+	PK_TRANSACTION_DB_STATEMENT_PRUNE_TIMELINES,
+	PK_TRANSACTION_DB_STATEMENT_LAST
+} PkTransactionDbStatement;
+
+static const gchar *pk_transaction_db_statements[] = {
+	"SELECT timespec FROM last_action WHERE role = ?",
+	"INSERT OR REPLACE INTO last_action (role, timespec) VALUES (?, ?)",
+	"SELECT transaction_id, timespec, succeeded, duration, role, data, uid, cmdline "
+		"FROM transactions ORDER BY timespec DESC LIMIT ?",
+	"SELECT proxy_http, proxy_https, proxy_ftp, proxy_socks, no_proxy, pac "
+		"FROM proxy WHERE uid = ? AND session = ? LIMIT 1",
+	"UPDATE proxy SET proxy_http = ?, proxy_https = ?, proxy_ftp = ?, "
+		"proxy_socks = ?, no_proxy = ?, pac = ? WHERE uid = ? AND session = ?",
+	"INSERT INTO proxy (created, uid, session, proxy_http, proxy_https, "
+		"proxy_ftp, proxy_socks, no_proxy, pac) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+	"BEGIN",
+	"COMMIT",
+	"ROLLBACK",
+	"INSERT OR IGNORE INTO transactions (transaction_id, timespec) VALUES (?, ?)",
+	/* a NULL binding keeps the existing value */
+	"UPDATE transactions SET role = COALESCE(?1, role), uid = COALESCE(?2, uid), "
+		"cmdline = COALESCE(?3, cmdline), data = COALESCE(?4, data), "
+		"succeeded = COALESCE(?5, succeeded), duration = COALESCE(?6, duration) "
+		"WHERE transaction_id = ?7",
+	"UPDATE config SET value = ? WHERE key = 'job_count'",
+	"SELECT timespec FROM transactions WHERE transaction_id = ?",
+	"INSERT INTO package_history (name, arch, version, data, info, tid, timestamp) "
+		"VALUES (?, ?, ?, ?, ?, ?, ?)",
+	"DELETE FROM package_history WHERE tid = ?",
+	/* the newest entries, one for each second as the arches of a
+	 * multiarch package are logged together, returned oldest first */
+	"SELECT info, version, data, timestamp, uid FROM ("
+		"SELECT h.info, h.version, h.data, h.timestamp, t.uid "
+		"FROM package_history h JOIN transactions t ON t.transaction_id = h.tid "
+		"WHERE h.name = ?1 AND h.info IN (?2, ?3, ?4) AND h.timestamp > 0 "
+		"AND t.succeeded = 1 GROUP BY h.timestamp "
+		"ORDER BY h.timestamp DESC LIMIT ?5) "
+		"ORDER BY timestamp ASC",
+	"SELECT COUNT(*) FROM transactions",
+	"SELECT COUNT(*) FROM package_history",
+	/* the oldest rows, optionally only those before a timespec */
+	"DELETE FROM package_history WHERE tid IN ("
+		"SELECT transaction_id FROM transactions WHERE ?1 IS NULL OR timespec < ?1 "
+		"ORDER BY timespec ASC LIMIT ?2)",
+	"DELETE FROM transactions WHERE transaction_id IN ("
+		"SELECT transaction_id FROM transactions WHERE ?1 IS NULL OR timespec < ?1 "
+		"ORDER BY timespec ASC LIMIT ?2)",
+	"PRAGMA page_count",
+	"PRAGMA page_size",
+	"PRAGMA freelist_count",
+	"PRAGMA auto_vacuum",
+	"SELECT timeline FROM timelines WHERE transaction_id = ?",
+	"INSERT OR REPLACE INTO timelines (transaction_id, timespec, timeline) "
+		"VALUES (?, ?, ?)",
+	/* kept as long as the transactions around them */
+	"DELETE FROM timelines WHERE timespec < "
+		"COALESCE(?1, (SELECT MIN(timespec) FROM transactions))",
+};
+
+/* the values of a transactions row that have not been written yet */
+typedef struct {
+	gchar			*tid;
+	gchar			*timespec;	/* set if the row has to be added */
+	gchar			*role;
+	gchar			*cmdline;
+	gchar			*data;
+	gchar			*timeline;
+	gchar			*timeline_timespec;
+	guint			 uid;
+	gboolean		 uid_set;
+	gboolean		 succeeded;
+	guint			 duration;
+	gboolean		 finished_set;
+} PkTransactionDbRow;
+
+typedef struct {
+	GPtrArray		*rows;
+	guint			 job_count;	/* 0 if unchanged */
+	GTask			*task;		/* returned once written */
+} PkTransactionDbBatch;
 
 struct PkTransactionDbPrivate
 {
 	gboolean		 loaded;
 	sqlite3			*db;
+	sqlite3_stmt		*statements[PK_TRANSACTION_DB_STATEMENT_LAST];
 	guint			 job_count;
+	gboolean		 job_count_changed;
 	guint			 database_save_id;
+	GHashTable		*pending_rows;
+	/* only used from the write pool */
+	sqlite3			*db_writer;
+	sqlite3_stmt		*statements_writer[PK_TRANSACTION_DB_STATEMENT_LAST];
+	GThreadPool		*write_pool;
+	PkStatistics		*statistics;
+	GMutex			 write_mutex;
+	GCond			 write_cond;
+	guint			 write_queued;
+	guint			 write_failed; /* only used from the write pool */
+	/* only used by the compaction, with compact_mutex held */
+	GMutex			 compact_mutex;
+	sqlite3			*db_compactor;
+	sqlite3_stmt		*statements_compactor[PK_TRANSACTION_DB_STATEMENT_LAST];
+	/* protected by write_mutex */
+	guint			 max_transactions;
+	guint			 max_age;
+	guint64			 max_size;
+	gboolean		 vacuum;
+	guint64			 pruned;
+	gint64			 compacted;
+	/* counted once when loaded, then kept up to date as rows are
+	 * written and pruned, so the statistics never need a COUNT(*) */
+	gint64			 transactions;
+	gint64			 package_history;
 };
 
 G_DEFINE_TYPE (PkTransactionDb, pk_transaction_db, G_TYPE_OBJECT)
+static gpointer pk_transaction_db_object = NULL;
 
 typedef struct {
 	gchar		*proxy_http;
@@ -68,6 +212,71 @@ typedef struct {
 	gboolean	set;
 } PkTransactionDbProxyItem;
 
+/**
+ * pk_transaction_db_prepare:
+ *
+ * Returns a cached statement for @db, preparing it the first time. The
+ * statement is reset again by pk_transaction_db_step_rows().
+ **/
+static sqlite3_stmt *
+pk_transaction_db_prepare (sqlite3 *db,
+			   sqlite3_stmt **statements,
+			   PkTransactionDbStatement idx)
+{
+	gint rc;
+
+	if (statements[idx] != NULL) {
+		sqlite3_clear_bindings (statements[idx]);
+		return statements[idx];
+	}
+	rc = sqlite3_prepare_v2 (db, pk_transaction_db_statements[idx], -1,
+				 &statements[idx], NULL);
+	if (rc != SQLITE_OK) {
+		g_warning ("failed to prepare statement: %s", sqlite3_errmsg (db));
+		return NULL;
+	}
+	return statements[idx];
+}
+
+/**
+ * pk_transaction_db_step_rows:
+ *
+ * Runs a prepared statement, calling @func for each row in the same way
+ * as sqlite3_exec() would.
+ **/
+static gboolean
+pk_transaction_db_step_rows (sqlite3 *db,
+			     sqlite3_stmt *statement,
+			     sqlite3_callback func,
+			     gpointer data)
+{
+	gchar **argv;
+	gchar **col_name;
+	gint argc;
+	gint i;
+	gint rc;
+
+	argc = sqlite3_column_count (statement);
+	argv = g_newa (gchar *, argc);
+	col_name = g_newa (gchar *, argc);
+	while ((rc = sqlite3_step (statement)) == SQLITE_ROW) {
+		if (func == NULL)
+			continue;
+		for (i = 0; i < argc; i++) {
+			col_name[i] = (gchar *) sqlite3_column_name (statement, i);
+			argv[i] = (gchar *) sqlite3_column_text (statement, i);
+		}
+		if (func (data, argc, argv, col_name) != 0)
+			break;
+	}
+	sqlite3_reset (statement);
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		g_warning ("SQL error: %s", sqlite3_errmsg (db));
+		return FALSE;
+	}
+	return TRUE;
+}
+
 /**
  * pk_transaction_sqlite_transaction_cb:
  **/
@@ -209,101 +418,978 @@ pk_transaction_db_iso8601_difference (const gchar *isodate)
 guint
 pk_transaction_db_action_time_since (PkTransactionDb *tdb, PkRoleEnum role)
 {
-	gchar *error_msg = NULL;
-	gint rc;
-	const gchar *role_text;
-	g_autofree gchar *statement = NULL;
+	sqlite3_stmt *statement;
 	g_autofree gchar *timespec = NULL;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), 0);
 	g_return_val_if_fail (tdb->priv->db != NULL, 0);
 
-	role_text = pk_role_enum_to_string (role);
-
-	statement = g_strdup_printf ("SELECT timespec FROM last_action WHERE role = '%s'", role_text);
-	rc = sqlite3_exec (tdb->priv->db, statement,
-			   pk_time_action_sqlite_callback, &timespec, &error_msg);
-	if (rc != SQLITE_OK) {
-		g_warning ("SQL error: %s", error_msg);
-		sqlite3_free (error_msg);
+	statement = pk_transaction_db_prepare (tdb->priv->db,
+					       tdb->priv->statements,
+					       PK_TRANSACTION_DB_STATEMENT_ACTION_TIME_GET);
+	if (statement == NULL)
+		return G_MAXUINT;
+	sqlite3_bind_text (statement, 1, pk_role_enum_to_string (role), -1, SQLITE_STATIC);
+	if (!pk_transaction_db_step_rows (tdb->priv->db, statement,
+					  pk_time_action_sqlite_callback, &timespec))
 		return G_MAXUINT;
-	}
 	if (timespec == NULL)
 		return G_MAXUINT;
 
-	/* work out the difference */
-	return pk_transaction_db_iso8601_difference (timespec);
+	/* work out the difference */
+	return pk_transaction_db_iso8601_difference (timespec);
+}
+
+/**
+ * pk_transaction_db_action_time_reset:
+ **/
+gboolean
+pk_transaction_db_action_time_reset (PkTransactionDb *tdb, PkRoleEnum role)
+{
+	sqlite3_stmt *statement;
+	g_autofree gchar *timespec = NULL;
+
+	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
+	g_return_val_if_fail (tdb->priv->db != NULL, FALSE);
+
+	/* update or insert the entry */
+	statement = pk_transaction_db_prepare (tdb->priv->db,
+					       tdb->priv->statements,
+					       PK_TRANSACTION_DB_STATEMENT_ACTION_TIME_SET);
+	if (statement == NULL)
+		return FALSE;
+	timespec = pk_iso8601_present ();
+	sqlite3_bind_text (statement, 1, pk_role_enum_to_string (role), -1, SQLITE_STATIC);
+	sqlite3_bind_text (statement, 2, timespec, -1, SQLITE_STATIC);
+	return pk_transaction_db_step_rows (tdb->priv->db, statement, NULL, NULL);
+}
+
+/**
+ * pk_transaction_db_get_list:
+ *
+ * Gets the newest transactions that have been written; use
+ * pk_transaction_db_flush_async() first to include any pending changes.
+ **/
+GList *
+pk_transaction_db_get_list (PkTransactionDb *tdb, guint limit)
+{
+	GList *list = NULL;
+	sqlite3_stmt *statement;
+
+	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), NULL);
+
+	statement = pk_transaction_db_prepare (tdb->priv->db,
+					       tdb->priv->statements,
+					       PK_TRANSACTION_DB_STATEMENT_GET_LIST);
+	if (statement == NULL)
+		return NULL;
+
+	/* a negative limit returns all the rows */
+	sqlite3_bind_int (statement, 1, limit > 0 ? (gint) limit : -1);
+	pk_transaction_db_step_rows (tdb->priv->db, statement,
+				     pk_transaction_db_add_transaction_cb, &list);
+	return list;
+}
+
+/**
+ * pk_transaction_db_row_free:
+ **/
+static void
+pk_transaction_db_row_free (PkTransactionDbRow *row)
+{
+	g_free (row->tid);
+	g_free (row->timespec);
+	g_free (row->role);
+	g_free (row->cmdline);
+	g_free (row->data);
+	g_free (row->timeline);
+	g_free (row->timeline_timespec);
+	g_free (row);
+}
+
+/**
+ * pk_transaction_db_batch_free:
+ **/
+static void
+pk_transaction_db_batch_free (PkTransactionDbBatch *batch)
+{
+	g_ptr_array_unref (batch->rows);
+	if (batch->task != NULL)
+		g_object_unref (batch->task);
+	g_free (batch);
+}
+
+/**
+ * pk_transaction_db_add_package_history:
+ * @data: the package lines saved for the transaction
+ * @added: (out) (optional): incremented by the number of rows added
+ *
+ * Adds a package_history row for each package in @data, replacing any
+ * rows already added for @tid.
+ **/
+static gboolean
+pk_transaction_db_add_package_history (sqlite3 *db,
+				       sqlite3_stmt **statements,
+				       const gchar *tid,
+				       const gchar *timespec,
+				       const gchar *data,
+				       gint64 *added)
+{
+	gint64 timestamp = 0;
+	guint i;
+	sqlite3_stmt *statement;
+	g_autoptr(GDateTime) datetime = NULL;
+	g_auto(GStrv) lines = NULL;
+
+	statement = pk_transaction_db_prepare (db, statements,
+					       PK_TRANSACTION_DB_STATEMENT_HISTORY_REMOVE);
+	if (statement == NULL)
+		return FALSE;
+	sqlite3_bind_text (statement, 1, tid, -1, SQLITE_STATIC);
+	if (!pk_transaction_db_step_rows (db, statement, NULL, NULL))
+		return FALSE;
+	if (added != NULL)
+		*added -= sqlite3_changes (db);
+
+	if (timespec != NULL)
+		datetime = pk_iso8601_to_datetime (timespec);
+	if (datetime != NULL)
+		timestamp = g_date_time_to_unix (datetime);
+
+	/* each line is 'info\tpackage_id\tsummary' */
+	lines = g_strsplit (data, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_auto(GStrv) sections = NULL;
+		g_auto(GStrv) split = NULL;
+
+		sections = g_strsplit (lines[i], "\t", 3);
+		if (g_strv_length (sections) < 2)
+			continue;
+		split = pk_package_id_split (sections[1]);
+		if (split == NULL) {
+			g_warning ("failed to parse package history: '%s'", lines[i]);
+			continue;
+		}
+		statement = pk_transaction_db_prepare (db, statements,
+						       PK_TRANSACTION_DB_STATEMENT_HISTORY_ADD);
+		if (statement == NULL)
+			return FALSE;
+		sqlite3_bind_text (statement, 1, split[PK_PACKAGE_ID_NAME], -1, SQLITE_STATIC);
+		sqlite3_bind_text (statement, 2, split[PK_PACKAGE_ID_ARCH], -1, SQLITE_STATIC);
+		sqlite3_bind_text (statement, 3, split[PK_PACKAGE_ID_VERSION], -1, SQLITE_STATIC);
+		sqlite3_bind_text (statement, 4, split[PK_PACKAGE_ID_DATA], -1, SQLITE_STATIC);
+		sqlite3_bind_int (statement, 5, pk_info_enum_from_string (sections[0]));
+		sqlite3_bind_text (statement, 6, tid, -1, SQLITE_STATIC);
+		sqlite3_bind_int64 (statement, 7, timestamp);
+		if (!pk_transaction_db_step_rows (db, statement, NULL, NULL))
+			return FALSE;
+		if (added != NULL)
+			(*added)++;
+	}
+	return TRUE;
+}
+
+/**
+ * pk_transaction_db_write_row:
+ * @transactions: (out): incremented if a transaction was added
+ * @package_history: (out): incremented by the package_history rows added
+ *
+ * Called from the write pool.
+ **/
+static gboolean
+pk_transaction_db_write_row (PkTransactionDb *tdb,
+			     PkTransactionDbRow *row,
+			     gint64 *transactions,
+			     gint64 *package_history)
+{
+	PkTransactionDbPrivate *priv = tdb->priv;
+	sqlite3_stmt *statement;
+
+	/* timelines are saved for every role, so are kept out of the log */
+	if (row->timeline != NULL) {
+		statement = pk_transaction_db_prepare (priv->db_writer,
+						       priv->statements_writer,
+						       PK_TRANSACTION_DB_STATEMENT_TIMELINE_SET);
+		if (statement == NULL)
+			return FALSE;
+		sqlite3_bind_text (statement, 1, row->tid, -1, SQLITE_STATIC);
+		sqlite3_bind_text (statement, 2, row->timeline_timespec, -1, SQLITE_STATIC);
+		sqlite3_bind_text (statement, 3, row->timeline, -1, SQLITE_STATIC);
+		if (!pk_transaction_db_step_rows (priv->db_writer, statement, NULL, NULL))
+			return FALSE;
+	}
+
+	/* nothing to log */
+	if (row->timespec == NULL && row->role == NULL && !row->uid_set &&
+	    row->cmdline == NULL && row->data == NULL && !row->finished_set)
+		return TRUE;
+
+	/* add a new row */
+	if (row->timespec != NULL) {
+		statement = pk_transaction_db_prepare (priv->db_writer,
+						       priv->statements_writer,
+						       PK_TRANSACTION_DB_STATEMENT_ADD);
+		if (statement == NULL)
+			return FALSE;
+		sqlite3_bind_text (statement, 1, row->tid, -1, SQLITE_STATIC);
+		sqlite3_bind_text (statement, 2, row->timespec, -1, SQLITE_STATIC);
+		if (!pk_transaction_db_step_rows (priv->db_writer, statement, NULL, NULL))
+			return FALSE;
+		*transactions += sqlite3_changes (priv->db_writer);
+	}
+
+	/* set all the other values at once, leaving unbound values as-is */
+	statement = pk_transaction_db_prepare (priv->db_writer,
+					       priv->statements_writer,
+					       PK_TRANSACTION_DB_STATEMENT_UPDATE);
+	if (statement == NULL)
+		return FALSE;
+	sqlite3_bind_text (statement, 1, row->role, -1, SQLITE_STATIC);
+	if (row->uid_set)
+		sqlite3_bind_int (statement, 2, row->uid);
+	sqlite3_bind_text (statement, 3, row->cmdline, -1, SQLITE_STATIC);
+	sqlite3_bind_text (statement, 4, row->data, -1, SQLITE_STATIC);
+	if (row->finished_set) {
+		sqlite3_bind_int (statement, 5, row->succeeded);
+		sqlite3_bind_int (statement, 6, row->duration);
+	}
+	sqlite3_bind_text (statement, 7, row->tid, -1, SQLITE_STATIC);
+	if (!pk_transaction_db_step_rows (priv->db_writer, statement, NULL, NULL))
+		return FALSE;
+
+	/* index the packages for GetPackageHistory */
+	if (row->data != NULL) {
+		g_autofree gchar *timespec = g_strdup (row->timespec);
+		if (timespec == NULL) {
+			statement = pk_transaction_db_prepare (priv->db_writer,
+							       priv->statements_writer,
+							       PK_TRANSACTION_DB_STATEMENT_TIMESPEC_GET);
+			if (statement == NULL)
+				return FALSE;
+			sqlite3_bind_text (statement, 1, row->tid, -1, SQLITE_STATIC);
+			if (!pk_transaction_db_step_rows (priv->db_writer, statement,
+							  pk_time_action_sqlite_callback,
+							  &timespec))
+				return FALSE;
+		}
+		if (!pk_transaction_db_add_package_history (priv->db_writer,
+							    priv->statements_writer,
+							    row->tid,
+							    timespec,
+							    row->data,
+							    package_history))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * pk_transaction_db_write_batch:
+ *
+ * Called from the write pool.
+ **/
+static gboolean
+pk_transaction_db_write_batch (PkTransactionDb *tdb, PkTransactionDbBatch *batch)
+{
+	PkTransactionDbPrivate *priv = tdb->priv;
+	gint64 package_history = 0;
+	gint64 transactions = 0;
+	sqlite3_stmt *statement;
+	guint i;
+
+	/* write everything in one SQL transaction */
+	statement = pk_transaction_db_prepare (priv->db_writer,
+					       priv->statements_writer,
+					       PK_TRANSACTION_DB_STATEMENT_BEGIN);
+	if (statement == NULL)
+		return FALSE;
+	if (!pk_transaction_db_step_rows (priv->db_writer, statement, NULL, NULL))
+		return FALSE;
+
+	for (i = 0; i < batch->rows->len; i++) {
+		if (!pk_transaction_db_write_row (tdb, g_ptr_array_index (batch->rows, i),
+						  &transactions, &package_history))
+			goto rollback;
+	}
+
+	if (batch->job_count > 0) {
+		statement = pk_transaction_db_prepare (priv->db_writer,
+						       priv->statements_writer,
+						       PK_TRANSACTION_DB_STATEMENT_JOB_COUNT);
+		if (statement == NULL)
+			goto rollback;
+		sqlite3_bind_int (statement, 1, batch->job_count);
+		if (!pk_transaction_db_step_rows (priv->db_writer, statement, NULL, NULL))
+			goto rollback;
+	}
+
+	statement = pk_transaction_db_prepare (priv->db_writer,
+					       priv->statements_writer,
+					       PK_TRANSACTION_DB_STATEMENT_COMMIT);
+	if (statement == NULL)
+		goto rollback;
+	if (!pk_transaction_db_step_rows (priv->db_writer, statement, NULL, NULL))
+		goto rollback;
+
+	g_mutex_lock (&priv->write_mutex);
+	priv->transactions += transactions;
+	priv->package_history += package_history;
+	g_mutex_unlock (&priv->write_mutex);
+	return TRUE;
+rollback:
+	statement = pk_transaction_db_prepare (priv->db_writer,
+					       priv->statements_writer,
+					       PK_TRANSACTION_DB_STATEMENT_ROLLBACK);
+	if (statement != NULL)
+		pk_transaction_db_step_rows (priv->db_writer, statement, NULL, NULL);
+	return FALSE;
+}
+
+/**
+ * pk_transaction_db_query_int:
+ **/
+static gboolean
+pk_transaction_db_query_int (sqlite3 *db,
+			     sqlite3_stmt **statements,
+			     PkTransactionDbStatement idx,
+			     gint64 *value)
+{
+	gint rc;
+	sqlite3_stmt *statement;
+
+	statement = pk_transaction_db_prepare (db, statements, idx);
+	if (statement == NULL)
+		return FALSE;
+	rc = sqlite3_step (statement);
+	if (rc == SQLITE_ROW)
+		*value = sqlite3_column_int64 (statement, 0);
+	sqlite3_reset (statement);
+	if (rc != SQLITE_ROW) {
+		g_warning ("SQL error: %s", sqlite3_errmsg (db));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * pk_transaction_db_prune_oldest:
+ * @before: only remove transactions older than this timespec, or %NULL
+ * @package_history: (out): incremented by the package_history rows removed
+ *
+ * Removes up to @limit of the oldest transactions and their package
+ * history in one SQL transaction, along with any timelines older than
+ * the transactions that are left. Called from the compaction thread.
+ *
+ * Return value: the number of transactions removed, or -1 for error
+ **/
+static gint
+pk_transaction_db_prune_oldest (sqlite3 *db,
+				sqlite3_stmt **statements,
+				const gchar *before,
+				guint limit,
+				gint64 *package_history)
+{
+	PkTransactionDbStatement idx[] = { PK_TRANSACTION_DB_STATEMENT_BEGIN,
+					   PK_TRANSACTION_DB_STATEMENT_PRUNE_HISTORY,
+					   PK_TRANSACTION_DB_STATEMENT_PRUNE,
+					   PK_TRANSACTION_DB_STATEMENT_PRUNE_TIMELINES,
+					   PK_TRANSACTION_DB_STATEMENT_COMMIT };
+	gint removed = 0;
+	gint removed_history = 0;
+	guint i;
+	sqlite3_stmt *statement;
+
+	for (i = 0; i < G_N_ELEMENTS (idx); i++) {
+		statement = pk_transaction_db_prepare (db, statements, idx[i]);
+		if (statement == NULL)
+			goto rollback;
+		if (sqlite3_bind_parameter_count (statement) >= 1)
+			sqlite3_bind_text (statement, 1, before, -1, SQLITE_STATIC);
+		if (sqlite3_bind_parameter_count (statement) == 2)
+			sqlite3_bind_int (statement, 2, limit);
+		if (!pk_transaction_db_step_rows (db, statement, NULL, NULL))
+			goto rollback;
+		if (idx[i] == PK_TRANSACTION_DB_STATEMENT_PRUNE_HISTORY)
+			removed_history = sqlite3_changes (db);
+		if (idx[i] == PK_TRANSACTION_DB_STATEMENT_PRUNE)
+			removed = sqlite3_changes (db);
+	}
+	*package_history += removed_history;
+	return removed;
+rollback:
+	if (!sqlite3_get_autocommit (db))
+		sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+	return -1;
+}
+
+/**
+ * pk_transaction_db_get_used_size:
+ *
+ * Gets the number of bytes in the database file that are in use.
+ **/
+static gboolean
+pk_transaction_db_get_used_size (sqlite3 *db, sqlite3_stmt **statements, guint64 *size)
+{
+	gint64 page_count = 0;
+	gint64 page_size = 0;
+	gint64 freelist_count = 0;
+
+	if (!pk_transaction_db_query_int (db, statements,
+					  PK_TRANSACTION_DB_STATEMENT_PAGE_COUNT,
+					  &page_count))
+		return FALSE;
+	if (!pk_transaction_db_query_int (db, statements,
+					  PK_TRANSACTION_DB_STATEMENT_PAGE_SIZE,
+					  &page_size))
+		return FALSE;
+	if (!pk_transaction_db_query_int (db, statements,
+					  PK_TRANSACTION_DB_STATEMENT_FREELIST_COUNT,
+					  &freelist_count))
+		return FALSE;
+	*size = (page_count - freelist_count) * page_size;
+	return TRUE;
+}
+
+/**
+ * pk_transaction_db_vacuum:
+ *
+ * Returns the free pages to the filesystem a chunk at a time, so writers
+ * are never held up for long. Files created before incremental vacuum
+ * was turned on are never rewritten, and just reuse their free pages.
+ **/
+static void
+pk_transaction_db_vacuum (sqlite3 *db, sqlite3_stmt **statements)
+{
+	gint64 auto_vacuum = 0;
+	gint64 freelist_count = 0;
+	gint64 freelist_count_old;
+	g_autofree gchar *statement = NULL;
+
+	if (!pk_transaction_db_query_int (db, statements,
+					  PK_TRANSACTION_DB_STATEMENT_FREELIST_COUNT,
+					  &freelist_count) ||
+	    freelist_count == 0)
+		return;
+	if (!pk_transaction_db_query_int (db, statements,
+					  PK_TRANSACTION_DB_STATEMENT_AUTO_VACUUM,
+					  &auto_vacuum))
+		return;
+
+	/* the free pages are still reused for new transactions */
+	if (auto_vacuum != 2)
+		return;
+
+	statement = g_strdup_printf ("PRAGMA incremental_vacuum(%i)",
+				     PK_TRANSACTION_DB_VACUUM_CHUNK);
+	do {
+		freelist_count_old = freelist_count;
+		if (sqlite3_exec (db, statement, NULL, NULL, NULL) != SQLITE_OK) {
+			g_warning ("failed to vacuum: %s", sqlite3_errmsg (db));
+			return;
+		}
+		if (!pk_transaction_db_query_int (db, statements,
+						  PK_TRANSACTION_DB_STATEMENT_FREELIST_COUNT,
+						  &freelist_count))
+			return;
+	} while (freelist_count > 0 && freelist_count < freelist_count_old);
+}
+
+/**
+ * pk_transaction_db_compact_thread_cb:
+ *
+ * Removes transactions outside the retention policy, oldest first and a
+ * chunk at a time so that readers and new writes are never held up for
+ * long, then returns the free pages to the filesystem.
+ *
+ * This runs on its own connection rather than in the write pool, so
+ * that pk_transaction_db_flush_async() never waits for it.
+ **/
+static void
+pk_transaction_db_compact_thread_cb (GTask *task,
+				     gpointer source_object,
+				     gpointer task_data,
+				     GCancellable *cancellable)
+{
+	PkTransactionDb *tdb = PK_TRANSACTION_DB (source_object);
+	PkTransactionDbPrivate *priv = tdb->priv;
+	gboolean vacuum;
+	gint removed;
+	gint64 count = 0;
+	guint max_age;
+	guint max_transactions;
+	guint64 max_size;
+	guint64 pruned = 0;
+	gint64 pruned_history = 0;
+	guint64 size;
+
+	g_mutex_lock (&priv->write_mutex);
+	max_transactions = priv->max_transactions;
+	max_age = priv->max_age;
+	max_size = priv->max_size;
+	vacuum = priv->vacuum;
+	g_mutex_unlock (&priv->write_mutex);
+
+	/* no retention policy, so there is nothing to remove */
+	if (max_transactions == 0 && max_age == 0 && max_size == 0) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	g_mutex_lock (&priv->compact_mutex);
+
+	/* too many transactions */
+	if (max_transactions > 0 &&
+	    pk_transaction_db_query_int (priv->db_compactor,
+					 priv->statements_compactor,
+					 PK_TRANSACTION_DB_STATEMENT_COUNT,
+					 &count)) {
+		while (count > max_transactions) {
+			removed = pk_transaction_db_prune_oldest (priv->db_compactor,
+								  priv->statements_compactor,
+								  NULL,
+								  MIN (count - max_transactions,
+								       PK_TRANSACTION_DB_PRUNE_CHUNK),
+								  &pruned_history);
+			if (removed <= 0)
+				break;
+			count -= removed;
+			pruned += removed;
+		}
+	}
+
+	/* too old */
+	if (max_age > 0) {
+		GTimeVal timeval;
+		g_autofree gchar *before = NULL;
+
+		g_get_current_time (&timeval);
+		timeval.tv_sec -= max_age;
+		timeval.tv_usec = 0;
+		before = g_time_val_to_iso8601 (&timeval);
+		do {
+			removed = pk_transaction_db_prune_oldest (priv->db_compactor,
+								  priv->statements_compactor,
+								  before,
+								  PK_TRANSACTION_DB_PRUNE_CHUNK,
+								  &pruned_history);
+			if (removed > 0)
+				pruned += removed;
+		} while (removed == PK_TRANSACTION_DB_PRUNE_CHUNK);
+	}
+
+	/* too big; deleted rows go straight onto the freelist */
+	if (max_size > 0) {
+		while (pk_transaction_db_get_used_size (priv->db_compactor,
+							priv->statements_compactor,
+							&size) &&
+		       size > max_size) {
+			removed = pk_transaction_db_prune_oldest (priv->db_compactor,
+								  priv->statements_compactor,
+								  NULL,
+								  PK_TRANSACTION_DB_PRUNE_CHUNK,
+								  &pruned_history);
+			if (removed <= 0)
+				break;
+			pruned += removed;
+		}
+	}
+
+	if (vacuum)
+		pk_transaction_db_vacuum (priv->db_compactor, priv->statements_compactor);
+	g_mutex_unlock (&priv->compact_mutex);
+
+	if (pruned > 0)
+		g_debug ("pruned %" G_GUINT64_FORMAT " old transactions", pruned);
+	g_mutex_lock (&priv->write_mutex);
+	priv->pruned += pruned;
+	priv->transactions -= pruned;
+	priv->package_history -= pruned_history;
+	priv->compacted = g_get_real_time () / G_USEC_PER_SEC;
+	g_mutex_unlock (&priv->write_mutex);
+	g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * pk_transaction_db_write_batch_retry:
+ *
+ * A failed batch has been rolled back, so it can be written again once
+ * whatever held the database, such as a full disk or a long lock, has gone.
+ **/
+static gboolean
+pk_transaction_db_write_batch_retry (PkTransactionDb *tdb, PkTransactionDbBatch *batch)
+{
+	gulong delay = G_USEC_PER_SEC;
+	guint i;
+
+	for (i = 0; i < PK_TRANSACTION_DB_WRITE_RETRIES; i++) {
+		if (pk_transaction_db_write_batch (tdb, batch))
+			return TRUE;
+		g_debug ("failed to write %u transactions, retrying in %lums",
+			 batch->rows->len, delay / 1000);
+		g_usleep (delay);
+		delay *= 2;
+	}
+	return pk_transaction_db_write_batch (tdb, batch);
+}
+
+/**
+ * pk_transaction_db_write_pool_cb:
+ **/
+static void
+pk_transaction_db_write_pool_cb (gpointer data, gpointer user_data)
+{
+	PkTransactionDb *tdb = PK_TRANSACTION_DB (user_data);
+	PkTransactionDbBatch *batch = (PkTransactionDbBatch *) data;
+	gint64 started = g_get_monotonic_time ();
+	guint time_ms;
+
+	if (batch->task != NULL) {
+		/* everything queued before this has been written, or lost */
+		if (tdb->priv->write_failed > 0) {
+			g_task_return_new_error (batch->task, 1, 0,
+						 "failed to write %u transactions",
+						 tdb->priv->write_failed);
+			tdb->priv->write_failed = 0;
+		} else {
+			g_task_return_boolean (batch->task, TRUE);
+		}
+	} else if (!pk_transaction_db_write_batch_retry (tdb, batch)) {
+		g_warning ("failed to write %u transactions", batch->rows->len);
+		tdb->priv->write_failed += batch->rows->len;
+	} else {
+		time_ms = (g_get_monotonic_time () - started) / 1000;
+		pk_statistics_add_database_write (tdb->priv->statistics, time_ms);
+		PK_TRACE2 (db__commit, batch->rows->len, time_ms);
+	}
+	pk_transaction_db_batch_free (batch);
+
+	/* wake up anything waiting in pk_transaction_db_flush() */
+	g_mutex_lock (&tdb->priv->write_mutex);
+	tdb->priv->write_queued--;
+	g_cond_broadcast (&tdb->priv->write_cond);
+	g_mutex_unlock (&tdb->priv->write_mutex);
+}
+
+/**
+ * pk_transaction_db_queue_pending:
+ *
+ * Hands everything that has changed since the last call to the write pool.
+ **/
+static void
+pk_transaction_db_queue_pending (PkTransactionDb *tdb)
+{
+	PkTransactionDbPrivate *priv = tdb->priv;
+	PkTransactionDbBatch *batch;
+	GHashTableIter iter;
+	gpointer value;
+	g_autoptr(GError) error = NULL;
+
+	if (g_hash_table_size (priv->pending_rows) == 0 && !priv->job_count_changed)
+		return;
+
+	/* not loaded! */
+	if (priv->write_pool == NULL) {
+		g_warning ("PkTransactionDb not loaded");
+		return;
+	}
+
+	batch = g_new0 (PkTransactionDbBatch, 1);
+	batch->rows = g_ptr_array_new_with_free_func ((GDestroyNotify) pk_transaction_db_row_free);
+	g_hash_table_iter_init (&iter, priv->pending_rows);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		g_ptr_array_add (batch->rows, value);
+		g_hash_table_iter_steal (&iter);
+	}
+	if (priv->job_count_changed) {
+		batch->job_count = priv->job_count;
+		priv->job_count_changed = FALSE;
+	}
+
+	g_mutex_lock (&priv->write_mutex);
+	priv->write_queued++;
+	g_mutex_unlock (&priv->write_mutex);
+	if (!g_thread_pool_push (priv->write_pool, batch, &error)) {
+		g_warning ("failed to queue write: %s", error->message);
+		pk_transaction_db_batch_free (batch);
+		g_mutex_lock (&priv->write_mutex);
+		priv->write_queued--;
+		g_mutex_unlock (&priv->write_mutex);
+	}
+}
+
+/**
+ * pk_transaction_db_write_idle_cb:
+ **/
+static gboolean
+pk_transaction_db_write_idle_cb (PkTransactionDb *tdb)
+{
+	tdb->priv->database_save_id = 0;
+	pk_transaction_db_queue_pending (tdb);
+	return FALSE;
+}
+
+/**
+ * pk_transaction_db_schedule_write:
+ **/
+static void
+pk_transaction_db_schedule_write (PkTransactionDb *tdb)
+{
+	/* we don't need to wait for the database write, just do this the
+	 * next time we are idle (but ensure we do this on shutdown) */
+	if (tdb->priv->database_save_id != 0)
+		return;
+	tdb->priv->database_save_id =
+		g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc)
+				 pk_transaction_db_write_idle_cb, tdb, NULL);
+	g_source_set_name_by_id (tdb->priv->database_save_id, "[PkTransactionDb] write");
+}
+
+/**
+ * pk_transaction_db_get_pending_row:
+ *
+ * Returns the unwritten values for @tid, which are written with any other
+ * changes made before the daemon is next idle.
+ **/
+static PkTransactionDbRow *
+pk_transaction_db_get_pending_row (PkTransactionDb *tdb, const gchar *tid)
+{
+	PkTransactionDbRow *row;
+
+	row = g_hash_table_lookup (tdb->priv->pending_rows, tid);
+	if (row == NULL) {
+		row = g_new0 (PkTransactionDbRow, 1);
+		row->tid = g_strdup (tid);
+		g_hash_table_insert (tdb->priv->pending_rows, row->tid, row);
+	}
+	pk_transaction_db_schedule_write (tdb);
+	return row;
+}
+
+/**
+ * pk_transaction_db_flush:
+ * @tdb: a #PkTransactionDb
+ *
+ * Writes all the pending changes, blocking until they are on disk. This
+ * is only for shutdown and the self tests, as it blocks the main loop.
+ **/
+void
+pk_transaction_db_flush (PkTransactionDb *tdb)
+{
+	PkTransactionDbPrivate *priv = tdb->priv;
+
+	g_return_if_fail (PK_IS_TRANSACTION_DB (tdb));
+
+	if (priv->database_save_id != 0) {
+		g_source_remove (priv->database_save_id);
+		priv->database_save_id = 0;
+	}
+	pk_transaction_db_queue_pending (tdb);
+
+	g_mutex_lock (&priv->write_mutex);
+	while (priv->write_queued > 0)
+		g_cond_wait (&priv->write_cond, &priv->write_mutex);
+	g_mutex_unlock (&priv->write_mutex);
+}
+
+/**
+ * pk_transaction_db_flush_async:
+ * @tdb: a #PkTransactionDb
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run when the changes have been written
+ * @user_data: the data to pass to @callback
+ *
+ * Queues all the pending changes and calls @callback once they and
+ * anything queued before them have been written, so the read functions
+ * can then be used without blocking on the write pool. Changes that could
+ * not be written since the last flush are reported as an error.
+ **/
+void
+pk_transaction_db_flush_async (PkTransactionDb *tdb,
+			       GCancellable *cancellable,
+			       GAsyncReadyCallback callback,
+			       gpointer user_data)
+{
+	PkTransactionDbPrivate *priv = tdb->priv;
+	PkTransactionDbBatch *batch;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GTask) task = NULL;
+
+	g_return_if_fail (PK_IS_TRANSACTION_DB (tdb));
+
+	task = g_task_new (tdb, cancellable, callback, user_data);
+	g_task_set_source_tag (task, pk_transaction_db_flush_async);
+
+	/* not loaded, so there is nothing to wait for */
+	if (priv->write_pool == NULL) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	if (priv->database_save_id != 0) {
+		g_source_remove (priv->database_save_id);
+		priv->database_save_id = 0;
+	}
+	pk_transaction_db_queue_pending (tdb);
+
+	/* the pool has one thread, so this is run after the writes */
+	batch = g_new0 (PkTransactionDbBatch, 1);
+	batch->rows = g_ptr_array_new ();
+	batch->task = g_object_ref (task);
+	g_mutex_lock (&priv->write_mutex);
+	priv->write_queued++;
+	g_mutex_unlock (&priv->write_mutex);
+	if (!g_thread_pool_push (priv->write_pool, batch, &error)) {
+		pk_transaction_db_batch_free (batch);
+		g_mutex_lock (&priv->write_mutex);
+		priv->write_queued--;
+		g_mutex_unlock (&priv->write_mutex);
+		g_task_return_error (task, g_steal_pointer (&error));
+	}
+}
+
+/**
+ * pk_transaction_db_flush_finish:
+ * @tdb: a #PkTransactionDb
+ * @res: the #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Return value: %TRUE if the pending changes were written
+ **/
+gboolean
+pk_transaction_db_flush_finish (PkTransactionDb *tdb, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (res, tdb), FALSE);
+	return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+/**
+ * pk_transaction_db_set_retention:
+ * @tdb: a #PkTransactionDb
+ * @max_transactions: the number of transactions to keep, or 0 for no limit
+ * @max_age: the age in seconds of the oldest transaction to keep, or 0
+ * @max_size: the size in bytes the database should be kept under, or 0
+ * @vacuum: if the freed space should be given back to the filesystem
+ *
+ * Sets which old transactions are removed by pk_transaction_db_compact_async().
+ * Unless @vacuum is set the freed space is only reused for new transactions.
+ **/
+void
+pk_transaction_db_set_retention (PkTransactionDb *tdb,
+				 guint max_transactions,
+				 guint max_age,
+				 guint64 max_size,
+				 gboolean vacuum)
+{
+	g_return_if_fail (PK_IS_TRANSACTION_DB (tdb));
+
+	g_mutex_lock (&tdb->priv->write_mutex);
+	tdb->priv->max_transactions = max_transactions;
+	tdb->priv->max_age = max_age;
+	tdb->priv->max_size = max_size;
+	tdb->priv->vacuum = vacuum;
+	g_mutex_unlock (&tdb->priv->write_mutex);
 }
 
 /**
- * pk_transaction_db_action_time_reset:
+ * pk_transaction_db_compact_flush_cb:
  **/
-gboolean
-pk_transaction_db_action_time_reset (PkTransactionDb *tdb, PkRoleEnum role)
+static void
+pk_transaction_db_compact_flush_cb (GObject *source_object,
+				    GAsyncResult *res,
+				    gpointer user_data)
 {
-	gchar *error_msg = NULL;
-	gint rc;
-	const gchar *role_text;
-	guint since;
-	g_autofree gchar *statement = NULL;
-	g_autofree gchar *timespec = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GTask) task = G_TASK (user_data);
 
-	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
-	g_return_val_if_fail (tdb->priv->db != NULL, FALSE);
+	/* pruning what was written is still worth doing */
+	if (!pk_transaction_db_flush_finish (PK_TRANSACTION_DB (source_object), res, &error))
+		g_warning ("failed to write pending changes: %s", error->message);
+	g_task_run_in_thread (task, pk_transaction_db_compact_thread_cb);
+}
 
-	timespec = pk_iso8601_present ();
-	role_text = pk_role_enum_to_string (role);
+/**
+ * pk_transaction_db_compact_async:
+ * @tdb: a #PkTransactionDb
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run when done, or %NULL
+ * @user_data: the data to pass to @callback
+ *
+ * Removes old transactions as set by pk_transaction_db_set_retention()
+ * and frees the unused space. This is done after any pending writes, in
+ * a thread of its own, so it should be started when the daemon is idle.
+ **/
+void
+pk_transaction_db_compact_async (PkTransactionDb *tdb,
+				 GCancellable *cancellable,
+				 GAsyncReadyCallback callback,
+				 gpointer user_data)
+{
+	GTask *task;
 
-	/* get the previous entry */
-	since = pk_transaction_db_action_time_since (tdb, role);
-	if (since == G_MAXUINT) {
-		statement = g_strdup_printf ("INSERT INTO last_action (role, timespec) VALUES ('%s', '%s')", role_text, timespec);
-	} else {
-		statement = g_strdup_printf ("UPDATE last_action SET timespec = '%s' WHERE role = '%s'", timespec, role_text);
-	}
+	g_return_if_fail (PK_IS_TRANSACTION_DB (tdb));
+	g_return_if_fail (tdb->priv->db_compactor != NULL);
 
-	/* update or insert the entry */
-	rc = sqlite3_exec (tdb->priv->db, statement, NULL, NULL, &error_msg);
-	if (rc != SQLITE_OK) {
-		g_warning ("SQL error: %s", error_msg);
-		sqlite3_free (error_msg);
-		return FALSE;
-	}
-	return TRUE;
+	task = g_task_new (tdb, cancellable, callback, user_data);
+	g_task_set_source_tag (task, pk_transaction_db_compact_async);
+	pk_transaction_db_flush_async (tdb, cancellable,
+				       pk_transaction_db_compact_flush_cb,
+				       task);
 }
 
 /**
- * pk_transaction_db_get_list:
+ * pk_transaction_db_compact_finish:
+ * @tdb: a #PkTransactionDb
+ * @res: the #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Return value: %TRUE for success
  **/
-GList *
-pk_transaction_db_get_list (PkTransactionDb *tdb, guint limit)
+gboolean
+pk_transaction_db_compact_finish (PkTransactionDb *tdb, GAsyncResult *res, GError **error)
 {
-	gchar *error_msg = NULL;
-	gint rc;
-	GList *list = NULL;
-	g_autofree gchar *statement = NULL;
-
-	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), NULL);
+	g_return_val_if_fail (g_task_is_valid (res, tdb), FALSE);
+	return g_task_propagate_boolean (G_TASK (res), error);
+}
 
-	if (limit == 0) {
-		statement = g_strdup ("SELECT transaction_id, timespec, succeeded, duration, role, data, uid, cmdline "
-				      "FROM transactions ORDER BY timespec DESC");
-	} else {
-		statement = g_strdup_printf ("SELECT transaction_id, timespec, succeeded, duration, role, data, uid, cmdline "
-					     "FROM transactions ORDER BY timespec DESC LIMIT %i", limit);
-	}
-	rc = sqlite3_exec (tdb->priv->db,
-			   statement,
-			   pk_transaction_db_add_transaction_cb,
-			   &list,
-			   &error_msg);
-	if (rc != SQLITE_OK) {
-		g_warning ("SQL error: %s", error_msg);
-		sqlite3_free (error_msg);
-		goto out;
-	}
-out:
-	return list;
+/**
+ * pk_transaction_db_get_stats:
+ * @tdb: a #PkTransactionDb
+ * @stats: (out caller-allocates): the statistics
+ *
+ * Gets the size of the database and what has been removed from it, as
+ * written; use pk_transaction_db_flush_async() first to include any
+ * pending changes. The rows are counted as they are written, and the
+ * size is read from the file header, so this never scans a table.
+ **/
+void
+pk_transaction_db_get_stats (PkTransactionDb *tdb, PkTransactionDbStats *stats)
+{
+	PkTransactionDbPrivate *priv = tdb->priv;
+	gint64 page_size = 0;
+	gint64 value = 0;
+
+	g_return_if_fail (PK_IS_TRANSACTION_DB (tdb));
+	g_return_if_fail (stats != NULL);
+
+	memset (stats, 0, sizeof (PkTransactionDbStats));
+	if (pk_transaction_db_query_int (priv->db, priv->statements,
+					 PK_TRANSACTION_DB_STATEMENT_PAGE_SIZE, &page_size) &&
+	    pk_transaction_db_query_int (priv->db, priv->statements,
+					 PK_TRANSACTION_DB_STATEMENT_PAGE_COUNT, &value))
+		stats->size = value * page_size;
+	if (pk_transaction_db_query_int (priv->db, priv->statements,
+					 PK_TRANSACTION_DB_STATEMENT_FREELIST_COUNT, &value))
+		stats->free = value * page_size;
+
+	g_mutex_lock (&priv->write_mutex);
+	stats->transactions = MAX (priv->transactions, 0);
+	stats->package_history = MAX (priv->package_history, 0);
+	stats->pruned = priv->pruned;
+	stats->compacted = priv->compacted;
+	stats->max_transactions = priv->max_transactions;
+	stats->max_age = priv->max_age;
+	stats->max_size = priv->max_size;
+	g_mutex_unlock (&priv->write_mutex);
 }
 
 /**
@@ -312,14 +1398,13 @@ out:
 gboolean
 pk_transaction_db_add (PkTransactionDb *tdb, const gchar *tid)
 {
-	g_autofree gchar *timespec = NULL;
-	g_autofree gchar *statement = NULL;
+	PkTransactionDbRow *row;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 
-	timespec = pk_iso8601_present ();
-	statement = g_strdup_printf ("INSERT INTO transactions (transaction_id, timespec) VALUES ('%s', '%s')", tid, timespec);
-	pk_transaction_db_sql_statement (tdb, statement);
+	row = pk_transaction_db_get_pending_row (tdb, tid);
+	g_free (row->timespec);
+	row->timespec = pk_iso8601_present ();
 	return TRUE;
 }
 
@@ -329,14 +1414,13 @@ pk_transaction_db_add (PkTransactionDb *tdb, const gchar *tid)
 gboolean
 pk_transaction_db_set_role (PkTransactionDb *tdb, const gchar *tid, PkRoleEnum role)
 {
-	const gchar *role_text;
-	g_autofree gchar *statement = NULL;
+	PkTransactionDbRow *row;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 
-	role_text = pk_role_enum_to_string (role);
-	statement = g_strdup_printf ("UPDATE transactions SET role = '%s' WHERE transaction_id = '%s'", role_text, tid);
-	pk_transaction_db_sql_statement (tdb, statement);
+	row = pk_transaction_db_get_pending_row (tdb, tid);
+	g_free (row->role);
+	row->role = g_strdup (pk_role_enum_to_string (role));
 	return TRUE;
 }
 
@@ -346,12 +1430,13 @@ pk_transaction_db_set_role (PkTransactionDb *tdb, const gchar *tid, PkRoleEnum r
 gboolean
 pk_transaction_db_set_uid (PkTransactionDb *tdb, const gchar *tid, guint uid)
 {
-	g_autofree gchar *statement = NULL;
+	PkTransactionDbRow *row;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 
-	statement = g_strdup_printf ("UPDATE transactions SET uid = '%i' WHERE transaction_id = '%s'", uid, tid);
-	pk_transaction_db_sql_statement (tdb, statement);
+	row = pk_transaction_db_get_pending_row (tdb, tid);
+	row->uid = uid;
+	row->uid_set = TRUE;
 	return TRUE;
 }
 
@@ -361,12 +1446,13 @@ pk_transaction_db_set_uid (PkTransactionDb *tdb, const gchar *tid, guint uid)
 gboolean
 pk_transaction_db_set_cmdline (PkTransactionDb *tdb, const gchar *tid, const gchar *cmdline)
 {
-	g_autofree gchar *statement = NULL;
+	PkTransactionDbRow *row;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 
-	statement = g_strdup_printf ("UPDATE transactions SET cmdline = '%s' WHERE transaction_id = '%s'", cmdline, tid);
-	pk_transaction_db_sql_statement (tdb, statement);
+	row = pk_transaction_db_get_pending_row (tdb, tid);
+	g_free (row->cmdline);
+	row->cmdline = g_strdup (cmdline);
 	return TRUE;
 }
 
@@ -376,14 +1462,13 @@ pk_transaction_db_set_cmdline (PkTransactionDb *tdb, const gchar *tid, const gch
 gboolean
 pk_transaction_db_set_data (PkTransactionDb *tdb, const gchar *tid, const gchar *data)
 {
-	g_autofree gchar *statement = NULL;
+	PkTransactionDbRow *row;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 
-	/* TODO: we have to be careful of SQL injection attacks */
-	statement = g_strdup_printf ("UPDATE transactions SET data = \"%s\" WHERE transaction_id = '%s'",
-				     data, tid);
-	pk_transaction_db_sql_statement (tdb, statement);
+	row = pk_transaction_db_get_pending_row (tdb, tid);
+	g_free (row->data);
+	row->data = g_strdup (data);
 	return TRUE;
 }
 
@@ -395,16 +1480,157 @@ pk_transaction_db_set_data (PkTransactionDb *tdb, const gchar *tid, const gchar
 gboolean
 pk_transaction_db_set_finished (PkTransactionDb *tdb, const gchar *tid, gboolean success, guint runtime)
 {
-	g_autofree gchar *statement = NULL;
+	PkTransactionDbRow *row;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 
-	statement = g_strdup_printf ("UPDATE transactions SET succeeded = %i, duration = %i WHERE transaction_id = '%s'",
-				     success, runtime, tid);
-	pk_transaction_db_sql_statement (tdb, statement);
+	row = pk_transaction_db_get_pending_row (tdb, tid);
+	row->succeeded = success ? 1 : 0;
+	row->duration = runtime;
+	row->finished_set = TRUE;
+	return TRUE;
+}
+
+/**
+ * pk_transaction_db_set_timeline:
+ * @timeline: lines of 'event\tms', where ms is the time since the
+ * transaction was created
+ *
+ * Saves when each step of the transaction happened. Timelines are kept
+ * apart from the transaction log, so saving one does not add the
+ * transaction to GetOldTransactions.
+ **/
+gboolean
+pk_transaction_db_set_timeline (PkTransactionDb *tdb, const gchar *tid, const gchar *timeline)
+{
+	PkTransactionDbRow *row;
+
+	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
+
+	row = pk_transaction_db_get_pending_row (tdb, tid);
+	if (row->timeline_timespec == NULL)
+		row->timeline_timespec = pk_iso8601_present ();
+	g_free (row->timeline);
+	row->timeline = g_strdup (timeline);
 	return TRUE;
 }
 
+/**
+ * pk_transaction_db_timeline_cb:
+ **/
+static gint
+pk_transaction_db_timeline_cb (void *data, gint argc, gchar **argv, gchar **col_name)
+{
+	gchar **timeline = (gchar **) data;
+	if (argc == 1)
+		*timeline = g_strdup (argv[0]);
+	return 0;
+}
+
+/**
+ * pk_transaction_db_get_timeline:
+ *
+ * Use pk_transaction_db_flush_async() first to include pending changes.
+ *
+ * Return value: the saved timeline, or %NULL if none was saved
+ **/
+gchar *
+pk_transaction_db_get_timeline (PkTransactionDb *tdb, const gchar *tid)
+{
+	gchar *timeline = NULL;
+	sqlite3_stmt *statement;
+
+	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), NULL);
+	g_return_val_if_fail (tid != NULL, NULL);
+
+	statement = pk_transaction_db_prepare (tdb->priv->db,
+					       tdb->priv->statements,
+					       PK_TRANSACTION_DB_STATEMENT_TIMELINE_GET);
+	if (statement == NULL)
+		return NULL;
+	sqlite3_bind_text (statement, 1, tid, -1, SQLITE_STATIC);
+	pk_transaction_db_step_rows (tdb->priv->db, statement,
+				     pk_transaction_db_timeline_cb, &timeline);
+	return timeline;
+}
+
+/**
+ * pk_transaction_db_history_item_free:
+ **/
+void
+pk_transaction_db_history_item_free (PkTransactionDbHistoryItem *item)
+{
+	g_free (item->version);
+	g_free (item->data);
+	g_free (item);
+}
+
+/**
+ * pk_transaction_db_add_history_item_cb:
+ **/
+static gint
+pk_transaction_db_add_history_item_cb (void *data, gint argc, gchar **argv, gchar **col_name)
+{
+	GPtrArray *array = (GPtrArray *) data;
+	PkTransactionDbHistoryItem *item;
+	guint tmp;
+
+	if (argc != 5) {
+		g_warning ("wrong number of replies: %i", argc);
+		return 0;
+	}
+	item = g_new0 (PkTransactionDbHistoryItem, 1);
+	if (pk_strtouint (argv[0], &tmp) && tmp < PK_INFO_ENUM_LAST)
+		item->info = tmp;
+	item->version = g_strdup (argv[1]);
+	item->data = g_strdup (argv[2]);
+	item->timestamp = g_ascii_strtoll (argv[3], NULL, 10);
+	if (argv[4] != NULL)
+		pk_strtouint (argv[4], &item->uid);
+	g_ptr_array_add (array, item);
+	return 0;
+}
+
+/**
+ * pk_transaction_db_get_package_history:
+ * @tdb: a #PkTransactionDb
+ * @name: a package name
+ * @limit: the maximum number of entries, or 0 for no limit
+ *
+ * Gets the most recent successful installs, updates and removals of a
+ * package, oldest first. Use pk_transaction_db_flush_async() first to
+ * include any pending changes.
+ *
+ * Return value: (element-type PkTransactionDbHistoryItem): the entries
+ **/
+GPtrArray *
+pk_transaction_db_get_package_history (PkTransactionDb *tdb,
+				       const gchar *name,
+				       guint limit)
+{
+	GPtrArray *array;
+	sqlite3_stmt *statement;
+
+	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), NULL);
+	g_return_val_if_fail (name != NULL, NULL);
+
+	array = g_ptr_array_new_with_free_func ((GDestroyNotify) pk_transaction_db_history_item_free);
+
+	statement = pk_transaction_db_prepare (tdb->priv->db,
+					       tdb->priv->statements,
+					       PK_TRANSACTION_DB_STATEMENT_HISTORY_GET);
+	if (statement == NULL)
+		return array;
+	sqlite3_bind_text (statement, 1, name, -1, SQLITE_STATIC);
+	sqlite3_bind_int (statement, 2, PK_INFO_ENUM_INSTALLING);
+	sqlite3_bind_int (statement, 3, PK_INFO_ENUM_REMOVING);
+	sqlite3_bind_int (statement, 4, PK_INFO_ENUM_UPDATING);
+	sqlite3_bind_int (statement, 5, limit > 0 ? (gint) limit : -1);
+	pk_transaction_db_step_rows (tdb->priv->db, statement,
+				     pk_transaction_db_add_history_item_cb, array);
+	return array;
+}
+
 /**
  * pk_transaction_db_print:
  **/
@@ -432,6 +1658,7 @@ pk_transaction_db_empty (PkTransactionDb *tdb)
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 	g_return_val_if_fail (tdb->priv->db != NULL, FALSE);
 
+	pk_transaction_db_flush (tdb);
 	statement = "TRUNCATE TABLE transactions;";
 	sqlite3_exec (tdb->priv->db, statement, NULL, NULL, NULL);
 	return TRUE;
@@ -476,42 +1703,6 @@ pk_transaction_db_get_random_hex_string (guint length)
 	return string;
 }
 
-/**
- * pk_transaction_db_defer_write_job_count_cb:
- **/
-static gboolean
-pk_transaction_db_defer_write_job_count_cb (PkTransactionDb *tdb)
-{
-	gchar *error_msg = NULL;
-	gint rc;
-	g_autofree gchar *statement = NULL;
-
-	/* not loaded! */
-	if (tdb->priv->db == NULL) {
-		g_warning ("PkTransactionDb not loaded");
-		goto out;
-	}
-
-	/* force fsync as we don't want to repeat this number */
-	sqlite3_exec (tdb->priv->db, "PRAGMA synchronous=ON", NULL, NULL, NULL);
-
-	/* save the job count */
-	statement = g_strdup_printf ("UPDATE config SET value = '%i' WHERE key = 'job_count'",
-				     tdb->priv->job_count);
-	rc = sqlite3_exec (tdb->priv->db, statement, NULL, NULL, &error_msg);
-	if (rc != SQLITE_OK) {
-		g_warning ("failed to set job id: %s", error_msg);
-		sqlite3_free (error_msg);
-		goto out;
-	}
-
-	/* turn off fsync */
-	sqlite3_exec (tdb->priv->db, "PRAGMA synchronous=OFF", NULL, NULL, NULL);
-out:
-	tdb->priv->database_save_id = 0;
-	return FALSE;
-}
-
 /**
  * pk_transaction_db_generate_id:
  **/
@@ -525,14 +1716,9 @@ pk_transaction_db_generate_id (PkTransactionDb *tdb)
 	tdb->priv->job_count++;
 	g_debug ("job count now %i", tdb->priv->job_count);
 
-	/* we don't need to wait for the database write, just do this the
-	 * next time we are idle (but ensure we do this on shutdown) */
-	if (tdb->priv->database_save_id == 0) {
-		tdb->priv->database_save_id =
-			g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc)
-					 pk_transaction_db_defer_write_job_count_cb, tdb, NULL);
-		g_source_set_name_by_id (tdb->priv->database_save_id, "[PkTransactionDb] save");
-	}
+	/* save with the next batch of writes */
+	tdb->priv->job_count_changed = TRUE;
+	pk_transaction_db_schedule_write (tdb);
 
 	/* make the tid */
 	rand_str = pk_transaction_db_get_random_hex_string (8);
@@ -600,28 +1786,25 @@ pk_transaction_db_proxy_item_free (PkTransactionDbProxyItem *item)
 static gboolean
 pk_transaction_db_is_proxy_set (PkTransactionDb *tdb, guint uid, const gchar *session)
 {
-	gchar *error_msg = NULL;
 	gboolean ret = FALSE;
-	gint rc;
 	PkTransactionDbProxyItem *item;
-	g_autofree gchar *statement = NULL;
+	sqlite3_stmt *statement;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 	g_return_val_if_fail (uid != G_MAXUINT, FALSE);
 
 	/* get existing data */
 	item = g_new0 (PkTransactionDbProxyItem, 1);
-	statement = g_strdup_printf ("SELECT proxy_http, proxy_https, proxy_ftp, proxy_socks, no_proxy, pac FROM proxy WHERE uid = '%i' AND session = '%s' LIMIT 1",
-				     uid, session);
-	rc = sqlite3_exec (tdb->priv->db, statement,
-			   pk_transaction_sqlite_proxy_cb,
-			   item,
-			   &error_msg);
-	if (rc != SQLITE_OK) {
-		g_warning ("SQL error: %s", error_msg);
-		sqlite3_free (error_msg);
+	statement = pk_transaction_db_prepare (tdb->priv->db,
+					       tdb->priv->statements,
+					       PK_TRANSACTION_DB_STATEMENT_PROXY_GET);
+	if (statement == NULL)
+		goto out;
+	sqlite3_bind_int (statement, 1, uid);
+	sqlite3_bind_text (statement, 2, session, -1, SQLITE_STATIC);
+	if (!pk_transaction_db_step_rows (tdb->priv->db, statement,
+					  pk_transaction_sqlite_proxy_cb, item))
 		goto out;
-	}
 
 	ret = item->set;
 
@@ -651,28 +1834,25 @@ pk_transaction_db_get_proxy (PkTransactionDb *tdb, guint uid, const gchar *sessi
 			     gchar **no_proxy,
 			     gchar **pac)
 {
-	gchar *error_msg = NULL;
 	gboolean ret = FALSE;
-	gint rc;
 	PkTransactionDbProxyItem *item;
-	g_autofree gchar *statement = NULL;
+	sqlite3_stmt *statement;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 	g_return_val_if_fail (uid != G_MAXUINT, FALSE);
 
 	/* get existing data */
 	item = g_new0 (PkTransactionDbProxyItem, 1);
-	statement = g_strdup_printf ("SELECT proxy_http, proxy_https, proxy_ftp, proxy_socks, no_proxy, pac FROM proxy WHERE uid = '%i' AND session = '%s' LIMIT 1",
-				     uid, session);
-	rc = sqlite3_exec (tdb->priv->db, statement,
-			   pk_transaction_sqlite_proxy_cb,
-			   item,
-			   &error_msg);
-	if (rc != SQLITE_OK) {
-		g_warning ("SQL error: %s", error_msg);
-		sqlite3_free (error_msg);
+	statement = pk_transaction_db_prepare (tdb->priv->db,
+					       tdb->priv->statements,
+					       PK_TRANSACTION_DB_STATEMENT_PROXY_GET);
+	if (statement == NULL)
+		goto out;
+	sqlite3_bind_int (statement, 1, uid);
+	sqlite3_bind_text (statement, 2, session, -1, SQLITE_STATIC);
+	if (!pk_transaction_db_step_rows (tdb->priv->db, statement,
+					  pk_transaction_sqlite_proxy_cb, item))
 		goto out;
-	}
 
 	/* success, even if we got no data */
 	ret = TRUE;
@@ -723,10 +1903,8 @@ pk_transaction_db_set_proxy (PkTransactionDb *tdb, guint uid,
 			     const gchar *pac)
 {
 	gboolean ret = FALSE;
-	gint rc;
-	sqlite3_stmt *statement = NULL;
+	sqlite3_stmt *statement;
 	g_autofree gchar *timespec = NULL;
-	g_autofree gchar *proxy_http_tmp = NULL;
 
 	g_return_val_if_fail (PK_IS_TRANSACTION_DB (tdb), FALSE);
 	g_return_val_if_fail (uid != G_MAXUINT, FALSE);
@@ -738,20 +1916,11 @@ pk_transaction_db_set_proxy (PkTransactionDb *tdb, guint uid,
 			 proxy_http, proxy_ftp, uid, session);
 
 		/* prepare statement */
-		rc = sqlite3_prepare_v2 (tdb->priv->db,
-					 "UPDATE proxy SET "
-					 "proxy_http = ?, "
-					 "proxy_https = ?, "
-					 "proxy_ftp = ?, "
-					 "proxy_socks = ?, "
-					 "no_proxy = ?, "
-					 "pac = ? "
-					 "WHERE uid = ? AND session = ?",
-					 -1, &statement, NULL);
-		if (rc != SQLITE_OK) {
-			g_warning ("failed to prepare statement: %s", sqlite3_errmsg (tdb->priv->db));
-			goto out;
-		}
+		statement = pk_transaction_db_prepare (tdb->priv->db,
+						       tdb->priv->statements,
+						       PK_TRANSACTION_DB_STATEMENT_PROXY_UPDATE);
+		if (statement == NULL)
+			return FALSE;
 
 		/* bind data, so that the freeform proxy text cannot be used to inject SQL */
 		sqlite3_bind_text (statement, 1, proxy_http, -1, SQLITE_STATIC);
@@ -764,12 +1933,7 @@ pk_transaction_db_set_proxy (PkTransactionDb *tdb, guint uid,
 		sqlite3_bind_text (statement, 8, session, -1, SQLITE_STATIC);
 
 		/* execute statement */
-		rc = sqlite3_step (statement);
-		if (rc != SQLITE_DONE) {
-			g_warning ("failed to execute statement: %s", sqlite3_errmsg (tdb->priv->db));
-			goto out;
-		}
-		goto out;
+		return pk_transaction_db_step_rows (tdb->priv->db, statement, NULL, NULL);
 	}
 
 	/* insert new entry */
@@ -777,20 +1941,11 @@ pk_transaction_db_set_proxy (PkTransactionDb *tdb, guint uid,
 	g_debug ("set proxy %s, %s for uid:%i and session:%s", proxy_http, proxy_ftp, uid, session);
 
 	/* prepare statement */
-	rc = sqlite3_prepare_v2 (tdb->priv->db,
-				 "INSERT INTO proxy (created, uid, session, "
-				 "proxy_http, "
-				 "proxy_https, "
-				 "proxy_ftp, "
-				 "proxy_socks, "
-				 "no_proxy, "
-				 "pac) "
-				 "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
-				 -1, &statement, NULL);
-	if (rc != SQLITE_OK) {
-		g_warning ("failed to prepare statement: %s", sqlite3_errmsg (tdb->priv->db));
-		goto out;
-	}
+	statement = pk_transaction_db_prepare (tdb->priv->db,
+					       tdb->priv->statements,
+					       PK_TRANSACTION_DB_STATEMENT_PROXY_INSERT);
+	if (statement == NULL)
+		return FALSE;
 
 	/* bind data, so that the freeform proxy text cannot be used to inject SQL */
 	sqlite3_bind_text (statement, 1, timespec, -1, SQLITE_STATIC);
@@ -804,17 +1959,7 @@ pk_transaction_db_set_proxy (PkTransactionDb *tdb, guint uid,
 	sqlite3_bind_text (statement, 9, pac, -1, SQLITE_STATIC);
 
 	/* execute statement */
-	rc = sqlite3_step (statement);
-	if (rc != SQLITE_DONE) {
-		g_warning ("failed to execute statement: %s", sqlite3_errmsg (tdb->priv->db));
-		goto out;
-	}
-
-	ret = TRUE;
-out:
-	if (statement != NULL)
-		sqlite3_finalize (statement);
-	return ret;
+	return pk_transaction_db_step_rows (tdb->priv->db, statement, NULL, NULL);
 }
 
 /**
@@ -865,6 +2010,69 @@ pk_transaction_db_execute (PkTransactionDb *tdb,
 	return ret;
 }
 
+/**
+ * pk_transaction_db_backfill_package_history_cb:
+ **/
+static gint
+pk_transaction_db_backfill_package_history_cb (void *data, gint argc, gchar **argv, gchar **col_name)
+{
+	PkTransactionDb *tdb = PK_TRANSACTION_DB (data);
+	if (argc != 3) {
+		g_warning ("wrong number of replies: %i", argc);
+		return 0;
+	}
+	if (argv[0] == NULL || argv[2] == NULL)
+		return 0;
+	if (!pk_transaction_db_add_package_history (tdb->priv->db,
+						    tdb->priv->statements,
+						    argv[0], argv[1], argv[2], NULL))
+		return 1;
+	return 0;
+}
+
+/**
+ * pk_transaction_db_create_package_history:
+ *
+ * Creates the package_history table and fills it from the package lines
+ * already saved for each transaction.
+ **/
+static gboolean
+pk_transaction_db_create_package_history (PkTransactionDb *tdb, GError **error)
+{
+	const gchar *statement;
+	gchar *error_msg = NULL;
+	gint rc;
+
+	if (!pk_transaction_db_execute (tdb, "BEGIN", error))
+		return FALSE;
+	statement = "CREATE TABLE package_history ("
+		    "name TEXT,"
+		    "arch TEXT,"
+		    "version TEXT,"
+		    "data TEXT,"
+		    "info INTEGER,"
+		    "tid TEXT,"
+		    "timestamp INTEGER);"
+		    "CREATE INDEX package_history_name ON package_history (name, timestamp);"
+		    "CREATE INDEX package_history_tid ON package_history (tid);";
+	if (!pk_transaction_db_execute (tdb, statement, error))
+		goto rollback;
+	statement = "SELECT transaction_id, timespec, data FROM transactions WHERE data IS NOT NULL";
+	rc = sqlite3_exec (tdb->priv->db, statement,
+			   pk_transaction_db_backfill_package_history_cb,
+			   tdb, &error_msg);
+	if (rc != SQLITE_OK) {
+		g_set_error (error, 1, 0,
+			     "failed to add package history: %s", error_msg);
+		sqlite3_free (error_msg);
+		goto rollback;
+	}
+	return pk_transaction_db_execute (tdb, "COMMIT", error);
+rollback:
+	pk_transaction_db_execute (tdb, "ROLLBACK", NULL);
+	return FALSE;
+}
+
 /**
  * pk_transaction_db_load:
  **/
@@ -883,9 +2091,9 @@ pk_transaction_db_load (PkTransactionDb *tdb, GError **error)
 	if (tdb->priv->loaded)
 		return TRUE;
 
-	g_debug ("trying to open database '%s'", PK_DB_DIR "/transactions.db");
-	pk_transaction_db_ensure_file_directory (PK_DB_DIR "/transactions.db");
-	rc = sqlite3_open (PK_DB_DIR "/transactions.db", &tdb->priv->db);
+	g_debug ("trying to open database '%s'", PK_TRANSACTION_DB_FILE);
+	pk_transaction_db_ensure_file_directory (PK_TRANSACTION_DB_FILE);
+	rc = sqlite3_open (PK_TRANSACTION_DB_FILE, &tdb->priv->db);
 	if (rc != SQLITE_OK) {
 		g_set_error (error,
 			     1, 0,
@@ -896,8 +2104,15 @@ pk_transaction_db_load (PkTransactionDb *tdb, GError **error)
 		return FALSE;
 	}
 
-	/* we don't need to keep doing fsync */
-	if (!pk_transaction_db_execute (tdb, "PRAGMA synchronous=OFF", error))
+	/* with a write-ahead log readers are never blocked by the writer,
+	 * and we only need to fsync when the log is checkpointed */
+	sqlite3_busy_timeout (tdb->priv->db, PK_TRANSACTION_DB_BUSY_TIMEOUT);
+	/* only has an effect before the first table is created */
+	if (!pk_transaction_db_execute (tdb, "PRAGMA auto_vacuum=INCREMENTAL", error))
+		return FALSE;
+	if (!pk_transaction_db_execute (tdb, "PRAGMA journal_mode=WAL", error))
+		return FALSE;
+	if (!pk_transaction_db_execute (tdb, "PRAGMA synchronous=NORMAL", error))
 		return FALSE;
 
 	/* check transactions */
@@ -963,8 +2178,81 @@ pk_transaction_db_load (PkTransactionDb *tdb, GError **error)
 			return FALSE;
 	}
 
+	/* package history index (since 1.1.12) */
+	if (!pk_transaction_db_execute (tdb, "SELECT * FROM package_history LIMIT 1", &error_local)) {
+		g_debug ("adding package history: %s", error_local->message);
+		g_clear_error (&error_local);
+		if (!pk_transaction_db_create_package_history (tdb, error))
+			return FALSE;
+	}
+
+	/* per-transaction timeline (since 1.1.12) */
+	if (!pk_transaction_db_execute (tdb, "SELECT * FROM timelines LIMIT 1", &error_local)) {
+		g_debug ("adding timelines: %s", error_local->message);
+		g_clear_error (&error_local);
+		statement = "CREATE TABLE timelines (transaction_id TEXT PRIMARY KEY, "
+			    "timespec TEXT, timeline TEXT);";
+		if (!pk_transaction_db_execute (tdb, statement, error))
+			return FALSE;
+	}
+
+	/* pruning removes the oldest transactions first (since 1.1.12) */
+	statement = "CREATE INDEX IF NOT EXISTS transactions_timespec ON transactions (timespec);";
+	if (!pk_transaction_db_execute (tdb, statement, error))
+		return FALSE;
+
+	/* writes are done on their own connection from the write pool */
+	rc = sqlite3_open (PK_TRANSACTION_DB_FILE, &tdb->priv->db_writer);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     1, 0,
+			     "Can't open transaction database for writing: %s",
+			     sqlite3_errmsg (tdb->priv->db_writer));
+		sqlite3_close (tdb->priv->db_writer);
+		tdb->priv->db_writer = NULL;
+		return FALSE;
+	}
+	sqlite3_busy_timeout (tdb->priv->db_writer, PK_TRANSACTION_DB_BUSY_TIMEOUT);
+	rc = sqlite3_exec (tdb->priv->db_writer, "PRAGMA synchronous=NORMAL", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error, 1, 0,
+			     "failed to set up writer: %s",
+			     sqlite3_errmsg (tdb->priv->db_writer));
+		return FALSE;
+	}
+	/* counted once here, then kept up to date by the writer and compactor */
+	if (!pk_transaction_db_query_int (tdb->priv->db, tdb->priv->statements,
+					  PK_TRANSACTION_DB_STATEMENT_COUNT,
+					  &tdb->priv->transactions) ||
+	    !pk_transaction_db_query_int (tdb->priv->db, tdb->priv->statements,
+					  PK_TRANSACTION_DB_STATEMENT_HISTORY_COUNT,
+					  &tdb->priv->package_history)) {
+		g_set_error (error, 1, 0,
+			     "failed to count transactions: %s",
+			     sqlite3_errmsg (tdb->priv->db));
+		return FALSE;
+	}
+
+	tdb->priv->write_pool = g_thread_pool_new (pk_transaction_db_write_pool_cb,
+						   tdb, 1, FALSE, error);
+	if (tdb->priv->write_pool == NULL)
+		return FALSE;
+
+	/* old transactions are removed on a third connection */
+	rc = sqlite3_open (PK_TRANSACTION_DB_FILE, &tdb->priv->db_compactor);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     1, 0,
+			     "Can't open transaction database for compacting: %s",
+			     sqlite3_errmsg (tdb->priv->db_compactor));
+		sqlite3_close (tdb->priv->db_compactor);
+		tdb->priv->db_compactor = NULL;
+		return FALSE;
+	}
+	sqlite3_busy_timeout (tdb->priv->db_compactor, PK_TRANSACTION_DB_BUSY_TIMEOUT);
+
 	/* try to set correct permissions */
-	g_chmod (PK_DB_DIR "/transactions.db", 0644);
+	g_chmod (PK_TRANSACTION_DB_FILE, 0644);
 
 	/* success */
 	tdb->priv->loaded = TRUE;
@@ -978,6 +2266,12 @@ static void
 pk_transaction_db_init (PkTransactionDb *tdb)
 {
 	tdb->priv = PK_TRANSACTION_DB_GET_PRIVATE (tdb);
+	tdb->priv->pending_rows = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+							 (GDestroyNotify) pk_transaction_db_row_free);
+	g_mutex_init (&tdb->priv->write_mutex);
+	g_cond_init (&tdb->priv->write_cond);
+	g_mutex_init (&tdb->priv->compact_mutex);
+	tdb->priv->statistics = pk_statistics_new ();
 }
 
 /**
@@ -988,17 +2282,35 @@ static void
 pk_transaction_db_finalize (GObject *object)
 {
 	PkTransactionDb *tdb;
+	guint i;
 	g_return_if_fail (PK_IS_TRANSACTION_DB (object));
 	tdb = PK_TRANSACTION_DB (object);
 	g_return_if_fail (tdb->priv != NULL);
 
-	/* if we shutdown with a deferred database write, then enforce it here */
-	if (tdb->priv->database_save_id != 0) {
-		pk_transaction_db_defer_write_job_count_cb (tdb);
+	/* if we shutdown with deferred database writes, then enforce them here */
+	if (tdb->priv->write_pool != NULL) {
+		pk_transaction_db_flush (tdb);
+		g_thread_pool_free (tdb->priv->write_pool, FALSE, TRUE);
+	} else if (tdb->priv->database_save_id != 0) {
 		g_source_remove (tdb->priv->database_save_id);
 	}
+	g_hash_table_unref (tdb->priv->pending_rows);
+	g_mutex_clear (&tdb->priv->write_mutex);
+	g_cond_clear (&tdb->priv->write_cond);
+	g_mutex_clear (&tdb->priv->compact_mutex);
+	g_object_unref (tdb->priv->statistics);
 
 	/* close the database */
+	for (i = 0; i < PK_TRANSACTION_DB_STATEMENT_LAST; i++) {
+		if (tdb->priv->statements[i] != NULL)
+			sqlite3_finalize (tdb->priv->statements[i]);
+		if (tdb->priv->statements_writer[i] != NULL)
+			sqlite3_finalize (tdb->priv->statements_writer[i]);
+		if (tdb->priv->statements_compactor[i] != NULL)
+			sqlite3_finalize (tdb->priv->statements_compactor[i]);
+	}
+	sqlite3_close (tdb->priv->db_compactor);
+	sqlite3_close (tdb->priv->db_writer);
 	sqlite3_close (tdb->priv->db);
 
 	G_OBJECT_CLASS (pk_transaction_db_parent_class)->finalize (object);
@@ -1007,13 +2319,20 @@ pk_transaction_db_finalize (GObject *object)
 /**
  * pk_transaction_db_new:
  *
- * Return value: a new PkTransactionDb object.
+ * The database is shared by the engine and every transaction, so there
+ * is only one write pool and one set of pending changes.
+ *
+ * Return value: the PkTransactionDb object.
  **/
 PkTransactionDb *
 pk_transaction_db_new (void)
 {
-	PkTransactionDb *tdb;
-	tdb = g_object_new (PK_TYPE_TRANSACTION_DB, NULL);
-	return PK_TRANSACTION_DB (tdb);
+	if (pk_transaction_db_object != NULL) {
+		g_object_ref (pk_transaction_db_object);
+	} else {
+		pk_transaction_db_object = g_object_new (PK_TYPE_TRANSACTION_DB, NULL);
+		g_object_add_weak_pointer (pk_transaction_db_object, &pk_transaction_db_object);
+	}
+	return PK_TRANSACTION_DB (pk_transaction_db_object);
 }
 
@@ -22,7 +22,7 @@
 #ifndef __PK_TRANSACTION_DB_H
 #define __PK_TRANSACTION_DB_H
 
-#include <glib-object.h>
+#include <gio/gio.h>
 #include <packagekit-glib2/pk-enum.h>
 
 G_BEGIN_DECLS
@@ -51,11 +51,63 @@ typedef struct
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(PkTransactionDb, g_object_unref)
 #endif
 
+/**
+ * PkTransactionDbHistoryItem:
+ *
+ * A package that was installed, updated or removed by a transaction.
+ **/
+typedef struct {
+	PkInfoEnum	 info;
+	gchar		*version;
+	gchar		*data;
+	gint64		 timestamp;
+	guint		 uid;
+} PkTransactionDbHistoryItem;
+
+/**
+ * PkTransactionDbStats:
+ *
+ * The size of the transaction database and its retention policy.
+ **/
+typedef struct {
+	guint64		 transactions;
+	guint64		 package_history;
+	guint64		 size;		/* bytes */
+	guint64		 free;		/* bytes */
+	guint64		 pruned;	/* since startup */
+	gint64		 compacted;	/* UNIX time, or 0 */
+	guint		 max_transactions;
+	guint		 max_age;	/* seconds */
+	guint64		 max_size;	/* bytes */
+} PkTransactionDbStats;
+
 GType		 pk_transaction_db_get_type		(void);
 PkTransactionDb	*pk_transaction_db_new			(void);
 gboolean	 pk_transaction_db_load			(PkTransactionDb	*tdb,
 							 GError			**error);
 gboolean	 pk_transaction_db_empty		(PkTransactionDb	*tdb);
+void		 pk_transaction_db_flush		(PkTransactionDb	*tdb);
+void		 pk_transaction_db_flush_async		(PkTransactionDb	*tdb,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+gboolean	 pk_transaction_db_flush_finish		(PkTransactionDb	*tdb,
+							 GAsyncResult		*res,
+							 GError			**error);
+void		 pk_transaction_db_set_retention	(PkTransactionDb	*tdb,
+							 guint			 max_transactions,
+							 guint			 max_age,
+							 guint64		 max_size,
+							 gboolean		 vacuum);
+void		 pk_transaction_db_compact_async	(PkTransactionDb	*tdb,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+gboolean	 pk_transaction_db_compact_finish	(PkTransactionDb	*tdb,
+							 GAsyncResult		*res,
+							 GError			**error);
+void		 pk_transaction_db_get_stats		(PkTransactionDb	*tdb,
+							 PkTransactionDbStats	*stats);
 gboolean	 pk_transaction_db_add			(PkTransactionDb	*tdb,
 							 const gchar		*tid);
 gboolean	 pk_transaction_db_print		(PkTransactionDb	*tdb);
@@ -75,8 +127,18 @@ gboolean	 pk_transaction_db_set_finished		(PkTransactionDb	*tdb,
 gboolean	 pk_transaction_db_set_data		(PkTransactionDb	*tdb,
 							 const gchar		*tid,
 							 const gchar		*data);
+gboolean	 pk_transaction_db_set_timeline		(PkTransactionDb	*tdb,
+							 const gchar		*tid,
+							 const gchar		*timeline);
+gchar		*pk_transaction_db_get_timeline		(PkTransactionDb	*tdb,
+							 const gchar		*tid)
+							 G_GNUC_WARN_UNUSED_RESULT;
 GList		*pk_transaction_db_get_list		(PkTransactionDb	*tdb,
 							 guint			 limit);
+GPtrArray	*pk_transaction_db_get_package_history	(PkTransactionDb	*tdb,
+							 const gchar		*name,
+							 guint			 limit);
+void		 pk_transaction_db_history_item_free	(PkTransactionDbHistoryItem *item);
 gboolean	 pk_transaction_db_action_time_reset	(PkTransactionDb	*tdb,
 							 PkRoleEnum		 role);
 guint		 pk_transaction_db_action_time_since	(PkTransactionDb	*tdb,
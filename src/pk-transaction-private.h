@@ -25,6 +25,8 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include "pk-transaction.h"
+
 G_BEGIN_DECLS
 
 /* only here for the self test program to use */
@@ -48,6 +50,15 @@ gboolean	 pk_transaction_strvalidate			(const gchar	*textr,
 								 GError		**error);
 gboolean	 pk_transaction_set_tid				(PkTransaction	*transaction,
 								 const gchar	*tid);
+gboolean	 pk_transaction_set_hint			(PkTransaction	*transaction,
+								 const gchar	*key,
+								 const gchar	*value,
+								 GError		**error);
+void		 pk_transaction_set_role			(PkTransaction	*transaction,
+								 PkRoleEnum	 role);
+void		 pk_transaction_package_cb			(PkBackend	*backend,
+								 PkPackage	*item,
+								 PkTransaction	*transaction);
 
 
 G_END_DECLS
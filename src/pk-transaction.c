@@ -50,8 +50,11 @@
 #include <polkit/polkit.h>
 
 #include "pk-backend.h"
+#include "pk-cache.h"
+#include "pk-statistics.h"
 #include "pk-dbus.h"
 #include "pk-shared.h"
+#include "pk-trace.h"
 #include "pk-transaction-db.h"
 #include "pk-transaction.h"
 #include "pk-transaction-private.h"
@@ -63,6 +66,9 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(PolkitDetails, g_object_unref)
 
 static void     pk_transaction_finalize		(GObject	    *object);
 static void     pk_transaction_dispose		(GObject	    *object);
+static void     pk_transaction_finished_emit	(PkTransaction	    *transaction,
+						 PkExitEnum	     exit_enum,
+						 guint		     time_ms);
 
 static gchar *pk_transaction_get_content_type_for_file (const gchar *filename, GError **error);
 static gboolean pk_transaction_is_supported_content_type (PkTransaction *transaction, const gchar *content_type);
@@ -79,6 +85,11 @@ static gboolean pk_transaction_is_supported_content_type (PkTransaction *transac
 /* maximum number of packages that can be processed in one go */
 #define PK_TRANSACTION_MAX_PACKAGES_TO_PROCESS	5200
 
+/* thresholds for coalescing packages into one Packages signal */
+#define PK_TRANSACTION_PACKAGES_BATCH_MAX	1000
+#define PK_TRANSACTION_PACKAGES_BATCH_SIZE	(64 * 1024) /* bytes */
+#define PK_TRANSACTION_PACKAGES_BATCH_TIMEOUT	100 /* ms */
+
 struct PkTransactionPrivate
 {
 	PkRoleEnum		 role;
@@ -106,6 +117,13 @@ struct PkTransactionPrivate
 	PolkitSubject		*subject;
 	GCancellable		*cancellable;
 	gboolean		 skip_auth_check;
+	gboolean		 supports_plural_signals;
+
+	/* packages waiting to be sent as one Packages signal */
+	GVariantBuilder		*packages_builder;
+	guint			 packages_pending;
+	gsize			 packages_pending_size;
+	guint			 packages_flush_id;
 
 	/* needed for gui coldplugging */
 	gchar			*last_package_id;
@@ -114,6 +132,17 @@ struct PkTransactionPrivate
 	gchar			*cmdline;
 	PkResults		*results;
 	PkTransactionDb		*transaction_db;
+	PkCache			*cache;
+	gchar			*cache_key;
+	guint			 cache_generation;
+	GPtrArray		*subscribers;	/* of PkTransaction sharing our results */
+	PkTransaction		*leader;	/* not ref'd */
+	gboolean		 sharing_stopped;
+	PkStatistics		*statistics;
+	gint64			 auth_started;
+	guint			 packages_emitted;
+	gint64			 created;
+	GString			*timeline;	/* only if TransactionTimeline */
 
 	/* cached */
 	gboolean		 cached_force;
@@ -314,6 +343,51 @@ out:
 	return TRUE;
 }
 
+/**
+ * pk_transaction_packages_flush:
+ *
+ * Sends any packages that have been queued up since the last flush
+ * as one Packages signal.
+ **/
+static void
+pk_transaction_packages_flush (PkTransaction *transaction)
+{
+	PkTransactionPrivate *priv = transaction->priv;
+
+	if (priv->packages_flush_id != 0) {
+		g_source_remove (priv->packages_flush_id);
+		priv->packages_flush_id = 0;
+	}
+	if (priv->packages_builder == NULL)
+		return;
+
+	g_debug ("emitting %u packages", priv->packages_pending);
+	g_dbus_connection_emit_signal (priv->connection,
+				       NULL,
+				       priv->tid,
+				       PK_DBUS_INTERFACE_TRANSACTION,
+				       "Packages",
+				       g_variant_new ("(a(uss))",
+						      priv->packages_builder),
+				       NULL);
+	g_variant_builder_unref (priv->packages_builder);
+	priv->packages_builder = NULL;
+	priv->packages_pending = 0;
+	priv->packages_pending_size = 0;
+}
+
+/**
+ * pk_transaction_packages_flush_cb:
+ **/
+static gboolean
+pk_transaction_packages_flush_cb (gpointer user_data)
+{
+	PkTransaction *transaction = PK_TRANSACTION (user_data);
+	transaction->priv->packages_flush_id = 0;
+	pk_transaction_packages_flush (transaction);
+	return G_SOURCE_REMOVE;
+}
+
 /**
  * pk_transaction_emit_property_changed:
  **/
@@ -325,6 +399,9 @@ pk_transaction_emit_property_changed (PkTransaction *transaction,
 	GVariantBuilder builder;
 	GVariantBuilder invalidated_builder;
 
+	/* clients must not see the state move past packages they do not have */
+	pk_transaction_packages_flush (transaction);
+
 	/* build the dict */
 	g_variant_builder_init (&invalidated_builder, G_VARIANT_TYPE ("as"));
 	g_variant_builder_init (&builder, G_VARIANT_TYPE_ARRAY);
@@ -344,6 +421,45 @@ pk_transaction_emit_property_changed (PkTransaction *transaction,
 				       NULL);
 }
 
+/**
+ * pk_transaction_packages_add:
+ *
+ * Queues a package to be sent in the next Packages signal, flushing
+ * straight away if the batch is full.
+ **/
+static void
+pk_transaction_packages_add (PkTransaction *transaction,
+			     PkInfoEnum info,
+			     const gchar *package_id,
+			     const gchar *summary)
+{
+	PkTransactionPrivate *priv = transaction->priv;
+
+	if (priv->packages_builder == NULL)
+		priv->packages_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(uss)"));
+	g_variant_builder_add (priv->packages_builder, "(uss)",
+			       info, package_id, summary);
+	priv->packages_pending++;
+	priv->packages_pending_size += strlen (package_id) + strlen (summary) + 6;
+
+	/* batch is full */
+	if (priv->packages_pending >= PK_TRANSACTION_PACKAGES_BATCH_MAX ||
+	    priv->packages_pending_size >= PK_TRANSACTION_PACKAGES_BATCH_SIZE) {
+		pk_transaction_packages_flush (transaction);
+		return;
+	}
+
+	/* don't hold packages back for too long */
+	if (priv->packages_flush_id == 0) {
+		priv->packages_flush_id =
+			g_timeout_add (PK_TRANSACTION_PACKAGES_BATCH_TIMEOUT,
+				       pk_transaction_packages_flush_cb,
+				       transaction);
+		g_source_set_name_by_id (priv->packages_flush_id,
+					 "[PkTransaction] flush packages");
+	}
+}
+
 /**
  * pk_transaction_progress_changed_emit:
  **/
@@ -415,6 +531,124 @@ pk_transaction_status_changed_emit (PkTransaction *transaction, PkStatusEnum sta
 					      g_variant_new_uint32 (status));
 }
 
+/**
+ * pk_transaction_finish_subscribers:
+ **/
+static void
+pk_transaction_finish_subscribers (PkTransaction *transaction,
+				   PkExitEnum exit_enum,
+				   guint time_ms)
+{
+	PkTransaction *subscriber;
+	guint i;
+	g_autoptr(GPtrArray) subscribers = NULL;
+
+	if (transaction->priv->subscribers->len == 0)
+		return;
+
+	/* nothing more will be shared */
+	subscribers = transaction->priv->subscribers;
+	transaction->priv->subscribers = g_ptr_array_new_with_free_func (g_object_unref);
+	for (i = 0; i < subscribers->len; i++) {
+		subscriber = g_ptr_array_index (subscribers, i);
+		subscriber->priv->leader = NULL;
+		subscriber->priv->finished = TRUE;
+		pk_results_set_exit_code (subscriber->priv->results, exit_enum);
+		pk_transaction_finished_emit (subscriber, exit_enum, time_ms);
+	}
+}
+
+/**
+ * pk_transaction_requeue_subscribers:
+ *
+ * Stops sharing the results of @transaction, which is not going to finish
+ * normally, and commits the transactions that were sharing them again.
+ * The first of those runs the query itself and the others share its
+ * results, so they start from nothing again.
+ **/
+void
+pk_transaction_requeue_subscribers (PkTransaction *transaction)
+{
+	PkTransaction *subscriber;
+	guint i;
+	g_autoptr(GPtrArray) subscribers = NULL;
+
+	transaction->priv->sharing_stopped = TRUE;
+	if (transaction->priv->subscribers->len == 0)
+		return;
+
+	subscribers = transaction->priv->subscribers;
+	transaction->priv->subscribers = g_ptr_array_new_with_free_func (g_object_unref);
+	for (i = 0; i < subscribers->len; i++) {
+		subscriber = g_ptr_array_index (subscribers, i);
+		g_debug ("%s no longer shares the results of %s",
+			 subscriber->priv->tid, transaction->priv->tid);
+		subscriber->priv->leader = NULL;
+		g_object_unref (subscriber->priv->results);
+		subscriber->priv->results = pk_results_new ();
+
+		/* first set state manually, otherwise set_state will refuse to switch to an earlier stage */
+		subscriber->priv->state = PK_TRANSACTION_STATE_READY;
+		pk_transaction_set_state (subscriber, PK_TRANSACTION_STATE_READY);
+	}
+}
+
+/**
+ * pk_transaction_is_shareable:
+ *
+ * Return value: %TRUE if other transactions can still share the results
+ * of @transaction
+ **/
+gboolean
+pk_transaction_is_shareable (PkTransaction *transaction)
+{
+	g_return_val_if_fail (PK_IS_TRANSACTION (transaction), FALSE);
+	return !transaction->priv->finished && !transaction->priv->sharing_stopped;
+}
+
+/**
+ * pk_transaction_unsubscribe:
+ **/
+static void
+pk_transaction_unsubscribe (PkTransaction *transaction)
+{
+	PkTransaction *leader = transaction->priv->leader;
+
+	if (leader == NULL)
+		return;
+	transaction->priv->leader = NULL;
+	g_ptr_array_remove (leader->priv->subscribers, transaction);
+}
+
+/**
+ * pk_transaction_timeline_add:
+ *
+ * Notes when @event happened, if the timeline is being saved.
+ **/
+static void
+pk_transaction_timeline_add (PkTransaction *transaction, const gchar *event)
+{
+	PkTransactionPrivate *priv = transaction->priv;
+
+	if (priv->timeline == NULL)
+		return;
+	g_string_append_printf (priv->timeline, "%s\t%" G_GINT64_FORMAT "\n", event,
+				(g_get_monotonic_time () - priv->created) / 1000);
+}
+
+/**
+ * pk_transaction_timeline_save:
+ **/
+static void
+pk_transaction_timeline_save (PkTransaction *transaction)
+{
+	PkTransactionPrivate *priv = transaction->priv;
+
+	if (priv->timeline == NULL)
+		return;
+	pk_transaction_db_set_timeline (priv->transaction_db, priv->tid, priv->timeline->str);
+}
+
 /**
  * pk_transaction_finished_emit:
  **/
@@ -426,6 +660,14 @@ pk_transaction_finished_emit (PkTransaction *transaction,
 	g_debug ("emitting finished '%s', %i",
 		 pk_exit_enum_to_string (exit_enum),
 		 time_ms);
+	pk_transaction_finish_subscribers (transaction, exit_enum, time_ms);
+	pk_statistics_add_finished (transaction->priv->statistics,
+				    transaction->priv->role, exit_enum);
+	PK_TRACE4 (finished, transaction->priv->tid,
+		   transaction->priv->role, exit_enum, time_ms);
+	pk_transaction_timeline_add (transaction, "finished");
+	pk_transaction_timeline_save (transaction);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -451,6 +693,7 @@ pk_transaction_error_code_emit (PkTransaction *transaction,
 	g_debug ("emitting error-code %s, '%s'",
 		 pk_error_enum_to_string (error_enum),
 		 details);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -503,6 +746,7 @@ pk_transaction_details_cb (PkBackendJob *job,
 			   PkDetails *item,
 			   PkTransaction *transaction)
 {
+	guint i;
 	GVariantBuilder builder;
 	PkGroupEnum group;
 	const gchar *tmp;
@@ -513,6 +757,8 @@ pk_transaction_details_cb (PkBackendJob *job,
 
 	/* add to results */
 	pk_results_add_details (transaction->priv->results, item);
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_details_cb (job, item, g_ptr_array_index (transaction->priv->subscribers, i));
 
 	/* emit */
 	g_debug ("emitting details");
@@ -544,6 +790,7 @@ pk_transaction_details_cb (PkBackendJob *job,
 		g_variant_builder_add (&builder, "{sv}", "size",
 				       g_variant_new_uint64 (size));
 
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -561,6 +808,7 @@ pk_transaction_error_code_cb (PkBackendJob *job,
 			      PkError *item,
 			      PkTransaction *transaction)
 {
+	guint i;
 	PkErrorEnum code;
 	g_autofree gchar *details = NULL;
 
@@ -589,6 +837,12 @@ pk_transaction_error_code_cb (PkBackendJob *job,
 		/* emit, as it is not the internally-handled LOCK_REQUIRED code */
 		pk_transaction_error_code_emit (transaction, code, details);
 	}
+
+	/* the lock is only our problem */
+	if (code == PK_ERROR_ENUM_LOCK_REQUIRED)
+		return;
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_error_code_cb (job, item, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -629,6 +883,7 @@ pk_transaction_files_cb (PkBackendJob *job,
 
 	/* emit */
 	g_debug ("emitting files %s", package_id);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -648,6 +903,7 @@ pk_transaction_category_cb (PkBackendJob *job,
 			    PkCategory *item,
 			    PkTransaction *transaction)
 {
+	guint i;
 	g_autofree gchar *parent_id = NULL;
 	g_autofree gchar *cat_id = NULL;
 	g_autofree gchar *name = NULL;
@@ -659,6 +915,8 @@ pk_transaction_category_cb (PkBackendJob *job,
 
 	/* add to results */
 	pk_results_add_category (transaction->priv->results, item);
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_category_cb (job, item, g_ptr_array_index (transaction->priv->subscribers, i));
 
 	/* get data */
 	g_object_get (item,
@@ -671,6 +929,7 @@ pk_transaction_category_cb (PkBackendJob *job,
 
 	/* emit */
 	g_debug ("emitting category %s, %s, %s, %s, %s ", parent_id, cat_id, name, summary, icon);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -693,6 +952,8 @@ pk_transaction_item_progress_cb (PkBackendJob *job,
 				 PkItemProgress *item_progress,
 				 PkTransaction *transaction)
 {
+	guint i;
+
 	g_return_if_fail (PK_IS_TRANSACTION (transaction));
 	g_return_if_fail (transaction->priv->tid != NULL);
 
@@ -701,6 +962,7 @@ pk_transaction_item_progress_cb (PkBackendJob *job,
 		 pk_item_progress_get_package_id (item_progress),
 		 pk_status_enum_to_string (pk_item_progress_get_status (item_progress)),
 		 pk_item_progress_get_percentage (item_progress));
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -711,6 +973,8 @@ pk_transaction_item_progress_cb (PkBackendJob *job,
 						      pk_item_progress_get_status (item_progress),
 						      pk_item_progress_get_percentage (item_progress)),
 				       NULL);
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_item_progress_cb (job, item_progress, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -742,6 +1006,7 @@ pk_transaction_distro_upgrade_cb (PkBackendJob *job,
 	g_debug ("emitting distro-upgrade %s, %s, %s",
 		 pk_distro_upgrade_enum_to_string (state),
 		 name, summary);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -828,6 +1093,7 @@ pk_transaction_set_state (PkTransaction *transaction, PkTransactionState state)
 
 	g_debug ("transaction now %s", pk_transaction_state_to_string (state));
 	priv->state = state;
+	pk_transaction_timeline_add (transaction, pk_transaction_state_to_string (state));
 	g_signal_emit (transaction, signals[SIGNAL_STATE_CHANGED], 0, state);
 
 	/* only save into the database for useful stuff */
@@ -1088,6 +1354,77 @@ pk_transaction_offline_finished (PkTransaction *transaction)
 	}
 }
 
+/**
+ * pk_transaction_role_changes_system:
+ **/
+static gboolean
+pk_transaction_role_changes_system (PkRoleEnum role)
+{
+	switch (role) {
+	case PK_ROLE_ENUM_INSTALL_FILES:
+	case PK_ROLE_ENUM_INSTALL_PACKAGES:
+	case PK_ROLE_ENUM_INSTALL_SIGNATURE:
+	case PK_ROLE_ENUM_REFRESH_CACHE:
+	case PK_ROLE_ENUM_REMOVE_PACKAGES:
+	case PK_ROLE_ENUM_REPAIR_SYSTEM:
+	case PK_ROLE_ENUM_REPO_ENABLE:
+	case PK_ROLE_ENUM_REPO_REMOVE:
+	case PK_ROLE_ENUM_REPO_SET_DATA:
+	case PK_ROLE_ENUM_UPDATE_PACKAGES:
+	case PK_ROLE_ENUM_UPGRADE_SYSTEM:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * pk_transaction_get_cache_key:
+ *
+ * Return value: a string describing everything that can change the
+ * results of the query, or %NULL if the results cannot be cached.
+ **/
+gchar *
+pk_transaction_get_cache_key (PkTransaction *transaction)
+{
+	PkTransactionPrivate *priv = transaction->priv;
+	GString *key;
+	const gchar *locale;
+	guint i;
+
+	switch (priv->role) {
+	case PK_ROLE_ENUM_GET_CATEGORIES:
+	case PK_ROLE_ENUM_GET_DETAILS:
+	case PK_ROLE_ENUM_GET_PACKAGES:
+	case PK_ROLE_ENUM_GET_REPO_LIST:
+	case PK_ROLE_ENUM_GET_UPDATE_DETAIL:
+	case PK_ROLE_ENUM_GET_UPDATES:
+	case PK_ROLE_ENUM_RESOLVE:
+	case PK_ROLE_ENUM_SEARCH_DETAILS:
+	case PK_ROLE_ENUM_SEARCH_GROUP:
+	case PK_ROLE_ENUM_SEARCH_NAME:
+	case PK_ROLE_ENUM_WHAT_PROVIDES:
+		break;
+	default:
+		return NULL;
+	}
+
+	/* the client wants the backend to check the metadata age */
+	if (pk_backend_job_get_cache_age (priv->job) != G_MAXUINT)
+		return NULL;
+
+	locale = pk_backend_job_get_locale (priv->job);
+	key = g_string_new (pk_role_enum_to_string (priv->role));
+	g_string_append_printf (key, "\x1f%" G_GUINT64_FORMAT "\x1f%s",
+				priv->cached_filters,
+				locale != NULL ? locale : "");
+	for (i = 0; priv->cached_package_ids != NULL && priv->cached_package_ids[i] != NULL; i++)
+		g_string_append_printf (key, "\x1fp%s", priv->cached_package_ids[i]);
+	for (i = 0; priv->cached_values != NULL && priv->cached_values[i] != NULL; i++)
+		g_string_append_printf (key, "\x1fv%s", priv->cached_values[i]);
+	return g_string_free (key, FALSE);
+}
+
 /**
  * pk_transaction_finished_cb:
  **/
@@ -1141,9 +1478,36 @@ pk_transaction_finished_cb (PkBackendJob *job, PkExitEnum exit_enum, PkTransacti
 	if (exit_enum == PK_EXIT_ENUM_SUCCESS)
 		pk_transaction_finish_invalidate_caches (transaction);
 
+	/* even a failed transaction may have changed the system */
+	if (pk_transaction_role_changes_system (transaction->priv->role)) {
+		pk_cache_invalidate (transaction->priv->cache,
+				     pk_role_enum_to_string (transaction->priv->role));
+	}
+
+	/* save the results so the next identical query is free */
+	if (exit_enum == PK_EXIT_ENUM_SUCCESS && transaction->priv->cache_key != NULL) {
+		g_autoptr(PkError) error_code = NULL;
+		error_code = pk_results_get_error_code (transaction->priv->results);
+		if (error_code == NULL) {
+			pk_cache_insert (transaction->priv->cache,
+					 transaction->priv->cache_key,
+					 transaction->priv->cache_generation,
+					 transaction->priv->results);
+		}
+	}
+
 	/* find the length of time we have been running */
 	time_ms = pk_transaction_get_runtime (transaction);
 	g_debug ("backend was running for %i ms", time_ms);
+	pk_statistics_add_timing (transaction->priv->statistics,
+				  transaction->priv->role,
+				  PK_STATISTICS_TIMING_RUNTIME,
+				  time_ms);
+	pk_statistics_add_packages (transaction->priv->statistics,
+				    transaction->priv->packages_emitted);
+	g_debug ("backend event queue peaked at %u with a max latency of %u ms",
+		 pk_backend_job_get_dispatch_queue_depth_max (job),
+		 pk_backend_job_get_dispatch_latency_max (job));
 
 	/* add to the database if we are going to log it */
 	if (transaction->priv->role == PK_ROLE_ENUM_UPDATE_PACKAGES ||
@@ -1228,11 +1592,12 @@ pk_transaction_finished_cb (PkBackendJob *job, PkExitEnum exit_enum, PkTransacti
 /**
  * pk_transaction_package_cb:
  **/
-static void
+void
 pk_transaction_package_cb (PkBackend *backend,
 			   PkPackage *item,
 			   PkTransaction *transaction)
 {
+	guint i;
 	const gchar *role_text;
 	PkInfoEnum info;
 	const gchar *package_id;
@@ -1281,9 +1646,25 @@ pk_transaction_package_cb (PkBackend *backend,
 		}
 	}
 
+	/* only count what came from our own backend job */
+	if (backend != NULL && transaction->priv->leader == NULL) {
+		if (transaction->priv->packages_emitted++ == 0) {
+			guint runtime = pk_transaction_get_runtime (transaction);
+			pk_statistics_add_timing (transaction->priv->statistics,
+						  transaction->priv->role,
+						  PK_STATISTICS_TIMING_FIRST_PACKAGE,
+						  runtime);
+			PK_TRACE3 (first__package, transaction->priv->tid,
+				   transaction->priv->role, runtime);
+			pk_transaction_timeline_add (transaction, "first-package");
+		}
+	}
+
 	/* add to results even if we already got a result */
 	if (info != PK_INFO_ENUM_FINISHED)
 		pk_results_add_package (transaction->priv->results, item);
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_package_cb (backend, item, g_ptr_array_index (transaction->priv->subscribers, i));
 
 	/* emit */
 	package_id = pk_package_get_id (item);
@@ -1296,6 +1677,13 @@ pk_transaction_package_cb (PkBackend *backend,
 			 package_id,
 			 summary);
 	}
+	if (transaction->priv->supports_plural_signals) {
+		pk_transaction_packages_add (transaction,
+					     info,
+					     package_id,
+					     summary ? summary : "");
+		return;
+	}
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -1316,6 +1704,7 @@ pk_transaction_repo_detail_cb (PkBackend *backend,
 			       PkRepoDetail *item,
 			       PkTransaction *transaction)
 {
+	guint i;
 	gboolean enabled;
 	const gchar *repo_id;
 	const gchar *description;
@@ -1325,12 +1714,15 @@ pk_transaction_repo_detail_cb (PkBackend *backend,
 
 	/* add to results */
 	pk_results_add_repo_detail (transaction->priv->results, item);
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_repo_detail_cb (backend, item, g_ptr_array_index (transaction->priv->subscribers, i));
 
 	/* emit */
 	repo_id = pk_repo_detail_get_id (item);
 	description = pk_repo_detail_get_description (item);
 	enabled = pk_repo_detail_get_enabled (item);
 	g_debug ("emitting repo-detail %s, %s, %i", repo_id, description, enabled);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -1351,6 +1743,7 @@ pk_transaction_repo_signature_required_cb (PkBackend *backend,
 					   PkRepoSignatureRequired *item,
 					   PkTransaction *transaction)
 {
+	guint i;
 	PkSigTypeEnum type;
 	g_autofree gchar *package_id = NULL;
 	g_autofree gchar *repository_name = NULL;
@@ -1383,6 +1776,7 @@ pk_transaction_repo_signature_required_cb (PkBackend *backend,
 		 package_id, repository_name, key_url, key_userid, key_id,
 		 key_fingerprint, key_timestamp,
 		 pk_sig_type_enum_to_string (type));
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -1401,6 +1795,8 @@ pk_transaction_repo_signature_required_cb (PkBackend *backend,
 
 	/* we should mark this transaction so that we finish with a special code */
 	transaction->priv->emit_signature_required = TRUE;
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_repo_signature_required_cb (backend, item, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -1411,6 +1807,7 @@ pk_transaction_eula_required_cb (PkBackend *backend,
 				 PkEulaRequired *item,
 				 PkTransaction *transaction)
 {
+	guint i;
 	const gchar *eula_id;
 	const gchar *package_id;
 	const gchar *vendor_name;
@@ -1431,6 +1828,7 @@ pk_transaction_eula_required_cb (PkBackend *backend,
 	/* emit */
 	g_debug ("emitting eula-required %s, %s, %s, %s",
 		   eula_id, package_id, vendor_name, license_agreement);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -1445,6 +1843,8 @@ pk_transaction_eula_required_cb (PkBackend *backend,
 
 	/* we should mark this transaction so that we finish with a special code */
 	transaction->priv->emit_eula_required = TRUE;
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_eula_required_cb (backend, item, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -1455,6 +1855,7 @@ pk_transaction_media_change_required_cb (PkBackend *backend,
 					 PkMediaChangeRequired *item,
 					 PkTransaction *transaction)
 {
+	guint i;
 	PkMediaTypeEnum media_type;
 	g_autofree gchar *media_id = NULL;
 	g_autofree gchar *media_text = NULL;
@@ -1477,6 +1878,7 @@ pk_transaction_media_change_required_cb (PkBackend *backend,
 		 pk_media_type_enum_to_string (media_type),
 		 media_id,
 		 media_text);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -1490,6 +1892,8 @@ pk_transaction_media_change_required_cb (PkBackend *backend,
 
 	/* we should mark this transaction so that we finish with a special code */
 	transaction->priv->emit_media_change_required = TRUE;
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_media_change_required_cb (backend, item, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -1545,6 +1949,7 @@ pk_transaction_require_restart_cb (PkBackend *backend,
 	g_debug ("emitting require-restart %s, '%s'",
 		 pk_restart_enum_to_string (restart),
 		 package_id);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -1554,6 +1959,8 @@ pk_transaction_require_restart_cb (PkBackend *backend,
 						      restart,
 						      package_id),
 				       NULL);
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_require_restart_cb (backend, item, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -1564,6 +1971,8 @@ pk_transaction_status_changed_cb (PkBackendJob *job,
 				  PkStatusEnum status,
 				  PkTransaction *transaction)
 {
+	guint i;
+
 	g_return_if_fail (PK_IS_TRANSACTION (transaction));
 	g_return_if_fail (transaction->priv->tid != NULL);
 
@@ -1579,6 +1988,8 @@ pk_transaction_status_changed_cb (PkBackendJob *job,
 	}
 
 	pk_transaction_status_changed_emit (transaction, status);
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_status_changed_cb (job, status, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -1589,6 +2000,7 @@ pk_transaction_update_detail_cb (PkBackend *backend,
 				 PkUpdateDetail *item,
 				 PkTransaction *transaction)
 {
+	guint i;
 	const gchar *changelog;
 	const gchar *issued;
 	const gchar *package_id;
@@ -1606,6 +2018,8 @@ pk_transaction_update_detail_cb (PkBackend *backend,
 
 	/* add to results */
 	pk_results_add_update_detail (transaction->priv->results, item);
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_update_detail_cb (backend, item, g_ptr_array_index (transaction->priv->subscribers, i));
 
 	/* emit */
 	package_id = pk_update_detail_get_package_id (item);
@@ -1619,6 +2033,7 @@ pk_transaction_update_detail_cb (PkBackend *backend,
 	issued = pk_update_detail_get_issued (item);
 	updated = pk_update_detail_get_updated (item);
 	g_debug ("emitting update-detail for %s", package_id);
+	pk_transaction_packages_flush (transaction);
 	g_dbus_connection_emit_signal (transaction->priv->connection,
 				       NULL,
 				       transaction->priv->tid,
@@ -1706,11 +2121,15 @@ pk_transaction_speed_cb (PkBackendJob *job,
 			 guint speed,
 			 PkTransaction *transaction)
 {
+	guint i;
+
 	/* emit */
 	transaction->priv->speed = speed;
 	pk_transaction_emit_property_changed (transaction,
 					      "Speed",
 					      g_variant_new_uint32 (speed));
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_speed_cb (job, speed, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -1721,11 +2140,15 @@ pk_transaction_download_size_remaining_cb (PkBackendJob *job,
 					   guint64 *download_size_remaining,
 					   PkTransaction *transaction)
 {
+	guint i;
+
 	/* emit */
 	transaction->priv->download_size_remaining = *download_size_remaining;
 	pk_transaction_emit_property_changed (transaction,
 					      "DownloadSizeRemaining",
 					      g_variant_new_uint64 (*download_size_remaining));
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_download_size_remaining_cb (job, download_size_remaining, g_ptr_array_index (transaction->priv->subscribers, i));
 }
 
 /**
@@ -1736,11 +2159,117 @@ pk_transaction_percentage_cb (PkBackendJob *job,
 			      guint percentage,
 			      PkTransaction *transaction)
 {
+	guint i;
+
 	/* emit */
 	transaction->priv->percentage = percentage;
 	pk_transaction_emit_property_changed (transaction,
 					      "Percentage",
 					      g_variant_new_uint32 (percentage));
+	for (i = 0; i < transaction->priv->subscribers->len; i++)
+		pk_transaction_percentage_cb (job, percentage, g_ptr_array_index (transaction->priv->subscribers, i));
+}
+
+/**
+ * pk_transaction_replay_results:
+ *
+ * Emits @results as if they had come from the backend.
+ **/
+static void
+pk_transaction_replay_results (PkTransaction *transaction, PkResults *results)
+{
+	guint i;
+	g_autoptr(GPtrArray) array = NULL;
+
+	array = pk_results_get_package_array (results);
+	for (i = 0; i < array->len; i++)
+		pk_transaction_package_cb (NULL, g_ptr_array_index (array, i), transaction);
+	g_ptr_array_unref (array);
+	array = pk_results_get_details_array (results);
+	for (i = 0; i < array->len; i++)
+		pk_transaction_details_cb (NULL, g_ptr_array_index (array, i), transaction);
+	g_ptr_array_unref (array);
+	array = pk_results_get_update_detail_array (results);
+	for (i = 0; i < array->len; i++)
+		pk_transaction_update_detail_cb (NULL, g_ptr_array_index (array, i), transaction);
+	g_ptr_array_unref (array);
+	array = pk_results_get_category_array (results);
+	for (i = 0; i < array->len; i++)
+		pk_transaction_category_cb (NULL, g_ptr_array_index (array, i), transaction);
+	g_ptr_array_unref (array);
+	array = pk_results_get_repo_detail_array (results);
+	for (i = 0; i < array->len; i++)
+		pk_transaction_repo_detail_cb (NULL, g_ptr_array_index (array, i), transaction);
+}
+
+/**
+ * pk_transaction_subscribe:
+ * @transaction: a queued or running transaction
+ * @subscriber: a committed transaction with the same cache key
+ *
+ * Makes @subscriber share the results of @transaction rather than running
+ * the same query in the backend again. Anything already emitted is
+ * replayed straight away along with the current status and percentage,
+ * and @subscriber finishes with @transaction.
+ *
+ * Every result and progress signal is forwarded, except ::locked-changed
+ * and ::allow-cancel as @subscriber can always be cancelled by itself,
+ * and ::files and ::distro-upgrade as GetFiles and GetDistroUpgrades are
+ * never shared.
+ **/
+void
+pk_transaction_subscribe (PkTransaction *transaction, PkTransaction *subscriber)
+{
+	g_return_if_fail (PK_IS_TRANSACTION (transaction));
+	g_return_if_fail (PK_IS_TRANSACTION (subscriber));
+	g_return_if_fail (pk_transaction_is_shareable (transaction));
+	g_return_if_fail (subscriber->priv->leader == NULL);
+
+	g_debug ("%s is sharing the results of %s",
+		 subscriber->priv->tid, transaction->priv->tid);
+	subscriber->priv->leader = transaction;
+	g_ptr_array_add (transaction->priv->subscribers, g_object_ref (subscriber));
+	pk_transaction_replay_results (subscriber, transaction->priv->results);
+
+	/* rather than waiting for the backend to next change them */
+	pk_transaction_status_changed_emit (subscriber, transaction->priv->status);
+	if (transaction->priv->percentage != PK_BACKEND_PERCENTAGE_INVALID)
+		pk_transaction_percentage_cb (NULL, transaction->priv->percentage, subscriber);
+}
+
+/**
+ * pk_transaction_run_cached:
+ *
+ * Replays the results of an identical earlier query without running the
+ * backend.
+ *
+ * Return value: %TRUE if the transaction was finished from the cache
+ **/
+static gboolean
+pk_transaction_run_cached (PkTransaction *transaction)
+{
+	PkTransactionPrivate *priv = transaction->priv;
+	g_autoptr(PkResults) results = NULL;
+
+	g_clear_pointer (&priv->cache_key, g_free);
+	priv->cache_key = pk_transaction_get_cache_key (transaction);
+	if (priv->cache_key == NULL)
+		return FALSE;
+	priv->cache_generation = pk_cache_get_generation (priv->cache);
+	results = pk_cache_lookup (priv->cache, priv->cache_key);
+	if (results == NULL)
+		return FALSE;
+
+	g_debug ("using cached results for %s",
+		 pk_role_enum_to_string (priv->role));
+	pk_transaction_replay_results (transaction, results);
+
+	/* we should get no more from the backend with this tid */
+	pk_results_set_exit_code (priv->results, PK_EXIT_ENUM_SUCCESS);
+	priv->finished = TRUE;
+	pk_transaction_db_action_time_reset (priv->transaction_db, priv->role);
+	pk_transaction_finished_emit (transaction, PK_EXIT_ENUM_SUCCESS, 0);
+	return TRUE;
 }
 
 /**
@@ -1774,7 +2303,13 @@ pk_transaction_run (PkTransaction *transaction)
 		return TRUE;
 	}
 
+	/* answer from the cache if nothing has changed */
+	if (pk_transaction_run_cached (transaction))
+		return TRUE;
+
 	/* run the job */
+	PK_TRACE2 (job__start, priv->tid, priv->role);
+	pk_transaction_timeline_add (transaction, "started");
 	pk_backend_start_job (priv->backend, priv->job);
 
 	/* is an error code set? */
@@ -2322,6 +2857,17 @@ pk_transaction_authorize_actions_finished_cb (GObject *source_object,
 	/* finish the call */
 	result = polkit_authority_check_authorization_finish (priv->authority, res, &error);
 
+	/* nothing more to check */
+	if (result == NULL || data->actions->len <= 1 ||
+	    !polkit_authorization_result_get_is_authorized (result)) {
+		pk_statistics_add_timing (priv->statistics, data->role,
+					  PK_STATISTICS_TIMING_AUTHORIZATION,
+					  (g_get_monotonic_time () - priv->auth_started) / 1000);
+		PK_TRACE3 (auth__done, priv->tid, data->role,
+			   result != NULL && polkit_authorization_result_get_is_authorized (result));
+		pk_transaction_timeline_add (data->transaction, "authorized");
+	}
+
 	/* failed because the request was cancelled */
 	if (g_cancellable_is_cancelled (priv->cancellable)) {
 		/* emit an ::StatusChanged, ::ErrorCode() and then ::Finished() */
@@ -2633,6 +3179,8 @@ pk_transaction_obtain_authorization (PkTransaction *transaction,
 	if (actions == NULL)
 		return FALSE;
 
+	priv->auth_started = g_get_monotonic_time ();
+	PK_TRACE2 (auth__start, priv->tid, role);
 	return pk_transaction_authorize_actions (transaction, role, actions);
 }
 
@@ -2664,7 +3212,7 @@ pk_transaction_get_role (PkTransaction *transaction)
 /**
  * pk_transaction_set_role:
  **/
-static void
+void
 pk_transaction_set_role (PkTransaction *transaction, PkRoleEnum role)
 {
 	transaction->priv->role = role;
@@ -2770,12 +3318,22 @@ pk_transaction_cancel_bg (PkTransaction *transaction)
 		return;
 	}
 
+	/* the ones sharing our results were not cancelled */
+	pk_transaction_requeue_subscribers (transaction);
+
 	/* if it's never been run, just remove this transaction from the list */
 	if (transaction->priv->state <= PK_TRANSACTION_STATE_READY) {
 		pk_transaction_finished_emit (transaction, PK_EXIT_ENUM_CANCELLED, 0);
 		return;
 	}
 
+	/* only sharing the results of another transaction */
+	if (transaction->priv->leader != NULL) {
+		pk_transaction_unsubscribe (transaction);
+		pk_transaction_finished_emit (transaction, PK_EXIT_ENUM_CANCELLED, 0);
+		return;
+	}
+
 	/* set the state, as cancelling might take a few seconds */
 	pk_backend_job_set_status (transaction->priv->job, PK_STATUS_ENUM_CANCEL);
 
@@ -2789,6 +3347,112 @@ pk_transaction_cancel_bg (PkTransaction *transaction)
 	pk_backend_cancel (transaction->priv->backend, transaction->priv->job);
 }
 
+/**
+ * pk_transaction_cancel_run:
+ **/
+static void
+pk_transaction_cancel_run (PkTransaction *transaction)
+{
+	/* only sharing the results of another transaction, so stop doing that */
+	if (transaction->priv->leader != NULL) {
+		pk_transaction_unsubscribe (transaction);
+		pk_transaction_error_code_emit (transaction,
+						PK_ERROR_ENUM_TRANSACTION_CANCELLED,
+						"The task was stopped successfully");
+		pk_transaction_finished_emit (transaction, PK_EXIT_ENUM_CANCELLED, 0);
+		return;
+	}
+
+	/* the ones sharing our results were not cancelled */
+	pk_transaction_requeue_subscribers (transaction);
+
+	/* if it's never been run, just remove this transaction from the list */
+	if (transaction->priv->state <= PK_TRANSACTION_STATE_READY) {
+		g_autofree gchar *msg = NULL;
+		msg = g_strdup_printf ("%s was cancelled and was never run",
+				       transaction->priv->tid);
+		pk_transaction_error_code_emit (transaction,
+						PK_ERROR_ENUM_TRANSACTION_CANCELLED,
+						msg);
+		pk_transaction_finished_emit (transaction, PK_EXIT_ENUM_CANCELLED, 0);
+		return;
+	}
+
+	/* set the state, as cancelling might take a few seconds */
+	pk_backend_job_set_status (transaction->priv->job, PK_STATUS_ENUM_CANCEL);
+
+	/* we don't want to cancel twice */
+	pk_backend_job_set_allow_cancel (transaction->priv->job, FALSE);
+
+	/* we need ::finished to not return success or failed */
+	pk_backend_job_set_exit_code (transaction->priv->job, PK_EXIT_ENUM_CANCELLED);
+
+	/* actually run the method */
+	pk_backend_cancel (transaction->priv->backend, transaction->priv->job);
+}
+
+typedef struct {
+	PkTransaction		*transaction;
+	GDBusMethodInvocation	*context;
+	gchar			*sender;
+} PkTransactionCancelState;
+
+/**
+ * pk_transaction_cancel_lookup_cb:
+ **/
+static void
+pk_transaction_cancel_lookup_cb (GObject *source_object,
+				 GAsyncResult *res,
+				 gpointer user_data)
+{
+	gboolean ret;
+	guint uid;
+	PkTransactionCancelState *state = (PkTransactionCancelState *) user_data;
+	PkTransaction *transaction = state->transaction;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	/* get the UID of the caller */
+	if (!pk_dbus_lookup_finish (PK_DBUS (source_object), res, &error_local)) {
+		g_set_error (&error,
+			     PK_TRANSACTION_ERROR,
+			     PK_TRANSACTION_ERROR_INVALID_STATE,
+			     "unable to get uid of caller: %s",
+			     error_local->message);
+		goto out;
+	}
+	uid = pk_dbus_get_uid (transaction->priv->dbus, state->sender);
+	if (uid == PK_TRANSACTION_UID_INVALID) {
+		g_set_error (&error,
+			     PK_TRANSACTION_ERROR,
+			     PK_TRANSACTION_ERROR_INVALID_STATE,
+			     "unable to get uid of caller");
+		goto out;
+	}
+
+	/* it may have finished whilst we were asking */
+	if (transaction->priv->finished) {
+		g_debug ("No point trying to cancel a finished transaction, ignoring");
+		goto out;
+	}
+
+	/* check the caller uid with the originator uid */
+	if (transaction->priv->uid != uid) {
+		g_debug ("uid does not match (%i vs. %i)", transaction->priv->uid, uid);
+		ret = pk_transaction_obtain_authorization (transaction,
+							   PK_ROLE_ENUM_CANCEL,
+							   &error);
+		if (!ret)
+			goto out;
+	}
+	pk_transaction_cancel_run (transaction);
+out:
+	pk_transaction_dbus_return (state->context, error);
+	g_object_unref (state->transaction);
+	g_free (state->sender);
+	g_free (state);
+}
+
 /**
  * pk_transaction_cancel:
  **/
@@ -2797,9 +3461,8 @@ pk_transaction_cancel (PkTransaction *transaction,
 		       GVariant *params,
 		       GDBusMethodInvocation *context)
 {
-	gboolean ret;
 	const gchar *sender;
-	guint uid;
+	PkTransactionCancelState *state;
 	g_autoptr(GError) error = NULL;
 
 	g_return_if_fail (PK_IS_TRANSACTION (transaction));
@@ -2829,9 +3492,6 @@ pk_transaction_cancel (PkTransaction *transaction,
 	/* if it's finished, cancelling will have no action regardless of uid */
 	if (transaction->priv->finished) {
 		g_debug ("No point trying to cancel a finished transaction, ignoring");
-
-		/* return from async with success */
-		pk_transaction_dbus_return (context, NULL);
 		goto out;
 	}
 
@@ -2845,10 +3505,10 @@ pk_transaction_cancel (PkTransaction *transaction,
 
 	/* first, check the sender -- if it's the same we don't need to check the uid */
 	sender = g_dbus_method_invocation_get_sender (context);
-	ret = (g_strcmp0 (transaction->priv->sender, sender) == 0);
-	if (ret) {
+	if (g_strcmp0 (transaction->priv->sender, sender) == 0) {
 		g_debug ("same sender, no need to check uid");
-		goto skip_uid;
+		pk_transaction_cancel_run (transaction);
+		goto out;
 	}
 
 	/* check if we saved the uid */
@@ -2860,50 +3520,14 @@ pk_transaction_cancel (PkTransaction *transaction,
 		goto out;
 	}
 
-	/* get the UID of the caller */
-	uid = pk_dbus_get_uid (transaction->priv->dbus, sender);
-	if (uid == PK_TRANSACTION_UID_INVALID) {
-		g_set_error (&error,
-			     PK_TRANSACTION_ERROR,
-			     PK_TRANSACTION_ERROR_INVALID_STATE,
-			     "unable to get uid of caller");
-		goto out;
-	}
-
-	/* check the caller uid with the originator uid */
-	if (transaction->priv->uid != uid) {
-		g_debug ("uid does not match (%i vs. %i)", transaction->priv->uid, uid);
-		ret = pk_transaction_obtain_authorization (transaction,
-							   PK_ROLE_ENUM_CANCEL,
-							   &error);
-		if (!ret)
-			goto out;
-	}
-
-skip_uid:
-	/* if it's never been run, just remove this transaction from the list */
-	if (transaction->priv->state <= PK_TRANSACTION_STATE_READY) {
-		g_autofree gchar *msg = NULL;
-		msg = g_strdup_printf ("%s was cancelled and was never run",
-				       transaction->priv->tid);
-		pk_transaction_error_code_emit (transaction,
-						PK_ERROR_ENUM_TRANSACTION_CANCELLED,
-						msg);
-		pk_transaction_finished_emit (transaction, PK_EXIT_ENUM_CANCELLED, 0);
-		goto out;
-	}
-
-	/* set the state, as cancelling might take a few seconds */
-	pk_backend_job_set_status (transaction->priv->job, PK_STATUS_ENUM_CANCEL);
-
-	/* we don't want to cancel twice */
-	pk_backend_job_set_allow_cancel (transaction->priv->job, FALSE);
-
-	/* we need ::finished to not return success or failed */
-	pk_backend_job_set_exit_code (transaction->priv->job, PK_EXIT_ENUM_CANCELLED);
-
-	/* actually run the method */
-	pk_backend_cancel (transaction->priv->backend, transaction->priv->job);
+	/* another client, so get its uid without blocking the daemon */
+	state = g_new0 (PkTransactionCancelState, 1);
+	state->transaction = g_object_ref (transaction);
+	state->context = context;
+	state->sender = g_strdup (sender);
+	pk_dbus_lookup_async (transaction->priv->dbus, sender, NULL,
+			      pk_transaction_cancel_lookup_cb, state);
+	return;
 out:
 	pk_transaction_dbus_return (context, error);
 }
@@ -3505,13 +4129,19 @@ out:
 	pk_transaction_dbus_return (context, error);
 }
 
+typedef struct {
+	PkTransaction		*transaction;
+	GDBusMethodInvocation	*context;
+	guint			 number;
+} PkTransactionGetOldState;
+
 /**
- * pk_transaction_get_old_transactions:
+ * pk_transaction_get_old_transactions_flush_cb:
  **/
 static void
-pk_transaction_get_old_transactions (PkTransaction *transaction,
-				     GVariant *params,
-				     GDBusMethodInvocation *context)
+pk_transaction_get_old_transactions_flush_cb (GObject *source_object,
+					      GAsyncResult *res,
+					      gpointer user_data)
 {
 	const gchar *cmdline;
 	const gchar *data;
@@ -3522,21 +4152,18 @@ pk_transaction_get_old_transactions (PkTransaction *transaction,
 	GList *transactions = NULL;
 	guint duration;
 	guint idle_id;
-	guint number;
 	guint uid;
 	PkRoleEnum role;
 	PkTransactionPast *item;
+	PkTransactionGetOldState *state = (PkTransactionGetOldState *) user_data;
+	PkTransaction *transaction = state->transaction;
+	g_autoptr(GError) error = NULL;
 
-	g_return_if_fail (PK_IS_TRANSACTION (transaction));
-	g_return_if_fail (transaction->priv->tid != NULL);
-
-	g_variant_get (params, "(u)",
-		       &number);
+	/* what has been written is still worth returning */
+	if (!pk_transaction_db_flush_finish (PK_TRANSACTION_DB (source_object), res, &error))
+		g_warning ("failed to write pending changes: %s", error->message);
 
-	g_debug ("GetOldTransactions method called");
-
-	pk_transaction_set_role (transaction, PK_ROLE_ENUM_GET_OLD_TRANSACTIONS);
-	transactions = pk_transaction_db_get_list (transaction->priv->transaction_db, number);
+	transactions = pk_transaction_db_get_list (transaction->priv->transaction_db, state->number);
 	for (l = transactions; l != NULL; l = l->next) {
 		item = PK_TRANSACTION_PAST (l->data);
 
@@ -3579,7 +4206,41 @@ pk_transaction_get_old_transactions (PkTransaction *transaction,
 	idle_id = g_idle_add ((GSourceFunc) pk_transaction_finished_idle_cb, transaction);
 	g_source_set_name_by_id (idle_id, "[PkTransaction] finished from get-old-transactions");
 
-	pk_transaction_dbus_return (context, NULL);
+	pk_transaction_dbus_return (state->context, NULL);
+	g_object_unref (state->transaction);
+	g_free (state);
+}
+
+/**
+ * pk_transaction_get_old_transactions:
+ **/
+static void
+pk_transaction_get_old_transactions (PkTransaction *transaction,
+				     GVariant *params,
+				     GDBusMethodInvocation *context)
+{
+	guint number;
+	PkTransactionGetOldState *state;
+
+	g_return_if_fail (PK_IS_TRANSACTION (transaction));
+	g_return_if_fail (transaction->priv->tid != NULL);
+
+	g_variant_get (params, "(u)",
+		       &number);
+
+	g_debug ("GetOldTransactions method called");
+
+	pk_transaction_set_role (transaction, PK_ROLE_ENUM_GET_OLD_TRANSACTIONS);
+
+	/* include the transactions not written yet, without blocking */
+	state = g_new0 (PkTransactionGetOldState, 1);
+	state->transaction = g_object_ref (transaction);
+	state->context = context;
+	state->number = number;
+	pk_transaction_db_flush_async (transaction->priv->transaction_db,
+				       NULL,
+				       pk_transaction_get_old_transactions_flush_cb,
+				       state);
 }
 
 /**
@@ -4733,7 +5394,7 @@ out:
  *
  * Only return FALSE on error, not invalid parameter name
  */
-static gboolean
+gboolean
 pk_transaction_set_hint (PkTransaction *transaction,
 			 const gchar *key,
 			 const gchar *value,
@@ -4814,6 +5475,23 @@ pk_transaction_set_hint (PkTransaction *transaction,
 		return TRUE;
 	}
 
+	/* supports-plural-signals=true */
+	if (g_strcmp0 (key, "supports-plural-signals") == 0) {
+		if (g_strcmp0 (value, "true") == 0) {
+			priv->supports_plural_signals = TRUE;
+		} else if (g_strcmp0 (value, "false") == 0) {
+			pk_transaction_packages_flush (transaction);
+			priv->supports_plural_signals = FALSE;
+		} else {
+			g_set_error (error,
+				     PK_TRANSACTION_ERROR,
+				     PK_TRANSACTION_ERROR_NOT_SUPPORTED,
+				      "supports-plural-signals hint expects true or false, not %s", value);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
 	/* cache-age=<time-in-seconds> */
 	if (g_strcmp0 (key, "cache-age") == 0) {
 		guint cache_age;
@@ -5369,6 +6047,13 @@ pk_transaction_set_tid (PkTransaction *transaction, const gchar *tid)
 	g_return_val_if_fail (transaction->priv->tid == NULL, FALSE);
 
 	transaction->priv->tid = g_strdup (tid);
+	transaction->priv->created = g_get_monotonic_time ();
+	PK_TRACE1 (transaction__new, tid);
+
+	/* save when each step happened, for finding slow transactions */
+	if (g_key_file_get_boolean (transaction->priv->conf, "Daemon",
+				    "TransactionTimeline", NULL))
+		transaction->priv->timeline = g_string_new (NULL);
 
 	/* register org.freedesktop.PackageKit.Transaction */
 	transaction->priv->connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
@@ -5392,12 +6077,21 @@ void
 pk_transaction_reset_after_lock_error (PkTransaction *transaction)
 {
 	PkTransactionPrivate *priv = PK_TRANSACTION_GET_PRIVATE (transaction);
+	PkTransaction *subscriber;
+	guint i;
 	g_return_if_fail (PK_IS_TRANSACTION (transaction));
 
 	/* clear results */
 	g_object_unref (priv->results);
 	priv->results = pk_results_new ();
 
+	/* the subscribers get everything again from the next attempt */
+	for (i = 0; i < priv->subscribers->len; i++) {
+		subscriber = g_ptr_array_index (priv->subscribers, i);
+		g_object_unref (subscriber->priv->results);
+		subscriber->priv->results = pk_results_new ();
+	}
+
 	/* reset transaction state */
 	/* first set state manually, otherwise set_state will refuse to switch to an earlier stage */
 	priv->state = PK_TRANSACTION_STATE_READY;
@@ -5457,12 +6151,15 @@ pk_transaction_init (PkTransaction *transaction)
 	transaction->priv->state = PK_TRANSACTION_STATE_UNKNOWN;
 	transaction->priv->dbus = pk_dbus_new ();
 	transaction->priv->results = pk_results_new ();
+	transaction->priv->subscribers = g_ptr_array_new_with_free_func (g_object_unref);
 	transaction->priv->supported_content_types = g_ptr_array_new_with_free_func (g_free);
 	transaction->priv->authority = polkit_authority_get_sync (NULL, &error);
 	if (transaction->priv->authority == NULL)
 		g_error ("failed to get pokit authority: %s", error->message);
 	transaction->priv->cancellable = g_cancellable_new ();
 
+	transaction->priv->cache = pk_cache_new ();
+	transaction->priv->statistics = pk_statistics_new ();
 	transaction->priv->transaction_db = pk_transaction_db_new ();
 	ret = pk_transaction_db_load (transaction->priv->transaction_db, &error);
 	if (!ret)
@@ -5489,6 +6186,23 @@ pk_transaction_dispose (GObject *object)
 		pk_transaction_finished_emit (transaction, PK_EXIT_ENUM_FAILED, 0);
 	}
 
+	if (transaction->priv->packages_flush_id != 0) {
+		g_source_remove (transaction->priv->packages_flush_id);
+		transaction->priv->packages_flush_id = 0;
+	}
+
+	/* nobody is going to finish these now */
+	pk_transaction_unsubscribe (transaction);
+	if (transaction->priv->subscribers->len > 0) {
+		guint i;
+		for (i = 0; i < transaction->priv->subscribers->len; i++) {
+			pk_transaction_error_code_emit (g_ptr_array_index (transaction->priv->subscribers, i),
+							PK_ERROR_ENUM_INTERNAL_ERROR,
+							"shared transaction was destroyed");
+		}
+		pk_transaction_finish_subscribers (transaction, PK_EXIT_ENUM_FAILED, 0);
+	}
+
 	if (transaction->priv->registration_id > 0) {
 		g_dbus_connection_unregister_object (transaction->priv->connection,
 						     transaction->priv->registration_id);
@@ -5539,7 +6253,11 @@ pk_transaction_finalize (GObject *object)
 	g_free (transaction->priv->tid);
 	g_free (transaction->priv->sender);
 	g_free (transaction->priv->cmdline);
+	if (transaction->priv->timeline != NULL)
+		g_string_free (transaction->priv->timeline, TRUE);
 	g_ptr_array_unref (transaction->priv->supported_content_types);
+	if (transaction->priv->packages_builder != NULL)
+		g_variant_builder_unref (transaction->priv->packages_builder);
 
 	if (transaction->priv->connection != NULL)
 		g_object_unref (transaction->priv->connection);
@@ -5552,6 +6270,10 @@ pk_transaction_finalize (GObject *object)
 		g_object_unref (transaction->priv->backend);
 	g_object_unref (transaction->priv->job);
 	g_object_unref (transaction->priv->transaction_db);
+	g_object_unref (transaction->priv->cache);
+	g_object_unref (transaction->priv->statistics);
+	g_free (transaction->priv->cache_key);
+	g_ptr_array_unref (transaction->priv->subscribers);
 	g_object_unref (transaction->priv->results);
 	g_object_unref (transaction->priv->authority);
 	g_object_unref (transaction->priv->cancellable);
@@ -88,6 +88,11 @@ gboolean	 pk_transaction_is_exclusive			(PkTransaction	*transaction);
 gboolean	 pk_transaction_is_finished_with_lock_required	(PkTransaction *transaction);
 void		 pk_transaction_reset_after_lock_error		(PkTransaction *transaction);
 void		 pk_transaction_make_exclusive			(PkTransaction *transaction);
+gchar		*pk_transaction_get_cache_key			(PkTransaction	*transaction);
+void		 pk_transaction_subscribe			(PkTransaction	*transaction,
+								 PkTransaction	*subscriber);
+void		 pk_transaction_requeue_subscribers		(PkTransaction	*transaction);
+gboolean	 pk_transaction_is_shareable			(PkTransaction	*transaction);
 void		 pk_transaction_skip_auth_checks		(PkTransaction *transaction,
 								 gboolean skip_checks);
 